@@ -47,6 +47,7 @@ STDNET_NAMESPACE_BEGIN
 
 namespace io {
   using service  = detail::service;
+  using service_stats = detail::service_stats;
   using socket   = detail::socket;
   using acceptor = detail::acceptor;
 }
@@ -10,6 +10,7 @@
 #include "stdnet/identifier.h"
 #include "stdnet/pcall.h"
 #include "stdnet/namespace.h"
+#include "stdnet/detail/stats.h"
 
 /***********************************************************************************/
 STDNET_NAMESPACE_BEGIN
@@ -23,16 +24,55 @@ namespace detail {
     semaphore   _semaphore;
     const void* _context = nullptr;
     executor_work_guard<executor_type> work_guard;
+    service_stats _stats;
+    int _loops    = 0;              /* nested run loops */
+    int _handlers = 0;              /* nested measured handlers */
+    std::atomic<size_t> _waiting;   /* us, since the loop waits, 0 when busy */
+
+    class loop_scope;
 
   public:
     typedef std::shared_ptr<
       service
     > type_ref;
 
+    /* measures a handler of a kind run by the service of the calling thread */
+    class measure final {
+      service* _service = nullptr;
+      int    _kind;
+      size_t _begin  = 0;
+      size_t _queued = 0;           /* us, when the handler was posted */
+    public:
+      inline explicit measure(int kind)
+        : _kind(kind) {
+        if (service_stats::enabled()) {
+          start(local().get());
+        }
+      }
+      inline measure(service* owner, int kind, size_t queued)
+        : _kind(kind), _queued(queued) {
+        if (service_stats::enabled()) {
+          start(owner);
+        }
+      }
+      inline ~measure() {
+        if (_service) {
+          _service->leave(_kind, _begin, _queued);
+        }
+      }
+    private:
+      inline void start(service* owner) {
+        _service = owner;
+        _begin = service_stats::now();
+        _service->enter(_begin);
+      }
+    };
+
     ASIO_DECL explicit service(int concurrency_hint);
 
+    /* kind is the index of the handler in the stats when they are enabled */
     template <typename Handler>
-    ASIO_DECL void post(Handler&& handler);
+    ASIO_DECL void post(Handler&& handler, int kind = 0);
 
     template <typename Handler>
     ASIO_DECL void dispatch(Handler&& handler);
@@ -46,21 +86,67 @@ namespace detail {
     ASIO_DECL void set_context(const void* context);
     ASIO_DECL const void* get_context() const;
     ASIO_DECL signal_set& signal();
+    ASIO_DECL size_t run();
+    ASIO_DECL size_t poll();
+    template <typename Rep, typename Period>
+    ASIO_DECL size_t run_for(const std::chrono::duration<Rep, Period>& expires);
+    ASIO_DECL const service_stats& stats() const;
+    ASIO_DECL void reset_stats();
+    ASIO_DECL size_t idle_us() const;
     ASIO_DECL static type_ref local();
     ASIO_DECL static type_ref create();
     ASIO_DECL static type_ref create(int concurrency_hint);
+
+  private:
+    inline void enter(size_t now) {
+      if (_handlers++ == 0 && _loops > 0) {
+        size_t since = _waiting.exchange(0, std::memory_order_relaxed);
+        if (since) {
+          _stats.idle(now - since);
+        }
+      }
+    }
+    inline void leave(int kind, size_t begin, size_t queued) {
+      size_t now = service_stats::now();
+      _stats.record(kind, now - begin, begin - queued, queued != 0);
+      if (--_handlers == 0 && _loops > 0) {
+        _waiting.store(now, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  /* the time a run loop (not nested in a handler) waits for handlers is idle */
+  class service::loop_scope final {
+    service& _service;
+  public:
+    inline explicit loop_scope(service& owner)
+      : _service(owner) {
+      if (_service._loops++ == 0 && _service._handlers == 0 && service_stats::enabled()) {
+        _service._waiting.store(service_stats::now(), std::memory_order_relaxed);
+      }
+    }
+    inline ~loop_scope() {
+      if (--_service._loops == 0 && _service._handlers == 0) {
+        size_t since = _service._waiting.exchange(0, std::memory_order_relaxed);
+        if (since) {
+          _service._stats.idle(service_stats::now() - since);
+        }
+      }
+    }
   };
 
   ASIO_DECL service::service()
     : io_context()
     , _signal(*this)
-    , work_guard(make_work_guard(*this)) {
+    , work_guard(make_work_guard(*this))
+    , _waiting(0) {
   }
 
   ASIO_DECL service::service(int concurrency_hint)
     : io_context(concurrency_hint)
     , _signal(*this)
-    , work_guard(make_work_guard(*this)) {
+    , work_guard(make_work_guard(*this))
+    , _waiting(0) {
   }
 
   ASIO_DECL const void* service::get_context() const {
@@ -81,6 +167,7 @@ namespace detail {
   }
 
   ASIO_DECL void service::wait() {
+    loop_scope scope(*this);
     while (!stopped()) {
       run_one();
       if (_semaphore.wait_for(0)) {
@@ -91,6 +178,7 @@ namespace detail {
   }
 
   ASIO_DECL bool service::wait_for(size_t expires) {
+    loop_scope scope(*this);
     auto begin = steady_clock();
     while (!stopped()) {
       auto now = steady_clock();
@@ -106,9 +194,55 @@ namespace detail {
     return false;
   }
 
+  ASIO_DECL size_t service::run() {
+    loop_scope scope(*this);
+    return io_context::run();
+  }
+
+  ASIO_DECL size_t service::poll() {
+    loop_scope scope(*this);
+    return io_context::poll();
+  }
+
+  template <typename Rep, typename Period>
+  ASIO_DECL size_t service::run_for(const std::chrono::duration<Rep, Period>& expires) {
+    loop_scope scope(*this);
+    return io_context::run_for(expires);
+  }
+
+  ASIO_DECL const service_stats& service::stats() const {
+    return _stats;
+  }
+
+  /* on the thread of the service */
+  ASIO_DECL void service::reset_stats() {
+    _stats.reset();
+    if (_loops > 0 && _handlers == 0) {
+      _waiting.store(_stats.since, std::memory_order_relaxed);
+    }
+  }
+
+  /* idle time of the measure, with the wait in progress */
+  ASIO_DECL size_t service::idle_us() const {
+    size_t idle = _stats.idle_us.load(std::memory_order_relaxed);
+    size_t since = _waiting.load(std::memory_order_relaxed);
+    size_t now = service_stats::now();
+    return (since && now > since) ? idle + now - since : idle;
+  }
+
   template <typename Handler>
-  ASIO_DECL void service::post(Handler&& handler) {
-    asio::post(*this, handler);
+  ASIO_DECL void service::post(Handler&& handler, int kind) {
+    if (!service_stats::enabled()) {
+      asio::post(*this, handler);
+      return;
+    }
+    _stats.queued();
+    size_t queued = service_stats::now();
+    asio::post(*this, [this, kind, queued, handler]() mutable {
+      _stats.dequeued();
+      measure scope(this, kind, queued);
+      handler();
+    });
   }
 
   template <typename Handler>
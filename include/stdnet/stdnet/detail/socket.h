@@ -304,6 +304,28 @@ namespace detail {
       _ssl ? _ssl->handshake(_handshake_type, ec) : ec.clear();
     }
 
+    /* a client sends host as SNI, and checks that the certificate is for it */
+    ASIO_SYNC_OP_VOID set_verify_host(const std::string& host, error_code& ec) {
+      if (!_ssl) {
+        ec.clear();
+        return;
+      }
+#if defined(STDNET_USE_OPENSSL)
+      error_code literal;
+      ip::make_address(host, literal);
+      if (literal && !SSL_set_tlsext_host_name(_ssl->native_handle(), host.c_str())) {
+        ec = error_code((int)::ERR_get_error(), error::get_ssl_category());
+        return;
+      }
+      _ssl->set_verify_mode(ssl::verify_peer, ec);
+      if (!ec) {
+        _ssl->set_verify_callback(ssl::host_name_verification(host), ec);
+      }
+#else
+      ec = error_if_nossl;
+#endif
+    }
+
     ASIO_SYNC_OP_VOID connect(const endpoint_type& peer, error_code& ec) {
       _handshake_type = handshake_type::client;
       ip_tcp_socket::connect(peer, ec);
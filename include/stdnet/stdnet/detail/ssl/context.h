@@ -127,6 +127,19 @@ ASIO_DECL void init_ssl_context(
   );
 }
 
+/* a client checks the certificate of the server against the CAs of the system */
+ASIO_DECL void use_default_verify_paths(
+  ssl::context& ctx, error_code& ec) {
+#if defined(STDNET_USE_OPENSSL)
+  ctx.set_verify_mode(ssl::verify_peer, ec);
+  if (!ec) {
+    ctx.set_default_verify_paths(ec);
+  }
+#else
+  ec = error_if_nossl;
+#endif
+}
+
 ASIO_DECL void use_certificate_file(
   ssl::context& ctx, const char* filename, error_code& ec) {
   ctx.use_certificate_chain_file(filename, ec);
@@ -0,0 +1,114 @@
+#ifndef STDNET_STATS_H
+#define STDNET_STATS_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+# pragma once
+#endif
+
+#include <atomic>
+#include <chrono>
+#include "stdnet/namespace.h"
+
+/***********************************************************************************/
+STDNET_NAMESPACE_BEGIN
+/***********************************************************************************/
+
+namespace detail {
+  /*
+  * Instrumentation of a service, off by default. Handlers of a kind record how
+  * long they waited in the queue and how long they ran, the run loop records
+  * the time it waits for handlers (idle). Counters are written by the thread
+  * of the service (the queue depth by the posters too) and read by any thread.
+  */
+  struct service_stats {
+    enum { kinds = 8, buckets = 6 };
+    typedef std::atomic<size_t> counter;
+
+    struct kind_stats {
+      counter count;
+      counter exec_us;           /* inclusive of the nested handlers */
+      counter exec_max;
+      counter wait_us;           /* in the queue, posted handlers only */
+      counter wait_max;
+      counter exec[buckets];
+      counter wait[buckets];
+    };
+
+    counter since;               /* us, start of the measure */
+    counter idle_us;
+    counter depth;               /* handlers posted and not run */
+    counter depth_max;
+    kind_stats kind[kinds];
+
+    /* upper bounds (us) of the buckets, the last one has none */
+    inline static size_t bound(int i) {
+      static const size_t bounds[buckets] = {
+        10, 100, 1000, 10000, 100000, (size_t)-1
+      };
+      return bounds[i];
+    }
+    inline static size_t now() {
+      return (size_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+      ).count();
+    }
+    inline static std::atomic<bool>& enabled() {
+      static std::atomic<bool> _enabled(false);
+      return _enabled;
+    }
+
+    inline service_stats() {
+      reset();
+    }
+    inline void reset() {
+      since = now();
+      idle_us = 0;
+      depth_max = depth.load(std::memory_order_relaxed);
+      for (auto& k : kind) {
+        k.count = k.exec_us = k.exec_max = k.wait_us = k.wait_max = 0;
+        for (int i = 0; i < buckets; i++) {
+          k.exec[i] = k.wait[i] = 0;
+        }
+      }
+    }
+
+    inline void queued() {
+      size_t n = depth.fetch_add(1, std::memory_order_relaxed) + 1;
+      size_t m = depth_max.load(std::memory_order_relaxed);
+      while (n > m && !depth_max.compare_exchange_weak(m, n, std::memory_order_relaxed));
+    }
+    inline void dequeued() {
+      depth.fetch_sub(1, std::memory_order_relaxed);
+    }
+    inline void idle(size_t us) {
+      idle_us.fetch_add(us, std::memory_order_relaxed);
+    }
+    void record(int k, size_t exec, size_t wait, bool posted) {
+      auto& s = kind[(unsigned)k < kinds ? k : 0];
+      s.count.fetch_add(1, std::memory_order_relaxed);
+      add(s.exec_us, s.exec_max, s.exec, exec);
+      if (posted) {
+        add(s.wait_us, s.wait_max, s.wait, wait);
+      }
+    }
+
+  private:
+    inline static void add(counter& total, counter& max, counter* histogram, size_t us) {
+      total.fetch_add(us, std::memory_order_relaxed);
+      if (us > max.load(std::memory_order_relaxed)) {
+        max.store(us, std::memory_order_relaxed);
+      }
+      int i = 0;
+      while (us > bound(i)) {
+        i++;
+      }
+      histogram[i].fetch_add(1, std::memory_order_relaxed);
+    }
+  };
+} //end of namespace detail
+
+/***********************************************************************************/
+STDNET_NAMESPACE_END
+/***********************************************************************************/
+
+#endif //STDNET_STATS_H
@@ -23,8 +23,8 @@ local const_max <const> = 0xffff;
 
 --------------------------------------------------------------------------------
 
-local function encode(t)
-  return proto_type.encode(t);
+local function encode(what, ...)
+  return proto_type.encode(what, ...);
 end
 
 --------------------------------------------------------------------------------
@@ -107,47 +107,93 @@ end
 
 --------------------------------------------------------------------------------
 
-local function ws_on_receive(peer, data, ec)
-  if ec then
-    ws_on_error(peer, "receive error");
+local function encode_bind(info)
+  return encode(info.what, info.name, info.module, info.rcb, info.caller);
+end
+
+--------------------------------------------------------------------------------
+
+local function encode_deliver(info, session)
+  --use the id of topic bound by the receiver
+  local name = session.topics[info.name] or info.name;
+  local who  = info.who >> 16;
+  return encode(proto_type.deliver, name, info.argv, info.mask, who, info.caller, info.rcf, info.sn, info.ttl);
+end
+
+--------------------------------------------------------------------------------
+
+local function lua_deliver(id, what, name, argv, mask, who, caller, rcf, sn, ttl)
+  if not what then
+    print(format("drop deliver of session(%d): %s", id, name));
     return;
   end
-  local id   = peer:id();
-  local info = decode(data);
-  local what = info.what;
-  
+  --unknown id of topic or no receiver, the caller is waiting
+  if (not name or r_deliver(name, argv, mask, who, caller << 16 | id, rcf, sn, ttl) == 0) and rcf ~= 0 then
+    local session = active_sessions[id];
+    if session then
+      local data = wrap(false, "function not found");
+      sendto_member(encode(proto_type.response, data, caller, rcf, sn), session);
+    end
+  end
+end
+
+--------------------------------------------------------------------------------
+
+local function lua_remote_bind(id, name, tid, module, rcb, caller)
+  local session = active_sessions[id];
+  if session then
+    session.topics[name] = tid;
+  end
+  local info = {
+    what   = proto_type.bind,
+    name   = name,
+    module = module,
+    rcb    = rcb,
+    caller = caller,
+  };
+  lua_bind(info, caller << 16 | id);
+end
+
+--------------------------------------------------------------------------------
+
+local function ws_on_frame(peer, id, what, ...)
   if what == proto_type.deliver then
-    local name   = info.name;
-    local argv   = info.argv;
-    local mask   = info.mask;
-    local who    = info.who;
-    local caller = info.caller << 16 | id;
-    local rcf    = info.rcf;
-    local sn     = info.sn;
-    r_deliver(name, argv, mask, who, caller, rcf, sn);
+    lua_deliver(id, what, ...);
+    return;
+  end
+  if what == proto_type.batch then
+    for _, v in ipairs({...}) do
+      lua_deliver(id, decode(v));
+    end
     return;
   end
   if what == proto_type.response then
-    local data   = info.data;
-    local caller = info.caller;
-    local rcf    = info.rcf;
-    local sn     = info.sn;
-    r_response(data, caller, rcf, sn);
+    r_response(...);
     return;
   end  
   if what == proto_type.bind then
-    local name   = info.name;
-    local rcb    = info.rcb;
-    local caller = info.caller << 16 | id;
-    lua_bind(info, caller);
+    lua_remote_bind(id, ...);
     return;
   end
   if what == proto_type.unbind then
-    local name   = info.name;
-    local caller = info.caller << 16 | id;
-    lua_unbind(name, caller);
+    local name, caller = ...;
+    lua_unbind(name, caller << 16 | id);
     return;
-  end  
+  end
+  --a bad frame is dropped, the link is kept
+  if not what then
+    print(format("drop frame of session(%d): %s", id, (...)));
+  end
+end
+
+--------------------------------------------------------------------------------
+
+local function ws_on_receive(peer, data, ec)
+  if ec then
+    ws_on_error(peer, "receive error");
+    return;
+  end
+  ws_on_frame(peer, peer:id(), decode(data));
 end
 
 --------------------------------------------------------------------------------
@@ -156,26 +202,45 @@ local function on_lookout(info)
   local what = info.what;  
   if what == proto_type.bind then
     lua_bind(info, info.caller);
-    sendto_others(encode(info));
+    sendto_others(encode_bind(info));
     return;
   end
   if what == proto_type.unbind then
     lua_unbind(info.name, info.caller);
-    sendto_others(encode(info));
+    sendto_others(encode(what, info.name, info.caller));
+    return;
+  end
+  if what == proto_type.batch then
+    --one frame for each session
+    local groups = {};
+    for _, v in ipairs(info.list) do
+      local id = v.who & const_max;
+      local session = active_sessions[id];
+      if session then
+        if not groups[id] then
+          groups[id] = {};
+        end
+        table.insert(groups[id], encode_deliver(v, session));
+      end
+    end
+    for id, list in pairs(groups) do
+      sendto_member(encode(what, table.unpack(list)), active_sessions[id]);
+    end
     return;
   end
-  local id;
   if what == proto_type.deliver then
-    id = info.who & const_max;
-    info.who = info.who >> 16;
+    local session = active_sessions[info.who & const_max];
+    if session then
+      sendto_member(encode_deliver(info, session), session);
+    end
+    return;
   end
   if what == proto_type.response then
-    id = info.caller & const_max;
-    info.caller = info.caller >> 16;
-  end
-  local session = active_sessions[id];
-  if session then
-    sendto_member(encode(info), session);
+    local session = active_sessions[info.caller & const_max];
+    if session then
+      local caller = info.caller >> 16;
+      sendto_member(encode(what, info.data, caller, info.rcf, info.sn), session);
+    end
   end
 end
 
@@ -191,6 +256,7 @@ local function new_session(peer)
     socket = peer,
     ip     = endpoint.address,
     port   = endpoint.port,
+    topics = {}, --ids of topic bound by the peer
   };
   local id = peer:id();
   active_sessions[id] = session;
@@ -199,7 +265,7 @@ local function new_session(peer)
   for caller, bounds in pairs(r_handlers) do
     if is_local(caller) then
       for name, info in pairs(bounds) do
-        peer:send(encode(info));
+        peer:send(encode_bind(info));
       end
     end
   end
@@ -252,15 +318,13 @@ local function connect_members(socket, protocol)
     if not data then
       return false;
     end
-    local packet = decode(data);
-    if packet.what == proto_type.ready then
+    local what, id, host, port = decode(data);
+    if what == proto_type.ready then
       break;
     end
-    if packet.what ~= proto_type.forword then
+    if what ~= proto_type.forword then
       return false;
     end
-    local host = packet.ip;
-    local port = packet.port;
     if not new_connect(host, port, protocol) then
       error(format("socket connect to %s:%d error", host, port));
       return false;
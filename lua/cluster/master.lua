@@ -13,8 +13,8 @@ local format = string.format;
 local proto_type = require("cluster.protocol");
 local active_sessions = {};
 
-local function encode(t)
-  return proto_type.encode(t);
+local function encode(what, ...)
+  return proto_type.encode(what, ...);
 end
 
 --------------------------------------------------------------------------------
@@ -22,17 +22,12 @@ end
 local function sendto_member(session)
   for peer, v in pairs(active_sessions) do
     if peer ~= session.socket then
-      local packet = {
-        what = proto_type.forword,
-        id   = v.socket:id(),
-        ip   = v.ip,
-        port = v.port,
-      };
-      session.socket:send(encode(packet));
+      local packet = encode(proto_type.forword, v.socket:id(), v.ip, v.port);
+      session.socket:send(packet);
     end
   end
   local peer = session.socket;
-  peer:send(encode({what = proto_type.ready}));
+  peer:send(encode(proto_type.ready));
 end
 
 --------------------------------------------------------------------------------
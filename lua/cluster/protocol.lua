@@ -22,14 +22,20 @@ local protocol = {
   bind     = "bind",
   unbind   = "unbind",
   response = "response",
+  batch    = "batch",
 };
 
-function protocol.encode(t)
-  return wrap(t);   
+local r_encode = rpc.r_encode;
+local r_decode = rpc.r_decode;
+
+--binary frame, see r_encode in lua_rpcall.cpp
+function protocol.encode(what, ...)
+  return r_encode(what, ...);
 end
 
+--returns what and the fields, or nil and error
 function protocol.decode(v)
-  return unwrap(v);   
+  return r_decode(v);
 end
 
 --------------------------------------------------------------------------------
@@ -16,51 +16,8 @@ local split      = string.split;
 local insert     = table.insert;
 local concat     = table.concat;
 local unescape   = io.http.unescape;
-
---------------------------------------------------------------------------------
-
-local http_status_text = {
-  [100] = "Continue",
-  [101] = "Switching Protocols",
-  [200] = "OK",
-  [201] = "Created",
-  [202] = "Accepted",
-  [203] = "Non-Authoritative Information",
-  [204] = "No Content",
-  [205] = "Reset Content",
-  [206] = "Partial Content",
-  [300] = "Multiple Choices",
-  [301] = "Moved Permanently",
-  [302] = "Found",
-  [303] = "See Other",
-  [304] = "Not Modified",
-  [305] = "Use Proxy",
-  [307] = "Temporary Redirect",
-  [400] = "Bad Request",
-  [401] = "Unauthorized",
-  [402] = "Payment Required",
-  [403] = "Forbidden",
-  [404] = "File Not Found",
-  [405] = "Method Not Allowed",
-  [406] = "Not Acceptable",
-  [407] = "Proxy Authentication Required",
-  [408] = "Request Time-out",
-  [409] = "Conflict",
-  [410] = "Gone",
-  [411] = "Length Required",
-  [412] = "Precondition Failed",
-  [413] = "Request Entity Too Large",
-  [414] = "Request-URI Too Large",
-  [415] = "Unsupported Media Type",
-  [416] = "Requested range not satisfiable",
-  [417] = "Expectation Failed",
-  [500] = "Internal Server Error",
-  [501] = "Not Implemented",
-  [502] = "Bad Gateway",
-  [503] = "Service Unavailable",
-  [504] = "Gateway Time-out",
-  [505] = "HTTP Version not supported",
-};
+local sort       = table.sort;
+local clock      = os.clock;
 
 --------------------------------------------------------------------------------
 
@@ -106,50 +63,174 @@ local os_version = "skynet-lua" .. "/" .. os.version();
 
 --------------------------------------------------------------------------------
 
+--responses cached by the policy returned with the result of the rpc:
+--  return result, ttl                          --seconds
+--  return result, { ttl = 60, version = "v1" } --version is the ETag
+--an entry without ttl stays until http:expire(method) is called, or until
+--it's the least recently used one of a full cache
+local cache_limit = 4096;
+local cache_count = 0;
+local cache       = {};
+local cache_lru   = {};  --the entries, most recently used first
+
+cache_lru.prev = cache_lru;
+cache_lru.next = cache_lru;
+
+--------------------------------------------------------------------------------
+
 local function skynet_version()
   return os_version;
 end
 
 --------------------------------------------------------------------------------
 
-local function http_response(peer, code, body, encoding)
-  body = body or "";
+local function http_response(reply, code, body, encoding, etag)
   local headers = {
     ["Server"]         = skynet_version(),
     ["Cache-Control"]  = "max-age=0",
-    ["Connection"]     = "Close",
-    ["Content-Length"] = format("%d", #body),
     ["Content-Type"]   = http_mime_type.html .. ";charset=UTF-8",
   };
 
   if encoding then
     headers["Content-Encoding"] = encoding;
   end
+  if etag then
+    headers["ETag"] = etag;
+    headers["Vary"] = "Accept-Encoding";
+  end
+  reply(code, body or "", headers);
+end
+
+--------------------------------------------------------------------------------
+
+local function cache_key(method, query)
+  if not query then
+    return method;
+  end
+  local t = {};
+  for k, v in pairs(query) do
+    insert(t, format("%s=%s", k, v));
+  end
+  sort(t);
+  return method .. "?" .. concat(t, "&");
+end
+
+--------------------------------------------------------------------------------
+
+local function lru_unlink(entry)
+  entry.prev.next = entry.next;
+  entry.next.prev = entry.prev;
+end
+
+local function lru_push(entry)
+  entry.prev = cache_lru;
+  entry.next = cache_lru.next;
+  cache_lru.next.prev = entry;
+  cache_lru.next = entry;
+end
+
+local function cache_remove(entry)
+  lru_unlink(entry);
+  cache[entry.key] = nil;
+  cache_count = cache_count - 1;
+end
+
+--------------------------------------------------------------------------------
+
+local function cache_lookup(key)
+  local entry = cache[key];
+  if not entry then
+    return nil;
+  end
+  if entry.expires and entry.expires <= clock("s") then
+    cache_remove(entry);
+    return nil;
+  end
+  lru_unlink(entry);
+  lru_push(entry);
+  return entry;
+end
+
+--------------------------------------------------------------------------------
+
+local function cache_store(key, method, result, policy)
+  local ttl, version = policy, nil;
+  if type(policy) == "table" then
+    ttl, version = policy.ttl, policy.version;
+  elseif type(policy) == "string" then
+    ttl, version = nil, policy;
+  end
+  if type(ttl) ~= "number" then
+    if not version then
+      return nil;
+    end
+    ttl = nil;
+  end
+
+  if cache[key] then
+    cache_remove(cache[key]);
+  end
+  if cache_count >= cache_limit then
+    cache_remove(cache_lru.prev);
+  end
+  local entry = {
+    key     = key,
+    method  = method,
+    raw     = result,
+    etag    = format('"%s"', version or crypto.md5(result)),
+    expires = ttl and (clock("s") + ttl),
+  };
+  cache[key] = entry;
+  cache_count = cache_count + 1;
+  lru_push(entry);
+  return entry;
+end
 
-  local response = {};
-  local status   = format("HTTP/1.1 %d %s\r\n", code, http_status_text[code]);
-  insert(response, status);
-  for k, v in pairs(headers) do
-    insert(response, k);
-    insert(response, ": ");
-    insert(response, v);
-    insert(response, "\r\n");
+--------------------------------------------------------------------------------
+
+local function cache_expire(method)
+  local count = 0;
+  for _, v in pairs(cache) do
+    if v.method == method then
+      cache_remove(v);
+      count = count + 1;
+    end
+  end
+  return count;
+end
+
+--------------------------------------------------------------------------------
+
+local function accept_gzip(headers)
+  local encoding = headers["Accept-Encoding"];
+  return encoding and encoding:find("gzip") ~= nil;
+end
+
+--------------------------------------------------------------------------------
+
+local function cache_response(reply, headers, entry)
+  if headers["If-None-Match"] == entry.etag then
+    http_response(reply, 304, "", nil, entry.etag);
+    return;
   end
-  insert(response, "\r\n");
-  insert(response, body);
-  peer:send(concat(response));
+  if #entry.raw > 0 and accept_gzip(headers) then
+    if not entry.gzip then
+      entry.gzip = compress(entry.raw, "gzip");
+    end
+    http_response(reply, 200, entry.gzip, "gzip", entry.etag);
+    return;
+  end
+  http_response(reply, 200, entry.raw, nil, entry.etag);
 end
 
 --------------------------------------------------------------------------------
 
-local function co_on_request(method, session)
-  local url     = session.url;
-  local headers = session.headers;
-  local body    = concat(session.body);
-  local context = io.http.parse_url(url);
-  local paths   = context.path:split("/");
+local function co_on_request(request, reply)
+  local headers = request.headers;
+  local body    = request.body;
+  local paths   = split(request.path or "", "/");
 
-  method = {};
+  local method = {};
   for _, v in ipairs(paths) do
     if #v > 0 then
       if #method > 0 then
@@ -163,7 +244,7 @@ local function co_on_request(method, session)
     method = "http:index";
   end
 
-  local query = context.query;
+  local query = request.query;
   if query and #query > 0 then
     local t = split(query, "&");
     query = {};
@@ -174,133 +255,58 @@ local function co_on_request(method, session)
   else
     query = nil;
   end
-  local status = 200;
-  if body == "" then
-    body = nil;
+  local key = not body and cache_key(method, query);
+  local entry = key and cache_lookup(key);
+  if entry then
+    cache_response(reply, headers, entry);
+    return;
   end
-  local ok, result = rpcall(method, query, body);
+
+  local status = 200;
+  local ok, result, policy = rpcall(method, query, body);
   if not ok then
     status = 500;
   end
   result = tostring(result or "");
 
-  local encoding = nil;
-  if #result > 0 then
-    encoding = headers["Accept-Encoding"];
-    if encoding then
-      if encoding:find("gzip") then
-        encoding = "gzip";
-        result = compress(result, encoding);
-      else
-        encoding = nil;
-      end
+  if ok and key and policy then
+    entry = cache_store(key, method, result, policy);
+    if entry then
+      cache_response(reply, headers, entry);
+      return;
     end
   end
-  http_response(session.socket, status, result, encoding);
-end
-
---------------------------------------------------------------------------------
-
-local function rp_on_request(session)
-  local parser = session.parser;
-  local co     = session.co;
-  local method = parser:method();
 
-  if method ~= "GET" and method ~= "POST" then
-    http_response(session.socket, 405, "Method Not Allowed");
-    return;
-  end
-
-  local ok, err = coroutine.resume(co, method, session);
-  if not ok then
-    error(err);
-    local peer = session.socket;
-    peer:close();
+  local encoding = nil;
+  if #result > 0 and accept_gzip(headers) then
+    encoding = "gzip";
+    result = compress(result, encoding);
   end
+  http_response(reply, status, result, encoding);
 end
 
 --------------------------------------------------------------------------------
 
-local function http_on_request(session)
-  local ok, err = pcall(rp_on_request, session);
+--runs in a pooled coroutine, it may yield on rpcall
+local function go_on_request(request, reply)
+  local ok, err = pcall(co_on_request, request, reply);
   if not ok then
+    http_response(reply, 500);
     error(err);
-    local peer = session.socket;
-    peer:close();
   end
 end
 
 --------------------------------------------------------------------------------
 
-local function http_on_receive(session, data, ec)
-  local peer = session.socket;
-  if ec then
-    peer:close();
-    coroutine.close(session.co);
+--requests are parsed in C++, answers are sent in order on the keep-alive connection
+local function http_on_request(request, reply)
+  local method = request.method;
+  if method ~= "GET" and method ~= "POST" then
+    http_response(reply, 405, "Method Not Allowed");
     return;
   end
 
-  local parser = session.parser;
-  while #data > 0 do
-    local parsed = parser:execute(data);
-    if parser:error() > 0 then
-      peer:close();
-      return;
-    end
-    if parsed == #data then
-      break;
-    end
-    data = data:sub(parsed + 1);
-  end
-end
-
---------------------------------------------------------------------------------
-
-local function http_on_url(session, url)
-  session.url = url;
-end
-
---------------------------------------------------------------------------------
-
-local function http_on_body(session, data)
-  insert(session.body, data);
-end
-
---------------------------------------------------------------------------------
-
-local function http_on_begin(session)
-  session.url  = "";
-  session.body = {};
-  session.headers = {};
-end
-
---------------------------------------------------------------------------------
-
-local function http_on_header(session, name, value)
-  session.headers[name] = value;
-end
-
---------------------------------------------------------------------------------
-
-local function http_new_session(peer)
-  local session = {
-    socket  = peer,
-    url     = "",
-    body    = {},
-    headers = {},
-    co = coroutine.create(co_on_request)
-  };
-
-  local options = {
-    on_message_begin    = bind(http_on_begin,   session),
-    on_body             = bind(http_on_body,    session),
-    on_header           = bind(http_on_header,  session),
-    on_url              = bind(http_on_url,     session),
-    on_message_complete = bind(http_on_request, session)
-  };
-
-  session.parser = io.http.request_parser(options);
-  return session;
+  os.go(go_on_request, request, reply);
 end
 
 --------------------------------------------------------------------------------
@@ -310,8 +316,7 @@ local function http_on_accept(peer, ec)
     peer:close();
     return;
   end
-  local session = http_new_session(peer);
-  peer:receive(bind(http_on_receive, session));
+  io.http.serve(peer, http_on_request);
 end
 
 --------------------------------------------------------------------------------
@@ -339,6 +344,7 @@ function main(port, host, ca, key, pwd)
     return;
   end
   rpc.create("http:index", skynet_version);
+  rpc.create("http:expire", cache_expire);
   print(format("%s works on port %d", os.name(), port));
   while not os.stopped() do
     os.wait();
@@ -23,6 +23,51 @@ function wrap(...) end
 ---@return ...
 function unwrap(data) end
 
+--- 解包一个由warp打包的数据，其中的table以只读视图返回，
+--- 访问字段时才解码对应路径，嵌套的table仍是视图。
+--- 视图支持pairs和#，wrap时直接复制原始字节，unwrap(view)可转成真正的table
+---@param data string
+---@return ...
+function unwrap_view(data) end
+
+--- 创建一个流式解包器，用于从socket收到的数据块中逐个解出wrap打包的值
+--- 只保留尚未解出的数据，不完整的值在后续数据到达时从中断处继续扫描
+---@return wrap_stream
+function unwrap_stream() end
+
+---@class wrap_stream
+local wrap_stream = {}
+
+--- 追加一个数据块
+---@param data string
+---@return integer 尚未解出的字节数
+function wrap_stream:feed(data) end
+
+--- 解出下一个完整的值，数据不完整时返回false；数据格式错误时抛出异常并清空
+---@return boolean
+---@return any
+function wrap_stream:next() end
+
+--- 遍历当前所有完整的值，for v in stream:values() do ... end，遇到nil值时也会结束
+---@return fun():any
+function wrap_stream:values() end
+
+--- 尚未解出的字节数
+---@return integer
+function wrap_stream:size() end
+
+--- 丢弃所有尚未解出的数据
+function wrap_stream:clear() end
+
+--- 注册一个固定结构的消息格式，返回其元表，设置了该元表的table被wrap时
+--- 按字段顺序打包且不写入键名，unwrap时自动还原并带上同一元表
+--- 字段写成"name:type"，type缺省为"any"，可选:
+--- "any"|"string"|"boolean"|"i8"|"i16"|"i32"|"i64"|"u8"|"u16"|"u32"|"f32"|"f64"
+--- 同一个id可在各个服务中重复注册，但字段必须相同，集群节点间也须一致
+---@param def table {id = 0~255, "name:type", ...}
+---@return table
+function wrap_schema(def) end
+
 --- 压缩一段数据
 ---@param data string
 ---@param what? "deflate"|"gzip" 缺省为"deflate"
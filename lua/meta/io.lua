@@ -20,6 +20,20 @@ function io.context() end
 
 io.http = {}
 
+--- 创建http请求解析器
+--- options中有on_message时为消息模式: url、头和包体在C中累积, 每个完整的请求只调用一次
+--- on_message(request), request = { method, url, path, query, headers, body, keepalive }
+--- 消息模式下同时给出on_body时, 超过stream(默认64K)的包体分块交给on_body, 以on_body(nil)结束
+--- 否则按片段回调 on_url, on_header, on_body, on_message_complete 等
+---@param options table
+---@return userdata
+function io.http.request_parser(options) end
+
+--- 创建http响应解析器, 消息模式下 on_message(response), response = { status, headers, body, keepalive }
+---@param options table
+---@return userdata
+function io.http.response_parser(options) end
+
 --- url编码
 ---@param url string
 ---@return string
@@ -28,4 +42,42 @@ function io.http.escape(url) end
 --- url解码
 ---@param url string
 ---@return string
-function io.http.unescape(url) end
\ No newline at end of file
+function io.http.unescape(url) end
+
+--- 在连接上提供http服务, 请求在C++中解析完整后交给handler, 支持keep-alive和pipelining
+--- request = { method, url, path, query, headers, body, keepalive }
+--- reply(status, body [, headers]) 回复请求, 回复按请求的顺序发送
+--- 未回复的请求达到pipeline时暂停读取, 超过timeout毫秒未回复的请求返回504
+---@param peer socket 已接受的连接
+---@param handler fun(request: table, reply: fun(status: integer, body?: string, headers?: table))
+---@param options? { keepalive?: boolean, limit?: integer, pipeline?: integer, timeout?: integer } limit 默认8M, 超过返回413, pipeline 默认16, timeout 默认30000, 0不限制
+---@return boolean
+function io.http.serve(peer, handler, options) end
+
+--- 发起http请求, 连接按主机保持在连接池中复用(keep-alive), GET/HEAD可在连接上pipelining, 域名解析结果缓存60秒
+--- 在协程中调用时挂起协程直到响应返回(同rpcall), 否则阻塞等待
+---@param method string "GET"|"POST"|"PUT"|"DELETE"|"HEAD"...
+---@param url string http://或https://, https用系统的CA校验服务器证书和主机名(SNI), 校验失败返回"handshake error"
+---@param body? string
+---@param headers? table<string, string>
+---@param timeout? integer 超时(毫秒), 默认30000
+---@return { status: integer, headers: table, body?: string, keepalive: boolean }|nil response
+---@return string? error
+function io.http.request(method, url, body, headers, timeout) end
+
+--- 发起http GET请求, 同io.http.request
+---@param url string
+---@param headers? table<string, string>
+---@param timeout? integer
+---@return table|nil response
+---@return string? error
+function io.http.get(url, headers, timeout) end
+
+--- 发起http POST请求, 同io.http.request
+---@param url string
+---@param body string
+---@param headers? table<string, string>
+---@param timeout? integer
+---@return table|nil response
+---@return string? error
+function io.http.post(url, body, headers, timeout) end
@@ -10,6 +10,36 @@ json = {}
 ---@return any
 function json.decode(str) end
 
+--- 创建一个流式解码器，用于从socket收到的数据块中逐个解出json文档
+--- 文档之间可以用空白分隔，顶层的数字和true/false/null须以空白结尾
+--- 只保留尚未解出的数据，不完整的文档在后续数据到达时从中断处继续扫描
+---@return json_decoder
+function json.decoder() end
+
+---@class json_decoder
+local decoder = {}
+
+--- 追加一个数据块
+---@param data string
+---@return integer 尚未解出的字节数
+function decoder:feed(data) end
+
+--- 解出下一个完整的文档，不完整时返回false；文档格式错误时返回nil和错误信息，并跳过该文档
+---@return boolean|nil
+---@return any
+function decoder:next() end
+
+--- 遍历当前所有完整的文档，for v in decoder:values() do ... end，格式错误时抛出异常
+---@return fun():any
+function decoder:values() end
+
+--- 尚未解出的字节数
+---@return integer
+function decoder:size() end
+
+--- 丢弃所有尚未解出的数据
+function decoder:clear() end
+
 --- 将LUA的变量序列化成字符串
 ---
 --- Returns json字符串
@@ -20,4 +50,8 @@ function json.decode(str) end
 --- **`table`**
 ---@param value any
 ---@return string
-function json.encode(value) end
\ No newline at end of file
+function json.encode(value) end
+
+--- json.encode查找无需转义的字符串时使用的SIMD指令集，运行时按CPU特性选择
+---@type "avx2"|"sse2"|"none"
+json._SIMD = "avx2"
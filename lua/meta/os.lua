@@ -36,9 +36,73 @@ function os.name() end
 ---@return coroutine 协程
 function os.coroutine() end
 
+---在本服务的协程池中运行函数, 函数可以yield(如rpcall), 返回后协程回到池中复用
+---函数的错误只记录日志
+---@param func function
+---@param ... any 透传参数
+function os.go(func, ...) end
+
+---返回本服务协程池的统计, 传入limit时设置池中保留的空闲协程上限(默认1024)
+---hits/(hits+misses)为命中率, peak为同时运行的最大数量
+---@param limit? integer
+---@return { idle: integer, running: integer, peak: integer, hits: integer, misses: integer, limit: integer }
+function os.gopool(limit) end
+
+---设置本服务GC单次停顿的预算(毫秒, 默认1), 返回原来的预算
+---GC运行在增量模式, 服务空闲时(每10ms的tick未延迟)分步回收, 步长按预算自适应且不超过Lua的默认值; 一轮回收完成后没有新的分配时tick降为每秒一次; 0关闭并回到分代模式
+---@param ms? number
+---@return number
+function os.gcbudget(ms) end
+
+---返回本服务GC的统计: count为内存(KB), rate为分配速率(KB/s), max为最大停顿(ms)
+---pauses为空闲回收停顿的直方图, 第i项为不超过bounds[i]毫秒的次数, skipped为服务忙而跳过的tick
+---@return { mode: string, budget: number, stepsize: integer, count: integer, rate: number, steps: integer, skipped: integer, cycles: integer, max: number, bounds: number[], pauses: integer[] }
+function os.gcstats() end
+
+---打开或关闭事件循环的统计(全进程, 默认关闭), 返回原来的状态; 打开时所有服务的计数重新开始
+---@param on? boolean
+---@return boolean
+function os.instrument(on) end
+
+---返回本服务事件循环的统计, 需要先os.instrument(true); 时间单位为毫秒
+---busy为处理回调的时间, ratio为busy/elapsed, depth为投递未执行的回调数, maxdepth为其峰值
+---kinds按回调种类(deliver, response, timer, socket, post, gc, other)统计次数, 执行时间, 排队时间及其直方图, 第i项为不超过bounds[i]的次数
+---"all"返回所有服务的统计数组, "dump"按繁忙程度在日志中每个服务打印一行, "reset"重新开始本服务的计数
+---@param what? "all" | "dump" | "reset"
+---@return { id: integer, name: string, elapsed: number, busy: number, ratio: number, depth: integer, maxdepth: integer, bounds: number[], kinds: table<string, { count: integer, exec: number, exec_max: number, wait: number, wait_max: number, exec_hist: integer[], wait_hist: integer[] }> }
+function os.stats(what) end
+
+---本服务的采样分析: true开始, 每interval毫秒(默认1)的CPU时间采样一次Lua调用栈, 环形缓冲保留最近capacity个(默认10000)样本
+---false停止并返回结果, 无参数返回当前结果; 结果为火焰图的folded格式("root;...;leaf 权重"每行一个栈)和样本数
+---开始失败返回false和原因; 运行期间替换coroutine.resume和wrap以采样协程, 停止时恢复原函数, 没有额外开销; C函数中的时间计入返回后的Lua栈
+---@param on? boolean
+---@param interval? number
+---@param capacity? integer
+---@return string|boolean
+---@return integer|string
+function os.profile(on, interval, capacity) end
+
+---本服务的堆快照: 从注册表开始遍历Lua对象, 每轮事件循环最多遍历budget毫秒(默认1), 逐个写入filename
+---每个对象一条记录(类型, 估算的字节数, 地址, 首次发现它的对象及名字); 大表分段遍历, 遍历不是原子的
+---开始成功返回true, 失败返回false和原因; false中止; 无参数返回进度, running为false时完成
+---用skynet.heapdiff比较两个快照, 按引用路径列出增长的对象
+---@param filename? string|boolean
+---@param budget? number
+---@return boolean|{ running: boolean, filename: string, objects: integer, bytes: integer, turns: integer, elapsed: number, error?: string }
+---@return string?
+function os.snapshot(filename, budget) end
+
+---进程共享的字节码缓存: require和os.pload加载的文件只在第一次解析, 之后文件的修改时间和大小不变时直接加载字节码
+---on为false时清空并关闭缓存, true时打开(默认打开); 返回缓存的统计
+---@param on? boolean
+---@return { enabled: boolean, count: integer, bytes: integer, hits: integer, misses: integer }
+function os.bytecode(on) end
+
 ---创建一个定时器
+---wheel为true时使用本服务的时间轮(精度10ms), 添加和取消为O(1), 同一tick到期的定时器成批回调, 适合大量定时器
+---@param options? { wheel?: boolean }
 ---@return timer 定时器
-function os.timer() end
+function os.timer(options) end
 
 ---返回当前平台的路径分隔符
 ---@return string
@@ -62,7 +126,7 @@ function os.processors() end
 ---@return integer
 function os.id() end
 
----给当前模块派发一个异步任务
+---给当前模块派发一个异步任务，任务在本服务的协程池中运行(见os.go)
 ---@param func fun() 任务函数
 function os.post(func) end
 
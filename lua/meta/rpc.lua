@@ -4,10 +4,12 @@
 rpc = {}
 
 --- 注册一个rpc函数
+--- 函数在本服务的协程池中运行(见os.go)，其中的同步调用挂起协程而不阻塞线程，其他请求照常处理
 ---@param name string rpc函数名
 ---@param func fun()
 ---@param invoke_by_remote? boolean 是否被远端调用，必须是其他进程
-function rpc.create(name, func, invoke_by_remote) end
+---@param lazy? boolean 为true时table参数以unwrap_view视图传入
+function rpc.create(name, func, invoke_by_remote, lazy) end
 
 ---@param name string rpc函数名
 ---@param mask integer
@@ -26,8 +28,100 @@ function rpc.remove(name) end
 ---@param ... any 传递给rpc函数的参数
 function rpc.deliver(name, mask, receiver, ...) end
 
+--- 创建一个批量调用对象，多个调用一次提交，按接受者合并投递
+---@param timeout? integer 超时时间(毫秒)，默认10000
+---@return rpcall_batch
+function rpc.batch(timeout) end
+
+--- 调用所有同名的rpc函数并等待全部返回, 第一个参数是整数时为超时时间
+--- rpc.all([timeout,] name, ...)
+---@param timeout? integer 超时时间(毫秒)，默认10000，不超过当前请求剩余的时间
+---@param name string rpc函数名
+---@param ... any 传递给rpc函数的参数
+---@return boolean done 是否全部返回(未超时)
+---@return table results 以接受者id为键，值为{ok, ...}
+function rpc.all(name, ...) end
+
+--- 在rpc函数中将应答转为流，分多次发送结果，必须在rpc函数返回前调用
+--- 调用者通过rpcall:stream读取，每次最多有16个未确认的数据块
+---@return rpcall_writer? writer 不在rpc函数中时返回nil
+function rpc.stream() end
+
+--- 设置当前模块rpc请求队列的上限，队列满时按策略处理新的请求
+--- "reject": 直接返回false, "busy"
+--- "shed": 丢弃最早的请求，被丢弃的请求返回false, "busy"
+--- "block": 协程中的本地调用者挂起直到请求被接受，非协程的调用者和远端调用者返回false, "busy"
+---@param max integer 队列上限，0表示不限制
+---@param policy? "reject"|"shed"|"block" 默认"reject"
+---@return integer previous 之前的上限
+function rpc.limit(max, policy) end
+
+--- 获取模块rpc请求队列的统计信息
+--- 包括depth, limit, policy, posted, executed, rejected, blocked, shed, max_depth, wait_avg, wait_max(毫秒)
+---@param id? integer 模块id，默认为当前模块
+---@return table? stats 没有设置过上限时返回nil, 只统计设置上限之后的请求
+function rpc.stats(id) end
+
 ---获取调用者的id
 function rpc.caller() end
 
+---获取当前请求剩余的时间(毫秒)，不在rpc函数中时返回nil
+---在rpc函数中发起的调用，超时时间不会超过剩余的时间，已超时的请求不会被执行
+---@return integer?
+function rpc.deadline() end
+
 ---获取应答函数
 function rpc.responser() end
+
+---@class rpcall_batch
+local batch = {}
+
+--- 添加一个调用，随机挑选一个接受者
+---@param name string rpc函数名
+---@param ... any 传递给rpc函数的参数
+---@return integer index 调用结果在results中的位置
+function batch:call(name, ...) end
+
+--- 添加一个调用，发送给指定的接受者
+---@param receiver integer 接受者
+---@param name string rpc函数名
+---@param ... any 传递给rpc函数的参数
+---@return integer index 调用结果在results中的位置
+function batch:call_to(receiver, name, ...) end
+
+--- 提交所有调用并等待返回，在协程中调用时不阻塞线程
+---@param partial? boolean 为true时超时也返回已完成的结果，否则返回false, "timeout"
+---@return boolean done 是否全部返回(未超时)
+---@return table results 按添加顺序排列，每一项为{ok, ...}
+function batch:submit(partial) end
+
+--- 获取未提交的调用数量
+---@return integer
+function batch:size() end
+
+--- 清除未提交的调用
+function batch:clear() end
+
+
+---@class rpcall_writer
+local writer = {}
+
+--- 发送一个数据块，对方未确认的数据块达到上限时等待(协程中挂起，否则阻塞)
+---@param ... any 数据块的内容
+---@return boolean ok 失败时返回false及原因("cancel"或"timeout")
+---@return string? error
+function writer:write(...) end
+
+--- 结束流，回收时未结束的流会以错误"stream aborted"结束
+---@param error? string 错误信息，调用者读取时返回false, error
+function writer:close(error) end
+
+---@class rpcall_reader
+local reader = {}
+
+--- 读取一个数据块，未到达时等待(协程中挂起，否则阻塞)
+---@return boolean? ok true后跟数据块的内容，流结束返回nil，出错返回false, error
+function reader:read() end
+
+--- 关闭流，未结束时通知对方停止发送
+function reader:close() end
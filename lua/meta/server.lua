@@ -5,6 +5,7 @@ local server = {}
 
 
 --- 创建监听
+--- 回调在协程池中运行(见os.go), 每个连接一个协程, 回调等待时不影响后续的连接
 ---@param host string 监听地址
 ---@param port integer 监听端口
 ---@param func fun(peer:socket, ec:string|nil)
@@ -31,6 +31,7 @@ function socket:write(data) end
 function socket:send(data, func) end
 
 --- 异步的方式接收
+--- 回调在协程池中运行(见os.go), 同一个套接字的回调依次执行, 回调等待时后续数据排队
 ---@param func fun(data:string, err:string|nil) 失败时会有错误描述
 function socket:receive(func) end
 
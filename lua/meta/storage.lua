@@ -22,8 +22,9 @@ function storage.set_if(key, func) end
 
 --- 获取一个 key-value 值
 ---@param key string
+---@param lazy? boolean 为true时table以unwrap_view视图返回
 ---@return any
-function storage.get(key) end
+function storage.get(key, lazy) end
 
 
 --- 擦除指定的 key-value 值
@@ -3,8 +3,9 @@
 ---@class timer
 local timer = {}
 
+---回调在协程池中运行(见os.go), 可以调用rpc等待, 回调结束后按返回值重新定时
 ---@param ms number 定时毫秒
----@param func fun():integer 任务函数
+---@param func fun():integer 任务函数, 返回下次的毫秒数, 0或nil不再定时
 function timer:expires(ms, func) end
 
 function timer:cancel() end
@@ -0,0 +1,185 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+---------------------------------------------------------------------------------
+---os.snapshot生成的堆快照的读取和比较, 也可以独立运行:
+---lua heapdiff.lua old.snapshot new.snapshot [top]
+
+local open    = io.open;
+local unpack  = string.unpack;
+local format  = string.format;
+local insert  = table.insert;
+local concat  = table.concat;
+local sort    = table.sort;
+
+local MAGIC   = "LUAHEAP1";
+local RECORD  = "=BBI2I4I8I8";   --type, reserved, length, size, address, referrer
+local HEADER  = string.packsize(RECORD);
+local END     = 0xff;
+local DEPTH   = 12;              --路径最多保留的名字数
+
+local names = {
+  [4] = "string", [5] = "table", [6] = "function", [7] = "userdata", [8] = "thread"
+};
+
+---------------------------------------------------------------------------------
+
+--数组下标和以对象为键的名字合并为一类, 如 cache.[#]
+local function normalize(name)
+  name = name:gsub("^%[%-?[%d%.e%+]+%]$", "[#]");
+  name = name:gsub("^%[(%a+):[%x:x]+%]$", "[%1]");
+  name = name:gsub("^(.+):%d+$", "%1");        --局部变量的行号
+  return name;
+end
+
+---读取快照
+---@param filename string
+---@return table|nil, string|nil
+local function load(filename)
+  local file, err = open(filename, "rb");
+  if not file then
+    return nil, err;
+  end
+  local data = file:read("a");
+  file:close();
+  if data:sub(1, #MAGIC) ~= MAGIC then
+    return nil, filename .. ": not a heap snapshot";
+  end
+  local objects = {};
+  local count, bytes, complete = 0, 0, false;
+  local pos = #MAGIC + 1;
+  while pos + HEADER - 1 <= #data do
+    local type, _, length, size, address, referrer = unpack(RECORD, data, pos);
+    pos = pos + HEADER;
+    if type == END then
+      complete = true;
+      break;
+    end
+    objects[address] = {
+      type     = names[type] or tostring(type),
+      size     = size,
+      referrer = referrer,
+      name     = data:sub(pos, pos + length - 1),
+    };
+    count = count + 1;
+    bytes = bytes + size;
+    pos = pos + length;
+  end
+  return { objects = objects, count = count, bytes = bytes, complete = complete };
+end
+
+--对象从根开始的路径, 由首次发现它的引用链组成
+local function path_of(snapshot, address, paths)
+  local path = paths[address];
+  if path then
+    return path;
+  end
+  local chain = {};
+  local object = snapshot.objects[address];
+  while object and #chain < DEPTH do
+    insert(chain, 1, normalize(object.name));
+    object = snapshot.objects[object.referrer];
+  end
+  path = concat(chain, ".");
+  paths[address] = path;
+  return path;
+end
+
+--按类型和引用路径分组统计
+local function group(snapshot)
+  local groups, paths = {}, {};
+  for address, object in pairs(snapshot.objects) do
+    local referrer = snapshot.objects[object.referrer];
+    local key = object.type .. " " .. (referrer and path_of(snapshot, object.referrer, paths) or "") .. "." .. normalize(object.name);
+    local g = groups[key];
+    if not g then
+      g = { count = 0, bytes = 0 };
+      groups[key] = g;
+    end
+    g.count = g.count + 1;
+    g.bytes = g.bytes + object.size;
+  end
+  return groups;
+end
+
+---比较两个快照, 按增长的字节数排序返回各分组的变化
+---@param old table|string 快照或文件名
+---@param new table|string 快照或文件名
+---@return table[]|nil, string|nil
+local function diff(old, new)
+  local err;
+  if type(old) == "string" then
+    old, err = load(old);
+    if not old then
+      return nil, err;
+    end
+  end
+  if type(new) == "string" then
+    new, err = load(new);
+    if not new then
+      return nil, err;
+    end
+  end
+  local a, b = group(old), group(new);
+  local rows = {};
+  for key, g in pairs(b) do
+    local o = a[key] or { count = 0, bytes = 0 };
+    if g.count ~= o.count or g.bytes ~= o.bytes then
+      insert(rows, { key = key, count = g.count - o.count, bytes = g.bytes - o.bytes, total = g.count });
+    end
+  end
+  for key, o in pairs(a) do
+    if not b[key] then
+      insert(rows, { key = key, count = -o.count, bytes = -o.bytes, total = 0 });
+    end
+  end
+  sort(rows, function(x, y)
+    if x.bytes ~= y.bytes then
+      return x.bytes > y.bytes;
+    end
+    return x.key < y.key;
+  end);
+  rows.old, rows.new = old, new;
+  return rows;
+end
+
+---比较两个快照, 返回可读的报告
+---@param old table|string
+---@param new table|string
+---@param top? integer 最多列出的分组, 默认30
+---@return string|nil, string|nil
+local function report(old, new, top)
+  local rows, err = diff(old, new);
+  if not rows then
+    return nil, err;
+  end
+  old, new = rows.old, rows.new;
+  local lines = {
+    format("objects %d -> %d (%+d), bytes %d -> %d (%+d)%s",
+      old.count, new.count, new.count - old.count, old.bytes, new.bytes, new.bytes - old.bytes,
+      (old.complete and new.complete) and "" or ", incomplete snapshot"),
+    format("%12s %10s %10s  %s", "bytes", "count", "total", "type path"),
+  };
+  for i = 1, math.min(top or 30, #rows) do
+    local r = rows[i];
+    insert(lines, format("%+12d %+10d %10d  %s", r.bytes, r.count, r.total, r.key));
+  end
+  return concat(lines, "\n");
+end
+
+---------------------------------------------------------------------------------
+
+local args = { ... };
+if #args >= 2 and args[1] ~= "skynet.heapdiff" then
+  local text, err = report(args[1], args[2], tonumber(args[3]));
+  print(text or err);
+  return;
+end
+
+return { load = load, diff = diff, report = report };
+
+---------------------------------------------------------------------------------
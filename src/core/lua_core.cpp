@@ -1,11 +1,15 @@
 
 
 #include "../skynet.h"
+#include "../skynet_profiler.h"
 #include "lua_global.h"
 #include "lua_bind.h"
 #include "lua_dofile.h"
 #include "lua_path.h"
 #include "lua_pcall.h"
+#include "lua_gc.h"
+#include "lua_go.h"
+#include "lua_stats.h"
 #include "lua_rpcall.h"
 #include "lua_pload.h"
 #include "lua_print.h"
@@ -19,13 +23,16 @@
 /********************************************************************************/
 
 static const lua_CFunction core_modules[] = {
-  luaopen_require,      /* require        */
+  luaopen_require,      /* require, os.bytecode */
   luaopen_global,
   luaopen_print,        /* print, trace, error, throw */
   luaopen_path,         /* path, cpath    */
   luaopen_wrap,         /* wrap, unwrap   */
   luaopen_pcall,        /* pcall, xpcall  */
   luaopen_rpcall,       /* os.rpcall      */
+  luaopen_go,           /* os.go          */
+  luaopen_gc,           /* os.gcbudget    */
+  luaopen_stats,        /* os.stats       */
   luaopen_bind,         /* bind           */
   luaopen_sheet,        /* os.sheet       */
   luaopen_pload,        /* pload          */
@@ -129,7 +136,7 @@ struct lua_coroutine final {
     }
     int yields = 0;
     if (lua_success(lua_status(self->coL))) {
-      int n = lua_resume(self->coL, L, 0, &yields);
+      int n = lua_profile_resume(self->coL, L, 0, &yields);
       if (n != LUA_OK && n != LUA_YIELD) {
         lua_ferror("%s\n", luaL_checkstring(L, -1));
         lua_pop(L, 1);
@@ -293,10 +300,8 @@ static int os_post(lua_State* L) {
       lua_pushref(L, params[i]);
       lua_unref(L, params[i]);
     }
-    if (lua_pcall(L, (int)argc, 0, 0) != LUA_OK) {
-      lua_ferror("%s\n", luaL_checkstring(L, -1));
-    }
-  });
+    lua_go(L, (int)argc);
+  }, stats_post);
   return 0;
 }
 
@@ -5,18 +5,21 @@
 
 static std::mutex _mutex;
 static std::map<int, typeof<io::service>> _services;
+static std::map<int, std::string> _names;
 
 class service_hold final {
 public:
-  inline service_hold() {
+  inline service_hold(const char* name) {
     std::unique_lock<std::mutex> _lock(_mutex);
     auto ios = io::service::local();
     _services[ios->id()] = ios;
+    _names[ios->id()] = name;
   }
   inline ~service_hold() {
     std::unique_lock<std::mutex> _lock(_mutex);
     auto ios = io::service::local();
     _services.erase(ios->id());
+    _names.erase(ios->id());
   }
 };
 
@@ -51,7 +54,7 @@ SKYNET_API int lua_dofile(lua_State* L) {
   lua_pushvalue(L, 1);
   lua_setglobal(L, "__progname");
 
-  service_hold hold;
+  service_hold hold(filename);
 
   int top = lua_gettop(L);
   lua_getglobal(L, LUA_LOADLIBNAME);  /* package */
@@ -87,4 +90,11 @@ SKYNET_API typeof<io::service> skynet_service(int servicdid) {
   return iter == _services.end() ? typeof<io::service>() : iter->second;
 }
 
+SKYNET_API void skynet_services(std::vector<std::pair<std::string, typeof<io::service>>>& services) {
+  std::unique_lock<std::mutex> _lock(_mutex);
+  for (auto& v : _services) {
+    services.emplace_back(_names[v.first], v.second);
+  }
+}
+
 /********************************************************************************/
@@ -16,6 +16,9 @@
 SKYNET_API int lua_dofile(lua_State* L);
 SKYNET_API typeof<io::service> skynet_service(int osid);
 
+/* the running services and their names */
+SKYNET_API void skynet_services(std::vector<std::pair<std::string, typeof<io::service>>>& services);
+
 #define find_service(id) skynet_service(id)
 
 /********************************************************************************/
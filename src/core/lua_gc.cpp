@@ -0,0 +1,256 @@
+
+#include "../skynet.h"
+#include "../skynet_allotor.h"
+#include "lua_gc.h"
+#include "lua_stats.h"
+
+#include <cmath>
+
+/********************************************************************************/
+
+#define GC_TICK      10     /* ms between two idle steps */
+#define GC_IDLE      1000   /* ms between two ticks when there's nothing to do */
+#define GC_BUDGET    1000   /* us, default budget of a pause */
+#define GC_STEPSIZE  13     /* log2 of the work of a step in bytes, as lua */
+#define GC_STEPMIN   10
+#define GC_STEPMAX   GC_STEPSIZE  /* a step never does more work than lua's */
+#define GC_SHARE     1024   /* a tick pays at most 1/GC_SHARE of the heap */
+#define GC_BUCKETS   8
+
+static const double gc_bounds[GC_BUCKETS] = {
+  0.1, 0.25, 0.5, 1, 2, 5, 10, HUGE_VAL  /* ms */
+};
+
+/*
+* Keeps the collector of the service in incremental mode and steps it while the
+* service is idle, instead of a full collect that stops the service now and then.
+* The service is idle when the tick of the controller isn't late: a busy loop
+* runs the tick behind its time, and the tick is skipped then.
+* A tick steps the collector until half the budget is spent or the cycle ends.
+* The work of a step (stepsize) is adapted so that a step takes less than half
+* the budget, it also bounds the steps lua does when allocating: it only gets
+* smaller than lua's default, as a bigger one makes the steps of the requests
+* longer.
+* Once a tick finished a cycle, the collector waits in its pause: nothing is
+* left to do until the service allocates again, and the tick slows down.
+*/
+struct gc_controller final {
+  typedef std::chrono::steady_clock clock;
+
+  size_t budget   = GC_BUDGET;   /* us, 0 when the controller is off */
+  int    stepsize = GC_STEPSIZE;
+  size_t average  = 0;           /* us, moving average of a step */
+  size_t steps    = 0;
+  size_t skipped  = 0;           /* ticks skipped as the service was busy */
+  size_t cycles   = 0;
+  bool   paused   = false;       /* a tick finished the cycle */
+  size_t paused_allocated = 0;   /* allocated bytes when it was finished */
+  double maxpause = 0;           /* ms */
+  size_t pauses[GC_BUCKETS] = { 0 };
+
+  size_t last_allocated = 0;     /* allocated bytes at the last sample */
+  size_t last_sample    = 0;     /* steady clock of the last sample */
+  double rate           = 0;     /* KB allocated per second */
+
+  inline gc_controller()
+    : _timer(*lua_service()) {
+  }
+  inline static gc_controller& local() {
+    static thread_local gc_controller controller;
+    return controller;
+  }
+
+  void start(lua_State* L) {
+    lua_gc(L, LUA_GCINC, 0, 0, stepsize);
+    last_allocated = skynet_allocated();
+    last_sample = steady_clock();
+    paused = false;
+    arm(GC_TICK);
+  }
+  void stop(lua_State* L) {
+    _timer.cancel();
+    lua_gc(L, LUA_GCGEN, 0, 0);
+  }
+
+  void sample() {
+    size_t now = steady_clock();
+    if (now - last_sample < 1000) {
+      return;
+    }
+    size_t allocated = skynet_allocated();
+    rate = (double)(allocated - last_allocated) / 1.024 / (double)(now - last_sample);
+    last_allocated = allocated;
+    last_sample = now;
+  }
+
+  void record(double ms) {
+    if (ms > maxpause) {
+      maxpause = ms;
+    }
+    int i = 0;
+    while (ms > gc_bounds[i]) {
+      i++;
+    }
+    pauses[i]++;
+  }
+
+  /* a step may be one big object, the size follows the average of the steps */
+  void adapt(lua_State* L, size_t us) {
+    average = (average * 7 + us) / 8;
+    if (average * 2 > budget && stepsize > GC_STEPMIN) {
+      stepsize--;
+      average /= 2; /* the steps are half the work */
+    }
+    else if (average * 8 < budget && stepsize < GC_STEPMAX) {
+      stepsize++;
+      average *= 2;
+    }
+    else {
+      return;
+    }
+    lua_gc(L, LUA_GCINC, 0, 0, stepsize);
+  }
+
+  /*
+  * Pays some debt of the collector ahead of the allocations: a cycle in
+  * progress goes on until half the budget is spent, in the pause at most a
+  * share of the heap is paid per tick, a new cycle only starts earlier when
+  * the service stays idle.
+  */
+  void step(lua_State* L) {
+    size_t share = std::max((size_t)lua_gc(L, LUA_GCCOUNT) / GC_SHARE, (size_t)1);
+    size_t kb = ((size_t)2 << stepsize) >> 10; /* lua leaves a step of credit */
+    auto begin = clock::now();
+    auto last = begin;
+    size_t elapsed = 0;
+    size_t paid = 0; /* debt paid without work, the collector is in its pause */
+    while (paid < share && elapsed * 2 < budget) {
+      bool done = lua_gc(L, LUA_GCSTEP, (int)kb) != 0;
+      auto now = clock::now();
+      auto us = (size_t)std::chrono::duration_cast<std::chrono::microseconds>(now - last).count();
+      if (us > 0) {
+        adapt(L, us);
+      }
+      else {
+        paid += kb;
+      }
+      elapsed = (size_t)std::chrono::duration_cast<std::chrono::microseconds>(now - begin).count();
+      last = now;
+      steps++;
+      if (done) {
+        cycles++;
+        paused = true;
+        paused_allocated = skynet_allocated();
+        break;
+      }
+    }
+    record((double)elapsed / 1000.0);
+  }
+
+  void arm(size_t ms) {
+    _due = clock::now() + std::chrono::milliseconds(ms);
+    _timer.expires_at(_due);
+    _timer.async_wait([this](const error_code& ec) {
+      if (ec || budget == 0) {
+        return;
+      }
+      io::service::measure measure(stats_gc);
+      lua_State* L = lua_local();
+      auto lag = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - _due);
+      sample();
+      if (paused && skynet_allocated() == paused_allocated) {
+        arm(GC_IDLE); /* still in the pause, nothing was allocated */
+        return;
+      }
+      paused = false;
+      if ((size_t)lag.count() > budget) {
+        skipped++;
+      }
+      else {
+        step(L);
+      }
+      arm(GC_TICK);
+    });
+  }
+
+private:
+  steady_timer _timer;
+  clock::time_point _due;
+};
+
+/********************************************************************************/
+
+/* os.gcbudget([ms]) */
+static int os_gcbudget(lua_State* L) {
+  auto& gc = gc_controller::local();
+  lua_pushnumber(L, (lua_Number)gc.budget / 1000.0);
+  if (!lua_isnoneornil(L, 1)) {
+    auto ms = luaL_checknumber(L, 1);
+    size_t budget = ms > 0 ? (size_t)(ms * 1000.0) : 0;
+    if (budget == 0 && gc.budget > 0) {
+      gc.budget = 0;
+      gc.stop(L);
+    }
+    else if (budget > 0) {
+      bool stopped = (gc.budget == 0);
+      gc.budget = budget;
+      if (stopped) {
+        gc.start(L);
+      }
+    }
+  }
+  return 1;
+}
+
+/* os.gcstats() */
+static int os_gcstats(lua_State* L) {
+  auto& gc = gc_controller::local();
+  gc.sample();
+  lua_createtable(L, 0, 12);
+  lua_pushstring(L, gc.budget > 0 ? "incremental" : "generational");
+  lua_setfield(L, -2, "mode");
+  lua_pushnumber(L, (lua_Number)gc.budget / 1000.0);
+  lua_setfield(L, -2, "budget");
+  lua_pushinteger(L, (lua_Integer)1 << gc.stepsize);
+  lua_setfield(L, -2, "stepsize");
+  lua_pushinteger(L, lua_gc(L, LUA_GCCOUNT));
+  lua_setfield(L, -2, "count");
+  lua_pushnumber(L, gc.rate);
+  lua_setfield(L, -2, "rate");
+  lua_pushinteger(L, (lua_Integer)gc.steps);
+  lua_setfield(L, -2, "steps");
+  lua_pushinteger(L, (lua_Integer)gc.skipped);
+  lua_setfield(L, -2, "skipped");
+  lua_pushinteger(L, (lua_Integer)gc.cycles);
+  lua_setfield(L, -2, "cycles");
+  lua_pushnumber(L, gc.maxpause);
+  lua_setfield(L, -2, "max");
+
+  lua_createtable(L, GC_BUCKETS, 0);
+  for (int i = 0; i < GC_BUCKETS; i++) {
+    lua_pushnumber(L, gc_bounds[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "bounds");
+  lua_createtable(L, GC_BUCKETS, 0);
+  for (int i = 0; i < GC_BUCKETS; i++) {
+    lua_pushinteger(L, (lua_Integer)gc.pauses[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "pauses");
+  return 1;
+}
+
+/********************************************************************************/
+
+SKYNET_API int luaopen_gc(lua_State* L) {
+  gc_controller::local().start(L);
+  const luaL_Reg methods[] = {
+    { "gcbudget",     os_gcbudget   },
+    { "gcstats",      os_gcstats    },
+    { NULL,           NULL          }
+  };
+  return new_module(L, "os", methods);
+}
+
+/********************************************************************************/
@@ -0,0 +1,18 @@
+
+
+#ifndef __LUA_GC_H
+#define __LUA_GC_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+# pragma once
+#endif
+
+#include "../skynet_lua.h"
+
+/********************************************************************************/
+
+SKYNET_API int luaopen_gc(lua_State* L);
+
+/********************************************************************************/
+
+#endif //__LUA_GC_H
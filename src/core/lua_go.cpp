@@ -0,0 +1,155 @@
+
+#include "../skynet.h"
+#include "../skynet_profiler.h"
+#include "lua_go.h"
+
+/********************************************************************************/
+
+#define GO_POOL_LIMIT 1024  /* idle coroutines kept by a service */
+
+/*
+* Coroutines of os.go are kept by the service when their function returns: a
+* thread is allocated once, with its stack and CallInfo chain, and reused by
+* the next requests instead of being garbage after each one.
+* A pooled coroutine loops in go_run, it calls the function it's given, goes
+* back to the pool and yields until it's given the next one.
+*/
+struct go_pool final {
+  std::vector<int> idle;          /* refs of the idle coroutines */
+  lua_State* assigned = nullptr;  /* the coroutine being given a function */
+  size_t limit   = GO_POOL_LIMIT;
+  size_t running = 0;             /* functions started and not returned */
+  size_t peak    = 0;             /* high-water mark of running */
+  size_t hits    = 0;             /* coroutines taken from the pool */
+  size_t misses  = 0;             /* coroutines created */
+
+  inline static go_pool& local() {
+    static thread_local go_pool pool;
+    return pool;
+  }
+
+  static int go_done(lua_State* L, int status, lua_KContext ctx) {
+    auto& pool = local();
+    if (!lua_success(status)) {
+      lua_ferror("%s\n", luaL_tolstring(L, -1, nullptr));
+    }
+    pool.running--;
+    lua_settop(L, 0);
+    if (pool.idle.size() >= pool.limit) {
+      return 0; /* the coroutine is dead, and collected */
+    }
+    lua_pushthread(L);
+    pool.idle.push_back(lua_ref(L, -1));
+    lua_pop(L, 1);
+    return lua_yield_k(L, 0, 0, go_next);
+  }
+
+  /* stack: function, arguments... */
+  static int go_run(lua_State* L) {
+    auto& pool = local();
+    if (pool.assigned != L) {
+      lua_settop(L, 0); /* resumed while idle, not by lua_go */
+      return lua_yield_k(L, 0, 0, go_next);
+    }
+    pool.assigned = nullptr;
+    lua_pcall_k(L, lua_gettop(L) - 1, 0, 0, go_done);
+    return go_done(L, LUA_OK, 0);
+  }
+
+  static int go_next(lua_State* L, int status, lua_KContext ctx) {
+    return go_run(L);
+  }
+
+  /* pushes an idle coroutine, or a new one */
+  lua_State* acquire(lua_State* L) {
+    lua_State* coL = nullptr;
+    if (!idle.empty()) {
+      int ref = idle.back();
+      idle.pop_back();
+      lua_pushref(L, ref);
+      lua_unref(L, ref);
+      coL = lua_tothread(L, -1);
+      hits++;
+    }
+    else {
+      coL = lua_newthread(L);
+      lua_pushcfunction(coL, go_run);
+      misses++;
+    }
+    if (++running > peak) {
+      peak = running;
+    }
+    return coL;
+  }
+};
+
+/********************************************************************************/
+
+SKYNET_API int lua_go(lua_State* L, int nargs) {
+  auto& pool = go_pool::local();
+  auto coL = pool.acquire(L);
+  lua_insert(L, -(nargs + 2));     /* below the function */
+  lua_xmove(L, coL, nargs + 1);
+
+  int nret = 0;
+  pool.assigned = coL;
+  int state = lua_profile_resume(coL, L, nargs + 1, &nret);
+  pool.assigned = nullptr;
+  if (state == LUA_OK || state == LUA_YIELD) {
+    lua_pop(coL, nret);
+  }
+  else {
+    /* go_run itself failed, the coroutine is dead */
+    pool.running--;
+    lua_ferror("%s\n", luaL_tolstring(coL, -1, nullptr));
+  }
+  lua_pop(L, 1); /* coroutine */
+  return state;
+}
+
+/* os.go(f, ...) */
+static int os_go(lua_State* L) {
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  lua_go(L, lua_gettop(L) - 1);
+  return 0;
+}
+
+/* os.gopool([limit]) */
+static int os_gopool(lua_State* L) {
+  auto& pool = go_pool::local();
+  if (!lua_isnoneornil(L, 1)) {
+    auto limit = luaL_checkinteger(L, 1);
+    pool.limit = (size_t)std::max(limit, (lua_Integer)0);
+    while (pool.idle.size() > pool.limit) {
+      lua_unref(L, pool.idle.back());
+      pool.idle.pop_back();
+    }
+  }
+  lua_createtable(L, 0, 6);
+  lua_pushinteger(L, (lua_Integer)pool.idle.size());
+  lua_setfield(L, -2, "idle");
+  lua_pushinteger(L, (lua_Integer)pool.running);
+  lua_setfield(L, -2, "running");
+  lua_pushinteger(L, (lua_Integer)pool.peak);
+  lua_setfield(L, -2, "peak");
+  lua_pushinteger(L, (lua_Integer)pool.hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushinteger(L, (lua_Integer)pool.misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushinteger(L, (lua_Integer)pool.limit);
+  lua_setfield(L, -2, "limit");
+  return 1;
+}
+
+/********************************************************************************/
+
+SKYNET_API int luaopen_go(lua_State* L) {
+  const luaL_Reg methods[] = {
+    { "go",           os_go         },
+    { "gopool",       os_gopool     },
+    { NULL,           NULL          }
+  };
+  return new_module(L, "os", methods);
+}
+
+/********************************************************************************/
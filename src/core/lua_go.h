@@ -0,0 +1,26 @@
+
+
+#ifndef __LUA_GO_H
+#define __LUA_GO_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+# pragma once
+#endif
+
+#include "../skynet_lua.h"
+
+/********************************************************************************/
+
+/*
+* Calls the function below the nargs arguments in a coroutine of the pool of
+* the service, and pops them. Errors of the function are logged, the result is
+* the status of the coroutine: LUA_OK when it's finished, LUA_YIELD when it's
+* waiting for something (e.g. a rpcall).
+*/
+SKYNET_API int lua_go(lua_State* L, int nargs);
+
+SKYNET_API int luaopen_go(lua_State* L);
+
+/********************************************************************************/
+
+#endif //__LUA_GO_H
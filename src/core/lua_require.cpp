@@ -2,6 +2,200 @@
 
 #include "lua_require.h"
 
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/stat.h>
+
+/********************************************************************************/
+
+/*
+* Compiled chunks of the loaded files, shared by the services of the process:
+* a file is parsed by the first service that loads it, the others load its
+* bytecode. A chunk is kept while the size and the mtime of its file match,
+* the mtime in nanoseconds where the platform has them.
+*/
+struct chunk_cache final {
+  typedef std::shared_ptr<const std::string> code_type;
+
+  struct chunk {
+    time_t    mtime;
+    long      nsec;
+    size_t    size;
+    code_type code;
+  };
+
+  bool   enabled = true;
+  size_t bytes   = 0;
+  size_t hits    = 0;
+  size_t misses  = 0;
+
+  inline static chunk_cache& instance() {
+    static chunk_cache cache;
+    return cache;
+  }
+
+  inline static long mtime_nsec(const struct stat& st) {
+#if defined(_WIN32)
+    return 0;
+#elif defined(__APPLE__)
+    return st.st_mtimespec.tv_nsec;
+#else
+    return st.st_mtim.tv_nsec;
+#endif
+  }
+
+  /* the file didn't change between the two stats */
+  inline static bool unchanged(const struct stat& st, const struct stat& now) {
+    return st.st_mtime == now.st_mtime && mtime_nsec(st) == mtime_nsec(now) && st.st_size == now.st_size;
+  }
+
+  code_type find(const std::string& filename, const struct stat& st) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!enabled) {
+      return code_type();
+    }
+    auto iter = _chunks.find(filename);
+    if (iter == _chunks.end() || iter->second.mtime != st.st_mtime || iter->second.nsec != mtime_nsec(st)
+      || iter->second.size != (size_t)st.st_size) {
+      misses++;
+      return code_type();
+    }
+    hits++;
+    return iter->second.code;
+  }
+
+  void insert(const std::string& filename, const struct stat& st, std::string&& code) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!enabled) {
+      return;
+    }
+    auto& v = _chunks[filename];
+    if (v.code) {
+      bytes -= v.code->size();
+    }
+    bytes += code.size();
+    v.mtime = st.st_mtime;
+    v.nsec = mtime_nsec(st);
+    v.size = (size_t)st.st_size;
+    v.code = std::make_shared<const std::string>(std::move(code));
+  }
+
+  void enable(bool on) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    enabled = on;
+    if (!on) {
+      _chunks.clear();
+      bytes = 0;
+    }
+  }
+
+  /* a copy of the counters, and the number of chunks */
+  size_t copy(chunk_cache& out) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    out.enabled = enabled;
+    out.bytes = bytes;
+    out.hits = hits;
+    out.misses = misses;
+    return _chunks.size();
+  }
+
+private:
+  std::mutex _mutex;
+  std::unordered_map<std::string, chunk> _chunks;
+};
+
+/********************************************************************************/
+
+#define PATH_CHECK   1000   /* ms between two looks at the mtime of a directory */
+
+/*
+* Listings of the directories of package.path, shared by the services of the
+* process: a lookup of a module is a probe of the listing of each directory,
+* found or not, instead of an open of each file. A listing is read again when
+* the mtime of its directory changes, looked at once per PATH_CHECK at most;
+* a directory changed in the last second may change again within the same
+* mtime, its listing is read again at the next look.
+*/
+struct path_cache final {
+  struct listing {
+    bool   exists  = false;
+    bool   stable  = false;      /* the mtime is older than a second */
+    time_t mtime   = 0;
+    std::chrono::steady_clock::time_point checked;
+    std::unordered_set<std::string> files;
+  };
+
+  inline static path_cache& instance() {
+    static path_cache cache;
+    return cache;
+  }
+
+  bool readable(const char* filename) {
+    const char* base = filename;
+    for (const char* p = filename; *p; p++) {
+      if (*p == '/' || *p == '\\') {
+        base = p + 1;
+      }
+    }
+    std::string dir(filename, base - filename);
+    if (dir.empty()) {
+      dir = ".";
+    }
+    std::string name(base);
+#ifdef _WIN32
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+#endif
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto iter = _dirs.find(dir);
+    if (iter == _dirs.end()) {
+      iter = _dirs.emplace(dir, listing()).first;
+      refresh(dir, iter->second);
+    }
+    else if (std::chrono::steady_clock::now() - iter->second.checked >= std::chrono::milliseconds(PATH_CHECK)) {
+      refresh(dir, iter->second);
+    }
+    return iter->second.files.count(name) > 0;
+  }
+
+private:
+  void refresh(const std::string& dir, listing& v) {
+    v.checked = std::chrono::steady_clock::now();
+    struct stat st;
+    if (stat(dir.c_str(), &st) != 0) {
+      v.exists = false;
+      v.files.clear();
+      return;
+    }
+    if (v.exists && v.stable && v.mtime == st.st_mtime) {
+      return;
+    }
+    v.exists = true;
+    v.stable = time(nullptr) - st.st_mtime > 1;
+    v.mtime = st.st_mtime;
+    v.files.clear();
+    tinydir_dir tdir;
+    if (tinydir_open(&tdir, dir.c_str()) < 0) {
+      return;
+    }
+    while (tdir.has_next) {
+      tinydir_file file;
+      if (tinydir_readfile(&tdir, &file) == 0 && !file.is_dir) {
+        std::string name(file.name);
+#ifdef _WIN32
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+#endif
+        v.files.insert(name);
+      }
+      tinydir_next(&tdir);
+    }
+    tinydir_close(&tdir);
+  }
+
+  std::mutex _mutex;
+  std::unordered_map<std::string, listing> _dirs;
+};
+
 /********************************************************************************/
 
 typedef struct {
@@ -97,6 +291,42 @@ static int ll_requiref(lua_State* L, const char* filename) {
   return result;
 }
 
+static int dump_string(lua_State* L, const void* p, size_t sz, void* ud) {
+  std::string* ps = (std::string*)ud;
+  return ps->append((char*)p, sz), LUA_OK;
+}
+
+/*
+* loads the compiled chunk of the file, or parses it and keeps its bytecode
+* unless the file was written while it was read
+*/
+static int ll_requirec(lua_State* L, const char* filename) {
+  auto& cache = chunk_cache::instance();
+  struct stat st;
+  if (stat(filename, &st) != 0) {
+    return ll_requiref(L, filename);
+  }
+  auto code = cache.find(filename, st);
+  if (code) {
+    int result = lua_loader(L, code->data(), code->size(), filename);
+    if (result == LUA_OK) {
+      lua_pushstring(L, filename);
+    }
+    return result;
+  }
+  int result = ll_requiref(L, filename);
+  struct stat now;
+  if (result == LUA_OK && stat(filename, &now) == 0 && chunk_cache::unchanged(st, now)) {
+    std::string data;
+    lua_pushvalue(L, -2); /* the chunk */
+    if (lua_dump(L, dump_string, &data, 0) == LUA_OK) {
+      cache.insert(filename, st, std::move(data));
+    }
+    lua_pop(L, 1);
+  }
+  return result;
+}
+
 static void pusherrornotfound(lua_State *L, const char *path) {
   luaL_Buffer b;
   luaL_buffinit(L, &b);
@@ -107,10 +337,7 @@ static void pusherrornotfound(lua_State *L, const char *path) {
 }
 
 static int readable(const char *filename) {
-  FILE *fp = fopen(filename, "rb");  /* try to open file */
-  if (fp == NULL) return 0; /* open failed */
-  fclose(fp);
-  return 1;
+  return path_cache::instance().readable(filename) ? 1 : 0;
 }
 
 static const char* next_filename(char **path, char *end) {
@@ -172,7 +399,7 @@ static int luac_require(lua_State* L) {
   auto fullname = findfile(L, findpath, filename);
   /* file found */
   if (fullname) {
-    if (ll_requiref(L, fullname) != LUA_OK) {
+    if (ll_requirec(L, fullname) != LUA_OK) {
       lua_error(L);
     }
     return 2;
@@ -195,6 +422,27 @@ static int luac_require(lua_State* L) {
   return 2;
 }
 
+/* os.bytecode([on]) */
+static int os_bytecode(lua_State* L) {
+  if (!lua_isnoneornil(L, 1)) {
+    chunk_cache::instance().enable(lua_toboolean(L, 1) != 0);
+  }
+  chunk_cache cache;
+  size_t count = chunk_cache::instance().copy(cache);
+  lua_createtable(L, 0, 5);
+  lua_pushboolean(L, cache.enabled ? 1 : 0);
+  lua_setfield(L, -2, "enabled");
+  lua_pushinteger(L, (lua_Integer)count);
+  lua_setfield(L, -2, "count");
+  lua_pushinteger(L, (lua_Integer)cache.bytes);
+  lua_setfield(L, -2, "bytes");
+  lua_pushinteger(L, (lua_Integer)cache.hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushinteger(L, (lua_Integer)cache.misses);
+  lua_setfield(L, -2, "misses");
+  return 1;
+}
+
 /********************************************************************************/
 
 SKYNET_API int luaopen_require(lua_State* L) {
@@ -203,7 +451,12 @@ SKYNET_API int luaopen_require(lua_State* L) {
   lua_pushcfunction(L, luac_require); /* push new loader */
   lua_rawseti(L, -2, 2);
   lua_pop(L, 2);
-  return 0;
+
+  const luaL_Reg methods[] = {
+    { "bytecode",     os_bytecode   },
+    { NULL,           NULL          }
+  };
+  return new_module(L, "os", methods);
 }
 
 /********************************************************************************/
@@ -1,10 +1,17 @@
 
 
 #include "../skynet.h"
+#include "../skynet_profiler.h"
 #include "lua_rpcall.h"
+#include "lua_go.h"
+#include "lua_stats.h"
 #include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <climits>
 #include <map>
 #include <set>
+#include <deque>
 #include <vector>
 
 /********************************************************************************/
@@ -21,8 +28,128 @@ typedef struct __node_type {
 
 struct pend_invoke {
   int caller;
-  int rcf;
+  int rcf;          /* < 0 the caller is blocked, its continuation otherwise */
   size_t timeout;
+  size_t batch = 0; /* sn of the batch, 0 if not */
+  int index = 0;    /* index in the batch */
+};
+
+/* the request being handled by a receiver function */
+struct invoke_context {
+  size_t caller;
+  size_t deadline;
+  size_t sn;
+  int rcf;
+  int handler;      /* ref of the responser, until the function takes it */
+};
+
+struct pend_slot {
+  size_t generation = 0;
+  bool used = false;
+  pend_invoke pend;
+};
+
+struct pend_batch {
+  int rcf;          /* rcf of the calls, < 0 the caller is blocked */
+  size_t hold = 0;  /* sn of the slot holding the coroutine */
+  int partial;
+  size_t remaining;
+  size_t timedout = 0;
+  std::vector<size_t> keys;
+  std::vector<std::string> results;
+};
+
+struct route_type {
+  size_t who;
+  int rcb;
+};
+
+struct batch_call {
+  std::string topic;
+  std::string argv;
+  size_t mask;
+  size_t receiver;
+};
+
+struct batch_item {
+  std::string topic;
+  std::string argv;
+  size_t mask;
+  size_t who;
+  int rcb;
+  size_t sn;
+  size_t deadline;
+};
+
+struct stream_reader {
+  size_t who = 0;       /* receiver of the stream */
+  size_t ssn = 0;       /* sn of the writer */
+  size_t hold = 0;      /* sn of the slot holding the coroutine waiting for chunk */
+  int consumed = 0;     /* chunks not credited */
+  bool blocked  = false;
+  bool finished = false;
+  bool closed   = false;
+  size_t timeout = 0;
+  size_t expires = 0;
+  std::string error;
+  std::deque<std::string> chunks;
+};
+
+struct stream_writer {
+  int credits = 0;
+  size_t hold = 0;      /* sn of the slot holding the coroutine waiting for credits */
+  bool blocked = false;
+  size_t expires = 0;
+  std::string error;
+};
+
+enum {
+  policy_none = 0,  /* admitted */
+  policy_reject,    /* reply busy to the caller */
+  policy_shed,      /* drop the oldest delivery */
+  policy_block      /* the caller is parked until admitted */
+};
+
+/* a delivery waiting for the mailbox, its caller is yielded meanwhile */
+struct parked_delivery {
+  int rcb;
+  std::string argv;
+  size_t caller;
+  int rcf;
+  size_t sn;
+  size_t deadline;
+  size_t expires;
+};
+
+struct mailbox_type {
+  size_t limit  = 0;  /* 0 is unlimited */
+  int    policy = policy_reject;
+  size_t next   = 0;  /* ticket of next delivery */
+  size_t head   = 0;  /* ticket of next execution */
+  size_t watermark = 0; /* tickets below are shed */
+  size_t posted    = 0;
+  size_t executed  = 0;
+  size_t rejected  = 0;
+  size_t blocked   = 0; /* times of the caller blocked */
+  size_t shed      = 0;
+  size_t max_depth = 0;
+  size_t waited    = 0; /* total wait time(ms) */
+  size_t max_wait  = 0;
+  inline size_t depth() const {
+    return next - std::max(head, watermark);
+  }
+};
+
+/*
+* The mailbox of a service, created by rpc.limit and kept for the id, the
+* deliveries to a service without a limit don't take the lock
+*/
+struct mailbox_holder {
+  std::mutex mutex;
+  std::atomic<bool> limited;
+  mailbox_type mailbox;
+  std::deque<parked_delivery> parked;
+  mailbox_holder() : limited(false) {}
 };
 
 typedef std::string topic_type;
@@ -36,46 +163,236 @@ typedef std::map<
 > rpcall_map_type;
 
 typedef std::map<
-  size_t, pend_invoke
-> invoke_map_type;
+  size_t, pend_batch
+> batch_map_type;
+
+typedef std::map<
+  size_t, stream_reader
+> reader_map_type;
+
+typedef std::map<
+  size_t, stream_writer
+> writer_map_type;
 
 #define max_expires  10000
-#define is_local(what) (what <= 0xffff)
+#define max_window   16 /* chunks in flight of a stream */
+#define stream_rcf   1  /* rcf of the stream credits */
+#define pending_rcf  2  /* rcf of a call, its continuation is in the slot */
+#define pending_bits 24 /* bits of the slot index in sn */
+#define pending_max  ((size_t)1 << pending_bits)
+#define max_services 0x10000
+#define is_local(what) (what < max_services)
 #define unique_mutex_lock(what) std::unique_lock<std::mutex> lock(what)
 
 static std::mutex _mutex;
+static std::mutex _qmutex; /* lock of creating mailboxes */
 static int watcher_ios  = 0;
 static int watcher_luaf = 0;
 static lua_CFunction   watcher_cfn = nullptr;
 static rpcall_map_type rpcall_handlers;
+static std::map<topic_type, size_t> topic_ids; /* ids of the bound topics */
+static std::vector<topic_type> topic_names;
+static std::atomic<mailbox_holder*> mailboxes[max_services];
 
 static thread_local size_t rpcall_nextid = 0;
-static thread_local size_t rpcall_caller = 0;
-static thread_local int    rpcall_r_handler = 0;
-static thread_local invoke_map_type invoke_pendings;
+static thread_local invoke_context* rpcall_context = nullptr; /* of the current request */
+static thread_local batch_map_type  batch_pendings;
+static thread_local reader_map_type stream_readers;
+static thread_local writer_map_type stream_writers;
+static thread_local std::set<int>   lazy_handlers; /* rcb receiving views */
 
 /********************************************************************************/
 
+/* sn of the calls not waiting for results, even, see pend_table */
 static inline size_t next_sn() {
-  return ++rpcall_nextid;
+  return (++rpcall_nextid) << 1;
 }
 
-static inline int remove_of_pending(size_t sn) {
-  auto iter = invoke_pendings.find(sn);
-  if (iter != invoke_pendings.end()) {
-    int rcf = iter->second.rcf;
-    invoke_pendings.erase(iter);
-    return rcf;
+/*
+* The calls waiting for results, of a service. A call takes a slot, and its
+* sn is the index of the slot with the generation of the slot, and the lowest
+* bit set (other sn are even). A result finds its call by an array lookup,
+* the result of a call given up (timeout) fails the generation check once
+* the slot is taken again. The continuations (the coroutine or callback) are
+* kept in a Lua table at the index of the slot + 1, no registry refs. A batch
+* or a stream waiting for results holds its coroutine in a slot of its own,
+* which is never timed out (they have their own timeouts).
+*/
+struct pend_table final {
+  std::vector<pend_slot> slots;
+  std::vector<size_t> frees;  /* indexes of the free slots */
+  int    conts = 0;           /* ref of the table of continuations */
+
+  inline static pend_table& local() {
+    static thread_local pend_table table;
+    return table;
   }
-  return 0;
+  inline static size_t index_of(size_t sn) {
+    return (sn >> 1) & (pending_max - 1);
+  }
+  inline static size_t generation_of(size_t sn) {
+    return sn >> (pending_bits + 1);
+  }
+  inline static bool is_pending(size_t sn) {
+    return (sn & 1) != 0;
+  }
+  inline size_t sn_of(size_t index) const {
+    return (slots[index].generation << (pending_bits + 1)) | (index << 1) | 1;
+  }
+  pend_slot* find(size_t sn) {
+    size_t index = index_of(sn);
+    if (!is_pending(sn) || index >= slots.size()) {
+      return nullptr;
+    }
+    auto slot = &slots[index];
+    if (!slot->used || slot->generation != generation_of(sn)) {
+      return nullptr;
+    }
+    return slot;
+  }
+  size_t insert(const pend_invoke& pend) {
+    size_t index = 0;
+    if (!frees.empty()) {
+      index = frees.back();
+      frees.pop_back();
+    }
+    else {
+      if (slots.empty()) {
+        slots.reserve(256);
+      }
+      index = slots.size();
+      slots.emplace_back();
+    }
+    auto& slot = slots[index];
+    slot.used = true;
+    slot.pend = pend;
+    return sn_of(index);
+  }
+  void erase(pend_slot* slot) {
+    slot->used = false;
+    slot->generation++;
+    frees.push_back(slot - &slots[0]);
+  }
+  /* pushes the table of continuations */
+  void push_conts(lua_State* L) {
+    if (conts == 0) {
+      lua_State* main = lua_local();
+      lua_createtable(main, 256, 0);
+      conts = lua_ref(main, -1);
+      lua_pop(main, 1);
+    }
+    lua_pushref(L, conts);
+  }
+};
+
+/*
+* The request handled by L: a receiver function runs in a coroutine of the
+* pool which keeps its request in the extra space of the thread, so it's
+* still known after the coroutine yields. Other code, e.g. a coroutine created
+* by the receiver function, sees the request being handled synchronously.
+*/
+static inline invoke_context* context_of(lua_State* L) {
+  auto context = *(invoke_context**)lua_getextraspace(L);
+  return context ? context : rpcall_context;
+}
+
+static inline size_t deadline_of(lua_State* L) {
+  auto context = context_of(L);
+  return context ? context->deadline : 0;
 }
 
-static void insert_of_pending(int caller, int rcf, size_t sn, size_t timeout) {
+/* the timeout of a new call is limited by the deadline of current request */
+static inline size_t inherit_timeout(lua_State* L, size_t timeout) {
+  auto deadline = deadline_of(L);
+  if (deadline == 0) {
+    return timeout;
+  }
+  auto now = steady_clock();
+  return deadline > now ? std::min(timeout, deadline - now) : 0;
+}
+
+static inline bool take_of_pending(size_t sn, pend_invoke& pend) {
+  auto& table = pend_table::local();
+  auto slot = table.find(sn);
+  if (!slot) {
+    return false;
+  }
+  pend = slot->pend;
+  table.erase(slot);
+  return true;
+}
+
+static inline int remove_of_pending(size_t sn) {
+  pend_invoke pend;
+  return take_of_pending(sn, pend) ? pend.rcf : 0;
+}
+
+/* returns the sn of the call */
+static size_t insert_of_pending(int caller, int rcf, size_t timeout, size_t batch = 0, int index = 0) {
   pend_invoke pend;
   pend.caller  = caller;
   pend.rcf     = rcf;
   pend.timeout = steady_clock() + timeout;
-  invoke_pendings[sn] = pend;
+  pend.batch   = batch;
+  pend.index   = index;
+  return pend_table::local().insert(pend);
+}
+
+/* the value on the top is the continuation of the call, pops it */
+static void keep_continuation(lua_State* L, size_t sn) {
+  pend_table::local().push_conts(L);
+  lua_insert(L, -2);
+  lua_rawseti(L, -2, (lua_Integer)pend_table::index_of(sn) + 1);
+  lua_pop(L, 1);
+}
+
+/* pushes the continuation of a call taken of the pendings and clears it */
+static int push_continuation(lua_State* L, size_t sn) {
+  auto index = (lua_Integer)pend_table::index_of(sn) + 1;
+  pend_table::local().push_conts(L);
+  int type = lua_rawgeti(L, -1, index);
+  lua_pushnil(L);
+  lua_rawseti(L, -3, index);
+  lua_remove(L, -2);
+  return type;
+}
+
+/* the value on the top is a coroutine waiting without a call, pops it */
+static size_t hold_continuation(lua_State* L) {
+  pend_invoke pend;
+  pend.caller  = lua_service()->id();
+  pend.rcf     = pending_rcf;
+  pend.timeout = (size_t)-1;
+  auto sn = pend_table::local().insert(pend);
+  keep_continuation(L, sn);
+  return sn;
+}
+
+/* pushes the coroutine held by sn and frees the slot, sn is cleared */
+static int release_continuation(lua_State* L, size_t& sn) {
+  int type = LUA_TNIL;
+  if (remove_of_pending(sn)) {
+    type = push_continuation(L, sn);
+  }
+  else {
+    lua_pushnil(L);
+  }
+  sn = 0;
+  return type;
+}
+
+static bool stream_arrived(const std::string& data, size_t sn);
+static void stream_timeout(size_t now);
+
+/* resume the coroutine waiting for results, its errors are logged */
+static void resume_caller(lua_State* coL, lua_State* L, int argc) {
+  int nret  = 0;
+  int state = lua_profile_resume(coL, L, argc, &nret);
+  if (state != LUA_OK && state != LUA_YIELD) {
+    lua_ferror("%s\n", luaL_tolstring(coL, -1, nullptr));
+    return;
+  }
+  lua_pop(coL, nret);
 }
 
 static int watch_handler(lua_State* L) {
@@ -97,29 +414,101 @@ static int watch_handler(lua_State* L) {
   return 0;
 }
 
+/* push the results of a batch, one table {ok, ...} for each call */
+static int push_batch(lua_State* L, const pend_batch& batch) {
+  if (batch.timedout && !batch.partial) {
+    lua_pushboolean(L, 0); /* false */
+    lua_pushliteral(L, "timeout");
+    return 2;
+  }
+  lua_pushboolean(L, batch.timedout ? 0 : 1);
+  int keyed = batch.keys.empty() ? 0 : 1;
+  int count = (int)batch.results.size();
+  lua_createtable(L, keyed ? 0 : count, keyed ? count : 0);
+  for (int i = 0; i < count; i++) {
+    int top = lua_gettop(L);
+    auto& data = batch.results[i];
+    if (data.empty()) {
+      lua_pushboolean(L, 0); /* false */
+      lua_pushliteral(L, "timeout");
+    }
+    else {
+      lua_pushlstring(L, data.c_str(), data.size());
+      lua_unwrap(L);
+    }
+    int argc = lua_gettop(L) - top;
+    lua_createtable(L, argc, 0);
+    lua_insert(L, top + 1);
+    for (int j = argc; j > 0; j--) {
+      lua_rawseti(L, top + 1, j);
+    }
+    lua_rawseti(L, top, keyed ? (lua_Integer)batch.keys[i] : i + 1);
+  }
+  return 2;
+}
+
+/* resume the coroutine waiting for a batch */
+static void resume_batch(pend_batch& batch) {
+  lua_State* L = lua_local();
+  lua_auto_revert revert(L);
+
+  int typeof_ref = release_continuation(L, batch.hold);
+  if (typeof_ref != LUA_TTHREAD) {
+    return;
+  }
+  auto coL = lua_tothread(L, -1);
+  if (lua_status(coL) != LUA_YIELD) {
+    return;
+  }
+  int argc = push_batch(coL, batch);
+  resume_caller(coL, L, argc);
+}
+
+/* a call of the batch is finished, empty data if timeout */
+static void batch_complete(const pend_invoke& pend, const std::string& data) {
+  auto iter = batch_pendings.find(pend.batch);
+  if (iter == batch_pendings.end()) {
+    return;
+  }
+  auto& batch = iter->second;
+  batch.results[pend.index] = data;
+  if (data.empty()) {
+    batch.timedout++;
+  }
+  if (--batch.remaining > 0) {
+    return;
+  }
+  /* the caller is blocked in submit */
+  if (batch.rcf < 0) {
+    lua_service()->wakeup();
+    return;
+  }
+  pend_batch finished(std::move(batch));
+  batch_pendings.erase(iter);
+  resume_batch(finished);
+}
+
 static void cancel_invoke(int rcf, size_t sn) {
-  rcf = remove_of_pending(sn);
-  if (rcf == 0) {
+  pend_invoke pend;
+  if (!take_of_pending(sn, pend)) {
+    return;
+  }
+  if (pend.batch) {
+    batch_complete(pend, std::string());
     return;
   }
   auto L = lua_local();
   lua_auto_revert revert(L);
-  lua_auto_unref  unref_rcf(L, rcf);
 
-  int typeof_ref = lua_pushref(L, rcf);
+  int typeof_ref = push_continuation(L, sn);
   if (typeof_ref == LUA_TTHREAD) {
     auto coL = lua_tothread(L, -1);
     if (lua_status(coL) != LUA_YIELD) {
       return;
     }
-    int nret = 0;
     lua_pushboolean(coL, 0); /* false */
     lua_pushliteral(coL, "timeout");
-    int state = lua_resume(coL, L, 2, &nret);
-    if (nret > 0) {
-      lua_xmove(coL, L, nret);
-      lua_pop(L, nret);
-    }
+    resume_caller(coL, L, 2);
     return;
   }
   if (typeof_ref == LUA_TFUNCTION) {
@@ -132,10 +521,18 @@ static void cancel_invoke(int rcf, size_t sn) {
 }
 
 static void cancel_block(const std::string& data, int rcf, size_t sn) {
-  rcf = remove_of_pending(sn);
-  if (rcf == 0) {
+  if (stream_arrived(data, sn)) {
+    return;
+  }
+  pend_invoke pend;
+  if (!take_of_pending(sn, pend)) {
+    return;
+  }
+  if (pend.batch) {
+    batch_complete(pend, data);
     return;
   }
+  rcf = pend.rcf;
   auto service = find_service(std::abs(rcf));
   if (!service) {
     return;
@@ -149,28 +546,29 @@ static void cancel_block(const std::string& data, int rcf, size_t sn) {
 
 /* calling the caller callback function */
 static void back_to_local(const std::string& data, int rcf, size_t sn) {
-  rcf = remove_of_pending(sn);
-  if (rcf == 0) {
+  if (stream_arrived(data, sn)) {
+    return;
+  }
+  pend_invoke pend;
+  if (!take_of_pending(sn, pend)) {
+    return;
+  }
+  if (pend.batch) {
+    batch_complete(pend, data);
     return;
   }
   lua_State* L = lua_local();
   lua_auto_revert revert(L);
-  lua_auto_unref  unref_rcf(L, rcf);
 
-  int typeof_ref = lua_pushref(L, rcf);
+  int typeof_ref = push_continuation(L, sn);
   if (typeof_ref == LUA_TTHREAD) {
     auto coL = lua_tothread(L, -1);
     if (lua_status(coL) != LUA_YIELD) {
       return;
     }
     lua_pushlstring(coL, data.c_str(), data.size());
-    int argc  = lua_unwrap(coL);
-    int nret  = 0;
-    int state = lua_resume(coL, L, argc, &nret);
-    if (nret > 0) {
-      lua_xmove(coL, L, nret);
-      lua_pop(L, nret);
-    }
+    int argc = lua_unwrap(coL);
+    resume_caller(coL, L, argc);
     return;
   }
   if (typeof_ref == LUA_TFUNCTION) {
@@ -183,34 +581,28 @@ static void back_to_local(const std::string& data, int rcf, size_t sn) {
 }
 
 static int check_timeout(size_t now) {
-  auto iter = invoke_pendings.begin();
-  for (; iter != invoke_pendings.end(); ++iter) {
-    auto timeout = iter->second.timeout;
-    if (now < timeout) {
+  auto& table = pend_table::local();
+  for (size_t i = 0; i < table.slots.size(); i++) {
+    auto& slot = table.slots[i];
+    if (!slot.used || now < slot.pend.timeout) {
       continue;
     }
-    auto rcf = iter->second.rcf;
+    auto rcf = slot.pend.rcf;
     if (rcf < 0) {
       continue;
     }
-    auto caller = iter->second.caller;
+    auto caller = slot.pend.caller;
     auto service = find_service(caller);
     if (service) {
-      service->post(_bind(cancel_invoke, rcf, iter->first));
+      service->post(_bind(cancel_invoke, rcf, table.sn_of(i)), stats_response);
     }
   }
+  stream_timeout(now);
   return LUA_OK;
 }
 
 static int check_timeout(lua_State* L, size_t expires) {
-  static thread_local size_t _lastgc = rand();
   static thread_local steady_timer _timer(*lua_service());
-  /* GC every one minute */
-  size_t gc_expires = is_debugging(L) ? expires : 60000;
-  if ((_lastgc += expires) >= gc_expires) {
-    _lastgc = 0;
-    lua_gc(L, LUA_GCCOLLECT);
-  }
   /* check timeout for rpcall */
   check_timeout(steady_clock());
   _timer.expires_after(std::chrono::milliseconds(expires));
@@ -245,7 +637,7 @@ static void forword(const std::string& data, size_t caller, int rcf, size_t sn)
         if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
           lua_ferror("%s\n", lua_tostring(L, -1));
         }
-      }
+      }, stats_response
     );
   }
 }
@@ -255,7 +647,33 @@ static void forword(const std::string& data, size_t caller, int rcf, size_t sn)
 ** who: receiver
 ** rcf: callback function reference for the caller
 */
-static int forword(const topic_type& topic, const char* data, size_t size, size_t mask, size_t who, size_t caller, int rcf, size_t sn) {
+static void push_deliver(lua_State* L, const topic_type& topic, const std::string& argv, size_t mask, size_t who, size_t caller, int rcf, size_t sn, size_t deadline) {
+  lua_createtable(L, 0, 9);
+  lua_pushliteral(L, evr_deliver);
+  lua_setfield(L, -2, "what");
+  lua_pushlstring(L, topic.c_str(), topic.size());
+  lua_setfield(L, -2, "name");
+  lua_pushlstring(L, argv.c_str(), argv.size());
+  lua_setfield(L, -2, "argv");
+  lua_pushinteger(L, (lua_Integer)mask);
+  lua_setfield(L, -2, "mask");
+  lua_pushinteger(L, (lua_Integer)who);
+  lua_setfield(L, -2, "who");
+  lua_pushinteger(L, (lua_Integer)caller);
+  lua_setfield(L, -2, "caller");
+  lua_pushinteger(L, (lua_Integer)rcf);
+  lua_setfield(L, -2, "rcf");
+  lua_pushinteger(L, (lua_Integer)sn);
+  lua_setfield(L, -2, "sn");
+  if (deadline > 0) {
+    /* clocks of the nodes are different */
+    auto now = steady_clock();
+    lua_pushinteger(L, (lua_Integer)(deadline > now ? deadline - now : 0));
+    lua_setfield(L, -2, "ttl");
+  }
+}
+
+static int forword(const topic_type& topic, const char* data, size_t size, size_t mask, size_t who, size_t caller, int rcf, size_t sn, size_t deadline) {
   std::string argv;
   if (data && size) {
     argv.assign(data, size);
@@ -267,27 +685,39 @@ static int forword(const topic_type& topic, const char* data, size_t size, size_
         lua_State* L = lua_local();
         lua_auto_revert revert(L);
         lua_pushcfunction(L, watch_handler);
-        lua_createtable(L, 0, 8);
-        lua_pushliteral(L, evr_deliver);
+        push_deliver(L, topic, argv, mask, who, caller, rcf, sn, deadline);
+        if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+          lua_ferror("%s\n", lua_tostring(L, -1));
+        }
+      }, stats_deliver
+    );
+  }
+  return service ? 1 : 0;
+}
+
+/* send a group of deliver requests */
+static int forword(const std::vector<batch_item>& list, size_t caller, int rcf) {
+  auto service = find_service(watcher_ios);
+  if (service) {
+    service->post(
+      [=]() {
+        lua_State* L = lua_local();
+        lua_auto_revert revert(L);
+        lua_pushcfunction(L, watch_handler);
+        lua_createtable(L, 0, 2);
+        lua_pushliteral(L, evr_batch);
         lua_setfield(L, -2, "what");
-        lua_pushlstring(L, topic.c_str(), topic.size());
-        lua_setfield(L, -2, "name");
-        lua_pushlstring(L, argv.c_str(), argv.size());
-        lua_setfield(L, -2, "argv");
-        lua_pushinteger(L, (lua_Integer)mask);
-        lua_setfield(L, -2, "mask");
-        lua_pushinteger(L, (lua_Integer)who);
-        lua_setfield(L, -2, "who");
-        lua_pushinteger(L, (lua_Integer)caller);
-        lua_setfield(L, -2, "caller");
-        lua_pushinteger(L, (lua_Integer)rcf);
-        lua_setfield(L, -2, "rcf");
-        lua_pushinteger(L, (lua_Integer)sn);
-        lua_setfield(L, -2, "sn");
+        lua_createtable(L, (int)list.size(), 0);
+        for (size_t i = 0; i < list.size(); i++) {
+          auto& item = list[i];
+          push_deliver(L, item.topic, item.argv, item.mask, item.who, caller, rcf, item.sn, item.deadline);
+          lua_rawseti(L, -2, (lua_Integer)i + 1);
+        }
+        lua_setfield(L, -2, "list");
         if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
           lua_ferror("%s\n", lua_tostring(L, -1));
         }
-      }
+      }, stats_deliver
     );
   }
   return service ? 1 : 0;
@@ -316,7 +746,7 @@ static int dispatch(const topic_type& topic, const std::string& osname, const st
         if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
           lua_ferror("%s\n", lua_tostring(L, -1));
         }
-      }
+      }, stats_other
     );
   }
   return service ? 1 : 0;
@@ -337,6 +767,119 @@ static int response(const char* data, size_t size, size_t caller, int rcf, size_
   return 1;
 }
 
+static void response_error(const char* what, size_t caller, int rcf, size_t sn) {
+  lua_State* L = lua_local();
+  lua_auto_revert revert(L);
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, what);
+  lua_wrap(L, 2);
+  size_t nsize;
+  const char* result = luaL_checklstring(L, -1, &nsize);
+  response(result, nsize, caller, rcf, sn);
+}
+
+/* the mailbox of a local service, nullptr if it has never been limited */
+static inline mailbox_holder* mailbox_of(size_t who) {
+  return is_local(who) ? mailboxes[who].load(std::memory_order_acquire) : nullptr;
+}
+
+static mailbox_holder* mailbox_create(size_t who) {
+  auto holder = mailbox_of(who);
+  if (!holder) {
+    unique_mutex_lock(_qmutex);
+    holder = mailboxes[who].load(std::memory_order_relaxed);
+    if (!holder) {
+      holder = new mailbox_holder();
+      mailboxes[who].store(holder, std::memory_order_release);
+    }
+  }
+  return holder;
+}
+
+/* take a ticket of the mailbox, must be called with holder->mutex held */
+static int admit_of_mailbox(mailbox_holder* holder, size_t& ticket) {
+  auto& mailbox = holder->mailbox;
+  if (mailbox.limit && mailbox.depth() >= mailbox.limit) {
+    if (mailbox.policy == policy_block) {
+      mailbox.blocked++;
+      return policy_block;
+    }
+    if (mailbox.policy != policy_shed) {
+      mailbox.rejected++;
+      return mailbox.policy;
+    }
+    /* the oldest one will be skipped */
+    mailbox.watermark = std::max(mailbox.head, mailbox.watermark) + 1;
+    mailbox.shed++;
+  }
+  ticket = mailbox.next++;
+  mailbox.posted++;
+  mailbox.max_depth = std::max(mailbox.max_depth, mailbox.depth());
+  return policy_none;
+}
+
+typedef std::vector<
+  std::pair<parked_delivery, size_t>
+> unparked_type; /* parked deliveries and their tickets */
+
+/* take the parked deliveries admitted, must be called with holder->mutex held */
+static void unpark_of_mailbox(mailbox_holder* holder, unparked_type& admitted, std::vector<parked_delivery>& expired) {
+  auto now = steady_clock();
+  auto& mailbox = holder->mailbox;
+  while (!holder->parked.empty()) {
+    auto& delivery = holder->parked.front();
+    if (delivery.expires <= now) {
+      expired.push_back(std::move(delivery));
+      holder->parked.pop_front();
+      continue;
+    }
+    if (mailbox.limit && mailbox.depth() >= mailbox.limit) {
+      break;
+    }
+    size_t ticket = mailbox.next++;
+    mailbox.posted++;
+    mailbox.max_depth = std::max(mailbox.max_depth, mailbox.depth());
+    admitted.emplace_back(std::move(delivery), ticket);
+    holder->parked.pop_front();
+  }
+}
+
+static void post_of_mailbox(size_t who, mailbox_holder* holder, size_t ticket, const parked_delivery& delivery);
+
+/* post the deliveries taken from the parked, without the lock */
+static void post_of_parked(size_t who, mailbox_holder* holder, const unparked_type& admitted, const std::vector<parked_delivery>& expired) {
+  for (auto& delivery : expired) {
+    response_error("busy", delivery.caller, delivery.rcf, delivery.sn);
+  }
+  for (auto& item : admitted) {
+    post_of_mailbox(who, holder, item.second, item.first);
+  }
+}
+
+/* the delivery is leaving the mailbox, false if it was shed */
+static bool leave_of_mailbox(size_t who, mailbox_holder* holder, size_t ticket, size_t posted) {
+  bool executed = true;
+  unparked_type admitted;
+  std::vector<parked_delivery> expired;
+  {
+    unique_mutex_lock(holder->mutex);
+    auto& mailbox = holder->mailbox;
+    mailbox.head = std::max(mailbox.head, ticket + 1);
+    if (ticket < mailbox.watermark) {
+      executed = false;
+    }
+    else {
+      auto wait = steady_clock() - posted;
+      mailbox.waited += wait;
+      mailbox.executed++;
+      mailbox.max_wait = std::max(mailbox.max_wait, wait);
+    }
+    unpark_of_mailbox(holder, admitted, expired);
+  }
+  post_of_parked(who, holder, admitted, expired);
+  return executed;
+}
+
 static int responser(lua_State* L) {
   lua_pushboolean(L, 1);
   lua_insert(L, 1);
@@ -350,99 +893,852 @@ static int responser(lua_State* L) {
   return 0;
 }
 
-/* calling the receiver function */
+/* the receiver function returned, stack: context, results or error */
+static int invoke_done(lua_State* L, int status, lua_KContext ctx) {
+  auto context = (invoke_context*)lua_touserdata(L, 1);
+  *(invoke_context**)lua_getextraspace(L) = nullptr;
+
+  bool need_response = false;
+  int callok = lua_success(status) ? LUA_OK : status;
+  if (callok != LUA_OK) {
+    lua_ferror("%s\n", lua_tostring(L, -1));
+  }
+  if (context->handler > 0) {
+    need_response = true;
+    lua_unref(L, context->handler);
+    context->handler = 0;
+  }
+  /* call success and need't response */
+  if (callok == LUA_OK && !need_response) {
+    /* the responser was taken */
+    return 0;
+  }
+  lua_pushboolean(L, callok == LUA_OK ? 1 : 0);
+  int count = lua_gettop(L) - 1;
+  if (count > 1) {
+    lua_rotate(L, -count, 1);
+  }
+  lua_wrap(L, count);
+  size_t nsize;
+  const char* result = luaL_checklstring(L, -1, &nsize);
+  response(result, nsize, context->caller, context->rcf, context->sn);
+  return 0;
+}
+
+/* the body of the coroutine, stack: context, function, arguments... */
+static int invoke_run(lua_State* L) {
+  auto context = (invoke_context*)lua_touserdata(L, 1);
+  *(invoke_context**)lua_getextraspace(L) = context;
+  lua_pcall_k(L, lua_gettop(L) - 2, LUA_MULTRET, 0, invoke_done);
+  return invoke_done(L, LUA_OK, 0);
+}
+
+/*
+* calling the receiver function, in a coroutine of the pool: a blocking
+* rpcall of the function yields instead of running the loop on this stack,
+* its caller is resumed by the response, other requests go on meanwhile
+*/
+static void invoke_local(int rcb, const std::string& argv, size_t caller, int rcf, size_t sn, size_t deadline) {
+  /* the caller has given up */
+  if (deadline > 0 && steady_clock() >= deadline) {
+    response_error("deadline exceeded", caller, rcf, sn);
+    return;
+  }
+  lua_State* L = lua_local();
+  lua_auto_revert revert(L);
+  lua_pushcfunction(L, invoke_run);
+  auto context = (invoke_context*)lua_newuserdata(L, sizeof(invoke_context));
+  context->caller   = caller;
+  context->deadline = deadline;
+  context->sn       = sn;
+  context->rcf      = rcf;
+  context->handler  = 0;
+  int type = lua_pushref(L, rcb);
+  if (type != LUA_TFUNCTION) {
+    response_error("function not found", caller, rcf, sn);
+    return;
+  }
+  if (!argv.empty()) {
+    lua_pushlstring(L, argv.c_str(), argv.size());
+    lazy_handlers.count(rcb) ? lua_unwrap_view(L) : lua_unwrap(L);
+  }
+  if (rcf != 0) {
+    lua_pushinteger(L, caller);
+    lua_pushinteger(L, rcf);
+    lua_pushinteger(L, sn);
+    lua_pushcclosure(L, responser, 3);
+    context->handler = lua_ref(L, -1);
+    lua_pop(L, 1);
+  }
+  auto previous = rpcall_context;
+  rpcall_context = context;
+  lua_go(L, lua_gettop(L) - revert.top() - 1);
+  rpcall_context = previous;
+}
+
+/* post the delivery admitted with a ticket to the receiver */
+static void post_of_mailbox(size_t who, mailbox_holder* holder, size_t ticket, const parked_delivery& delivery) {
+  auto service = find_service((int)who);
+  if (!service) {
+    return;
+  }
+  auto posted = steady_clock();
+  service->post(
+    [=]() {
+      if (leave_of_mailbox(who, holder, ticket, posted)) {
+        invoke_local(delivery.rcb, delivery.argv, delivery.caller, delivery.rcf, delivery.sn, delivery.deadline);
+      }
+      else {
+        response_error("busy", delivery.caller, delivery.rcf, delivery.sn);
+      }
+    }, stats_deliver
+  );
+}
+
 /*
 ** who: receiver
 ** rcf: callback function reference for the caller
 */
-static int dispatch(const topic_type& topic, int rcb, const char* data, size_t size, size_t mask, size_t who, size_t caller, int rcf, size_t sn) {
+static int dispatch(const topic_type& topic, int rcb, const char* data, size_t size, size_t mask, size_t who, size_t caller, int rcf, size_t sn, size_t deadline) {
   /* who is receiver */
   if (!is_local(who)) {
-    return forword(topic, data, size, mask, who, caller, rcf, sn);
+    return forword(topic, data, size, mask, who, caller, rcf, sn, deadline);
+  }
+  std::string argv;
+  if (data && size) {
+    argv.assign(data, size);
+  }
+  auto service = find_service((int)who);
+  if (!service) {
+    return 0;
+  }
+  auto holder = mailbox_of(who);
+  if (!holder || !holder->limited.load(std::memory_order_relaxed)) {
+    service->post(
+      [=]() {
+        invoke_local(rcb, argv, caller, rcf, sn, deadline);
+      }, stats_deliver
+    );
+    return 1;
+  }
+  /*
+  * only a local caller waiting for the response by a yield (or not waiting)
+  * can be parked, the blocked rpcall would have to run the loop meanwhile
+  */
+  bool blocking = (rcf < 0 && pend_table::is_pending(sn));
+  bool parkable = (lua_service()->id() == (int)caller && !blocking);
+
+  size_t ticket = 0;
+  int policy = policy_none;
+  parked_delivery delivery{ rcb, std::move(argv), caller, rcf, sn, deadline, 0 };
+  {
+    unique_mutex_lock(holder->mutex);
+    policy = admit_of_mailbox(holder, ticket);
+    if (policy == policy_block && parkable) {
+      delivery.expires = deadline > 0 ? deadline : steady_clock() + max_expires;
+      holder->parked.push_back(std::move(delivery));
+      return 1;
+    }
+  }
+  if (policy != policy_none) {
+    response_error("busy", caller, rcf, sn);
+    return 1;
+  }
+  post_of_mailbox(who, holder, ticket, delivery);
+  return 1;
+}
+
+/* select the receivers of topic, must be called with _mutex held */
+static void select_receivers(const topic_type& topic, size_t mask, size_t who, size_t caller, std::vector<route_type>& routes) {
+  node_type node;
+  node.who = who;
+
+  auto iter = rpcall_handlers.find(topic);
+  if (iter == rpcall_handlers.end()) {
+    return;
+  }
+  rpcall_set_type& val = iter->second;
+  if (val.empty()) {
+    return;
+  }
+  if (!is_local(caller) && !is_local(who)) {
+    return;
+  }
+  size_t receiver = who;
+  /* if the mask is set */
+  if (mask > 0) {
+    std::vector<node_type> select;
+    for (auto find = val.begin(); find != val.end(); ++find) {
+      /* can't call by remote */
+      if (find->opt == 0 && !is_local(caller)) {
+        continue;
+      }
+      if (is_local(caller) || is_local(who)) {
+        select.push_back(*find);
+      }
+    }
+    if (!select.empty()) {
+      auto i = mask % select.size();
+      node.who = receiver = select[i].who;
+    }
+  }
+  /* if there is a receiver */
+  if (receiver > 0) {
+    auto find = val.find(node);
+    if (find == val.end()) {
+      return;
+    }
+    if (!is_local(caller)) {
+      /* can't call by remote */
+      if (find->opt == 0) {
+        return;
+      }
+    }
+    routes.push_back({ receiver, find->rcb });
+    return;
+  }
+  /* dispatch to all receivers */
+  for (auto find = val.begin(); find != val.end(); ++find) {
+    routes.push_back({ find->who, find->rcb });
+  }
+}
+
+/* send the calls of a batch, one post for each receiver */
+static int submit_batch(lua_State* L, const std::vector<batch_call>& calls, size_t timeout, int partial, bool keyed) {
+  timeout = inherit_timeout(L, timeout);
+  if (timeout == 0) {
+    lua_pushboolean(L, 0); /* false */
+    lua_pushliteral(L, "deadline exceeded");
+    return 2;
+  }
+  auto deadline = steady_clock() + timeout;
+  auto service = lua_service();
+  int caller = service->id();
+  auto bsn = next_sn();
+
+  pend_batch batch;
+  batch.rcf = 0 - caller;
+  batch.partial = partial;
+  batch.remaining = 0;
+
+  std::vector<batch_item> items;
+  {
+    unique_mutex_lock(_mutex);
+    for (auto& call : calls) {
+      std::vector<route_type> routes;
+      select_receivers(call.topic, call.mask, call.receiver, caller, routes);
+      if (routes.empty()) {
+        routes.push_back({ 0, 0 }); /* not found */
+      }
+      for (auto& route : routes) {
+        items.push_back({ call.topic, call.argv, call.mask, route.who, route.rcb, 0, deadline });
+      }
+    }
+  }
+  if (keyed && items.size() == 1 && items[0].who == 0) {
+    lua_pushboolean(L, 0); /* false */
+    lua_pushfstring(L, "%s not found", items[0].topic.c_str());
+    return 2;
+  }
+  batch.results.resize(items.size());
+  if (keyed) {
+    for (auto& item : items) {
+      batch.keys.push_back(item.who);
+    }
+  }
+  /* if invoke by coroutine */
+  if (lua_isyieldable(L)) {
+    lua_pushthread(L);
+    batch.hold = hold_continuation(L);
+    batch.rcf  = pending_rcf;
+  }
+  std::vector<batch_item> remote;
+  std::map<size_t, std::vector<batch_item>> local;
+  for (size_t i = 0; i < items.size(); i++) {
+    auto& item = items[i];
+    bool found = (item.who > 0);
+    if (found) {
+      found = find_service(is_local(item.who) ? (int)item.who : watcher_ios) != nullptr;
+    }
+    if (!found) {
+      lua_pushboolean(L, 0); /* false */
+      lua_pushfstring(L, "%s not found", item.topic.c_str());
+      lua_wrap(L, 2);
+      size_t size;
+      const char* data = luaL_checklstring(L, -1, &size);
+      batch.results[i].assign(data, size);
+      lua_pop(L, 1);
+      continue;
+    }
+    item.sn = insert_of_pending(caller, batch.rcf, timeout, bsn, (int)i);
+    batch.remaining++;
+    if (is_local(item.who)) {
+      local[item.who].push_back(item);
+    }
+    else {
+      remote.push_back(item);
+    }
+  }
+  if (batch.remaining == 0) {
+    if (batch.hold) {
+      release_continuation(L, batch.hold);
+      lua_pop(L, 1);
+    }
+    return push_batch(L, batch);
+  }
+  int rcf = batch.rcf;
+  batch_pendings[bsn] = std::move(batch);
+
+  for (auto iter = local.begin(); iter != local.end(); ++iter) {
+    auto who = iter->first;
+    auto receiver = find_service((int)who);
+    if (!receiver) {
+      continue;
+    }
+    auto holder = mailbox_of(who);
+    if (!holder || !holder->limited.load(std::memory_order_relaxed)) {
+      auto list = std::move(iter->second);
+      receiver->post(
+        [list, caller, rcf]() {
+          for (auto& item : list) {
+            invoke_local(item.rcb, item.argv, caller, rcf, item.sn, item.deadline);
+          }
+        }, stats_deliver
+      );
+      continue;
+    }
+    std::vector<batch_item> list;
+    std::vector<size_t> tickets;
+    std::vector<size_t> rejected;
+    {
+      unique_mutex_lock(holder->mutex);
+      for (auto& item : iter->second) {
+        size_t ticket = 0;
+        /* the batch is never parked */
+        if (admit_of_mailbox(holder, ticket) != policy_none) {
+          rejected.push_back(item.sn);
+          continue;
+        }
+        list.push_back(item);
+        tickets.push_back(ticket);
+      }
+    }
+    for (auto sn : rejected) {
+      response_error("busy", caller, rcf, sn);
+    }
+    if (list.empty()) {
+      continue;
+    }
+    auto posted = steady_clock();
+    receiver->post(
+      [list, tickets, who, holder, posted, caller, rcf]() {
+        for (size_t i = 0; i < list.size(); i++) {
+          auto& item = list[i];
+          if (leave_of_mailbox(who, holder, tickets[i], posted)) {
+            invoke_local(item.rcb, item.argv, caller, rcf, item.sn, item.deadline);
+          }
+          else {
+            response_error("busy", caller, rcf, item.sn);
+          }
+        }
+      }, stats_deliver
+    );
+  }
+  if (!remote.empty()) {
+    forword(remote, caller, rcf);
+  }
+  /* run in coroutine */
+  if (rcf > 0) {
+    lua_settop(L, 0);
+    return lua_yield(L, 0);
+  }
+  /* call will be blocked */
+  auto begin = steady_clock();
+  while (!service->stopped()) {
+    if (batch_pendings[bsn].remaining == 0) {
+      break;
+    }
+    auto elapsed = steady_clock() - begin;
+    if (elapsed >= timeout) {
+      break;
+    }
+    service->wait_for(timeout - elapsed);
+  }
+  pend_batch finished(std::move(batch_pendings[bsn]));
+  batch_pendings.erase(bsn);
+
+  /* the calls not returned are timeout */
+  for (auto& item : items) {
+    if (remove_of_pending(item.sn)) {
+      finished.timedout++;
+    }
+  }
+  if (service->stopped()) {
+    lua_pushboolean(L, 0); /* false */
+    lua_pushliteral(L, "cancel");
+    return 2;
+  }
+  return push_batch(L, finished);
+}
+
+/* resume the coroutine or wakeup the thread waiting for a stream */
+static void stream_wakeup(size_t& hold, bool blocked) {
+  if (blocked) {
+    lua_service()->wakeup();
+    return;
+  }
+  if (hold == 0) {
+    return;
+  }
+  lua_State* L = lua_local();
+  lua_auto_revert revert(L);
+  if (release_continuation(L, hold) != LUA_TTHREAD) {
+    return;
+  }
+  auto coL = lua_tothread(L, -1);
+  if (lua_status(coL) != LUA_YIELD) {
+    return;
+  }
+  resume_caller(coL, L, 0);
+}
+
+/* send a control message to the writer */
+static void stream_control(const stream_reader& reader, const std::string& data) {
+  response(data.c_str(), data.size(), reader.who, stream_rcf, reader.ssn);
+}
+
+/*
+** messages of a stream, the first byte is the type
+** o: opened by the writer, followed by sn of the writer
+** c: a chunk, followed by the wrapped values
+** e: end of the stream, followed by the error if any
+** k: credits from the reader
+** x: cancelled by the reader
+** otherwise it's a normal response of rpcall
+*/
+static bool stream_arrived(const std::string& data, size_t sn) {
+  auto witer = stream_writers.find(sn);
+  if (witer != stream_writers.end()) {
+    auto& writer = witer->second;
+    if (!data.empty() && data[0] == 'k') {
+      writer.credits += std::atoi(data.c_str() + 1);
+    }
+    else if (writer.error.empty()) {
+      writer.error = "cancel";
+    }
+    stream_wakeup(writer.hold, writer.blocked);
+    return true;
+  }
+  auto iter = stream_readers.find(sn);
+  if (iter == stream_readers.end()) {
+    return false;
+  }
+  auto& reader = iter->second;
+  char what = data.empty() ? 0 : data[0];
+  if (what == 'o') {
+    reader.ssn = (size_t)std::strtoull(data.c_str() + 1, nullptr, 10);
+    if (reader.closed) {
+      stream_control(reader, "x");
+      stream_readers.erase(iter);
+    }
+    return true;
+  }
+  if (reader.closed) {
+    if (what != 'c') {
+      stream_readers.erase(iter);
+    }
+    return true;
+  }
+  if (reader.finished) {
+    return true;
+  }
+  switch (what) {
+  case 'c':
+    reader.chunks.push_back(data.substr(1));
+    break;
+  case 'e':
+    reader.finished = true;
+    reader.error = data.substr(1);
+    break;
+  case '\xc3': /* true, the callee didn't stream */
+    reader.finished = true;
+    reader.chunks.push_back(data.substr(1));
+    break;
+  default: {
+    reader.finished = true;
+    lua_State* L = lua_local();
+    lua_auto_revert revert(L);
+    lua_pushlstring(L, data.c_str(), data.size());
+    int argc = lua_unwrap(L);
+    reader.error = (argc > 1 && lua_isstring(L, -argc + 1)) ? lua_tostring(L, -argc + 1) : "error";
+    break;
+  }
+  }
+  stream_wakeup(reader.hold, reader.blocked);
+  return true;
+}
+
+static void cancel_stream(size_t sn) {
+  auto witer = stream_writers.find(sn);
+  if (witer != stream_writers.end()) {
+    auto& writer = witer->second;
+    if (writer.hold && writer.credits == 0 && writer.error.empty()) {
+      writer.error = "timeout";
+      stream_wakeup(writer.hold, false);
+    }
+    return;
+  }
+  auto iter = stream_readers.find(sn);
+  if (iter == stream_readers.end()) {
+    return;
+  }
+  auto& reader = iter->second;
+  if (reader.closed) {
+    stream_readers.erase(iter);
+    return;
+  }
+  if (reader.hold && reader.chunks.empty() && !reader.finished) {
+    reader.finished = true;
+    reader.error = "timeout";
+    stream_wakeup(reader.hold, false);
+  }
+}
+
+static void stream_timeout(size_t now) {
+  auto service = lua_service();
+  for (auto iter = stream_readers.begin(); iter != stream_readers.end(); ++iter) {
+    auto& reader = iter->second;
+    if ((reader.hold || reader.closed) && now >= reader.expires) {
+      service->post(_bind(cancel_stream, iter->first), stats_response);
+    }
+  }
+  for (auto iter = stream_writers.begin(); iter != stream_writers.end(); ++iter) {
+    auto& writer = iter->second;
+    if (writer.hold && now >= writer.expires) {
+      service->post(_bind(cancel_stream, iter->first), stats_response);
+    }
+  }
+}
+
+/* the caller side of a stream */
+struct lua_newreader final {
+  inline static const char* name() {
+    return "skynet rpcall reader";
+  }
+  inline static lua_newreader* __this(
+    lua_State* L, int index = 1) {
+    return checkudata<lua_newreader>(L, index, name());
+  }
+  static int __gc(lua_State* L) {
+    auto self = __this(L);
+#ifdef LUA_DEBUG
+    lua_ftrace("DEBUG: %s will gc\n", name());
+#endif
+    close(L);
+    self->~lua_newreader();
+    return 0;
+  }
+  static int close(lua_State* L) {
+    auto self = __this(L);
+    auto iter = stream_readers.find(self->sn);
+    if (iter == stream_readers.end()) {
+      return 0;
+    }
+    auto& reader = iter->second;
+    if (reader.finished) {
+      stream_readers.erase(iter);
+    }
+    else if (reader.ssn) {
+      stream_control(reader, "x");
+      stream_readers.erase(iter);
+    }
+    else {
+      /* wait for the writer to be opened */
+      reader.closed  = true;
+      reader.expires = steady_clock() + reader.timeout;
+      reader.chunks.clear();
+    }
+    return 0;
+  }
+  static int fetch(lua_State* L, int iterate) {
+    auto self = __this(L);
+    while (true) {
+      auto iter = stream_readers.find(self->sn);
+      if (iter == stream_readers.end()) {
+        lua_pushnil(L);
+        return 1;
+      }
+      auto& reader = iter->second;
+      if (!reader.chunks.empty()) {
+        if (!iterate) {
+          lua_pushboolean(L, 1);
+        }
+        int argc = iterate ? 0 : 1;
+        auto& chunk = reader.chunks.front();
+        if (!chunk.empty()) {
+          lua_pushlstring(L, chunk.c_str(), chunk.size());
+          argc += lua_unwrap(L);
+        }
+        reader.chunks.pop_front();
+        if (++reader.consumed >= max_window / 2 && reader.ssn) {
+          stream_control(reader, "k" + std::to_string(reader.consumed));
+          reader.consumed = 0;
+        }
+        return argc;
+      }
+      if (reader.finished) {
+        if (reader.error.empty()) {
+          lua_pushnil(L);
+          return 1;
+        }
+        if (iterate) {
+          lua_pushlstring(L, reader.error.c_str(), reader.error.size());
+          return lua_error(L);
+        }
+        lua_pushboolean(L, 0);
+        lua_pushlstring(L, reader.error.c_str(), reader.error.size());
+        return 2;
+      }
+      reader.expires = steady_clock() + reader.timeout;
+      /* if invoke by coroutine */
+      if (lua_isyieldable(L)) {
+        lua_pushthread(L);
+        reader.hold = hold_continuation(L);
+        return lua_yieldk(L, 0, iterate, fetch_k);
+      }
+      /* read will be blocked */
+      auto service = lua_service();
+      reader.blocked = true;
+      bool result = service->wait_for(reader.timeout);
+      iter = stream_readers.find(self->sn);
+      if (iter != stream_readers.end()) {
+        auto& later = iter->second;
+        later.blocked = false;
+        if (!result && later.chunks.empty() && !later.finished) {
+          later.finished = true;
+          later.error = service->stopped() ? "cancel" : "timeout";
+        }
+      }
+    }
+  }
+  static int fetch_k(lua_State* L, int status, lua_KContext ctx) {
+    return fetch(L, (int)ctx);
+  }
+  static int read(lua_State* L) {
+    lua_settop(L, 1);
+    return fetch(L, 0);
+  }
+  static int __call(lua_State* L) {
+    lua_settop(L, 1);
+    return fetch(L, 1);
+  }
+  static void init_metatable(lua_State* L) {
+    const luaL_Reg methods[] = {
+      { "__gc",     __gc      },
+      { "__close",  close     },
+      { "__call",   __call    },
+      { "read",     read      },
+      { "close",    close     },
+      { NULL,       NULL      }
+    };
+    newmetatable(L, name(), methods);
+    lua_pop(L, 1);
+  }
+  /* returns reader, nil, nil, reader for generic for */
+  static int create(lua_State* L, const char* fname, const char* data, size_t size, size_t mask, size_t who, size_t timeout) {
+    topic_type topic(fname);
+    std::vector<route_type> routes;
+    {
+      unique_mutex_lock(_mutex);
+      select_receivers(topic, mask, who, lua_service()->id(), routes);
+    }
+    auto sn = next_sn();
+    auto& reader = stream_readers[sn];
+    reader.timeout = timeout;
+
+    int count = 0;
+    int caller = lua_service()->id();
+    if (!routes.empty()) {
+      reader.who = routes[0].who;
+      count = dispatch(topic, routes[0].rcb, data, size, mask, reader.who, caller, 0 - caller, sn, deadline_of(L));
+    }
+    if (count == 0) {
+      reader.finished = true;
+      reader.error = topic + " not found";
+    }
+    auto self = newuserdata<lua_newreader>(L, name());
+    self->sn = sn;
+    lua_pushnil(L);
+    lua_pushnil(L);
+    lua_pushvalue(L, -3);
+    return 4;
+  }
+  size_t sn;
+};
+
+/* the callee side of a stream */
+struct lua_newwriter final {
+  inline static const char* name() {
+    return "skynet rpcall writer";
   }
-  std::string argv;
-  if (data && size) {
-    argv.assign(data, size);
+  inline static lua_newwriter* __this(
+    lua_State* L, int index = 1) {
+    return checkudata<lua_newwriter>(L, index, name());
   }
-  auto service = find_service((int)who);
-  if (!service) {
+  static int __gc(lua_State* L) {
+    auto self = __this(L);
+#ifdef LUA_DEBUG
+    lua_ftrace("DEBUG: %s will gc\n", name());
+#endif
+    if (!self->closed) {
+      self->finish("stream aborted");
+    }
+    self->~lua_newwriter();
     return 0;
   }
-  service->post(
-    [=]() {
-      lua_State* L = lua_local();
-      lua_auto_revert revert(L);
-      int type = lua_pushref(L, rcb);
-      if (type != LUA_TFUNCTION) {
-        lua_pushboolean(L, 0);
-        lua_pushliteral(L, "function not found");
-        lua_wrap(L, 2);
-        size_t nsize;
-        const char* result = luaL_checklstring(L, -1, &nsize);
-        response(result, nsize, caller, rcf, sn);
-        return;
-      }
-      int argc = 0;
-      if (!argv.empty()) {
-        lua_pushlstring(L, argv.c_str(), argv.size());
-        argc += lua_unwrap(L);
-      }
-      int prev_handler = rpcall_r_handler;
-      if (rcf != 0) {
-        lua_pushinteger(L, caller);
-        lua_pushinteger(L, rcf);
-        lua_pushinteger(L, sn);
-        lua_pushcclosure(L, responser, 3);
-        rpcall_r_handler = lua_ref(L, -1);
-        lua_pop(L, 1);
+  static int close(lua_State* L) {
+    auto self = __this(L);
+    if (self->closed) {
+      return 0;
+    }
+    std::string error;
+    if (!lua_isnoneornil(L, 2)) {
+      error = luaL_tolstring(L, 2, nullptr);
+    }
+    self->finish(error);
+    return 0;
+  }
+  static int send(lua_State* L) {
+    auto self = __this(L);
+    while (true) {
+      auto iter = stream_writers.find(self->ssn);
+      if (iter == stream_writers.end()) {
+        return luaL_error(L, "stream closed");
       }
-      size_t previous = rpcall_caller;
-      rpcall_caller = caller;
-      int callok = lua_pcall(L, argc, LUA_MULTRET, 0);
-      rpcall_caller = previous;
-
-      bool need_response = false;
-      if (callok != LUA_OK) {
-        lua_ferror("%s\n", lua_tostring(L, -1));
+      auto& writer = iter->second;
+      if (!writer.error.empty()) {
+        lua_pushboolean(L, 0);
+        lua_pushlstring(L, writer.error.c_str(), writer.error.size());
+        return 2;
       }
-      if (rpcall_r_handler > 0) {
-        need_response = true;
-        lua_unref(L, rpcall_r_handler);
+      if (writer.credits > 0) {
+        writer.credits--;
+        std::string chunk("c");
+        int argc = lua_gettop(L) - 1;
+        if (argc > 0) {
+          lua_wrap(L, argc);
+          size_t size = 0;
+          const char* data = luaL_checklstring(L, -1, &size);
+          chunk.append(data, size);
+        }
+        response(chunk.c_str(), chunk.size(), self->caller, self->rcf, self->sn);
+        lua_pushboolean(L, 1);
+        return 1;
       }
-      rpcall_r_handler = prev_handler;
-      /* call success and need't response */
-      if (callok == LUA_OK && !need_response) {
-        /* maybe will run in coroutine */
-        return;
+      writer.expires = steady_clock() + max_expires;
+      /* if invoke by coroutine */
+      if (lua_isyieldable(L)) {
+        lua_pushthread(L);
+        writer.hold = hold_continuation(L);
+        return lua_yieldk(L, 0, 0, send_k);
       }
-      lua_pushboolean(L, callok == LUA_OK ? 1 : 0);
-      int count = lua_gettop(L) - revert.top();
-      if (count > 1) {
-        lua_rotate(L, -count, 1);
+      /* write will be blocked */
+      auto service = lua_service();
+      writer.blocked = true;
+      bool result = service->wait_for(max_expires);
+      iter = stream_writers.find(self->ssn);
+      if (iter != stream_writers.end()) {
+        auto& later = iter->second;
+        later.blocked = false;
+        if (!result && later.credits == 0 && later.error.empty()) {
+          later.error = service->stopped() ? "cancel" : "timeout";
+        }
       }
-      lua_wrap(L, count);
-      size_t nsize;
-      const char* result = luaL_checklstring(L, -1, &nsize);
-      response(result, nsize, caller, rcf, sn);
     }
-  );
-  return 1;
-}
+  }
+  static int send_k(lua_State* L, int status, lua_KContext ctx) {
+    return send(L);
+  }
+  static void init_metatable(lua_State* L) {
+    const luaL_Reg methods[] = {
+      { "__gc",     __gc      },
+      { "__close",  close     },
+      { "write",    send      },
+      { "close",    close     },
+      { NULL,       NULL      }
+    };
+    newmetatable(L, name(), methods);
+    lua_pop(L, 1);
+  }
+  static int create(lua_State* L) {
+    auto context = context_of(L);
+    if (!context || context->handler == 0) {
+      lua_pushnil(L);
+      return 1;
+    }
+    lua_pushref(L, context->handler);
+    lua_unref(L, context->handler);
+    context->handler = 0;
+    lua_getupvalue(L, -1, 1);
+    lua_getupvalue(L, -2, 2);
+    lua_getupvalue(L, -3, 3);
+    size_t caller = luaL_checkinteger(L, -3);
+    int rcf       = (int)luaL_checkinteger(L, -2);
+    size_t sn     = luaL_checkinteger(L, -1);
+    lua_pop(L, 4);
+
+    auto ssn = next_sn();
+    stream_writers[ssn].credits = max_window;
+    auto self = newuserdata<lua_newwriter>(L, name());
+    self->caller = caller;
+    self->rcf    = rcf;
+    self->sn     = sn;
+    self->ssn    = ssn;
+    self->closed = false;
+    std::string opened("o" + std::to_string(ssn));
+    response(opened.c_str(), opened.size(), caller, rcf, sn);
+    return 1;
+  }
+  void finish(const std::string& error) {
+    closed = true;
+    stream_writers.erase(ssn);
+    std::string data("e" + error);
+    response(data.c_str(), data.size(), caller, rcf, sn);
+  }
+  size_t caller, sn, ssn;
+  int rcf;
+  bool closed;
+};
 
 /********************************************************************************/
 
 static int luac_r_caller(lua_State* L) {
-  lua_pushinteger(L, (lua_Integer)rpcall_caller);
+  auto context = context_of(L);
+  lua_pushinteger(L, (lua_Integer)(context ? context->caller : 0));
+  return 1;
+}
+
+/* the remaining time of current request */
+static int luac_r_deadline(lua_State* L) {
+  auto deadline = deadline_of(L);
+  if (deadline == 0) {
+    lua_pushnil(L);
+    return 1;
+  }
+  auto now = steady_clock();
+  lua_pushinteger(L, (lua_Integer)(deadline > now ? deadline - now : 0));
   return 1;
 }
 
 static int luac_r_handler(lua_State* L) {
-  if (rpcall_r_handler == 0) {
+  auto context = context_of(L);
+  if (!context || context->handler == 0) {
     lua_pushnil(L);
   }
   else {
-    lua_pushref(L, rpcall_r_handler);
-    rpcall_r_handler = 0;
+    lua_pushref(L, context->handler);
+    lua_unref(L, context->handler);
+    context->handler = 0;
   }
   return 1;
 }
@@ -461,7 +1757,7 @@ static int luac_deliver(lua_State* L) {
     data = luaL_checklstring(L, -1, &size);
   }
   int caller = lua_service()->id();
-  int count  = lua_r_deliver(name, data, size, mask, who, caller, 0, next_sn());
+  int count  = lua_r_deliver(name, data, size, mask, who, caller, 0, next_sn(), deadline_of(L));
   lua_pushinteger(L, count);
   return 1;
 }
@@ -471,11 +1767,10 @@ static int luac_invoke(lua_State* L) {
   const char* name = luaL_checkstring (L, 1);
   size_t mask      = luaL_checkinteger(L, 2);
   size_t receiver  = luaL_checkinteger(L, 3);
-  size_t timeout   = luaL_checkinteger(L, 4);
+  size_t timeout   = inherit_timeout(L, luaL_checkinteger(L, 4));
   if (mask == 0 && receiver == 0) {
     mask = rand() + 1;
   }
-  int rcf = lua_ref(L, 5); /* callback */
   size_t size = 0;
   const char* data = nullptr;
   int argc = lua_gettop(L) - 5;
@@ -483,26 +1778,34 @@ static int luac_invoke(lua_State* L) {
     lua_wrap(L, argc);
     data = luaL_checklstring(L, -1, &size);
   }
-  auto sn = next_sn();
   auto service = lua_service();
   auto caller = service->id();
-  int count = lua_r_deliver(name, data, size, mask, receiver, caller, rcf, sn);
+  int rcf = pending_rcf;
+  auto sn = insert_of_pending(caller, rcf, timeout);
+  lua_pushvalue(L, 5); /* callback */
+  keep_continuation(L, sn);
+
+  int count = 0;
+  std::string error("deadline exceeded");
+  if (timeout > 0) {
+    count = lua_r_deliver(name, data, size, mask, receiver, caller, rcf, sn, steady_clock() + timeout);
+    error.assign(name).append(" not found");
+  }
   if (count == 0) {
-    std::string fname(name);
-    service->post([rcf, fname]() {
+    service->post([sn, error]() {
+      pend_invoke pend;
+      if (!take_of_pending(sn, pend)) {
+        return;
+      }
       lua_State* L = lua_local();
       lua_auto_revert revert(L);
-      lua_auto_unref  unref(L, rcf);
-      lua_pushref(L, rcf);
+      push_continuation(L, sn);
       lua_pushboolean(L, 0);
-      lua_pushfstring(L, "%s not found", fname.c_str());
+      lua_pushlstring(L, error.c_str(), error.size());
       if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
         lua_ferror("%s\n", lua_tostring(L, -1));
       }
-    });
-  }
-  else {
-    insert_of_pending(caller, rcf, sn, timeout);
+    }, stats_response);
   }
   lua_pushboolean(L, count > 0 ? 1 : 0);
   return 1;
@@ -516,7 +1819,12 @@ static int luac_rpcall(lua_State* L) {
   const char* name = luaL_checkstring (L, 1);
   size_t mask      = luaL_checkinteger(L, 2);
   size_t receiver  = luaL_checkinteger(L, 3);
-  size_t timeout   = luaL_checkinteger(L, 4);
+  size_t timeout   = inherit_timeout(L, luaL_checkinteger(L, 4));
+  if (timeout == 0) {
+    lua_pushboolean(L, 0); /* false */
+    lua_pushliteral(L, "deadline exceeded");
+    return 2;
+  }
   if (mask == 0 && receiver == 0) {
     mask = rand() + 1;
   }
@@ -527,28 +1835,29 @@ static int luac_rpcall(lua_State* L) {
     lua_wrap(L, argc);
     data = luaL_checklstring(L, -1, &size);
   }
-  auto sn = next_sn();
   int  caller = lua_service()->id();
   int  rcf = 0 - caller;
   /* if invoke by coroutine */
   if (lua_isyieldable(L)) {
-    lua_State* main = lua_local();
+    rcf = pending_rcf;
+  }
+  auto sn = insert_of_pending(caller, rcf, timeout);
+  if (rcf > 0) {
     lua_pushthread(L);
-    lua_xmove(L, main, 1);
-    rcf = lua_ref(main, -1);
-    lua_pop(main, 1);
+    keep_continuation(L, sn);
   }
-  int count = lua_r_deliver(name, data, size, mask, receiver, caller, rcf, sn);
+  int count = lua_r_deliver(name, data, size, mask, receiver, caller, rcf, sn, steady_clock() + timeout);
   if (count == 0) {
     if (rcf > 0) {
-      lua_unref(L, rcf);
+      push_continuation(L, sn);
+      lua_pop(L, 1);
     }
+    remove_of_pending(sn);
     lua_pushboolean(L, 0); /* false */
     lua_pushfstring(L, "%s not found", name);
     return 2;
   }
   /* run in coroutine */
-  insert_of_pending(caller, rcf, sn, timeout);
   if (rcf > 0) {
     lua_settop(L, 0);
     return lua_yield(L, lua_gettop(L));
@@ -580,6 +1889,7 @@ static int luac_declare(lua_State* L) {
   const char* name = luaL_checkstring(L, 1);
   luaL_checktype(L, 2, LUA_TFUNCTION);
   int opt = luaL_optboolean(L, 3, 0);
+  int lazy = luaL_optboolean(L, 4, 0);
   int who = lua_service()->id();
   int rcb = lua_ref(L, 2);
 
@@ -594,6 +1904,7 @@ static int luac_declare(lua_State* L) {
   }
   else {
     lua_pushboolean(L, 1);
+    if (lazy) lazy_handlers.insert(rcb);
     if (opt) dispatch(name, osname, evr_bind, rcb, who);
   }
   return 1;
@@ -610,6 +1921,7 @@ static int luac_undeclare(lua_State* L) {
 
   int rcb = lua_r_unbind(name, who, &opt);
   if (rcb) {
+    lazy_handlers.erase(rcb);
     lua_unref(L, rcb);
     if (opt) dispatch(name, osname, evr_unbind, rcb, who);
   }
@@ -654,6 +1966,277 @@ static int luac_r_unbind(lua_State* L) {
   return 1;
 }
 
+/********************************************************************************/
+
+/*
+** frame of the cluster protocol
+** version(1 byte) + what(1 byte) + fields
+** integers are varints, signed integers are zigzag encoded
+** strings are length(varint) + bytes, payloads are opaque
+** topic of deliver is the id bound by the receiver, or 0 + name
+*/
+#define frame_version 1
+
+enum {
+  frame_deliver = 1,
+  frame_response,
+  frame_bind,
+  frame_unbind,
+  frame_batch,
+  frame_ready,
+  frame_forword,
+};
+
+static const char* frame_names[] = {
+  evr_deliver, evr_response, evr_bind, evr_unbind, evr_batch, "ready", "forword", nullptr
+};
+
+/* get the id of topic, assign a new one if not exist */
+static size_t topic_id_of(const topic_type& topic) {
+  unique_mutex_lock(_mutex);
+  auto iter = topic_ids.find(topic);
+  if (iter != topic_ids.end()) {
+    return iter->second;
+  }
+  topic_names.push_back(topic);
+  return topic_ids[topic] = topic_names.size();
+}
+
+static bool topic_name_of(size_t id, topic_type& topic) {
+  unique_mutex_lock(_mutex);
+  if (id == 0 || id > topic_names.size()) {
+    return false;
+  }
+  topic = topic_names[id - 1];
+  return true;
+}
+
+struct frame_writer {
+  std::string data;
+  inline void put_varint(uint64_t v) {
+    while (v >= 0x80) {
+      data.push_back((char)(v | 0x80));
+      v >>= 7;
+    }
+    data.push_back((char)v);
+  }
+  inline void put_signed(int64_t v) {
+    put_varint(((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+  }
+  inline void put_bytes(const char* p, size_t size) {
+    put_varint(size);
+    data.append(p, size);
+  }
+  inline void put_integer(lua_State* L, int index) {
+    put_varint((uint64_t)luaL_checkinteger(L, index));
+  }
+  inline void put_string(lua_State* L, int index) {
+    size_t size = 0;
+    const char* p = luaL_checklstring(L, index, &size);
+    put_bytes(p, size);
+  }
+};
+
+struct frame_reader {
+  const unsigned char* p;
+  const unsigned char* end;
+  bool ok = true;
+  inline uint64_t get_varint() {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (p >= end) {
+        break;
+      }
+      uint64_t c = *p++;
+      v |= (c & 0x7f) << shift;
+      if (!(c & 0x80)) {
+        return v;
+      }
+    }
+    ok = false;
+    return 0;
+  }
+  inline int64_t get_signed() {
+    uint64_t v = get_varint();
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+  }
+  inline void push_integer(lua_State* L) {
+    lua_pushinteger(L, (lua_Integer)get_varint());
+  }
+  inline void push_signed(lua_State* L) {
+    lua_pushinteger(L, (lua_Integer)get_signed());
+  }
+  inline void push_bytes(lua_State* L) {
+    size_t size = (size_t)get_varint();
+    if (!ok || size > (size_t)(end - p)) {
+      ok = false;
+      lua_pushnil(L);
+      return;
+    }
+    lua_pushlstring(L, (const char*)p, size);
+    p += size;
+  }
+};
+
+static void encode_deliver(lua_State* L, frame_writer& w, int i) {
+  if (lua_type(L, i) == LUA_TNUMBER) {
+    w.put_integer(L, i); /* id of topic */
+  }
+  else {
+    w.put_varint(0);
+    w.put_string(L, i);
+  }
+  w.put_string (L, i + 1); /* argv */
+  w.put_integer(L, i + 2); /* mask */
+  w.put_integer(L, i + 3); /* who */
+  w.put_integer(L, i + 4); /* caller */
+  w.put_signed (luaL_checkinteger(L, i + 5)); /* rcf */
+  w.put_integer(L, i + 6); /* sn */
+  w.put_varint(lua_isnoneornil(L, i + 7) ? 0 : (uint64_t)luaL_checkinteger(L, i + 7) + 1);
+}
+
+static int decode_deliver(lua_State* L, frame_reader& r) {
+  auto id = r.get_varint();
+  if (id > 0) {
+    topic_type topic;
+    topic_name_of((size_t)id, topic) ? (void)lua_pushlstring(L, topic.c_str(), topic.size()) : lua_pushnil(L);
+  }
+  else {
+    r.push_bytes(L);
+  }
+  r.push_bytes(L);   /* argv */
+  r.push_integer(L); /* mask */
+  r.push_integer(L); /* who */
+  r.push_integer(L); /* caller */
+  r.push_signed(L);  /* rcf */
+  r.push_integer(L); /* sn */
+  auto ttl = r.get_varint();
+  ttl ? lua_pushinteger(L, (lua_Integer)(ttl - 1)) : lua_pushnil(L);
+  return 8;
+}
+
+/* encode a frame: what, ... */
+static int luac_r_encode(lua_State* L) {
+  int what = luaL_checkoption(L, 1, nullptr, frame_names) + 1;
+  frame_writer w;
+  w.data.reserve(32);
+  w.data.push_back((char)frame_version);
+  w.data.push_back((char)what);
+  switch (what) {
+  case frame_deliver:
+    encode_deliver(L, w, 2);
+    break;
+  case frame_response:
+    w.put_string (L, 2); /* data */
+    w.put_integer(L, 3); /* caller */
+    w.put_signed (luaL_checkinteger(L, 4)); /* rcf */
+    w.put_integer(L, 5); /* sn */
+    break;
+  case frame_bind: {
+    size_t size = 0;
+    const char* name = luaL_checklstring(L, 2, &size);
+    w.put_bytes(name, size);
+    w.put_varint(topic_id_of(topic_type(name, size)));
+    w.put_string (L, 3); /* module */
+    w.put_signed (luaL_checkinteger(L, 4)); /* rcb */
+    w.put_integer(L, 5); /* caller */
+    break;
+  }
+  case frame_unbind:
+    w.put_string (L, 2); /* name */
+    w.put_integer(L, 3); /* caller */
+    break;
+  case frame_batch: {
+    int count = lua_gettop(L) - 1;
+    w.put_varint(count);
+    for (int i = 2; i <= count + 1; i++) {
+      w.put_string(L, i); /* frame of deliver */
+    }
+    break;
+  }
+  case frame_ready:
+    break;
+  case frame_forword:
+    w.put_integer(L, 2); /* id */
+    w.put_string (L, 3); /* ip */
+    w.put_integer(L, 4); /* port */
+    break;
+  }
+  lua_pushlstring(L, w.data.c_str(), w.data.size());
+  return 1;
+}
+
+/* decode a frame, returns what, ... */
+static int luac_r_decode(lua_State* L) {
+  size_t size = 0;
+  const char* data = luaL_checklstring(L, 1, &size);
+  if (size < 2 || data[0] != frame_version) {
+    lua_pushnil(L);
+    lua_pushliteral(L, "version mismatch");
+    return 2;
+  }
+  int what = (unsigned char)data[1];
+  if (what < frame_deliver || what > frame_forword) {
+    lua_pushnil(L);
+    lua_pushliteral(L, "malformed frame");
+    return 2;
+  }
+  frame_reader r;
+  r.p   = (const unsigned char*)data + 2;
+  r.end = (const unsigned char*)data + size;
+  lua_settop(L, 0);
+  lua_pushstring(L, frame_names[what - 1]);
+  switch (what) {
+  case frame_deliver:
+    decode_deliver(L, r);
+    break;
+  case frame_response:
+    r.push_bytes(L);   /* data */
+    r.push_integer(L); /* caller */
+    r.push_signed(L);  /* rcf */
+    r.push_integer(L); /* sn */
+    break;
+  case frame_bind:
+    r.push_bytes(L);   /* name */
+    r.push_integer(L); /* id */
+    r.push_bytes(L);   /* module */
+    r.push_signed(L);  /* rcb */
+    r.push_integer(L); /* caller */
+    break;
+  case frame_unbind:
+    r.push_bytes(L);   /* name */
+    r.push_integer(L); /* caller */
+    break;
+  case frame_batch: {
+    auto count = r.get_varint();
+    if (!r.ok || count > (uint64_t)(r.end - r.p)) {
+      r.ok = false;
+      break;
+    }
+    if (count > INT_MAX - 8 || !lua_checkstack(L, (int)count)) {
+      r.ok = false;
+      break;
+    }
+    for (uint64_t i = 0; i < count && r.ok; i++) {
+      r.push_bytes(L);
+    }
+    break;
+  }
+  case frame_forword:
+    r.push_integer(L); /* id */
+    r.push_bytes(L);   /* ip */
+    r.push_integer(L); /* port */
+    break;
+  }
+  if (!r.ok) {
+    lua_settop(L, 0);
+    lua_pushnil(L);
+    lua_pushliteral(L, "malformed frame");
+    return 2;
+  }
+  return lua_gettop(L);
+}
+
 static int luac_r_response(lua_State* L) {
   size_t size;
   const char* data = luaL_checklstring(L, 1, &size);
@@ -684,7 +2267,11 @@ static int luac_r_deliver(lua_State* L) {
   }
   int rcf = (int)luaL_checkinteger(L, 6);
   size_t sn = luaL_checkinteger(L, 7);
-  int count = lua_r_deliver(name, data, size, mask, who, caller, rcf, sn);
+  size_t deadline = 0;
+  if (!lua_isnoneornil(L, 8)) {
+    deadline = steady_clock() + luaL_checkinteger(L, 8);
+  }
+  int count = lua_r_deliver(name, data, size, mask, who, caller, rcf, sn, deadline);
   lua_pushinteger(L, count);
   return 1;
 }
@@ -726,6 +2313,22 @@ struct lua_newrpc final {
     lua_remove(L, 1); /* remove self */
     return luac_deliver(L);
   }
+  static int stream(lua_State* L) {
+    auto self = __this(L);
+    const char* name = luaL_checkstring(L, 2);
+    size_t mask = self->mask;
+    if (mask == 0 && self->receiver == 0) {
+      mask = rand() + 1;
+    }
+    size_t size = 0;
+    const char* data = nullptr;
+    int argc = lua_gettop(L) - 2;
+    if (argc > 0) {
+      lua_wrap(L, argc);
+      data = luaL_checklstring(L, -1, &size);
+    }
+    return lua_newreader::create(L, name, data, size, mask, self->receiver, self->timeout);
+  }
   static int set_mask(lua_State* L) {
     auto self = __this(L);
     auto old  = self->mask;
@@ -755,6 +2358,7 @@ struct lua_newrpc final {
   static void init_metatable(lua_State* L) {
     const luaL_Reg methods[] = {
       { "dispatch", dispatch      },
+      { "stream",   stream        },
       { "__call",   __call        },
       { "__gc",     __gc          },
       { "mask",     set_mask      },
@@ -784,6 +2388,92 @@ struct lua_newrpc final {
   size_t mask, receiver, timeout;
 };
 
+struct lua_newbatch final {
+  inline static const char* name() {
+    return "skynet rpcall batch";
+  }
+  inline static lua_newbatch* __this(
+    lua_State* L, int index = 1) {
+    return checkudata<lua_newbatch>(L, index, name());
+  }
+  static int __gc(lua_State* L) {
+    auto self = __this(L);
+#ifdef LUA_DEBUG
+    lua_ftrace("DEBUG: %s will gc\n", name());
+#endif
+    self->~lua_newbatch();
+    return 0;
+  }
+  static int push_call(lua_State* L, size_t receiver, int index) {
+    auto self = __this(L);
+    batch_call call;
+    call.topic    = luaL_checkstring(L, index);
+    call.receiver = receiver;
+    call.mask     = receiver ? 0 : rand() + 1;
+    int argc = lua_gettop(L) - index;
+    if (argc > 0) {
+      lua_wrap(L, argc);
+      size_t size = 0;
+      const char* data = luaL_checklstring(L, -1, &size);
+      call.argv.assign(data, size);
+    }
+    self->calls.push_back(call);
+    lua_pushinteger(L, (lua_Integer)self->calls.size());
+    return 1;
+  }
+  static int call(lua_State* L) {
+    return push_call(L, 0, 2);
+  }
+  static int call_to(lua_State* L) {
+    size_t receiver = luaL_checkinteger(L, 2);
+    if (receiver == 0) {
+      luaL_argerror(L, 2, "must be greater than 0");
+    }
+    return push_call(L, receiver, 3);
+  }
+  static int size(lua_State* L) {
+    auto self = __this(L);
+    lua_pushinteger(L, (lua_Integer)self->calls.size());
+    return 1;
+  }
+  static int clear(lua_State* L) {
+    auto self = __this(L);
+    self->calls.clear();
+    return 0;
+  }
+  static int submit(lua_State* L) {
+    auto self = __this(L);
+    int partial = luaL_optboolean(L, 2, 0);
+    std::vector<batch_call> calls;
+    calls.swap(self->calls);
+    return submit_batch(L, calls, self->timeout, partial, false);
+  }
+  static void init_metatable(lua_State* L) {
+    const luaL_Reg methods[] = {
+      { "__gc",     __gc      },
+      { "call",     call      },
+      { "call_to",  call_to   },
+      { "size",     size      },
+      { "clear",    clear     },
+      { "submit",   submit    },
+      { NULL,       NULL      }
+    };
+    newmetatable(L, name(), methods);
+    lua_pop(L, 1);
+  }
+  static int create(lua_State* L) {
+    auto timeout = luaL_optinteger(L, 1, max_expires);
+    if (timeout < 1000) {
+      timeout = 1000;
+    }
+    auto self = newuserdata<lua_newbatch>(L, name());
+    self->timeout = timeout;
+    return 1;
+  }
+  size_t timeout;
+  std::vector<batch_call> calls;
+};
+
 static void push_provider(lua_State* L, const rpcall_set_type& list) {
   int i = 1;
   lua_createtable(L, (int)list.size(), 0);
@@ -826,26 +2516,150 @@ static int luac_new(lua_State* L) {
   return lua_newrpc::create(L);
 }
 
+static const char* policy_names[] = {
+  "reject", "shed", "block", nullptr
+};
+
+/* set the inbound limit of the current service */
+static int luac_limit(lua_State* L) {
+  size_t limit = luaL_checkinteger(L, 1);
+  int policy = luaL_checkoption(L, 2, "reject", policy_names) + policy_reject;
+  size_t who = lua_service()->id();
+  auto holder = mailbox_create(who);
+  unparked_type admitted;
+  std::vector<parked_delivery> expired;
+  {
+    unique_mutex_lock(holder->mutex);
+    auto& mailbox = holder->mailbox;
+    lua_pushinteger(L, (lua_Integer)mailbox.limit);
+    mailbox.limit  = limit;
+    mailbox.policy = policy;
+    holder->limited.store(limit > 0, std::memory_order_relaxed);
+    /* the parked callers may be admitted by the new limit */
+    unpark_of_mailbox(holder, admitted, expired);
+  }
+  post_of_parked(who, holder, admitted, expired);
+  return 1;
+}
+
+static int luac_stats(lua_State* L) {
+  size_t who = luaL_optinteger(L, 1, lua_service()->id());
+  auto holder = mailbox_of(who);
+  if (!holder) {
+    lua_pushnil(L);
+    return 1;
+  }
+  mailbox_type mailbox;
+  {
+    unique_mutex_lock(holder->mutex);
+    mailbox = holder->mailbox;
+  }
+  lua_createtable(L, 0, 12);
+  lua_pushinteger(L, (lua_Integer)mailbox.depth());
+  lua_setfield(L, -2, "depth");
+  lua_pushinteger(L, (lua_Integer)mailbox.limit);
+  lua_setfield(L, -2, "limit");
+  lua_pushstring(L, policy_names[mailbox.policy - policy_reject]);
+  lua_setfield(L, -2, "policy");
+  lua_pushinteger(L, (lua_Integer)mailbox.posted);
+  lua_setfield(L, -2, "posted");
+  lua_pushinteger(L, (lua_Integer)mailbox.executed);
+  lua_setfield(L, -2, "executed");
+  lua_pushinteger(L, (lua_Integer)mailbox.rejected);
+  lua_setfield(L, -2, "rejected");
+  lua_pushinteger(L, (lua_Integer)mailbox.blocked);
+  lua_setfield(L, -2, "blocked");
+  lua_pushinteger(L, (lua_Integer)mailbox.shed);
+  lua_setfield(L, -2, "shed");
+  lua_pushinteger(L, (lua_Integer)mailbox.max_depth);
+  lua_setfield(L, -2, "max_depth");
+  lua_pushinteger(L, (lua_Integer)(mailbox.executed ? mailbox.waited / mailbox.executed : 0));
+  lua_setfield(L, -2, "wait_avg");
+  lua_pushinteger(L, (lua_Integer)mailbox.max_wait);
+  lua_setfield(L, -2, "wait_max");
+  return 1;
+}
+
+static int luac_stream(lua_State* L) {
+  return lua_newwriter::create(L);
+}
+
+static int luac_batch(lua_State* L) {
+  return lua_newbatch::create(L);
+}
+
+/* call all receivers of name, results are keyed by receiver */
+/* rpc.all([timeout,] name, ...), the timeout is limited by the deadline */
+static int luac_all(lua_State* L) {
+  size_t timeout = max_expires;
+  if (lua_type(L, 1) == LUA_TNUMBER) {
+    auto value = luaL_checkinteger(L, 1);
+    timeout = value < 1000 ? 1000 : (size_t)value;
+    lua_remove(L, 1);
+  }
+  batch_call call;
+  call.topic    = luaL_checkstring(L, 1);
+  call.mask     = 0;
+  call.receiver = 0;
+  int argc = lua_gettop(L) - 1;
+  if (argc > 0) {
+    lua_wrap(L, argc);
+    size_t size = 0;
+    const char* data = luaL_checklstring(L, -1, &size);
+    call.argv.assign(data, size);
+  }
+  std::vector<batch_call> calls;
+  calls.push_back(call);
+  return submit_batch(L, calls, timeout, 1, true);
+}
+
 /********************************************************************************/
 
 SKYNET_API int luaopen_rpcall(lua_State* L) {
+  /* copied to the new threads, see context_of */
+  *(invoke_context**)lua_getextraspace(L) = nullptr;
   lua_newrpc::init_metatable(L);
+  lua_newbatch::init_metatable(L);
+  lua_newreader::init_metatable(L);
+  lua_newwriter::init_metatable(L);
   const luaL_Reg methods[] = {
     { "lookout",    luac_lookout    },
     { "create",     luac_declare    },
     { "new",        luac_new        },
+    { "batch",      luac_batch      },
+    { "all",        luac_all        },
     { "provider",   luac_provider   },
     { "remove",     luac_undeclare  },
     { "caller",     luac_r_caller   },
+    { "deadline",   luac_r_deadline },
     { "responser",  luac_r_handler  },
+    { "stream",     luac_stream     },
+    { "limit",      luac_limit      },
+    { "stats",      luac_stats      },
 
     { "r_deliver",  luac_r_deliver  },
     { "r_bind",     luac_r_bind     },
     { "r_unbind",   luac_r_unbind   },
     { "r_response", luac_r_response },
+    { "r_encode",   luac_r_encode   },
+    { "r_decode",   luac_r_decode   },
     { NULL,         NULL            }
   };
   new_module(L, "rpc", methods);
+  auto holder = mailbox_of(lua_service()->id());
+  if (holder) {
+    /* the id may be reused by a new service */
+    std::deque<parked_delivery> parked;
+    {
+      unique_mutex_lock(holder->mutex);
+      holder->limited.store(false, std::memory_order_relaxed);
+      holder->mailbox = mailbox_type();
+      parked.swap(holder->parked);
+    }
+    for (auto& delivery : parked) {
+      response_error("busy", delivery.caller, delivery.rcf, delivery.sn);
+    }
+  }
   return check_timeout(L, 1000);
 }
 
@@ -913,14 +2727,14 @@ SKYNET_API int lua_r_response(const std::string& data, size_t caller, int rcf, s
     if (rcf < 0) {
       auto service = find_service(std::abs(rcf));
       if (service) {
-        service->post(_bind(cancel_block, data, rcf, sn));
+        service->post(_bind(cancel_block, data, rcf, sn), stats_response);
         return LUA_OK;
       }
     }
     else {
       auto service = find_service((int)caller);
       if (service) {
-        service->post(_bind(back_to_local, data, rcf, sn));
+        service->post(_bind(back_to_local, data, rcf, sn), stats_response);
         return LUA_OK;
       }
     }
@@ -928,65 +2742,16 @@ SKYNET_API int lua_r_response(const std::string& data, size_t caller, int rcf, s
   return LUA_ERRRUN;
 }
 
-SKYNET_API int lua_r_deliver(const char* name, const char* data, size_t size, size_t mask, size_t who, size_t caller, int rcf, size_t sn) {
-  node_type node;
-  node.who = who;
+SKYNET_API int lua_r_deliver(const char* name, const char* data, size_t size, size_t mask, size_t who, size_t caller, int rcf, size_t sn, size_t deadline) {
   topic_type topic(name);
-
-  unique_mutex_lock(_mutex);
-  auto iter = rpcall_handlers.find(topic);
-  if (iter == rpcall_handlers.end()) {
-    return 0;
-  }
-  rpcall_set_type& val = iter->second;
-  if (val.empty()) {
-    return 0;
-  }
-  if (!is_local(caller) && !is_local(who)) {
-    return 0;
-  }
-  size_t receiver = who;
-  /* if the mask is set */
-  if (mask > 0) {
-    std::vector<node_type> select;
-    for (auto find = val.begin(); find != val.end(); ++find) {
-      /* can't call by remote */
-      if (find->opt == 0 && !is_local(caller)) {
-        continue;
-      }
-      if (is_local(caller) || is_local(who)) {
-        select.push_back(*find);
-      }
-    }
-    if (!select.empty()) {
-      auto i = mask % select.size();
-      node.who = receiver = select[i].who;
-    }
+  std::vector<route_type> routes;
+  {
+    unique_mutex_lock(_mutex);
+    select_receivers(topic, mask, who, caller, routes);
   }
   int count = 0;
-  /* if there is a receiver */
-  if (receiver > 0) {
-    auto find = val.find(node);
-    if (find == val.end()) {
-      return 0;
-    }
-    if (!is_local(caller)) {
-      /* can't call by remote */
-      if (find->opt == 0) {
-        return 0;
-      }
-    }
-    auto rcb = find->rcb;
-    count = dispatch(topic, rcb, data, size, mask, receiver, caller, rcf, sn);
-  }
-  /* dispatch to all receivers */
-  else {
-    auto find = val.begin();
-    for (; find != val.end(); ++find) {
-      auto rcb = find->rcb;
-      auto who = find->who;
-      count += dispatch(topic, rcb, data, size, mask, who, caller, rcf, sn);
-    }
+  for (auto& route : routes) {
+    count += dispatch(topic, route.rcb, data, size, mask, route.who, caller, rcf, sn, deadline);
   }
   return count;
 }
@@ -15,6 +15,7 @@
 #define evr_bind      "bind"
 #define evr_unbind    "unbind"
 #define evr_response  "response"
+#define evr_batch     "batch"
 
 /********************************************************************************/
 
@@ -22,7 +23,7 @@ SKYNET_API int luaopen_rpcall(lua_State* L);
 SKYNET_API int lua_l_lookout (lua_CFunction f);
 SKYNET_API int lua_r_bind    (const char* name, const char* osname, size_t who, int rcb, int opt);
 SKYNET_API int lua_r_unbind  (const char* name, size_t who, int* opt);
-SKYNET_API int lua_r_deliver (const char* name, const char* data, size_t size, size_t mask, size_t who, size_t caller, int rcf, size_t sn);
+SKYNET_API int lua_r_deliver (const char* name, const char* data, size_t size, size_t mask, size_t who, size_t caller, int rcf, size_t sn, size_t deadline = 0);
 SKYNET_API int lua_r_response(const std::string& data, size_t caller, int rcf, size_t sn);
 
 /********************************************************************************/
@@ -2,6 +2,9 @@
 
 #include "../skynet.h"
 #include "lua_socket.h"
+#include "lua_go.h"
+#include "lua_stats.h"
+#include <deque>
 
 /********************************************************************************/
 
@@ -185,6 +188,76 @@ inline typeof<Ty> ref_new_object(lua_State* L, std::string& what) {
 
 /********************************************************************************/
 
+/*
+* The callbacks of a socket run in a coroutine of the pool, one after another
+* in the order of the events: while a callback is waiting (e.g. for a rpcall),
+* the next events are queued, and the same coroutine calls them when it's
+* finished. The accepts of a server are independent, each has its coroutine.
+*/
+struct socket_callbacks final {
+  typedef std::shared_ptr<socket_callbacks> pointer;
+  std::deque<int> queued;   /* refs of {function, nargs, args...} */
+  pointer running;          /* held by the coroutine calling them */
+
+  /* calls the function below the nargs arguments, or queues it */
+  static void go(lua_State* L, const pointer& self, int nargs) {
+    if (self->running) {
+      lua_createtable(L, nargs + 2, 0);
+      lua_insert(L, -(nargs + 2));
+      lua_pushinteger(L, nargs);
+      lua_insert(L, -(nargs + 1));
+      for (int i = nargs + 2; i > 0; i--) {
+        lua_rawseti(L, -(i + 1), i);
+      }
+      self->queued.push_back(lua_ref(L, -1));
+      lua_pop(L, 1);
+      return;
+    }
+    self->running = self;
+    lua_pushcfunction(L, run);
+    lua_insert(L, -(nargs + 2));
+    lua_pushlightuserdata(L, self.get());
+    lua_insert(L, -(nargs + 2));
+    int status = lua_go(L, nargs + 2);
+    if (!lua_success(status)) {
+      self->running.reset(); /* run never started or didn't finish */
+    }
+  }
+  /* the body of the coroutine, stack: self, function, args... */
+  static int run(lua_State* L) {
+    int status = lua_pcall_k(L, lua_gettop(L) - 2, 0, 0, next);
+    return next(L, status, 0);
+  }
+  static int next(lua_State* L, int status, lua_KContext ctx) {
+    auto self = (socket_callbacks*)lua_touserdata(L, 1);
+    while (true) {
+      if (!lua_success(status)) {
+        lua_ferror("%s\n", luaL_tolstring(L, -1, nullptr));
+      }
+      lua_settop(L, 1);
+      if (self->queued.empty()) {
+        pointer finished(std::move(self->running));
+        return 0;
+      }
+      int ref = self->queued.front();
+      self->queued.pop_front();
+      lua_pushref(L, ref);
+      lua_unref(L, ref);
+      lua_rawgeti(L, 2, 2);
+      int nargs = (int)lua_tointeger(L, -1);
+      lua_pop(L, 1);
+      lua_rawgeti(L, 2, 1);
+      for (int i = 1; i <= nargs; i++) {
+        lua_rawgeti(L, 2, i + 2);
+      }
+      lua_remove(L, 2);
+      status = lua_pcall_k(L, nargs, 0, 0, next);
+    }
+  }
+};
+
+/********************************************************************************/
+
 struct lua_socket final {
   inline static const char* name() {
     return "skynet socket";
@@ -263,17 +336,17 @@ struct lua_socket final {
     }
     luaL_checktype(L, 4, LUA_TFUNCTION);
     int handler = lua_ref(L, 4);
+    auto callbacks = self->callbacks;
     async_connect(self->socket, host, port,
-      [handler](const error_code& ec) {
+      [handler, callbacks](const error_code& ec) {
+        io::service::measure measure(stats_socket);
         lua_State* L = lua_local();
         lua_auto_revert revert(L);
         lua_auto_unref  unref(L, handler);
 
         lua_pushref(L, handler);
         ec ? push_errcode(L, ec) : lua_pushnil(L);
-        if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
-          lua_ferror("%s\n", luaL_checkstring(L, -1));
-        }
+        socket_callbacks::go(L, callbacks, 1);
       }
     );
     return 0;
@@ -331,8 +404,10 @@ struct lua_socket final {
     luaL_checktype(L, 2, LUA_TFUNCTION);
     auto self = __this(L);
     int handler = lua_ref(L, 2);
+    auto callbacks = self->callbacks;
     async_receive(self->socket,
-      [handler](const error_code& ec, const char* data, size_t size) {
+      [handler, callbacks](const error_code& ec, const char* data, size_t size) {
+        io::service::measure measure(stats_socket);
         lua_State* L = lua_local();
         lua_auto_revert revert(L);
         lua_auto_unref  unref(L, handler);
@@ -347,9 +422,7 @@ struct lua_socket final {
           lua_pushlstring(L, data, size);
         }
         ec ? push_errcode(L, ec) : lua_pushnil(L);
-        if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
-          lua_ferror("%s\n", luaL_checkstring(L, -1));
-        }
+        socket_callbacks::go(L, callbacks, 2);
       }
     );
     return 0;
@@ -375,8 +448,10 @@ struct lua_socket final {
       luaL_checktype(L, 3, LUA_TFUNCTION);
     }
     int handler = lua_ref(L, 3);
+    auto callbacks = self->callbacks;
     self->socket->async_send(data, size,
-      [handler](const error_code& ec, size_t size) {
+      [handler, callbacks](const error_code& ec, size_t size) {
+        io::service::measure measure(stats_socket);
         lua_State* L = lua_local();
         lua_auto_revert revert(L);
         lua_auto_unref  unref(L, handler);
@@ -384,9 +459,7 @@ struct lua_socket final {
         lua_pushref(L, handler);
         lua_pushinteger(L, (lua_Integer)size);
         ec ? push_errcode(L, ec) : lua_pushnil(L);
-        if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
-          lua_ferror("%s\n", luaL_checkstring(L, -1));
-        }
+        socket_callbacks::go(L, callbacks, 2);
       }
     );
     return 0;
@@ -436,6 +509,7 @@ struct lua_socket final {
     return new_module(L, "io", methods);
   }
   typeof<io::socket> socket;
+  socket_callbacks::pointer callbacks = std::make_shared<socket_callbacks>();
 };
 
 /********************************************************************************/
@@ -492,6 +566,7 @@ struct lua_acceptor final {
     int handler = lua_ref(L, 4);
     auto ec = self->server->listen(port, host,
       [handler, self](const error_code& ec, typeof<io::socket> peer) {
+        io::service::measure measure(stats_socket);
         lua_State* L = lua_local();
         lua_auto_revert revert(L);
         lua_auto_unref  unref(L, handler);
@@ -510,9 +585,7 @@ struct lua_acceptor final {
           lua_pushnil(L);
         }
         ec ? push_errcode(L, ec) : lua_pushnil(L);
-        if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
-          lua_ferror("%s\n", luaL_checkstring(L, -1));
-        }
+        lua_go(L, 2);
       }
     );
     lua_pushboolean(L, ec ? 0 : 1);
@@ -560,6 +633,12 @@ struct lua_acceptor final {
 
 /********************************************************************************/
 
+SKYNET_API typeof<io::socket> lua_checksocket(lua_State* L, int idx) {
+  return checkudata<lua_socket>(L, idx, lua_socket::name())->socket;
+}
+
+/********************************************************************************/
+
 SKYNET_API int luaopen_socket(lua_State* L) {
   int result = 0;
   result += ssl_context::open_library(L);
@@ -12,6 +12,7 @@
 /********************************************************************************/
 
 SKYNET_API int luaopen_socket(lua_State* L);
+SKYNET_API typeof<io::socket> lua_checksocket(lua_State* L, int idx);
 
 /********************************************************************************/
 
@@ -0,0 +1,180 @@
+
+#include "../skynet.h"
+#include "lua_stats.h"
+
+#include <algorithm>
+
+/********************************************************************************/
+
+typedef io::service::type_ref service_ref;
+typedef std::vector<std::pair<std::string, service_ref>> service_list;
+
+static const char* kind_names[] = {
+  "other", "deliver", "response", "timer", "socket", "post", "gc"
+};
+
+static void push_histogram(lua_State* L, const std::atomic<size_t>* histogram) {
+  lua_createtable(L, io::service_stats::buckets, 0);
+  for (int i = 0; i < io::service_stats::buckets; i++) {
+    lua_pushinteger(L, (lua_Integer)histogram[i].load());
+    lua_rawseti(L, -2, i + 1);
+  }
+}
+
+static void push_stats(lua_State* L, const std::string& name, const service_ref& ios) {
+  auto& stats = ios->stats();
+  size_t now = io::service_stats::now();
+  size_t elapsed = now - stats.since;
+  size_t idle = std::min(ios->idle_us(), elapsed);
+
+  lua_createtable(L, 0, 10);
+  lua_pushinteger(L, ios->id());
+  lua_setfield(L, -2, "id");
+  lua_pushlstring(L, name.c_str(), name.size());
+  lua_setfield(L, -2, "name");
+  lua_pushnumber(L, elapsed / 1000.0);
+  lua_setfield(L, -2, "elapsed");
+  lua_pushnumber(L, (elapsed - idle) / 1000.0);
+  lua_setfield(L, -2, "busy");
+  lua_pushnumber(L, elapsed ? (double)(elapsed - idle) / elapsed : 0.0);
+  lua_setfield(L, -2, "ratio");
+  lua_pushinteger(L, (lua_Integer)stats.depth.load());
+  lua_setfield(L, -2, "depth");
+  lua_pushinteger(L, (lua_Integer)stats.depth_max.load());
+  lua_setfield(L, -2, "maxdepth");
+
+  lua_createtable(L, io::service_stats::buckets, 0);
+  for (int i = 0; i < io::service_stats::buckets; i++) {
+    size_t bound = io::service_stats::bound(i);
+    lua_pushnumber(L, bound == (size_t)-1 ? HUGE_VAL : bound / 1000.0);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "bounds");
+
+  lua_newtable(L);
+  for (int i = 0; i < (int)(sizeof(kind_names) / sizeof(kind_names[0])); i++) {
+    auto& kind = stats.kind[i];
+    if (kind.count == 0) {
+      continue;
+    }
+    lua_createtable(L, 0, 7);
+    lua_pushinteger(L, (lua_Integer)kind.count.load());
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, kind.exec_us / 1000.0);
+    lua_setfield(L, -2, "exec");
+    lua_pushnumber(L, kind.exec_max / 1000.0);
+    lua_setfield(L, -2, "exec_max");
+    lua_pushnumber(L, kind.wait_us / 1000.0);
+    lua_setfield(L, -2, "wait");
+    lua_pushnumber(L, kind.wait_max / 1000.0);
+    lua_setfield(L, -2, "wait_max");
+    push_histogram(L, kind.exec);
+    lua_setfield(L, -2, "exec_hist");
+    push_histogram(L, kind.wait);
+    lua_setfield(L, -2, "wait_hist");
+    lua_setfield(L, -2, kind_names[i]);
+  }
+  lua_setfield(L, -2, "kinds");
+}
+
+/* one line per service, the busiest first */
+static void dump_stats(const service_list& services) {
+  std::vector<std::pair<double, size_t>> order;
+  size_t now = io::service_stats::now();
+  for (size_t i = 0; i < services.size(); i++) {
+    auto& ios = services[i].second;
+    size_t elapsed = now - ios->stats().since;
+    size_t idle = std::min(ios->idle_us(), elapsed);
+    order.emplace_back(elapsed ? (double)(elapsed - idle) / elapsed : 0.0, i);
+  }
+  std::sort(order.begin(), order.end(),
+    [](const std::pair<double, size_t>& a, const std::pair<double, size_t>& b) {
+      return a.first > b.first;
+    }
+  );
+  for (auto& v : order) {
+    auto& name = services[v.second].first;
+    auto& ios = services[v.second].second;
+    auto& stats = ios->stats();
+    int top = 0; /* the kind that ran the longest */
+    for (int i = 1; i < io::service_stats::kinds; i++) {
+      if (stats.kind[i].exec_us > stats.kind[top].exec_us) {
+        top = i;
+      }
+    }
+    auto& kind = stats.kind[top];
+    lua_ftrace("service %d %s busy %.1f%% depth %zu/%zu %s %zu x %.3fms max %.3fms wait max %.3fms\n",
+      ios->id(), name.c_str(), v.first * 100, stats.depth.load(), stats.depth_max.load(),
+      top < (int)(sizeof(kind_names) / sizeof(kind_names[0])) ? kind_names[top] : "other",
+      kind.count.load(), kind.count ? kind.exec_us / 1000.0 / kind.count : 0.0,
+      kind.exec_max / 1000.0, kind.wait_max / 1000.0
+    );
+  }
+}
+
+/* os.stats(["all" | "dump" | "reset"]) */
+static int os_stats(lua_State* L) {
+  const char* what = luaL_optstring(L, 1, "");
+  if (strcmp(what, "reset") == 0) {
+    lua_service()->reset_stats();
+    return 0;
+  }
+  if (strcmp(what, "all") == 0 || strcmp(what, "dump") == 0) {
+    service_list services;
+    skynet_services(services);
+    if (what[0] == 'd') {
+      dump_stats(services);
+      return 0;
+    }
+    lua_createtable(L, (int)services.size(), 0);
+    for (size_t i = 0; i < services.size(); i++) {
+      push_stats(L, services[i].first, services[i].second);
+      lua_rawseti(L, -2, (lua_Integer)i + 1);
+    }
+    return 1;
+  }
+  lua_getglobal(L, "__progname");
+  std::string name(luaL_optstring(L, -1, ""));
+  lua_pop(L, 1);
+  push_stats(L, name, lua_service());
+  return 1;
+}
+
+/* os.instrument([on]) */
+static int os_instrument(lua_State* L) {
+  auto& enabled = io::service_stats::enabled();
+  lua_pushboolean(L, enabled ? 1 : 0);
+  if (lua_isnoneornil(L, 1)) {
+    return 1;
+  }
+  bool on = lua_toboolean(L, 1) != 0;
+  if (on && !enabled) {
+    enabled = true;
+    /* the counters of every service start now, on its own thread */
+    service_list services;
+    skynet_services(services);
+    auto local = lua_service();
+    for (auto& v : services) {
+      auto ios = v.second;
+      if (ios != local) {
+        ios->post([ios]() { ios->reset_stats(); });
+      }
+    }
+    local->reset_stats();
+  }
+  enabled = on;
+  return 1;
+}
+
+/********************************************************************************/
+
+SKYNET_API int luaopen_stats(lua_State* L) {
+  const luaL_Reg methods[] = {
+    { "stats",        os_stats      },
+    { "instrument",   os_instrument },
+    { NULL,           NULL          }
+  };
+  return new_module(L, "os", methods);
+}
+
+/********************************************************************************/
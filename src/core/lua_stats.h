@@ -0,0 +1,29 @@
+
+
+#ifndef __LUA_STATS_H
+#define __LUA_STATS_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+# pragma once
+#endif
+
+#include "../skynet_lua.h"
+
+/********************************************************************************/
+
+/* kinds of the handlers measured by os.stats, the second argument of post */
+enum stats_kind {
+  stats_other = 0,
+  stats_deliver,    /* rpc requests delivered to the service */
+  stats_response,   /* rpc responses, timeouts and cancels */
+  stats_timer,
+  stats_socket,     /* callbacks of the sockets */
+  stats_post,       /* os.post */
+  stats_gc,         /* idle steps of the collector */
+};
+
+SKYNET_API int luaopen_stats(lua_State* L);
+
+/********************************************************************************/
+
+#endif //__LUA_STATS_H
@@ -2,6 +2,323 @@
 
 #include "../skynet.h"
 #include "lua_timer.h"
+#include "lua_stats.h"
+#include "lua_go.h"
+
+/********************************************************************************/
+
+#define WHEEL_TICK        10  /* ms */
+#define WHEEL_NEAR_SHIFT  8
+#define WHEEL_NEAR        (1 << WHEEL_NEAR_SHIFT)
+#define WHEEL_LEVEL_SHIFT 6
+#define WHEEL_LEVEL       (1 << WHEEL_LEVEL_SHIFT)
+#define WHEEL_NEAR_MASK   (WHEEL_NEAR - 1)
+#define WHEEL_LEVEL_MASK  (WHEEL_LEVEL - 1)
+
+/*
+* The callback of a timer runs in a coroutine of the pool (see lua_go), so a
+* rpcall in it yields instead of running the loop on this stack. The timer is
+* armed again by the continuation, with what the callback returned, once the
+* callback is finished.
+*/
+typedef void (*timer_done_type)(lua_State* L, void* owner, size_t expires);
+
+struct timer_callback final {
+  /* stack: done, owner, result or error */
+  static int finish(lua_State* L, int status, lua_KContext ctx) {
+    size_t expires = 0;
+    if (lua_success(status)) {
+      expires = (size_t)lua_tointeger(L, -1);
+    }
+    else {
+      lua_ferror("%s\n", luaL_tolstring(L, -1, nullptr));
+    }
+    auto done = (timer_done_type)lua_touserdata(L, 1);
+    done(L, lua_touserdata(L, 2), expires);
+    return 0;
+  }
+  /* the body of the coroutine, stack: done, owner, function */
+  static int run(lua_State* L) {
+    lua_pcall_k(L, 0, 1, 0, finish);
+    return finish(L, LUA_OK, 0);
+  }
+  static void call(lua_State* L, int handler, timer_done_type done, void* owner) {
+    lua_auto_revert revert(L);
+    lua_pushcfunction(L, run);
+    lua_pushlightuserdata(L, (void*)done);
+    lua_pushlightuserdata(L, owner);
+    lua_pushref(L, handler);
+    lua_go(L, 3);
+  }
+};
+
+/********************************************************************************/
+
+/* a timer of the wheel, owned by its userdata, or by the wheel while it runs */
+struct wheel_node final {
+  wheel_node* prev = nullptr;
+  wheel_node* next = nullptr;
+  uint32_t expire  = 0;     /* tick */
+  int  handler     = 0;
+  bool running     = false; /* its callback is being called, or suspended */
+  bool stopped     = false; /* cancelled by its own callback */
+  bool orphan      = false; /* the userdata was collected meanwhile */
+
+  inline bool linked() const {
+    return prev != nullptr;
+  }
+  inline void unlink() {
+    if (prev) {
+      prev->next = next;
+      next->prev = prev;
+      prev = next = nullptr;
+    }
+  }
+};
+
+/* circular list with a sentinel, insert and remove are O(1) */
+struct wheel_list final {
+  wheel_node head;
+  inline wheel_list() {
+    head.prev = head.next = &head;
+  }
+  inline bool empty() const {
+    return head.next == &head;
+  }
+  inline void push_back(wheel_node* node) {
+    node->prev = head.prev;
+    node->next = &head;
+    head.prev->next = node;
+    head.prev = node;
+  }
+  inline wheel_node* pop_front() {
+    wheel_node* node = head.next;
+    node->unlink();
+    return node;
+  }
+  inline void splice(wheel_list& from) {
+    while (!from.empty()) {
+      push_back(from.pop_front());
+    }
+  }
+};
+
+/*
+* Hierarchical timing wheel of a service (skynet style): 256 slots of one tick,
+* then 4 levels of 64 slots, so adding and cancelling a timer are O(1) and a
+* single asio timer drives all of them. The timers expiring in the same tick
+* are called as one batch.
+*/
+struct timing_wheel final {
+  inline timing_wheel()
+    : _timer(*lua_service()) {
+  }
+  static timing_wheel& local() {
+    static thread_local timing_wheel wheel;
+    return wheel;
+  }
+  void add(wheel_node* node, size_t timeout) {
+    size_t ticks = (timeout + WHEEL_TICK - 1) / WHEEL_TICK;
+    if (ticks == 0) {
+      ticks = 1;
+    }
+    if (ticks > 0xffffffffu) {
+      ticks = 0xffffffffu;
+    }
+    if (_count++ == 0) {
+      _last = steady_clock();
+      arm(WHEEL_TICK);
+    }
+    node->expire = _time + (uint32_t)ticks;
+    link(node);
+  }
+  void remove(wheel_node* node) {
+    if (node->linked()) {
+      node->unlink();
+      _count--;
+    }
+  }
+
+private:
+  void link(wheel_node* node) {
+    uint32_t expire = node->expire;
+    if ((expire | WHEEL_NEAR_MASK) == (_time | WHEEL_NEAR_MASK)) {
+      _near[expire & WHEEL_NEAR_MASK].push_back(node);
+      return;
+    }
+    int i = 0;
+    uint32_t mask = WHEEL_NEAR << WHEEL_LEVEL_SHIFT;
+    for (; i < 3; i++) {
+      if ((expire | (mask - 1)) == (_time | (mask - 1))) {
+        break;
+      }
+      mask <<= WHEEL_LEVEL_SHIFT;
+    }
+    int shift = WHEEL_NEAR_SHIFT + i * WHEEL_LEVEL_SHIFT;
+    _level[i][(expire >> shift) & WHEEL_LEVEL_MASK].push_back(node);
+  }
+  /* moves the timers of a slot down to the lower levels */
+  void cascade(int level, int idx) {
+    wheel_list list;
+    list.splice(_level[level][idx]);
+    while (!list.empty()) {
+      link(list.pop_front());
+    }
+  }
+  void shift() {
+    uint32_t ct = ++_time;
+    if (ct == 0) {
+      cascade(3, 0);
+      return;
+    }
+    uint32_t mask = WHEEL_NEAR;
+    uint32_t time = ct >> WHEEL_NEAR_SHIFT;
+    int i = 0;
+    while ((ct & (mask - 1)) == 0) {
+      int idx = (int)(time & WHEEL_LEVEL_MASK);
+      if (idx != 0) {
+        cascade(i, idx);
+        break;
+      }
+      mask <<= WHEEL_LEVEL_SHIFT;
+      time >>= WHEEL_LEVEL_SHIFT;
+      ++i;
+    }
+  }
+  /* calls the timers of the current tick as one batch */
+  void execute(lua_State* L) {
+    wheel_list& slot = _near[_time & WHEEL_NEAR_MASK];
+    if (slot.empty()) {
+      return;
+    }
+    wheel_list batch;
+    batch.splice(slot);
+    while (!batch.empty()) {
+      wheel_node* node = batch.pop_front();
+      _count--;
+      node->running = true;
+      timer_callback::call(L, node->handler, finish, node);
+    }
+  }
+  /* the callback of a node is finished, it returned expires */
+  static void finish(lua_State* L, void* owner, size_t expires) {
+    auto node = (wheel_node*)owner;
+    node->running = false;
+    if (node->orphan) {
+      local().remove(node);
+      lua_unref(L, node->handler);
+      delete node;
+      return;
+    }
+    if (node->linked()) {
+      return; /* expires was called again by the callback */
+    }
+    if (expires == 0 || node->stopped) {
+      node->stopped = false;
+      lua_unref(L, node->handler);
+      node->handler = 0;
+      return;
+    }
+    local().add(node, expires);
+  }
+  void update(lua_State* L) {
+    execute(L);
+    shift();
+    execute(L);
+  }
+  void arm(size_t expires) {
+    _timer.expires_after(std::chrono::milliseconds(expires));
+    _timer.async_wait([this](const error_code& ec) {
+      if (ec) {
+        return;
+      }
+      io::service::measure measure(stats_timer);
+      lua_State* L = lua_local();
+      size_t now = steady_clock();
+      while (now - _last >= WHEEL_TICK && _count > 0) {
+        _last += WHEEL_TICK;
+        update(L);
+      }
+      if (_count == 0) {
+        return; /* armed again by the next add */
+      }
+      size_t elapsed = now - _last;
+      arm(elapsed < WHEEL_TICK ? WHEEL_TICK - elapsed : 1);
+    });
+  }
+
+  steady_timer _timer;
+  size_t   _last  = 0;  /* steady clock of the last tick */
+  size_t   _count = 0;  /* linked timers, the asio timer runs while > 0 */
+  uint32_t _time  = 0;  /* current tick */
+  wheel_list _near[WHEEL_NEAR];
+  wheel_list _level[4][WHEEL_LEVEL];
+};
+
+/* os.timer{ wheel = true }, the same methods as os.timer() on the wheel of the service */
+struct wheel_timer final {
+  wheel_node* node;
+
+  inline wheel_timer()
+    : node(new wheel_node()) {
+  }
+  inline static const char* name() {
+    return "skynet wheel timer";
+  }
+  inline static wheel_timer* __this(lua_State* L) {
+    return checkudata<wheel_timer>(L, 1, name());
+  }
+  static int __gc(lua_State* L) {
+    auto self = __this(L);
+    auto node = self->node;
+    if (node->running) {
+      node->orphan = true; /* released by the wheel after the callback */
+    }
+    else {
+      cancel(L);
+      delete node;
+    }
+    self->~wheel_timer();
+    return 0;
+  }
+  static int cancel(lua_State* L) {
+    auto node = __this(L)->node;
+    timing_wheel::local().remove(node);
+    if (node->running) {
+      node->stopped = true;
+    }
+    else if (node->handler) {
+      lua_unref(L, node->handler);
+      node->handler = 0;
+    }
+    return 0;
+  }
+  static int expires(lua_State* L) {
+    auto self = __this(L);
+    size_t timeout = luaL_checkinteger(L, 2);
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+
+    auto node = self->node;
+    timing_wheel::local().remove(node);
+    if (node->handler) {
+      lua_unref(L, node->handler);
+    }
+    node->handler = lua_ref(L, 3);
+    node->stopped = false;
+    timing_wheel::local().add(node, timeout);
+    return 0;
+  }
+  static void init_metatable(lua_State* L) {
+    const luaL_Reg methods[] = {
+      { "__gc",      __gc        },
+      { "cancel",    cancel      },
+      { "expires",   expires     },
+      { NULL,        NULL        }
+    };
+    newmetatable(L, name(), methods);
+    lua_pop(L, 1);
+  }
+};
 
 /********************************************************************************/
 
@@ -9,28 +326,35 @@ struct class_timer final {
   inline class_timer()
     : _timer(*lua_service()) {
   }
+  /* a callback running, the timer may be cancelled or collected meanwhile */
+  struct running_type {
+    class_timer* self;
+    int handler;
+    std::shared_ptr<bool> pending;
+  };
+  static void finish(lua_State* L, void* owner, size_t expires) {
+    auto running = (running_type*)owner;
+    if (expires == 0 || !*running->pending) {
+      *running->pending = false;
+      lua_unref(L, running->handler);
+    }
+    else {
+      running->self->on_timer(L, expires, running->handler, running->pending);
+    }
+    delete running;
+  }
   int on_timer(lua_State* L, size_t timeout, int handler, std::shared_ptr<bool> pending) {
     _timer.expires_after(
       std::chrono::milliseconds(timeout)
     );
     _timer.async_wait([=](const error_code& ec) {
+      io::service::measure measure(stats_timer);
       lua_State* L = lua_local();
-      lua_auto_revert revert(L);
-      lua_auto_unref  unref(L, handler);
       if (ec || !*pending) {
+        lua_unref(L, handler);
         return;
       }
-      lua_pushref(L, handler);
-      if (lua_pcall(L, 0, 1, 0) != LUA_OK) {
-        lua_ferror("%s\n", luaL_checkstring(L, -1));
-      }
-      size_t expires = lua_tointeger(L, -1);
-      if (expires == 0) {
-        *pending = false;
-        return;
-      }
-      unref.cancel();
-      on_timer(L, (expires ? expires : timeout), handler, pending);
+      timer_callback::call(L, handler, finish, new running_type{ this, handler, pending });
     });
     return 0;
   }
@@ -83,6 +407,20 @@ public:
     lua_pop(L, 1);
   }
   static int create(lua_State* L) {
+    if (lua_istable(L, 1)) {
+      lua_getfield(L, 1, "wheel");
+      bool wheel = lua_toboolean(L, -1) != 0;
+      lua_pop(L, 1);
+      if (wheel) {
+        auto self = newuserdata<wheel_timer>(L, wheel_timer::name());
+        if (!self) {
+          lua_pushnil(L);
+          lua_pushliteral(L, "no memory");
+          return 2;
+        }
+        return 1;
+      }
+    }
     auto self = newuserdata<class_timer>(L, name());
     if (!self) {
       lua_pushnil(L);
@@ -93,8 +431,9 @@ public:
   }
   static int open_library(lua_State* L) {
     init_metatable(L);
+    wheel_timer::init_metatable(L);
     const luaL_Reg methods[] = {
-      { "timer",  create   }, /* os.timer() */
+      { "timer",  create   }, /* os.timer([{ wheel = true }]) */
       { NULL,     NULL     }
     };
     return new_module(L, "os", methods);
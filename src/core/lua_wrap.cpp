@@ -5,6 +5,11 @@
 #ifdef _MSC_VER
 #include <set>
 #endif
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
 
 /* Allows a preprocessor directive to override MAX_NESTING */
 #ifndef LUACMSGPACK_MAX_NESTING
@@ -81,50 +86,60 @@ static void memrevifle(void *ptr, size_t len) {
 * This is a simple implementation of string buffers. The only operation
 * supported is creating empty buffers and appending bytes to it.
 * The string buffer uses 2x preallocation on every realloc for O(N) append
-* behavior.  */
+* behavior. Every thread keeps one buffer for all of its wrap calls, so the
+* memory is only grown, and given back once it is larger than MP_BUF_RETAIN.
+* The memory comes from the allocator of the state, which accounts it. */
+
+/* Allows a preprocessor directive to override MP_BUF_RETAIN */
+#ifndef MP_BUF_RETAIN
+#define MP_BUF_RETAIN  (1024 * 1024) /* Max bytes kept by a thread buffer. */
+#endif
 
 typedef struct mp_buf {
-  unsigned char *b;
-  size_t len, free;
+  unsigned char *b = nullptr;
+  size_t len = 0, free = 0;
+  lua_Alloc alloc = nullptr;
+  void *ud = nullptr;
+  ~mp_buf() { if (b) alloc(ud, b, len + free, 0); }
 } mp_buf;
 
-static void *mp_realloc(lua_State *L, void *target, size_t osize,size_t nsize) {
-  void *(*local_realloc) (void *, void *, size_t osize, size_t nsize) = NULL;
-  void *ud;
-
-  local_realloc = lua_getallocf(L, &ud);
-
-  return local_realloc(ud, target, osize, nsize);
+static mp_buf *mp_buf_local() {
+  static thread_local mp_buf buf;
+  buf.free += buf.len;
+  buf.len = 0;
+  return &buf;
 }
 
-static mp_buf *mp_buf_new(lua_State *L) {
-  mp_buf *buf = NULL;
-
-  /* Old size = 0; new size = sizeof(*buf) */
-  buf = (mp_buf*)mp_realloc(L, NULL, 0, sizeof(*buf));
-
-  buf->b = NULL;
-  buf->len = buf->free = 0;
-  return buf;
+static void mp_buf_release(mp_buf *buf) {
+  if (buf->len + buf->free > MP_BUF_RETAIN) {
+    buf->alloc(buf->ud, buf->b, buf->len + buf->free, 0);
+    buf->b = nullptr;
+    buf->len = buf->free = 0;
+  }
 }
 
-static void mp_buf_append(lua_State *L, mp_buf *buf, const unsigned char *s, size_t len) {
+static void mp_buf_reserve(lua_State *L, mp_buf *buf, size_t len) {
   if (buf->free < len) {
     size_t newsize = (buf->len+len)*2;
-
-    buf->b = (unsigned char*)mp_realloc(L, buf->b, buf->len + buf->free, newsize);
+    if (buf->alloc == nullptr) {
+      buf->alloc = lua_getallocf(L, &buf->ud);
+    }
+    unsigned char *b = (unsigned char*)buf->alloc(buf->ud, buf->b, buf->len + buf->free, newsize);
+    if (b == nullptr) {
+      luaL_error(L, "not enough memory");
+    }
+    buf->b = b;
     buf->free = newsize - buf->len;
   }
+}
+
+static void mp_buf_append(lua_State *L, mp_buf *buf, const unsigned char *s, size_t len) {
+  mp_buf_reserve(L, buf, len);
   memcpy(buf->b+buf->len,s,len);
   buf->len += len;
   buf->free -= len;
 }
 
-static void mp_buf_free(lua_State *L, mp_buf *buf) {
-  mp_realloc(L, buf->b, buf->len + buf->free, 0); /* realloc to 0 = free */
-  mp_realloc(L, buf, sizeof(*buf), 0);
-}
-
 /* ---------------------------- String cursor ----------------------------------
 * This simple data structure is used for parsing. Basically you create a cursor
 * using a string pointer and a length, then it is possible to access the
@@ -137,6 +152,7 @@ static void mp_buf_free(lua_State *L, mp_buf *buf) {
 #define MP_CUR_ERROR_NONE   0
 #define MP_CUR_ERROR_EOF    1   /* Not enough data to complete operation. */
 #define MP_CUR_ERROR_BADFMT 2   /* Bad data format */
+#define MP_CUR_ERROR_SCHEMA 3   /* Schema not registered */
 
 typedef struct mp_cur {
   const unsigned char *p;
@@ -162,6 +178,15 @@ static void mp_cur_init(mp_cur *cursor, const unsigned char *s, size_t len) {
     } \
 } while(0)
 
+/* A view is a read only proxy over the bytes of one encoded table, the string
+* owning them is kept as user value of the view. */
+#define nameof_view "wrap view"
+
+typedef struct mp_view {
+  const unsigned char *p;
+  size_t len;
+} mp_view;
+
 /* ------------------------- Low level MP encoding -------------------------- */
 
 static void mp_encode_bytes(lua_State *L, mp_buf *buf, const unsigned char *s, size_t len) {
@@ -283,50 +308,65 @@ static void mp_encode_int(lua_State *L, mp_buf *buf, int64_t n) {
   mp_buf_append(L,buf,b,enclen);
 }
 
-static void mp_encode_array(lua_State *L, mp_buf *buf, int64_t n) {
-  unsigned char b[5];
-  int enclen;
-
+/* Write the header of an array or a map with n entries, returns its size. */
+static int mp_header_of(unsigned char *b, int64_t n, unsigned char fix, unsigned char op16, unsigned char op32) {
   if (n <= 15) {
-    b[0] = 0x90 | (n & 0xf);    /* fix array */
-    enclen = 1;
-  } else if (n <= 65535) {
-    b[0] = 0xdc;                /* array 16 */
+    b[0] = fix | (n & 0xf);     /* fix array/map */
+    return 1;
+  }
+  if (n <= 65535) {
+    b[0] = op16;                /* array/map 16 */
     b[1] = (n & 0xff00) >> 8;
     b[2] = n & 0xff;
-    enclen = 3;
-  } else {
-    b[0] = 0xdd;                /* array 32 */
-    b[1] = (unsigned char)((n & 0xff000000) >> 24);
-    b[2] = (unsigned char)((n & 0xff0000) >> 16);
-    b[3] = (unsigned char)((n & 0xff00) >> 8);
-    b[4] = (unsigned char)((n & 0xff));
-    enclen = 5;
+    return 3;
   }
-  mp_buf_append(L,buf,b,enclen);
+  b[0] = op32;                  /* array/map 32 */
+  b[1] = (unsigned char)((n & 0xff000000) >> 24);
+  b[2] = (unsigned char)((n & 0xff0000) >> 16);
+  b[3] = (unsigned char)((n & 0xff00) >> 8);
+  b[4] = (unsigned char)((n & 0xff));
+  return 5;
 }
 
-static void mp_encode_map(lua_State *L, mp_buf *buf, int64_t n) {
-  unsigned char b[5];
-  int enclen;
+static int mp_header_width(size_t n) {
+  return n <= 15 ? 1 : (n <= 65535 ? 3 : 5);
+}
 
-  if (n <= 15) {
-    b[0] = 0x80 | (n & 0xf);    /* fix map */
-    enclen = 1;
-  } else if (n <= 65535) {
-    b[0] = 0xde;                /* map 16 */
-    b[1] = (n & 0xff00) >> 8;
-    b[2] = n & 0xff;
-    enclen = 3;
-  } else {
-    b[0] = 0xdf;                /* map 32 */
-    b[1] = (unsigned char)((n & 0xff000000) >> 24);
-    b[2] = (unsigned char)((n & 0xff0000) >> 16);
-    b[3] = (unsigned char)((n & 0xff00) >> 8);
-    b[4] = (unsigned char)((n & 0xff));
-    enclen = 5;
+/* Leave room for a header guessed from hint, the real one is written later by
+* mp_patch_header once the number of entries is known. */
+static size_t mp_reserve_header(lua_State *L, mp_buf *buf, size_t hint, int *width) {
+  size_t offset = buf->len;
+  *width = mp_header_width(hint);
+  mp_buf_reserve(L, buf, *width);
+  buf->len  += *width;
+  buf->free -= *width;
+  return offset;
+}
+
+/* Write the header reserved at offset, the body is only moved when the guessed
+* width differs from the real one. */
+static void mp_patch(lua_State *L, mp_buf *buf, size_t offset, int width, const unsigned char *b, int enclen) {
+  if (enclen != width) {
+    unsigned char *body;
+    size_t size = buf->len - offset - width;
+    if (enclen > width) {
+      mp_buf_reserve(L, buf, enclen - width);
+    }
+    body = buf->b + offset + width;
+    memmove(body + enclen - width, body, size);
+    buf->len  += enclen - width;
+    buf->free -= enclen - width;
   }
-  mp_buf_append(L,buf,b,enclen);
+  memcpy(buf->b + offset, b, enclen);
+}
+
+/* The guess is only wrong for a table of more than 15 entries without array
+* part. */
+static void mp_patch_header(lua_State *L, mp_buf *buf, size_t offset, int width, int array, size_t n) {
+  unsigned char b[5];
+  int enclen = array ? mp_header_of(b, n, 0x90, 0xdc, 0xdd)
+                     : mp_header_of(b, n, 0x80, 0xde, 0xdf);
+  mp_patch(L, buf, offset, width, b, enclen);
 }
 
 /* --------------------------- Lua types encoding --------------------------- */
@@ -369,90 +409,79 @@ static void mp_encode_lua_number(lua_State *L, mp_buf *buf) {
 
 static void mp_encode_lua_type(lua_State *L, mp_buf *buf, int level);
 
-/* Convert a lua table into a message pack list. */
-static void mp_encode_lua_table_as_array(lua_State *L, mp_buf *buf, int level) {
-#if LUA_VERSION_NUM < 502
-  size_t len = lua_objlen(L,-1), j;
-#else
-  size_t len = lua_rawlen(L,-1), j;
-#endif
-
-  mp_encode_array(L,buf,len);
-  luaL_checkstack(L, 1, "in function mp_encode_lua_table_as_array");
-  for (j = 1; j <= len; j++) {
-    lua_pushnumber(L, (lua_Number)j);
-    lua_gettable(L,-2);
-    mp_encode_lua_type(L,buf,level+1);
-  }
+/* Encode a map entry for the key and value on top of the stack, the value is
+* popped and the key is kept for the next lua_next. */
+static void mp_encode_lua_entry(lua_State *L, mp_buf *buf, int level) {
+  lua_pushvalue(L,-2); /* Stack: ... key value key */
+  mp_encode_lua_type(L,buf,level+1); /* encode key */
+  mp_encode_lua_type(L,buf,level+1); /* encode val */
 }
 
-/* Convert a lua table into a message pack key-value map. */
-static void mp_encode_lua_table_as_map(lua_State *L, mp_buf *buf, int level) {
-  size_t len = 0;
-
-  /* First step: count keys into table. No other way to do it with the
-  * Lua API, we need to iterate a first time. Note that an alternative
-  * would be to do a single run, and then hack the buffer to insert the
-  * map opcodes for message pack. Too hackish for this lib. */
-  luaL_checkstack(L, 3, "in function mp_encode_lua_table_as_map");
-  lua_pushnil(L);
-  while(lua_next(L,-2)) {
-    lua_pop(L,1); /* remove value, keep key for next iteration. */
-    len++;
-  }
-
-  /* Step two: actually encoding of the map. */
-  mp_encode_map(L,buf,len);
-  lua_pushnil(L);
-  while(lua_next(L,-2)) {
-    /* Stack: ... key value */
-    lua_pushvalue(L,-2); /* Stack: ... key value key */
-    mp_encode_lua_type(L,buf,level+1); /* encode key */
-    mp_encode_lua_type(L,buf,level+1); /* encode val */
-  }
-}
-
-/* Returns true if the Lua table on top of the stack is exclusively composed
-* of keys from numerical keys from 1 up to N, with N being the total number
-* of elements, without any hole in the middle. */
-static int table_is_an_array(lua_State *L) {
-  int count = 0, max = 0;
-#if LUA_VERSION_NUM < 503
-  lua_Number n;
-#else
+/* Returns true if the key on top of the stack and all the keys after it are
+* the integers count+1..len, each one once. Pops the key in any case. */
+static int table_rest_is_sequence(lua_State *L, size_t count, size_t len) {
+  size_t rest = 0;
   lua_Integer n;
-#endif
 
   /* Stack top on function entry */
-  int stacktop;
-
-  stacktop = lua_gettop(L);
+  int stacktop = lua_gettop(L) - 1;
+  do {
+    lua_settop(L, stacktop + 1); /* Stack: ... key */
+    if (!lua_isinteger(L,-1) || (n = lua_tointeger(L,-1)) <= (lua_Integer)count ||
+      n > (lua_Integer)len) {
+      lua_settop(L, stacktop);
+      return 0;
+    }
+    rest++;
+  } while(lua_next(L,-2));
+  lua_settop(L, stacktop);
+  return rest == len - count;
+}
 
+/* Convert a lua table into a message pack list or key-value map in a single
+* traversal. The table is optimistically written as a list while lua_next
+* yields the keys 1, 2, 3... in order, which is the case of the array part.
+* Keys of a sequence left in the hash part are only checked, then written in
+* order. Any other key starts the table over as a map, and a table without
+* key 1 is a map from the start. The header is reserved from the length hint
+* and patched once the number of entries is known. */
+static void mp_encode_lua_table_once(lua_State *L, mp_buf *buf, int level) {
+  size_t len = lua_rawlen(L,-1), count = 0, j;
+  int array = (len > 0), width = 0;
+  size_t offset = mp_reserve_header(L, buf, len, &width);
+
+  luaL_checkstack(L, 3, "in function mp_encode_lua_table_once");
   lua_pushnil(L);
   while(lua_next(L,-2)) {
     /* Stack: ... key value */
+    if (!array) {
+      mp_encode_lua_entry(L,buf,level);
+      count++;
+      continue;
+    }
+    if (lua_isinteger(L,-2) && lua_tointeger(L,-2) == (lua_Integer)(count+1)) {
+      mp_encode_lua_type(L,buf,level+1); /* encode val */
+      count++;
+      continue;
+    }
     lua_pop(L,1); /* Stack: ... key */
-                  /* The <= 0 check is valid here because we're comparing indexes. */
-#if LUA_VERSION_NUM < 503
-    if ((LUA_TNUMBER != lua_type(L,-1)) || (n = lua_tonumber(L, -1)) <= 0 ||
-      !IS_INT_EQUIVALENT(n))
-#else
-    if (!lua_isinteger(L,-1) || (n = lua_tointeger(L, -1)) <= 0)
-#endif
-    {
-      lua_settop(L, stacktop);
-      return 0;
+    if (table_rest_is_sequence(L, count, len)) {
+      for (j = count+1; j <= len; j++) {
+        lua_rawgeti(L,-1,(lua_Integer)j);
+        mp_encode_lua_type(L,buf,level+1);
+      }
+      count = len;
+      break;
     }
-    max = int(n > max ? n : max);
-    count++;
+    /* Not a sequence, start over and write the table as a map. */
+    array = 0;
+    count = 0;
+    buf->free += buf->len - offset - width;
+    buf->len = offset + width;
+    lua_pushnil(L);
   }
-  /* We have the total number of elements in "count". Also we have
-  * the max index encountered in "max". We can't reach this code
-  * if there are indexes <= 0. If you also note that there can not be
-  * repeated keys into a table, you have that if max==count you are sure
-  * that there are all the keys form 1 to count (both included). */
-  lua_settop(L, stacktop);
-  return max == count;
+  /* An empty table is still an empty list */
+  mp_patch_header(L,buf,offset,width,array || count == 0,count);
 }
 
 static void mp_encode_lua_null(lua_State *L, mp_buf *buf) {
@@ -463,9 +492,202 @@ static void mp_encode_lua_null(lua_State *L, mp_buf *buf) {
 }
 
 
-/* If the length operator returns non-zero, that is, there is at least
-* an object at key '1', we serialize to message pack list. Otherwise
-* we use a map. */
+/* ------------------------------- Schemas -----------------------------------
+* A schema lists the fields of a fixed message shape. A table having the
+* metatable of a schema is written as an ext value of type MP_EXT_SCHEMA:
+*   id (1 byte), bitmap of the present fields, present fields in order
+* Keys are dropped, the numeric types are written with a fixed width and the
+* other ones as regular message pack values. Schemas are shared by all the
+* services of the process, each lua_State builds its metatable on first use,
+* holding the field names at 1..n so that they are never hashed again. */
+
+#define MP_EXT_SCHEMA   0x01
+#define MP_MAX_SCHEMAS  256
+
+enum mp_field_type {
+  MP_FIELD_ANY, MP_FIELD_STRING, MP_FIELD_BOOLEAN,
+  MP_FIELD_I8,  MP_FIELD_I16,    MP_FIELD_I32, MP_FIELD_I64,
+  MP_FIELD_U8,  MP_FIELD_U16,    MP_FIELD_U32,
+  MP_FIELD_F32, MP_FIELD_F64
+};
+
+static const char *const mp_field_names[] = {
+  "any", "string", "boolean", "i8", "i16", "i32", "i64", "u8", "u16", "u32", "f32", "f64", NULL
+};
+
+typedef struct mp_field {
+  std::string name;
+  int type;
+} mp_field;
+
+typedef struct mp_schema {
+  int id;
+  std::vector<mp_field> fields;
+} mp_schema;
+
+static std::mutex mp_schema_mutex;
+static std::unique_ptr<mp_schema> mp_schema_owned[MP_MAX_SCHEMAS];
+static std::atomic<const mp_schema*> mp_schemas[MP_MAX_SCHEMAS];
+static const char mp_schema_key = 0;  /* registry: the metatables by id */
+static const char mp_schema_field = 0;  /* metatable: the schema */
+
+/* Push the metatable of a schema for this lua_State */
+static void mp_push_schema(lua_State *L, const mp_schema *schema) {
+  luaL_checkstack(L, 3, "in function mp_push_schema");
+  if (lua_rawgetp(L, LUA_REGISTRYINDEX, &mp_schema_key) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &mp_schema_key);
+  }
+  if (lua_rawgeti(L, -1, schema->id) != LUA_TTABLE) {
+    int n = (int)schema->fields.size();
+    lua_pop(L, 1);
+    lua_createtable(L, n, 1);
+    for (int i = 0; i < n; i++) {
+      const mp_field &field = schema->fields[i];
+      lua_pushlstring(L, field.name.c_str(), field.name.size());
+      lua_rawseti(L, -2, i + 1);
+    }
+    lua_pushlightuserdata(L, (void*)schema);
+    lua_rawsetp(L, -2, &mp_schema_field);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, -3, schema->id);
+  }
+  lua_remove(L, -2);
+}
+
+/* Returns the schema of the metatable on top of the stack, if it is one.
+ * The key is a light userdata: nothing is allocated, so no GC step (and no
+ * finalizer calling wrap) can run in the middle of an encode. */
+static const mp_schema *mp_schema_of(lua_State *L) {
+  const mp_schema *schema = NULL;
+  if (lua_rawgetp(L, -1, &mp_schema_field) == LUA_TLIGHTUSERDATA) {
+    schema = (const mp_schema*)lua_touserdata(L, -1);
+  }
+  lua_pop(L, 1);
+  return schema;
+}
+
+static int mp_field_error(lua_State *L, const mp_schema *schema, const mp_field &field) {
+  return luaL_error(L, "field '%s' of schema %d expects %s, got %s", field.name.c_str(),
+    schema->id, mp_field_names[field.type], luaL_typename(L, -1));
+}
+
+/* Encode the value on top of the stack as a field, then pops it. */
+static void mp_encode_lua_field(lua_State *L, mp_buf *buf, const mp_schema *schema, const mp_field &field, int level) {
+  unsigned char b[8];
+  int size = 0;
+  int isnum = 0;
+  lua_Integer n = 0;
+
+  switch (field.type) {
+  case MP_FIELD_ANY:
+    mp_encode_lua_type(L,buf,level+1);
+    return;
+  case MP_FIELD_STRING:
+    if (lua_type(L,-1) != LUA_TSTRING) mp_field_error(L, schema, field);
+    mp_encode_lua_string(L,buf);
+    break;
+  case MP_FIELD_BOOLEAN:
+    if (lua_type(L,-1) != LUA_TBOOLEAN) mp_field_error(L, schema, field);
+    mp_encode_lua_bool(L,buf);
+    break;
+  case MP_FIELD_F32: {
+    float f;
+    if (lua_type(L,-1) != LUA_TNUMBER) mp_field_error(L, schema, field);
+    f = (float)lua_tonumber(L,-1);
+    memcpy(b,&f,4);
+    memrevifle(b,4);
+    mp_buf_append(L,buf,b,4);
+    break;
+  }
+  case MP_FIELD_F64: {
+    double d;
+    if (lua_type(L,-1) != LUA_TNUMBER) mp_field_error(L, schema, field);
+    d = (double)lua_tonumber(L,-1);
+    memcpy(b,&d,8);
+    memrevifle(b,8);
+    mp_buf_append(L,buf,b,8);
+    break;
+  }
+  default:
+    if (lua_type(L,-1) == LUA_TNUMBER) {
+      n = lua_tointegerx(L,-1,&isnum);
+    }
+    switch (field.type) {
+    case MP_FIELD_I8:  size = 1; isnum = isnum && n >= INT8_MIN  && n <= INT8_MAX;   break;
+    case MP_FIELD_I16: size = 2; isnum = isnum && n >= INT16_MIN && n <= INT16_MAX;  break;
+    case MP_FIELD_I32: size = 4; isnum = isnum && n >= INT32_MIN && n <= INT32_MAX;  break;
+    case MP_FIELD_U8:  size = 1; isnum = isnum && n >= 0 && n <= UINT8_MAX;          break;
+    case MP_FIELD_U16: size = 2; isnum = isnum && n >= 0 && n <= UINT16_MAX;         break;
+    case MP_FIELD_U32: size = 4; isnum = isnum && n >= 0 && n <= (lua_Integer)UINT32_MAX; break;
+    default:           size = 8; break;
+    }
+    if (!isnum) mp_field_error(L, schema, field);
+    for (int i = size - 1; i >= 0; i--) {
+      b[i] = (unsigned char)(n & 0xff);
+      n = (lua_Integer)((uint64_t)n >> 8);
+    }
+    mp_buf_append(L,buf,b,size);
+    break;
+  }
+  lua_pop(L,1);
+}
+
+/* Encode the table below the schema metatable on top of the stack. */
+static void mp_encode_lua_schema(lua_State *L, mp_buf *buf, const mp_schema *schema, int level) {
+  unsigned char b[6];
+  int width = 3, enclen;
+  unsigned char id = (unsigned char)schema->id;
+  size_t n = schema->fields.size(), bitmap, len, i;
+  size_t offset = buf->len;
+
+  /* ext 8 header is guessed, bitmap is filled while fields are written */
+  mp_buf_reserve(L, buf, width);
+  buf->len  += width;
+  buf->free -= width;
+  mp_buf_append(L,buf,&id,1);
+  bitmap = buf->len;
+  for (i = 0; i < (n + 7) / 8; i++) {
+    unsigned char zero = 0;
+    mp_buf_append(L,buf,&zero,1);
+  }
+  luaL_checkstack(L, 2, "in function mp_encode_lua_schema");
+  for (i = 0; i < n; i++) {
+    /* Stack: ... table metatable */
+    lua_rawgeti(L, -1, (lua_Integer)(i + 1));
+    if (lua_rawget(L, -3) == LUA_TNIL) {
+      lua_pop(L,1);
+      continue;
+    }
+    buf->b[bitmap + i / 8] |= (unsigned char)(1 << (i % 8));
+    mp_encode_lua_field(L, buf, schema, schema->fields[i], level);
+  }
+  len = buf->len - offset - width;
+  if (len <= 0xff) {
+    b[0] = 0xc7;  /* ext 8 */
+    b[1] = (unsigned char)len;
+    enclen = 2;
+  } else if (len <= 0xffff) {
+    b[0] = 0xc8;  /* ext 16 */
+    b[1] = (unsigned char)((len & 0xff00) >> 8);
+    b[2] = (unsigned char)(len & 0xff);
+    enclen = 3;
+  } else {
+    b[0] = 0xc9;  /* ext 32 */
+    b[1] = (unsigned char)((len & 0xff000000) >> 24);
+    b[2] = (unsigned char)((len & 0xff0000) >> 16);
+    b[3] = (unsigned char)((len & 0xff00) >> 8);
+    b[4] = (unsigned char)(len & 0xff);
+    enclen = 5;
+  }
+  b[enclen++] = MP_EXT_SCHEMA;
+  mp_patch(L, buf, offset, width, b, enclen);
+}
+
+/* Tables with the keys 1..N and nothing else are serialized to message pack
+* list, the others to a map. */
 static void mp_encode_lua_table(lua_State *L, mp_buf *buf, int level) {
 #ifdef LUA_DEBUG
   static thread_local std::set<const void*> readed;
@@ -484,17 +706,35 @@ static void mp_encode_lua_table(lua_State *L, mp_buf *buf, int level) {
     return;
   }
 #endif
-  if (table_is_an_array(L)) {
-    mp_encode_lua_table_as_array(L, buf, level);
-  }
-  else {
-    mp_encode_lua_table_as_map(L,buf,level);
+  if (lua_getmetatable(L, -1)) {
+    const mp_schema *schema = mp_schema_of(L);
+    if (schema) {
+      mp_encode_lua_schema(L, buf, schema, level);
+    }
+    lua_pop(L, 1);
+    if (schema) {
+#ifdef LUA_DEBUG
+      readed.erase(lua_topointer(L, -1));
+#endif
+      return;
+    }
   }
+  mp_encode_lua_table_once(L, buf, level);
 #ifdef LUA_DEBUG
   readed.erase(lua_topointer(L, -1));
 #endif
 }
 
+/* The bytes of a view are written as they are, other userdata are nil. */
+static void mp_encode_lua_view(lua_State *L, mp_buf *buf) {
+  mp_view *view = (mp_view*)luaL_testudata(L,-1,nameof_view);
+  if (view) {
+    mp_buf_append(L,buf,view->p,view->len);
+  } else {
+    mp_encode_lua_null(L,buf);
+  }
+}
+
 static void mp_encode_lua_type(lua_State *L, mp_buf *buf, int level) {
   int t = lua_type(L,-1);
 
@@ -516,6 +756,7 @@ static void mp_encode_lua_type(lua_State *L, mp_buf *buf, int level) {
     break;
 #endif
   case LUA_TTABLE: mp_encode_lua_table(L,buf,level); break;
+  case LUA_TUSERDATA: mp_encode_lua_view(L,buf); break;
   default: mp_encode_lua_null(L,buf); break;
   }
   lua_pop(L,1);
@@ -536,25 +777,18 @@ static int pack_any(lua_State *L) {
   if (!lua_checkstack(L, nargs))
     return luaL_argerror(L, 0, "Too many arguments for pack.");
 
-  buf = mp_buf_new(L);
+  /* All the arguments are encoded one after another in the thread buffer,
+  * a failed encoding leaves garbage that the next call resets. */
+  buf = mp_buf_local();
   for(i = 1; i <= nargs; i++) {
     /* Copy argument i to top of stack for _encode processing;
     * the encode function pops it from the stack when complete. */
     luaL_checkstack(L, 1, "in function mp_check");
     lua_pushvalue(L, i);
     mp_encode_lua_type(L,buf,0);
-    lua_pushlstring(L,(char*)buf->b,buf->len);
-
-    /* Reuse the buffer for the next operation by
-    * setting its free count to the total buffer size
-    * and the current position to zero. */
-    buf->free += buf->len;
-    buf->len = 0;
   }
-  mp_buf_free(L, buf);
-
-  /* Concatenate all nargs buffers together */
-  lua_concat(L, nargs);
+  lua_pushlstring(L,(char*)buf->b,buf->len);
+  mp_buf_release(buf);
   return 1;
 }
 
@@ -588,6 +822,122 @@ static void mp_decode_to_lua_hash(lua_State *L, mp_cur *c, size_t len) {
   }
 }
 
+/* Bytes of a fixed-width field, 0 for the ones written as message pack. */
+static size_t mp_field_width(int type) {
+  switch (type) {
+  case MP_FIELD_I8:  case MP_FIELD_U8:  return 1;
+  case MP_FIELD_I16: case MP_FIELD_U16: return 2;
+  case MP_FIELD_I32: case MP_FIELD_U32: case MP_FIELD_F32: return 4;
+  case MP_FIELD_I64: case MP_FIELD_F64: return 8;
+  default: return 0;
+  }
+}
+
+/* Decode a fixed-width field to a Lua number. */
+static void mp_decode_to_lua_fixed(lua_State *L, mp_cur *c, int type) {
+  size_t size = mp_field_width(type);
+  uint64_t v = 0;
+
+  mp_cur_need(c,size);
+  if (type == MP_FIELD_F32) {
+    float f;
+    memcpy(&f,c->p,4);
+    memrevifle(&f,4);
+    lua_pushnumber(L,f);
+  } else if (type == MP_FIELD_F64) {
+    double d;
+    memcpy(&d,c->p,8);
+    memrevifle(&d,8);
+    lua_pushnumber(L,d);
+  } else {
+    for (size_t j = 0; j < size; j++) {
+      v = (v << 8) | c->p[j];
+    }
+    switch (type) {
+    case MP_FIELD_I8:  lua_pushinteger(L,(int8_t)v);  break;
+    case MP_FIELD_I16: lua_pushinteger(L,(int16_t)v); break;
+    case MP_FIELD_I32: lua_pushinteger(L,(int32_t)v); break;
+    default:           lua_pushinteger(L,(lua_Integer)v); break;
+    }
+  }
+  mp_cur_consume(c,size);
+}
+
+/* Read the id and bitmap at the start of a schema payload. */
+static const mp_schema *mp_cur_schema(mp_cur *c, const unsigned char **bitmap) {
+  const mp_schema *schema;
+  size_t nbytes;
+
+  if (c->left < 1) {
+    c->err = MP_CUR_ERROR_EOF;
+    return NULL;
+  }
+  schema = mp_schemas[c->p[0]].load();
+  if (schema == NULL) {
+    c->err = MP_CUR_ERROR_SCHEMA;
+    return NULL;
+  }
+  nbytes = (schema->fields.size() + 7) / 8;
+  if (c->left < 1 + nbytes) {
+    c->err = MP_CUR_ERROR_EOF;
+    return NULL;
+  }
+  *bitmap = c->p + 1;
+  mp_cur_consume(c,1+nbytes);
+  return schema;
+}
+
+#define mp_bitmap_test(b, i) ((b)[(i) / 8] & (1 << ((i) % 8)))
+
+/* Decode the payload of a schema ext value, the table is left on the stack. */
+static void mp_decode_to_lua_schema(lua_State *L, mp_cur *c) {
+  const unsigned char *bitmap = NULL;
+  const mp_schema *schema = mp_cur_schema(c, &bitmap);
+  size_t n, i;
+
+  if (schema == NULL) {
+    return;
+  }
+  n = schema->fields.size();
+  luaL_checkstack(L, 4, "in function mp_decode_to_lua_schema");
+  lua_createtable(L, 0, (int)n);
+  mp_push_schema(L, schema);
+  for (i = 0; i < n; i++) {
+    int type = schema->fields[i].type;
+    if (!mp_bitmap_test(bitmap, i)) {
+      continue;
+    }
+    /* Stack: ... table metatable name */
+    lua_rawgeti(L, -1, (lua_Integer)(i + 1));
+    if (mp_field_width(type) > 0) {
+      mp_decode_to_lua_fixed(L,c,type);
+    } else {
+      mp_decode_to_lua_type(L,c);
+    }
+    if (c->err) return;
+    lua_rawset(L, -4);
+  }
+  lua_setmetatable(L, -2);
+}
+
+/* Decode an ext value, only the schema type is known. */
+static void mp_decode_to_lua_ext(lua_State *L, mp_cur *c, size_t hdrlen, size_t len) {
+  mp_cur payload;
+
+  mp_cur_need(c,hdrlen+len);
+  if (c->p[hdrlen-1] != MP_EXT_SCHEMA) {
+    c->err = MP_CUR_ERROR_BADFMT;
+    return;
+  }
+  mp_cur_init(&payload, c->p+hdrlen, len);
+  mp_decode_to_lua_schema(L, &payload);
+  if (payload.err == MP_CUR_ERROR_NONE && payload.left != 0) {
+    payload.err = MP_CUR_ERROR_BADFMT;
+  }
+  c->err = payload.err;
+  mp_cur_consume(c,hdrlen+len);
+}
+
 /* Decode a Message Pack raw object pointed by the string cursor 'c' to
 * a Lua type, that is left as the only result on the stack. */
 static void mp_decode_to_lua_type(lua_State *L, mp_cur *c) {
@@ -778,6 +1128,22 @@ static void mp_decode_to_lua_type(lua_State *L, mp_cur *c) {
       mp_decode_to_lua_hash(L,c,l);
     }
     break;
+  case 0xc7:  /* ext 8 */
+    mp_cur_need(c,3);
+    mp_decode_to_lua_ext(L,c,3,c->p[1]);
+    break;
+  case 0xc8:  /* ext 16 */
+    mp_cur_need(c,4);
+    mp_decode_to_lua_ext(L,c,4,(c->p[1] << 8) | c->p[2]);
+    break;
+  case 0xc9:  /* ext 32 */
+    mp_cur_need(c,6);
+    mp_decode_to_lua_ext(L,c,6,
+      ((size_t)c->p[1] << 24) |
+      ((size_t)c->p[2] << 16) |
+      ((size_t)c->p[3] << 8) |
+      (size_t)c->p[4]);
+    break;
   default:    /* types that can't be idenitified by first byte value. */
     if ((c->p[0] & 0x80) == 0) {   /* positive fixnum */
       lua_pushunsigned(L,c->p[0]);
@@ -804,6 +1170,16 @@ static void mp_decode_to_lua_type(lua_State *L, mp_cur *c) {
   }
 }
 
+/* Bytes of a string or of a view, so that unwrap turns a view into tables */
+static const char *mp_checkbytes(lua_State *L, int idx, size_t *len) {
+  mp_view *view = (mp_view*)luaL_testudata(L,idx,nameof_view);
+  if (view) {
+    *len = view->len;
+    return (const char*)view->p;
+  }
+  return luaL_checklstring(L,idx,len);
+}
+
 static int mp_unpack_full(lua_State *L, int limit, int offset) {
   size_t len;
   const char *s;
@@ -811,7 +1187,7 @@ static int mp_unpack_full(lua_State *L, int limit, int offset) {
   int cnt; /* Number of objects unpacked */
   int decode_all = (!limit && !offset);
 
-  s = luaL_checklstring(L,1,&len); /* if no match, exits */
+  s = mp_checkbytes(L,1,&len); /* if no match, exits */
 
   if (offset < 0 || limit < 0) /* requesting negative off or lim is invalid */
     return luaL_error(L,
@@ -834,6 +1210,8 @@ static int mp_unpack_full(lua_State *L, int limit, int offset) {
       return luaL_error(L,"Missing bytes in input.");
     } else if (c.err == MP_CUR_ERROR_BADFMT) {
       return luaL_error(L,"Bad data format in input.");
+    } else if (c.err == MP_CUR_ERROR_SCHEMA) {
+      return luaL_error(L,"Unknown schema in input.");
     }
   }
 
@@ -887,6 +1265,606 @@ static int unpack_limit(lua_State *L) {
   return mp_unpack_full(L, limit, offset);
 }
 
+/* -------------------------------- Views ------------------------------------
+* unwrap_view decodes the top level values like unwrap, except that tables are
+* returned as views. Indexing a view only decodes the entries on the way to the
+* key, nested tables come back as views over the same bytes. pairs and # work
+* on views, wrap copies their bytes without encoding again, and unwrap turns
+* them into real tables. */
+
+enum mp_view_kind { MP_VIEW_ARRAY, MP_VIEW_MAP, MP_VIEW_SCHEMA };
+
+static void mp_check_error(lua_State *L, mp_cur *c) {
+  if (c->err == MP_CUR_ERROR_EOF) {
+    luaL_error(L,"Missing bytes in input.");
+  } else if (c->err == MP_CUR_ERROR_BADFMT) {
+    luaL_error(L,"Bad data format in input.");
+  } else if (c->err == MP_CUR_ERROR_SCHEMA) {
+    luaL_error(L,"Unknown schema in input.");
+  }
+}
+
+/* Skip values until pending is zero, entries of the nested tables are added to
+* pending. When bytes are missing the cursor stays on the value that is cut,
+* so that skipping can go on from there once more bytes are available. */
+static void mp_cur_skip_pending(mp_cur *c, size_t *pending) {
+  while (*pending > 0) {
+    size_t hdr = 1, body = 0, more = 0;
+    unsigned char b;
+
+    mp_cur_need(c,1);
+    b = c->p[0];
+    switch (b) {
+    case 0xc0: case 0xc2: case 0xc3: break;
+    case 0xcc: case 0xd0: hdr = 2; break;
+    case 0xcd: case 0xd1: hdr = 3; break;
+    case 0xce: case 0xd2: case 0xca: hdr = 5; break;
+    case 0xcf: case 0xd3: case 0xcb: hdr = 9; break;
+    case 0xd9: /* raw 8 */
+    case 0xc7: /* ext 8 */
+      hdr = (b == 0xd9) ? 2 : 3;
+      mp_cur_need(c,hdr);
+      body = c->p[1];
+      break;
+    case 0xda: /* raw 16 */
+    case 0xc8: /* ext 16 */
+      hdr = (b == 0xda) ? 3 : 4;
+      mp_cur_need(c,hdr);
+      body = (c->p[1] << 8) | c->p[2];
+      break;
+    case 0xdb: /* raw 32 */
+    case 0xc9: /* ext 32 */
+    case 0xdd: /* array 32 */
+    case 0xdf: /* map 32 */
+      hdr = (b == 0xc9) ? 6 : 5;
+      mp_cur_need(c,hdr);
+      body = ((size_t)c->p[1] << 24) | ((size_t)c->p[2] << 16) |
+        ((size_t)c->p[3] << 8) | (size_t)c->p[4];
+      if (b == 0xdd || b == 0xdf) {
+        more = (b == 0xdd) ? body : body * 2;
+        body = 0;
+      }
+      break;
+    case 0xdc: /* array 16 */
+    case 0xde: /* map 16 */
+      hdr = 3;
+      mp_cur_need(c,hdr);
+      more = (c->p[1] << 8) | c->p[2];
+      more = (b == 0xdc) ? more : more * 2;
+      break;
+    default:
+      if ((b & 0x80) == 0 || (b & 0xe0) == 0xe0) {
+        /* fixnum */
+      } else if ((b & 0xe0) == 0xa0) {
+        body = b & 0x1f;
+      } else if ((b & 0xf0) == 0x90) {
+        more = b & 0xf;
+      } else if ((b & 0xf0) == 0x80) {
+        more = (b & 0xf) * 2;
+      } else {
+        c->err = MP_CUR_ERROR_BADFMT;
+        return;
+      }
+    }
+    mp_cur_need(c,hdr+body);
+    mp_cur_consume(c,hdr+body);
+    *pending += more;
+    *pending -= 1;
+  }
+}
+
+/* Skip one value without decoding it. */
+static void mp_cur_skip(mp_cur *c) {
+  size_t pending = 1;
+  mp_cur_skip_pending(c, &pending);
+}
+
+/* Skip a field of a schema. */
+static void mp_cur_skip_field(mp_cur *c, int type) {
+  size_t size = mp_field_width(type);
+  if (size == 0) {
+    mp_cur_skip(c);
+    return;
+  }
+  mp_cur_need(c,size);
+  mp_cur_consume(c,size);
+}
+
+static int mp_is_table(unsigned char b) {
+  return (b & 0xe0) == 0x80 || (b >= 0xdc && b <= 0xdf) || (b >= 0xc7 && b <= 0xc9);
+}
+
+/* Push a view of len bytes at p, owned by the string at index owner. */
+static void mp_push_view(lua_State *L, int owner, const unsigned char *p, size_t len) {
+  mp_view *view = newuserdata<mp_view>(L, nameof_view);
+  view->p = p;
+  view->len = len;
+  lua_pushvalue(L, owner);
+  lua_setiuservalue(L, -2, 1);
+}
+
+/* Like mp_decode_to_lua_type, but a table is pushed as a view. */
+static void mp_decode_to_lua_view(lua_State *L, mp_cur *c, int owner) {
+  const unsigned char *begin;
+
+  mp_cur_need(c,1);
+  if (!mp_is_table(c->p[0])) {
+    mp_decode_to_lua_type(L,c);
+    return;
+  }
+  begin = c->p;
+  mp_cur_skip(c);
+  if (c->err) return;
+  luaL_checkstack(L, 2, "in function mp_decode_to_lua_view");
+  mp_push_view(L, owner, begin, (size_t)(c->p - begin));
+}
+
+/* Read the header of the table of a view. For a schema, n is the number of
+* fields and the bitmap is returned. */
+static int mp_cur_open(mp_cur *c, size_t *n, const mp_schema **schema, const unsigned char **bitmap) {
+  unsigned char b;
+
+  *n = 0;
+  if (c->left < 1) {
+    c->err = MP_CUR_ERROR_EOF;
+    return MP_VIEW_MAP;
+  }
+  b = c->p[0];
+  if ((b & 0xf0) == 0x90 || (b & 0xf0) == 0x80) {
+    *n = b & 0xf;
+    mp_cur_consume(c,1);
+    return (b & 0xf0) == 0x90 ? MP_VIEW_ARRAY : MP_VIEW_MAP;
+  }
+  if ((b == 0xdc || b == 0xde) && c->left >= 3) {
+    *n = (c->p[1] << 8) | c->p[2];
+    mp_cur_consume(c,3);
+    return b == 0xdc ? MP_VIEW_ARRAY : MP_VIEW_MAP;
+  }
+  if ((b == 0xdd || b == 0xdf) && c->left >= 5) {
+    *n = ((size_t)c->p[1] << 24) | ((size_t)c->p[2] << 16) |
+      ((size_t)c->p[3] << 8) | (size_t)c->p[4];
+    mp_cur_consume(c,5);
+    return b == 0xdd ? MP_VIEW_ARRAY : MP_VIEW_MAP;
+  }
+  if (b >= 0xc7 && b <= 0xc9) {
+    size_t hdr = (b == 0xc7) ? 3 : (b == 0xc8 ? 4 : 6);
+    if (c->left >= hdr && c->p[hdr-1] == MP_EXT_SCHEMA) {
+      mp_cur_consume(c,hdr);
+      *schema = mp_cur_schema(c, bitmap);
+      *n = *schema ? (*schema)->fields.size() : 0;
+      return MP_VIEW_SCHEMA;
+    }
+  }
+  c->err = MP_CUR_ERROR_BADFMT;
+  return MP_VIEW_MAP;
+}
+
+/* Compare the key at the cursor with the value at idx, the key is consumed. */
+static int mp_cur_key_equals(lua_State *L, mp_cur *c, int idx) {
+  size_t hdr = 0, len = 0;
+  unsigned char b;
+  int equal;
+
+  if (c->left < 1) {
+    c->err = MP_CUR_ERROR_EOF;
+    return 0;
+  }
+  b = c->p[0];
+  if (lua_type(L, idx) == LUA_TSTRING) {
+    if ((b & 0xe0) == 0xa0) {
+      hdr = 1; len = b & 0x1f;
+    } else if (b == 0xd9 && c->left >= 2) {
+      hdr = 2; len = c->p[1];
+    } else if (b == 0xda && c->left >= 3) {
+      hdr = 3; len = (c->p[1] << 8) | c->p[2];
+    }
+    if (hdr > 0) {
+      size_t size;
+      const char *key = lua_tolstring(L, idx, &size);
+      if (c->left < hdr + len) {
+        c->err = MP_CUR_ERROR_EOF;
+        return 0;
+      }
+      equal = (size == len && memcmp(key, c->p + hdr, len) == 0);
+      mp_cur_consume(c,hdr+len);
+      return equal;
+    }
+  }
+  /* other keys are decoded to be compared */
+  mp_decode_to_lua_type(L,c);
+  if (c->err) return 0;
+  equal = lua_rawequal(L, -1, idx);
+  lua_pop(L, 1);
+  return equal;
+}
+
+static int view_index(lua_State *L) {
+  mp_view *view = checkudata<mp_view>(L, 1, nameof_view);
+  const mp_schema *schema = NULL;
+  const unsigned char *bitmap = NULL;
+  size_t n = 0, i;
+  mp_cur c;
+
+  lua_settop(L, 2);
+  lua_getiuservalue(L, 1, 1); /* owner of the bytes at 3 */
+  mp_cur_init(&c, view->p, view->len);
+  switch (mp_cur_open(&c, &n, &schema, &bitmap)) {
+  case MP_VIEW_ARRAY: {
+    lua_Integer k = lua_isinteger(L, 2) ? lua_tointeger(L, 2) : 0;
+    if (k < 1 || (size_t)k > n) {
+      break;
+    }
+    for (i = 1; i < (size_t)k && !c.err; i++) {
+      mp_cur_skip(&c);
+    }
+    if (!c.err) {
+      mp_decode_to_lua_view(L, &c, 3);
+      mp_check_error(L, &c);
+      return 1;
+    }
+    break;
+  }
+  case MP_VIEW_MAP:
+    for (i = 0; i < n && !c.err; i++) {
+      if (mp_cur_key_equals(L, &c, 2)) {
+        mp_decode_to_lua_view(L, &c, 3);
+        mp_check_error(L, &c);
+        return 1;
+      }
+      if (!c.err) {
+        mp_cur_skip(&c);
+      }
+    }
+    break;
+  case MP_VIEW_SCHEMA:
+    for (i = 0; i < n && !c.err; i++) {
+      const mp_field &field = schema->fields[i];
+      int found = lua_type(L, 2) == LUA_TSTRING && field.name == lua_tostring(L, 2);
+      if (!mp_bitmap_test(bitmap, i)) {
+        if (found) break;
+        continue;
+      }
+      if (!found) {
+        mp_cur_skip_field(&c, field.type);
+        continue;
+      }
+      if (mp_field_width(field.type) > 0) {
+        mp_decode_to_lua_fixed(L, &c, field.type);
+      } else {
+        mp_decode_to_lua_view(L, &c, 3);
+      }
+      mp_check_error(L, &c);
+      return 1;
+    }
+    break;
+  }
+  mp_check_error(L, &c);
+  lua_pushnil(L);
+  return 1;
+}
+
+static int view_len(lua_State *L) {
+  mp_view *view = checkudata<mp_view>(L, 1, nameof_view);
+  const mp_schema *schema = NULL;
+  const unsigned char *bitmap = NULL;
+  size_t n = 0;
+  mp_cur c;
+
+  mp_cur_init(&c, view->p, view->len);
+  int kind = mp_cur_open(&c, &n, &schema, &bitmap);
+  mp_check_error(L, &c);
+  lua_pushinteger(L, kind == MP_VIEW_ARRAY ? (lua_Integer)n : 0);
+  return 1;
+}
+
+/* Iterator of pairs, upvalues are the view, the offset of the next entry and
+* the number of entries already read. */
+static int view_next(lua_State *L) {
+  mp_view *view = checkudata<mp_view>(L, lua_upvalueindex(1), nameof_view);
+  size_t offset = (size_t)lua_tointeger(L, lua_upvalueindex(2));
+  size_t index  = (size_t)lua_tointeger(L, lua_upvalueindex(3));
+  const mp_schema *schema = NULL;
+  const unsigned char *bitmap = NULL;
+  size_t n = 0;
+  mp_cur c;
+
+  mp_cur_init(&c, view->p, view->len);
+  int kind = mp_cur_open(&c, &n, &schema, &bitmap);
+  mp_check_error(L, &c);
+  if (offset > 0) {
+    mp_cur_init(&c, view->p + offset, view->len - offset);
+  }
+  if (kind == MP_VIEW_SCHEMA) {
+    while (index < n && !mp_bitmap_test(bitmap, index)) {
+      index++;
+    }
+  }
+  if (index >= n) {
+    return 0;
+  }
+  lua_settop(L, 0);
+  lua_getiuservalue(L, lua_upvalueindex(1), 1); /* owner of the bytes at 1 */
+  switch (kind) {
+  case MP_VIEW_ARRAY:
+    lua_pushinteger(L, (lua_Integer)(index + 1));
+    mp_decode_to_lua_view(L, &c, 1);
+    break;
+  case MP_VIEW_MAP:
+    mp_decode_to_lua_type(L, &c);
+    if (!c.err) {
+      mp_decode_to_lua_view(L, &c, 1);
+    }
+    break;
+  default: {
+    const mp_field &field = schema->fields[index];
+    lua_pushlstring(L, field.name.c_str(), field.name.size());
+    if (mp_field_width(field.type) > 0) {
+      mp_decode_to_lua_fixed(L, &c, field.type);
+    } else {
+      mp_decode_to_lua_view(L, &c, 1);
+    }
+    break;
+  }
+  }
+  mp_check_error(L, &c);
+  lua_pushinteger(L, (lua_Integer)(c.p - view->p));
+  lua_replace(L, lua_upvalueindex(2));
+  lua_pushinteger(L, (lua_Integer)(index + 1));
+  lua_replace(L, lua_upvalueindex(3));
+  return 2;
+}
+
+static int view_pairs(lua_State *L) {
+  checkudata<mp_view>(L, 1, nameof_view);
+  lua_pushvalue(L, 1);
+  lua_pushinteger(L, 0);
+  lua_pushinteger(L, 0);
+  lua_pushcclosure(L, view_next, 3);
+  return 1;
+}
+
+static int view_newindex(lua_State *L) {
+  return luaL_error(L, "%s is readonly", nameof_view);
+}
+
+static int view_tostring(lua_State *L) {
+  lua_pushfstring(L, "%s: %p", nameof_view, lua_topointer(L, 1));
+  return 1;
+}
+
+static void view_metatable(lua_State *L) {
+  const luaL_Reg methods[] = {
+    { "__len",      view_len       },
+    { "__pairs",    view_pairs     },
+    { "__newindex", view_newindex  },
+    { "__tostring", view_tostring  },
+    { NULL,         NULL           }
+  };
+  newmetatable(L, nameof_view, methods);
+  lua_pushcfunction(L, view_index);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+}
+
+static int unpack_view(lua_State *L) {
+  size_t len;
+  const char *s = luaL_checklstring(L,1,&len);
+  mp_cur c;
+  int cnt;
+
+  lua_settop(L, 1);
+  mp_cur_init(&c,(const unsigned char *)s,len);
+  for(cnt = 0; c.left > 0; cnt++) {
+    mp_decode_to_lua_view(L,&c,1);
+    mp_check_error(L,&c);
+  }
+  return cnt;
+}
+
+/* ------------------------------- Streams -----------------------------------
+* unwrap_stream returns a decoder fed with the chunks of a byte stream, such as
+* the ones given by socket:receive. Only the bytes not yet decoded are kept.
+* The value at the head is scanned without being decoded, and the scan goes on
+* from where it stopped when more bytes come, so a value cut in many chunks is
+* never parsed again from its start. It is decoded once it is complete. */
+
+#define nameof_stream "wrap stream"
+
+typedef struct mp_stream {
+  std::string data;
+  size_t head = 0;    /* start of the value at the head */
+  size_t scan = 0;    /* bytes of it already scanned */
+  size_t pending = 0; /* values left to scan, 0 when no scan is running */
+} mp_stream;
+
+static int stream_gc(lua_State *L) {
+  mp_stream *stream = checkudata<mp_stream>(L, 1, nameof_stream);
+  stream->~mp_stream();
+  return 0;
+}
+
+static int stream_feed(lua_State *L) {
+  mp_stream *stream = checkudata<mp_stream>(L, 1, nameof_stream);
+  size_t len = 0;
+  const char *s = luaL_checklstring(L, 2, &len);
+  stream->data.append(s, len);
+  lua_pushinteger(L, (lua_Integer)(stream->data.size() - stream->head));
+  return 1;
+}
+
+/* Returns true and the next value, or false when it is not complete yet */
+static int stream_next(lua_State *L) {
+  mp_stream *stream = checkudata<mp_stream>(L, 1, nameof_stream);
+  const unsigned char *data = (const unsigned char*)stream->data.c_str();
+  size_t begin;
+  mp_cur c;
+
+  if (stream->pending == 0) {
+    if (stream->head == stream->data.size()) {
+      lua_pushboolean(L, 0);
+      return 1;
+    }
+    stream->pending = 1;
+    stream->scan = stream->head;
+  }
+  mp_cur_init(&c, data + stream->scan, stream->data.size() - stream->scan);
+  mp_cur_skip_pending(&c, &stream->pending);
+  stream->scan = (size_t)(c.p - data);
+  if (c.err == MP_CUR_ERROR_BADFMT) {
+    /* nothing after a bad byte can be trusted */
+    stream->data.clear();
+    stream->head = stream->scan = stream->pending = 0;
+    return luaL_error(L, "Bad data format in input.");
+  }
+  if (stream->pending > 0) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  /* the value is complete, and is consumed even if decoding fails */
+  begin = stream->head;
+  stream->head = stream->scan;
+  lua_pushboolean(L, 1);
+  mp_cur_init(&c, data + begin, stream->scan - begin);
+  mp_decode_to_lua_type(L, &c);
+  mp_check_error(L, &c);
+  if (stream->head > 4096 && stream->head * 2 > stream->data.size()) {
+    stream->data.erase(0, stream->head);
+    stream->scan -= stream->head;
+    stream->head = 0;
+  }
+  return 2;
+}
+
+static int stream_value(lua_State *L) {
+  lua_settop(L, 1);
+  stream_next(L);
+  return lua_toboolean(L, 2) ? 1 : 0;
+}
+
+/* for v in stream:values() do ... end, stops at a nil value too */
+static int stream_values(lua_State *L) {
+  checkudata<mp_stream>(L, 1, nameof_stream);
+  lua_pushcfunction(L, stream_value);
+  lua_pushvalue(L, 1);
+  return 2;
+}
+
+static int stream_size(lua_State *L) {
+  mp_stream *stream = checkudata<mp_stream>(L, 1, nameof_stream);
+  lua_pushinteger(L, (lua_Integer)(stream->data.size() - stream->head));
+  return 1;
+}
+
+static int stream_clear(lua_State *L) {
+  mp_stream *stream = checkudata<mp_stream>(L, 1, nameof_stream);
+  stream->data.clear();
+  stream->head = stream->scan = stream->pending = 0;
+  return 0;
+}
+
+static void stream_metatable(lua_State *L) {
+  const luaL_Reg methods[] = {
+    { "__gc",       stream_gc      },
+    { "feed",       stream_feed    },
+    { "next",       stream_next    },
+    { "values",     stream_values  },
+    { "size",       stream_size    },
+    { "clear",      stream_clear   },
+    { NULL,         NULL           }
+  };
+  newmetatable(L, nameof_stream, methods);
+  lua_pop(L, 1);
+}
+
+static int unpack_stream(lua_State *L) {
+  newuserdata<mp_stream>(L, nameof_stream);
+  return 1;
+}
+
+/* Registers a schema, the same id can be registered again by every service
+* as long as the fields are the same. Returns the metatable of the schema. */
+static int schema_create(lua_State *L) {
+  std::unique_ptr<mp_schema> schema;
+  const char *error = NULL;
+  const mp_schema *exist;
+  lua_Integer id;
+  int isnum = 0;
+  size_t n, i;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_getfield(L, 1, "id");
+  id = lua_tointegerx(L, -1, &isnum);
+  lua_pop(L, 1);
+  if (!isnum || id < 0 || id >= MP_MAX_SCHEMAS) {
+    return luaL_error(L, "schema id must be an integer from 0 to %d", MP_MAX_SCHEMAS - 1);
+  }
+  /* no lua error may be raised while the schema is owned here */
+  schema.reset(new mp_schema());
+  schema->id = (int)id;
+  n = lua_rawlen(L, 1);
+  for (i = 1; i <= n && !error; i++) {
+    size_t size = 0;
+    const char *def, *colon;
+    mp_field field;
+
+    lua_rawgeti(L, 1, (lua_Integer)i);
+    def = lua_type(L, -1) == LUA_TSTRING ? lua_tolstring(L, -1, &size) : NULL;
+    if (def == NULL || size == 0) {
+      error = "field must be a string of \"name[:type]\"";
+    } else {
+      colon = (const char*)memchr(def, ':', size);
+      field.name.assign(def, colon ? colon - def : size);
+      field.type = colon ? -1 : MP_FIELD_ANY;
+      for (int j = 0; colon && mp_field_names[j]; j++) {
+        if (strcmp(colon + 1, mp_field_names[j]) == 0) {
+          field.type = j;
+        }
+      }
+      if (field.name.empty() || field.type < 0) {
+        error = "field must be a string of \"name[:type]\"";
+      }
+      for (auto &other : schema->fields) {
+        if (other.name == field.name) {
+          error = "field is defined twice";
+        }
+      }
+      if (!error) {
+        schema->fields.push_back(field);
+      }
+    }
+    lua_pop(L, 1);
+  }
+  if (!error && schema->fields.empty()) {
+    error = "schema has no field";
+  }
+  if (!error) {
+    std::unique_lock<std::mutex> lock(mp_schema_mutex);
+    exist = mp_schemas[id].load();
+    if (exist == NULL) {
+      exist = schema.get();
+      mp_schema_owned[id] = std::move(schema);
+      mp_schemas[id].store(exist);
+    }
+    else if (exist->fields.size() != schema->fields.size()) {
+      error = "schema is defined with other fields";
+    }
+    else {
+      for (i = 0; i < exist->fields.size(); i++) {
+        if (exist->fields[i].name != schema->fields[i].name ||
+          exist->fields[i].type != schema->fields[i].type) {
+          error = "schema is defined with other fields";
+        }
+      }
+    }
+  }
+  schema.reset();
+  if (error) {
+    return luaL_error(L, "schema %d: %s", (int)id, error);
+  }
+  mp_push_schema(L, mp_schemas[id].load());
+  return 1;
+}
+
 static int mp_safe(lua_State *L) {
   int argc, err, total_results;
   argc = lua_gettop(L);
@@ -913,6 +1891,9 @@ static const struct luaL_Reg methods[] = {
   { "unwrap_rest",    unpack_rest    },
   { "unwrap_one",     unpack_one     },
   { "unwrap_limit",   unpack_limit   },
+  { "unwrap_view",    unpack_view    },
+  { "unwrap_stream",  unpack_stream  },
+  { "wrap_schema",    schema_create  },
   { NULL,             NULL           }
 };
 
@@ -972,7 +1953,24 @@ SKYNET_API int skynet_unwrap(lua_State* L) {
 
 /********************************************************************************/
 
+SKYNET_API int skynet_unwrap_view(lua_State* L) {
+  luaL_checktype(L, -1, LUA_TSTRING);
+  int top = lua_gettop(L) - 1;
+  lua_pushcfunction(L, unpack_view);
+  lua_rotate(L, -2, 1);
+  int status = lua_pcall(L, 1, LUA_MULTRET, 0);
+  if (status != LUA_OK) {
+    lua_pop(L, 1);
+    lua_pushnil(L);
+  }
+  return lua_gettop(L) - top;
+}
+
+/********************************************************************************/
+
 SKYNET_API int luaopen_wrap(lua_State* L) {
+  view_metatable(L);
+  stream_metatable(L);
   package_create(L);
   /* Wrap all functions in the safe handler */
   for (int i = 0; i < (sizeof(methods)/sizeof(*methods) - 1); i++) {
@@ -14,9 +14,11 @@
 SKYNET_API int luaopen_wrap (lua_State* L);
 SKYNET_API int skynet_wrap  (lua_State* L, int n);
 SKYNET_API int skynet_unwrap(lua_State* L);
+SKYNET_API int skynet_unwrap_view(lua_State* L);
 
 #define lua_wrap(L, n) skynet_wrap(L, n)
 #define lua_unwrap(L)  skynet_unwrap(L)
+#define lua_unwrap_view(L) skynet_unwrap_view(L)
 
 /********************************************************************************/
 
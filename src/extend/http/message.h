@@ -0,0 +1,184 @@
+#ifndef __HTTP_MESSAGE_H
+#define __HTTP_MESSAGE_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+# pragma once
+#endif
+
+#include <cctype>
+#include <string>
+#include <vector>
+#include "../../skynet_lua.h"
+#include "parser.h"
+
+/********************************************************************************/
+
+/*
+* Accumulates one http message in C++ while http_parser runs, so that a
+* complete message is handed to Lua at once instead of a call per fragment.
+* The parser is paused when a message is complete, http_parser_execute then
+* returns where the next (pipelined) message starts.
+*/
+struct http_message final {
+  typedef std::pair<std::string, std::string> header_type;
+
+  std::string url;
+  std::string body;
+  std::vector<header_type> headers;
+  bool value    = false; /* the last header fragment was a value */
+  bool complete = false;
+  bool head     = false; /* a response to HEAD, it has no body (kept by clear) */
+
+  inline void clear() {
+    url.clear();
+    body.clear();
+    headers.clear();
+    value = complete = false;
+  }
+  inline size_t size() const {
+    size_t n = url.size() + body.size();
+    for (auto& v : headers) {
+      n += v.first.size() + v.second.size();
+    }
+    return n;
+  }
+  inline static bool equals(const std::string& field, const char* name) {
+    size_t i = 0;
+    for (; i < field.size() && name[i]; i++) {
+      if (tolower((unsigned char)field[i]) != tolower((unsigned char)name[i])) {
+        return false;
+      }
+    }
+    return i == field.size() && name[i] == 0;
+  }
+  inline const std::string* header(const char* name) const {
+    for (auto& v : headers) {
+      if (equals(v.first, name)) {
+        return &v.second;
+      }
+    }
+    return nullptr;
+  }
+
+  inline static http_message* of(http_parser* parser) {
+    return (http_message*)parser->data;
+  }
+  static int on_begin(http_parser* parser) {
+    of(parser)->clear();
+    return 0;
+  }
+  static int on_url(http_parser* parser, const char* at, size_t size) {
+    of(parser)->url.append(at, size);
+    return 0;
+  }
+  static int on_header_field(http_parser* parser, const char* at, size_t size) {
+    auto self = of(parser);
+    if (self->value || self->headers.empty()) {
+      self->headers.emplace_back();
+      self->value = false;
+    }
+    self->headers.back().first.append(at, size);
+    return 0;
+  }
+  static int on_header_value(http_parser* parser, const char* at, size_t size) {
+    auto self = of(parser);
+    self->value = true;
+    self->headers.back().second.append(at, size);
+    return 0;
+  }
+  static int on_headers_complete(http_parser* parser) {
+    return of(parser)->head ? 1 : 0; /* 1 tells http_parser to skip the body */
+  }
+  static int on_body(http_parser* parser, const char* at, size_t size) {
+    of(parser)->body.append(at, size);
+    return 0;
+  }
+  static int on_complete(http_parser* parser) {
+    of(parser)->complete = true;
+    http_parser_pause(parser, 1);
+    return 0;
+  }
+  static const http_parser_settings* settings() {
+    static const http_parser_settings settings = {
+      on_begin,
+      on_url,
+      nullptr,
+      on_header_field,
+      on_header_value,
+      on_headers_complete,
+      on_body,
+      on_complete,
+      nullptr,
+      nullptr
+    };
+    return &settings;
+  }
+
+  /*
+  * Pushes the request as a table: {
+  *   method, url, path, query, headers = { name = value }, body, keepalive
+  * }
+  */
+  void push_request(lua_State* L, http_parser* parser) const {
+    lua_createtable(L, 0, 8);
+    lua_pushstring(L, http_method_str((enum http_method)parser->method));
+    lua_setfield(L, -2, "method");
+    lua_pushlstring(L, url.c_str(), url.size());
+    lua_setfield(L, -2, "url");
+
+    struct http_parser_url u;
+    http_parser_url_init(&u);
+    if (http_parser_parse_url(url.c_str(), url.size(), 0, &u) == 0) {
+      if (u.field_set & (1 << UF_PATH)) {
+        lua_pushlstring(L, url.c_str() + u.field_data[UF_PATH].off, u.field_data[UF_PATH].len);
+        lua_setfield(L, -2, "path");
+      }
+      if (u.field_set & (1 << UF_QUERY)) {
+        lua_pushlstring(L, url.c_str() + u.field_data[UF_QUERY].off, u.field_data[UF_QUERY].len);
+        lua_setfield(L, -2, "query");
+      }
+    }
+    else {
+      lua_pushlstring(L, url.c_str(), url.size());
+      lua_setfield(L, -2, "path");
+    }
+    push_fields(L, http_should_keep_alive(parser) != 0);
+  }
+
+  /*
+  * Pushes the response as a table: {
+  *   status, headers = { name = value }, body, keepalive
+  * }
+  */
+  void push_response(lua_State* L, http_parser* parser) const {
+    push_response(L, parser->status_code, http_should_keep_alive(parser) != 0);
+  }
+  void push_response(lua_State* L, int status, bool keepalive) const {
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, status);
+    lua_setfield(L, -2, "status");
+    push_fields(L, keepalive);
+  }
+
+private:
+  void push_fields(lua_State* L, bool keepalive) const {
+    lua_createtable(L, 0, (int)headers.size());
+    for (auto& v : headers) {
+      lua_pushlstring(L, v.first.c_str(), v.first.size());
+      lua_pushlstring(L, v.second.c_str(), v.second.size());
+      lua_rawset(L, -3);
+    }
+    lua_setfield(L, -2, "headers");
+
+    if (!body.empty()) {
+      lua_pushlstring(L, body.c_str(), body.size());
+      lua_setfield(L, -2, "body");
+    }
+    lua_pushboolean(L, keepalive);
+    lua_setfield(L, -2, "keepalive");
+  }
+};
+
+/********************************************************************************/
+
+#endif //__HTTP_MESSAGE_H
@@ -4,6 +4,7 @@
 
 #include "lua_http.h"
 #include "http/parser.h"
+#include "http/message.h"
 
 #if LUA_VERSION_NUM >= 502
 #define lua_setfenv         lua_setuservalue
@@ -33,6 +34,7 @@
 #define CB_ON_MESSAGE_COMPLETE   7
 #define CB_ON_CHUNK_HEADER       8
 #define CB_ON_CHUNK_COMPLETE     9
+#define CB_ON_MESSAGE            10
 #define CB_LEN                   (sizeof(lhp_callback_names)/sizeof(*lhp_callback_names))
 
 static const char *lhp_callback_names[] = {
@@ -46,6 +48,7 @@ static const char *lhp_callback_names[] = {
     "on_message_complete",
     "on_chunk_header",
     "on_chunk_complete",
+    "on_message",
 };
 
 /* Non-callback FENV indices. */
@@ -96,6 +99,11 @@ typedef struct lhttp_parser {
     http_parser parser;     /* embedded http_parser. */
     int         flags;      /* See above flag test/set/remove macros. */
     int         buf_len;    /* number of buffered chunks for current callback. */
+    /* message mode, see lhp_message_mode. */
+    http_message* message;  /* the message accumulated in C, or NULL. */
+    lua_State*    L;        /* parser.data points to message in this mode. */
+    size_t        stream;   /* bodies above this size go to on_body in chunks. */
+    int           streamed; /* the body of the current message is streamed. */
 } lhttp_parser;
 
 /* Concatinate and remove elements from the table at idx starting at
@@ -365,6 +373,90 @@ static int lhp_chunk_complete_cb(http_parser* parser) {
     return lhp_http_cb(parser, CB_ON_CHUNK_COMPLETE);
 }
 
+/* Message mode: the url, the headers and the body are accumulated in C
+ * and a single on_message(table) event is pushed per completed message,
+ * instead of an event per fragment.  When on_body is given, a body
+ * growing above the stream threshold is sent to on_body in chunks and
+ * ended with on_body(nil), the table then has no body.
+ */
+#define STREAM_THRESHOLD         (64 * 1024)
+
+static int lhp_msg_push_body(lhttp_parser* lparser) {
+    lua_State* L = lparser->L;
+
+    if ( ! lua_checkstack(L, 5) ) return -1;
+
+    lua_rawgeti(L, ST_FENV_IDX, CB_ON_BODY);
+    if ( lparser->message->body.empty() ) {
+        lua_pushnil(L);
+    } else {
+        lua_pushlstring(L, lparser->message->body.c_str(), lparser->message->body.size());
+        lparser->message->body.clear();
+    }
+    return 0;
+}
+
+static int lhp_msg_body_cb(http_parser* parser, const char* str, size_t len) {
+    lhttp_parser* lparser = (lhttp_parser*)parser;
+
+    lparser->message->body.append(str, len);
+    if ( FLAG_HAS_CB(lparser->flags, CB_ON_BODY) &&
+         lparser->message->body.size() >= lparser->stream ) {
+        lparser->streamed = 1;
+        return lhp_msg_push_body(lparser);
+    }
+    return 0;
+}
+
+static int lhp_msg_complete_cb(http_parser* parser) {
+    lhttp_parser* lparser = (lhttp_parser*)parser;
+    lua_State*    L = lparser->L;
+
+    if ( lparser->streamed ) {
+        lparser->streamed = 0;
+        if ( ! lparser->message->body.empty() ) {
+            int result = lhp_msg_push_body(lparser);
+            if ( 0 != result ) return result;
+        }
+        int result = lhp_msg_push_body(lparser); /* on_body(nil) */
+        if ( 0 != result ) return result;
+    }
+
+    if ( FLAG_HAS_CB(lparser->flags, CB_ON_MESSAGE) ) {
+        if ( ! lua_checkstack(L, 8) ) return -1;
+
+        lua_rawgeti(L, ST_FENV_IDX, CB_ON_MESSAGE);
+        if ( parser->type == HTTP_REQUEST ) {
+            lparser->message->push_request(L, parser);
+        } else {
+            lparser->message->push_response(L, parser);
+        }
+    }
+    lparser->message->clear();
+    return 0;
+}
+
+/* Switches the parser to message mode when the callbacks table at idx
+ * has an on_message function, back to the fragment events otherwise.
+ */
+static void lhp_message_mode(lua_State* L, lhttp_parser* lparser, int idx) {
+    lua_getfield(L, idx, "on_message");
+    int mode = lua_isfunction(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "stream");
+    lparser->stream   = (size_t)luaL_optinteger(L, -1, STREAM_THRESHOLD);
+    lparser->streamed = 0;
+    lua_pop(L, 1);
+
+    if ( mode && !lparser->message ) {
+        lparser->message = new http_message();
+    } else if ( !mode && lparser->message ) {
+        delete lparser->message;
+        lparser->message = NULL;
+    }
+}
+
 static int lhp_init(lua_State* L, enum http_parser_type type) {
     int cb_id;
     /* Stack: callbacks */
@@ -379,6 +471,8 @@ static int lhp_init(lua_State* L, enum http_parser_type type) {
 
     lparser->flags   = 0;
     lparser->buf_len = 0;
+    lparser->message = NULL;
+    lparser->L       = NULL;
 
     /* Get the metatable: */
     luaL_getmetatable(L, PARSER_MT);
@@ -408,6 +502,7 @@ static int lhp_init(lua_State* L, enum http_parser_type type) {
     parser->data = NULL;
 
     lua_setmetatable(L, -2);
+    lhp_message_mode(L, lparser, 1);
 
     return 1;
 }
@@ -454,10 +549,29 @@ static int lhp_execute(lua_State* L) {
     assert(lua_gettop(L) == ST_LEN);
     lua_pushnil(L);
 
-    /* Stack: (userdata, string, fenv, buffer, url, nil) */
-    parser->data = L;
+    static const http_parser_settings message_settings = {
+        http_message::on_begin,
+        http_message::on_url,
+        NULL,
+        http_message::on_header_field,
+        http_message::on_header_value,
+        NULL,
+        lhp_msg_body_cb,
+        lhp_msg_complete_cb,
+        NULL,
+        NULL
+    };
 
-    result = http_parser_execute(parser, &settings, str, len);
+    /* Stack: (userdata, string, fenv, buffer, url, nil) */
+    if ( lparser->message ) {
+        parser->data = lparser->message;
+        lparser->L   = L;
+        result = http_parser_execute(parser, &message_settings, str, len);
+        lparser->L   = NULL;
+    } else {
+        parser->data = L;
+        result = http_parser_execute(parser, &settings, str, len);
+    }
 
     parser->data = NULL;
 
@@ -482,6 +596,13 @@ static int lhp_is_upgrade(lua_State* L) {
     return 1;
 }
 
+static int lhp__gc(lua_State* L) {
+    lhttp_parser* lparser = check_parser(L, 1);
+    delete lparser->message;
+    lparser->message = NULL;
+    return 0;
+}
+
 static int lhp__tostring(lua_State* L) {
     lhttp_parser* lparser = check_parser(L, 1);
     lua_pushfstring(L, PARSER_MT" %p", lparser);
@@ -596,6 +717,11 @@ static int lhp_reset(lua_State* L) {
           }
           lua_rawseti(L, -2, cb_id); /* fenv[cb_id] = callback */
       }
+      lhp_message_mode(L, lparser, 2);
+  }
+  if (lparser->message) {
+      lparser->message->clear();
+      lparser->streamed = 0;
   }
 
   /* clear buffer */
@@ -748,6 +874,8 @@ SKYNET_API int luaopen_http(lua_State* L) {
     lua_setfield(L, -2, "is_upgrade");
     lua_pushcfunction(L, lhp__tostring);
     lua_setfield(L, -2, "__tostring");
+    lua_pushcfunction(L, lhp__gc);
+    lua_setfield(L, -2, "__gc");
     lua_pushcfunction(L, lhp_method);
     lua_setfield(L, -2, "method");
     lua_pushcfunction(L, lhp_version);
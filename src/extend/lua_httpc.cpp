@@ -0,0 +1,560 @@
+
+#include "lua_httpc.h"
+#include "http/message.h"
+#include "../core/lua_stats.h"
+#include "../skynet_profiler.h"
+
+#include <map>
+#include <list>
+#include <deque>
+
+/********************************************************************************/
+
+#define HTTPC_TIMEOUT     30000 /* default timeout of a request (ms) */
+#define HTTPC_IDLE        60000 /* pooled connections idle longer are closed (ms) */
+#define HTTPC_DNS_TTL     60000 /* resolved addresses are kept for (ms) */
+#define HTTPC_PIPELINE    8     /* requests in flight on one connection */
+#define HTTPC_POOLSIZE    16    /* idle connections kept for a host */
+
+/********************************************************************************/
+
+struct http_conn;
+
+/* a request of io.http.request, alive until its response or error is delivered */
+struct http_call final {
+  typedef std::shared_ptr<http_call> type_ref;
+
+  inline http_call()
+    : timer(*lua_service()) {
+  }
+
+  std::string key;          /* the pool, scheme://host:port */
+  std::string host;
+  unsigned short port = 0;
+  bool secure     = false;
+  bool head       = false;
+  bool idempotent = false;  /* may be pipelined, and retried once */
+  bool retried    = false;
+  bool close      = false;  /* sent with "Connection: close" */
+  bool done       = false;
+  std::string request;      /* the request on the wire */
+  std::weak_ptr<http_conn> conn;
+  steady_timer timer;
+
+  int  rcf = 0;             /* ref of the yielded coroutine, 0 if the caller blocks */
+  int  status = 0;
+  bool keepalive = false;
+  http_message response;
+  std::string error;
+};
+
+/********************************************************************************/
+
+struct http_conn final
+  : public std::enable_shared_from_this<http_conn> {
+  typedef std::shared_ptr<http_conn> type_ref;
+
+  typeof<io::socket> peer;
+  std::string  key;
+  http_parser  parser;
+  http_message message;
+  std::deque<http_call::type_ref> calls; /* sent, or waiting the connection */
+  bool   connected = false;
+  bool   closed    = false;
+  bool   reusable  = true;  /* no "Connection: close" seen */
+  size_t served    = 0;     /* responses received */
+
+  inline bool idle() const {
+    return connected && !closed && calls.empty();
+  }
+  inline bool pipelined() const {
+    if (closed || !reusable || calls.size() >= HTTPC_PIPELINE) {
+      return false;
+    }
+    for (auto& call : calls) {
+      if (!call->idempotent || call->close) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+/********************************************************************************/
+
+typedef std::list<http_conn::type_ref> http_pool;
+
+static std::map<std::string, http_pool>& http_pools() {
+  static thread_local std::map<std::string, http_pool> pools;
+  return pools;
+}
+
+struct dns_entry {
+  ip::tcp::endpoint endpoint;
+  size_t expires;
+};
+
+static std::map<std::string, dns_entry>& dns_cache() {
+  static thread_local std::map<std::string, dns_entry> cache;
+  return cache;
+}
+
+static ip::tcp::endpoint dns_resolve(const http_call& call, error_code& ec) {
+  auto& cache = dns_cache();
+  auto now  = steady_clock();
+  auto iter = cache.find(call.key);
+  if (iter != cache.end() && iter->second.expires > now) {
+    return iter->second.endpoint;
+  }
+  auto endpoint = resolve(call.host.c_str(), call.port, ec);
+  if (ec) {
+    cache.erase(call.key);
+    return endpoint;
+  }
+  cache[call.key] = dns_entry{ endpoint, now + HTTPC_DNS_TTL };
+  return endpoint;
+}
+
+/* the servers are checked against the CAs of the system, a failure fails the handshake */
+struct client_context final {
+  inline client_context()
+    : ctx(ssl::context::tlsv12) {
+    error_code ec;
+    init_ssl_context(ctx, ec);
+    use_default_verify_paths(ctx, ec);
+  }
+  inline static ssl::context& local() {
+    static thread_local client_context context;
+    return context.ctx;
+  }
+  ssl::context ctx;
+};
+
+/********************************************************************************/
+
+static void submit(const http_call::type_ref& call);
+
+static int push_result(lua_State* L, http_call& call) {
+  if (!call.error.empty()) {
+    lua_pushnil(L);
+    lua_pushlstring(L, call.error.c_str(), call.error.size());
+    return 2;
+  }
+  call.response.push_response(L, call.status, call.keepalive);
+  return 1;
+}
+
+/* hands the response, or the error, to the caller */
+static void complete(const http_call::type_ref& call) {
+  if (call->done) {
+    return;
+  }
+  call->done = true;
+  call->timer.cancel();
+  if (call->rcf == 0) {
+    lua_service()->wakeup(); /* the caller blocks in request */
+    return;
+  }
+  lua_State* L = lua_local();
+  lua_auto_revert revert(L);
+  lua_auto_unref  unref_rcf(L, call->rcf);
+
+  if (lua_pushref(L, call->rcf) != LUA_TTHREAD) {
+    return;
+  }
+  auto coL = lua_tothread(L, -1);
+  if (lua_status(coL) != LUA_YIELD) {
+    return;
+  }
+  int argc  = push_result(coL, *call);
+  int nret  = 0;
+  int state = lua_profile_resume(coL, L, argc, &nret);
+  if (state != LUA_OK && state != LUA_YIELD) {
+    lua_ferror("%s\n", luaL_checkstring(coL, -1));
+    return;
+  }
+  if (nret > 0) {
+    lua_pop(coL, nret);
+  }
+}
+
+static void fail(const http_call::type_ref& call, const char* error) {
+  call->error.assign(error);
+  complete(call);
+}
+
+/* closes the connection, its unanswered requests are failed or retried */
+static void close_conn(const http_conn::type_ref& conn, const char* error) {
+  if (conn->closed) {
+    return;
+  }
+  conn->closed = true;
+  conn->peer->close();
+
+  auto& pools = http_pools();
+  auto iter = pools.find(conn->key);
+  if (iter != pools.end()) {
+    iter->second.remove(conn);
+    if (iter->second.empty()) {
+      pools.erase(iter);
+    }
+  }
+  auto calls = std::move(conn->calls);
+  conn->calls.clear();
+  for (auto& call : calls) {
+    if (call->done) {
+      continue;
+    }
+    /* a pooled connection may have been closed by the server meanwhile */
+    if (conn->served > 0 && call->idempotent && !call->retried) {
+      call->retried = true;
+      submit(call);
+      continue;
+    }
+    fail(call, error);
+  }
+}
+
+/* closes the connections over the pool size once they are idle */
+static void release_conn(const http_conn::type_ref& conn) {
+  if (!conn->reusable) {
+    close_conn(conn, "closed");
+    return;
+  }
+  if (!conn->calls.empty()) {
+    return;
+  }
+  size_t idles = 0;
+  for (auto& v : http_pools()[conn->key]) {
+    idles += v->idle() ? 1 : 0;
+  }
+  if (idles > HTTPC_POOLSIZE) {
+    close_conn(conn, "closed");
+  }
+}
+
+static void on_response(const http_conn::type_ref& conn) {
+  auto call = conn->calls.front();
+  conn->calls.pop_front();
+  conn->served++;
+  if (!http_should_keep_alive(&conn->parser)) {
+    conn->reusable = false;
+  }
+  call->status    = conn->parser.status_code;
+  call->keepalive = conn->reusable;
+  call->response.url.clear();
+  call->response.body.swap(conn->message.body);
+  call->response.headers.swap(conn->message.headers);
+  complete(call);
+}
+
+static void receive(const http_conn::type_ref& conn, const char* data, size_t size) {
+  while (size > 0 && !conn->closed) {
+    if (conn->calls.empty()) {
+      close_conn(conn, "unexpected response");
+      return;
+    }
+    conn->message.head = conn->calls.front()->head;
+    conn->parser.data  = &conn->message;
+    size_t n = http_parser_execute(&conn->parser, http_message::settings(), data, size);
+    if (conn->message.complete) {
+      http_parser_pause(&conn->parser, 0);
+      on_response(conn);
+      conn->message.clear();
+    }
+    else if (n < size || HTTP_PARSER_ERRNO(&conn->parser) != HPE_OK) {
+      close_conn(conn, "bad response");
+      return;
+    }
+    data += n;
+    size -= n;
+  }
+  if (!conn->closed) {
+    release_conn(conn);
+  }
+}
+
+static void send(const http_conn::type_ref& conn, const http_call::type_ref& call) {
+  auto peer = conn->peer;
+  peer->async_send(call->request.c_str(), call->request.size(),
+    [conn](const error_code& ec, size_t) {
+      if (ec) {
+        close_conn(conn, "send error");
+      }
+    }
+  );
+}
+
+static void connect(const http_conn::type_ref& conn, const http_call& call) {
+  error_code ec;
+  auto endpoint = dns_resolve(call, ec);
+  if (ec) {
+    lua_service()->post([conn]() { close_conn(conn, "resolve error"); }, stats_socket);
+    return;
+  }
+  auto peer = conn->peer;
+  peer->set_timeout(HTTPC_IDLE);
+  peer->native_socket::async_connect(endpoint, [conn, peer](const error_code& ec) {
+    if (ec || conn->closed) {
+      dns_cache().erase(conn->key);
+      close_conn(conn, "connect error");
+      return;
+    }
+    peer->async_handshake([conn, peer](const error_code& ec) {
+      if (ec || conn->closed) {
+        close_conn(conn, "handshake error");
+        return;
+      }
+      conn->connected = true;
+      for (auto& call : conn->calls) {
+        send(conn, call);
+      }
+      async_receive(peer, [conn](const error_code& ec, const char* data, size_t size) {
+        io::service::measure measure(stats_socket);
+        if (!ec) {
+          receive(conn, data, size);
+          return;
+        }
+        /* a body delimited by the end of the connection */
+        if (!conn->closed && !conn->calls.empty()) {
+          conn->parser.data = &conn->message;
+          http_parser_execute(&conn->parser, http_message::settings(), nullptr, 0);
+          if (conn->message.complete) {
+            on_response(conn);
+          }
+        }
+        close_conn(conn, "closed");
+      });
+    });
+  });
+}
+
+/* sends the request on an idle pooled connection, pipelines it, or connects */
+static void submit(const http_call::type_ref& call) {
+  auto& pool = http_pools()[call->key];
+  http_conn::type_ref conn;
+  for (auto& v : pool) {
+    if (v->idle()) {
+      conn = v;
+      break;
+    }
+  }
+  if (!conn && call->idempotent) {
+    for (auto& v : pool) {
+      if (v->connected && v->pipelined() && (!conn || v->calls.size() < conn->calls.size())) {
+        conn = v;
+      }
+    }
+  }
+  if (conn) {
+    call->conn = conn;
+    conn->calls.push_back(call);
+    conn->reusable = conn->reusable && !call->close;
+    send(conn, call);
+    return;
+  }
+
+  conn = std::make_shared<http_conn>();
+  conn->key  = call->key;
+  conn->peer = call->secure
+    ? ref_new<io::socket>(io::service::local(), std::reference_wrapper<ssl::context>(client_context::local()), io::socket::native)
+    : ref_new<io::socket>(io::service::local(), io::socket::native);
+  if (!conn->peer) {
+    fail(call, "no ssl support");
+    return;
+  }
+  error_code ec;
+  conn->peer->set_verify_host(call->host, ec);
+  if (ec) {
+    fail(call, "ssl error");
+    return;
+  }
+  http_parser_init(&conn->parser, HTTP_RESPONSE);
+  call->conn = conn;
+  conn->calls.push_back(call);
+  conn->reusable = !call->close;
+  pool.push_back(conn);
+  connect(conn, *call);
+}
+
+/********************************************************************************/
+
+static bool build_request(lua_State* L, http_call& call, const char* method,
+  const char* url, size_t size, const char* body, size_t bodylen, int headers) {
+  struct http_parser_url u;
+  http_parser_url_init(&u);
+  if (http_parser_parse_url(url, size, 0, &u) != 0 || !(u.field_set & (1 << UF_HOST))) {
+    return false;
+  }
+  std::string schema("http");
+  if (u.field_set & (1 << UF_SCHEMA)) {
+    schema.assign(url + u.field_data[UF_SCHEMA].off, u.field_data[UF_SCHEMA].len);
+  }
+  if (schema == "https") {
+    call.secure = true;
+  }
+  else if (schema != "http") {
+    return false;
+  }
+  call.host.assign(url + u.field_data[UF_HOST].off, u.field_data[UF_HOST].len);
+  call.port = (u.field_set & (1 << UF_PORT)) ? u.port : (call.secure ? 443 : 80);
+  call.key  = schema + "://" + call.host + ":" + std::to_string(call.port);
+  call.head = (strcmp(method, "HEAD") == 0);
+  call.idempotent = call.head || strcmp(method, "GET") == 0;
+
+  auto& data = call.request;
+  data.append(method).append(" ", 1);
+  if (u.field_set & (1 << UF_PATH)) {
+    data.append(url + u.field_data[UF_PATH].off, u.field_data[UF_PATH].len);
+  }
+  else {
+    data.append("/", 1);
+  }
+  if (u.field_set & (1 << UF_QUERY)) {
+    data.append("?", 1).append(url + u.field_data[UF_QUERY].off, u.field_data[UF_QUERY].len);
+  }
+  data.append(" HTTP/1.1\r\n");
+
+  bool host = false;
+  if (headers) {
+    lua_pushnil(L);
+    while (lua_next(L, headers)) {
+      /* nothing here may raise, a longjmp would leak data */
+      if (lua_type(L, -2) == LUA_TSTRING && lua_isstring(L, -1)) {
+        size_t n = 0, m = 0;
+        const char* k = lua_tolstring(L, -2, &n);
+        const char* v = lua_tolstring(L, -1, &m);
+        std::string name(k, n);
+        if (!http_message::equals(name, "content-length")) {
+          host = host || http_message::equals(name, "host");
+          if (http_message::equals(name, "connection") && http_message::equals(std::string(v, m), "close")) {
+            call.close = true;
+          }
+          data.append(k, n).append(": ", 2).append(v, m).append("\r\n", 2);
+        }
+      }
+      lua_pop(L, 1);
+    }
+  }
+  if (!host) {
+    data.append("Host: ").append(call.host);
+    if (u.field_set & (1 << UF_PORT)) {
+      data.append(":").append(std::to_string(call.port));
+    }
+    data.append("\r\n", 2);
+  }
+  if (bodylen > 0 || !call.idempotent) {
+    data.append("Content-Length: ").append(std::to_string(bodylen)).append("\r\n", 2);
+  }
+  data.append("\r\n", 2);
+  data.append(body, bodylen);
+  return true;
+}
+
+/*
+* io.http.request(method, url [, body [, headers [, timeout]]])
+* returns { status, headers, body, keepalive } or nil, error. The calling
+* coroutine is suspended until the response, like rpcall, or the service
+* waits for it when not called in a coroutine.
+*/
+static int request(lua_State* L) {
+  const char* method = luaL_checkstring(L, 1);
+  size_t size = 0, bodylen = 0;
+  const char* url  = luaL_checklstring(L, 2, &size);
+  const char* body = luaL_optlstring(L, 3, "", &bodylen);
+  int headers = 0;
+  if (!lua_isnoneornil(L, 4)) {
+    luaL_checktype(L, 4, LUA_TTABLE);
+    headers = 4;
+  }
+  size_t timeout = (size_t)luaL_optinteger(L, 5, HTTPC_TIMEOUT);
+
+  auto call = std::make_shared<http_call>();
+  if (!build_request(L, *call, method, url, size, body, bodylen, headers)) {
+    lua_pushnil(L);
+    lua_pushliteral(L, "invalid url");
+    return 2;
+  }
+  /* if invoke by coroutine */
+  if (lua_isyieldable(L)) {
+    lua_State* main = lua_local();
+    lua_pushthread(L);
+    lua_xmove(L, main, 1);
+    call->rcf = lua_ref(main, -1);
+    lua_pop(main, 1);
+  }
+  call->timer.expires_after(std::chrono::milliseconds(timeout));
+  call->timer.async_wait([call](const error_code& ec) {
+    if (ec || call->done) {
+      return;
+    }
+    io::service::measure measure(stats_timer);
+    fail(call, "timeout");
+    auto conn = call->conn.lock();
+    if (conn) {
+      close_conn(conn, "timeout"); /* the responses behind it are out of order now */
+    }
+  });
+  submit(call);
+
+  /* failed already, nothing will resume the coroutine */
+  if (call->done) {
+    return push_result(L, *call);
+  }
+  /* run in coroutine */
+  if (call->rcf > 0) {
+    lua_settop(L, 0);
+    return lua_yield(L, 0);
+  }
+  /* call will be blocked */
+  auto service = lua_service();
+  while (!call->done && !service->stopped()) {
+    service->wait_for(timeout);
+  }
+  if (!call->done) {
+    call->done = true;
+    call->timer.cancel();
+    lua_pushnil(L);
+    lua_pushliteral(L, "cancel");
+    return 2;
+  }
+  return push_result(L, *call);
+}
+
+/* io.http.get(url [, headers [, timeout]]) */
+static int get(lua_State* L) {
+  luaL_checkstring(L, 1);
+  lua_settop(L, 3);
+  lua_pushliteral(L, "GET");
+  lua_insert(L, 1);        /* GET, url, headers, timeout */
+  lua_pushnil(L);
+  lua_insert(L, 3);        /* GET, url, nil, headers, timeout */
+  return request(L);
+}
+
+/* io.http.post(url, body [, headers [, timeout]]) */
+static int post(lua_State* L) {
+  luaL_checkstring(L, 1);
+  lua_settop(L, 4);
+  lua_pushliteral(L, "POST");
+  lua_insert(L, 1);        /* POST, url, body, headers, timeout */
+  return request(L);
+}
+
+/********************************************************************************/
+
+SKYNET_API int luaopen_httpc(lua_State* L) {
+  const luaL_Reg methods[] = {
+    { "request",  request  }, /* io.http.request */
+    { "get",      get      }, /* io.http.get */
+    { "post",     post     }, /* io.http.post */
+    { NULL,       NULL     }
+  };
+  lua_getglobal(L, "io");
+  lua_getfield(L, -1, "http");
+  luaL_setfuncs(L, methods, 0);
+  lua_pop(L, 2);
+  return 0;
+}
+
+/********************************************************************************/
@@ -0,0 +1,443 @@
+
+#include "lua_httpd.h"
+#include "http/message.h"
+#include "../core/lua_socket.h"
+#include "../core/lua_stats.h"
+#include "../core/lua_go.h"
+
+#include <map>
+
+/********************************************************************************/
+
+#define HTTPD_PIPELINE    16    /* requests in flight on one connection */
+#define HTTPD_TIMEOUT     30000 /* requests not answered in time get 504 (ms) */
+
+/********************************************************************************/
+
+static const char* http_status_text(int code) {
+  switch (code) {
+  case 100: return "Continue";
+  case 101: return "Switching Protocols";
+  case 200: return "OK";
+  case 201: return "Created";
+  case 202: return "Accepted";
+  case 203: return "Non-Authoritative Information";
+  case 204: return "No Content";
+  case 205: return "Reset Content";
+  case 206: return "Partial Content";
+  case 300: return "Multiple Choices";
+  case 301: return "Moved Permanently";
+  case 302: return "Found";
+  case 303: return "See Other";
+  case 304: return "Not Modified";
+  case 305: return "Use Proxy";
+  case 307: return "Temporary Redirect";
+  case 400: return "Bad Request";
+  case 401: return "Unauthorized";
+  case 402: return "Payment Required";
+  case 403: return "Forbidden";
+  case 404: return "File Not Found";
+  case 405: return "Method Not Allowed";
+  case 406: return "Not Acceptable";
+  case 407: return "Proxy Authentication Required";
+  case 408: return "Request Time-out";
+  case 409: return "Conflict";
+  case 410: return "Gone";
+  case 411: return "Length Required";
+  case 412: return "Precondition Failed";
+  case 413: return "Request Entity Too Large";
+  case 414: return "Request-URI Too Large";
+  case 415: return "Unsupported Media Type";
+  case 416: return "Requested range not satisfiable";
+  case 417: return "Expectation Failed";
+  case 500: return "Internal Server Error";
+  case 501: return "Not Implemented";
+  case 502: return "Bad Gateway";
+  case 503: return "Service Unavailable";
+  case 504: return "Gateway Time-out";
+  case 505: return "HTTP Version not supported";
+  default:  return "Unknown";
+  }
+}
+
+/********************************************************************************/
+
+/*
+* One connection of io.http.serve, requests are parsed in C++ and handed to
+* Lua complete. Responses may be given in any order by the handlers, they are
+* written in the order of the requests (pipelining), and the connection is
+* kept open unless the client, or the options, ask to close it. Reading stops
+* while the requests in flight are at the pipeline limit, and a request not
+* answered before its deadline gets 504.
+*/
+struct http_session final
+  : public std::enable_shared_from_this<http_session> {
+  typedef std::shared_ptr<http_session> type_ref;
+
+  enum { FLAG_KEEPALIVE = 1, FLAG_HEAD = 2 };
+
+  typeof<io::socket> peer;
+  steady_timer timer;
+  http_parser  parser;
+  http_message message;
+  int    handler   = 0;     /* ref of the request handler */
+  int    selfref   = 0;     /* ref of the userdata holding this session */
+  bool   keepalive = true;
+  bool   stopped   = false; /* no more requests are read */
+  size_t limit     = 8 * 1024 * 1024;
+  size_t pipeline  = HTTPD_PIPELINE;
+  size_t timeout   = HTTPD_TIMEOUT;
+  size_t received  = 0;     /* requests handed to Lua */
+  size_t sent      = 0;     /* responses written */
+  size_t last      = (size_t)-1; /* the connection closes after this response */
+  bool   corked    = false; /* answers are held until the received data is handled */
+  bool   posted    = false; /* a flush is posted to the service */
+  bool   paused    = false; /* reading stops at the pipeline limit */
+  bool   waiting   = false; /* the timer is armed */
+  std::string output;
+  std::string backlog;      /* data received after the pipeline limit */
+  std::map<size_t, std::string> ready;
+  std::map<size_t, size_t> deadlines; /* of the requests not answered */
+
+  inline http_session()
+    : timer(*lua_service()) {
+  }
+
+  inline static const char* name() {
+    return "skynet http session";
+  }
+  inline static type_ref* __this(lua_State* L, int idx) {
+    return checkudata<type_ref>(L, idx, name());
+  }
+  static int __gc(lua_State* L) {
+    auto self = __this(L, 1);
+    self->~type_ref();
+    return 0;
+  }
+
+  static std::string build(int code, bool keepalive, bool head,
+    const char* body, size_t size, lua_State* L = nullptr, int headers = 0) {
+    char status[128];
+    snprintf(status, sizeof(status),
+      "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\nConnection: %s\r\n",
+      code, http_status_text(code), size, keepalive ? "keep-alive" : "close"
+    );
+    std::string data(status);
+    if (L && headers) {
+      lua_pushnil(L);
+      while (lua_next(L, headers)) {
+        /* nothing here may raise, a longjmp would leak data */
+        if (lua_type(L, -2) == LUA_TSTRING && lua_isstring(L, -1)) {
+          size_t n = 0, m = 0;
+          const char* k = lua_tolstring(L, -2, &n);
+          const char* v = lua_tolstring(L, -1, &m);
+          data.append(k, n).append(": ", 2).append(v, m).append("\r\n", 2);
+        }
+        lua_pop(L, 1);
+      }
+    }
+    data.append("\r\n", 2);
+    if (!head) {
+      data.append(body, size);
+    }
+    return data;
+  }
+
+  void release(lua_State* L) {
+    if (handler) {
+      lua_unref(L, handler);
+      handler = 0;
+    }
+    if (selfref) {
+      lua_unref(L, selfref);
+      selfref = 0;
+    }
+  }
+
+  /* sends what is ready in one write, small answers don't wait for acks (nagle) */
+  void flush() {
+    if (output.empty()) {
+      return;
+    }
+    if (!peer->is_open()) {
+      output.clear();
+      return;
+    }
+    auto peer = this->peer;
+    bool close = (sent > last);
+    peer->async_send(output.c_str(), output.size(),
+      [peer, close](const error_code& ec, size_t) {
+        if (close || ec) {
+          peer->close();
+        }
+      }
+    );
+    output.clear();
+  }
+
+  void respond(size_t seq, std::string&& data) {
+    if (seq < sent || seq > last || ready.count(seq)) {
+      return; /* already answered, or after the connection closed */
+    }
+    deadlines.erase(seq);
+    ready.emplace(seq, std::move(data));
+    auto i = ready.begin();
+    while (i != ready.end() && i->first == sent) {
+      output.append(i->second);
+      i = ready.erase(i);
+      sent++;
+    }
+    if (!corked && !posted && (!output.empty() || (paused && !full()))) {
+      /* answers given in the same turn of the loop go out together */
+      posted = true;
+      auto self = shared_from_this();
+      lua_service()->post([self]() {
+        self->posted = false;
+        self->flush();
+        self->resume(lua_local());
+      }, stats_socket);
+    }
+  }
+
+  inline bool full() const {
+    return received - sent >= pipeline;
+  }
+
+  /* answers 504 to the requests missing their deadlines */
+  void expire() {
+    if (waiting || deadlines.empty()) {
+      return;
+    }
+    waiting = true;
+    auto self = shared_from_this();
+    auto expires = deadlines.begin()->second;
+    auto now = steady_clock();
+    timer.expires_after(std::chrono::milliseconds(expires > now ? expires - now : 0));
+    timer.async_wait([self](const error_code& ec) {
+      self->waiting = false;
+      if (ec || !self->peer->is_open()) {
+        return;
+      }
+      io::service::measure measure(stats_timer);
+      auto now = steady_clock();
+      while (!self->deadlines.empty() && self->deadlines.begin()->second <= now) {
+        auto seq = self->deadlines.begin()->first;
+        self->deadlines.erase(seq);
+        bool keepalive = (seq != self->last);
+        self->respond(seq, build(504, keepalive, false, "", 0));
+      }
+      self->expire();
+    });
+  }
+
+  /* reads again once the requests in flight are below the pipeline limit */
+  void resume(lua_State* L) {
+    if (!paused || full() || !peer->is_open()) {
+      return;
+    }
+    paused = false;
+    std::string data;
+    data.swap(backlog);
+    receive(L, data.c_str(), data.size());
+    if (!paused && peer->is_open()) {
+      read();
+    }
+  }
+
+  /* answers the next request itself and closes the connection */
+  void fail(int code) {
+    stopped = true;
+    last = received++;
+    respond(last, build(code, false, false, "", 0));
+  }
+
+  /* reply(status, body [, headers]) */
+  static int reply(lua_State* L) {
+    int code = (int)luaL_optinteger(L, 1, 200);
+    size_t size = 0;
+    const char* body = luaL_optlstring(L, 2, "", &size);
+    int headers = 0;
+    if (!lua_isnoneornil(L, 3)) {
+      luaL_checktype(L, 3, LUA_TTABLE);
+      headers = 3;
+    }
+    auto self = *__this(L, lua_upvalueindex(1));
+    size_t seq = (size_t)lua_tointeger(L, lua_upvalueindex(2));
+    int flags = (int)lua_tointeger(L, lua_upvalueindex(3));
+    self->respond(seq, build(code, (flags & FLAG_KEEPALIVE) != 0,
+      (flags & FLAG_HEAD) != 0, body, size, L, headers)
+    );
+    return 0;
+  }
+
+  void dispatch(lua_State* L) {
+    size_t seq = received++;
+    int flags = 0;
+    if (keepalive && http_should_keep_alive(&parser)) {
+      flags |= FLAG_KEEPALIVE;
+    }
+    else {
+      stopped = true;
+      last = seq;
+    }
+    if (parser.method == HTTP_HEAD) {
+      flags |= FLAG_HEAD;
+    }
+
+    lua_auto_revert revert(L);
+    lua_pushcfunction(L, run);
+    lua_pushref(L, selfref);
+    lua_pushinteger(L, (lua_Integer)seq);
+    lua_pushinteger(L, flags);
+    lua_pushcclosure(L, reply, 3);
+    lua_pushref(L, handler);
+    message.push_request(L, &parser);
+    if (timeout > 0) {
+      deadlines.emplace(seq, steady_clock() + timeout);
+      expire();
+    }
+    lua_go(L, 3);
+  }
+
+  /* the handler failed, the request gets 500 unless it's answered */
+  static int done(lua_State* L, int status, lua_KContext ctx) {
+    if (!lua_success(status)) {
+      lua_ferror("%s\n", luaL_tolstring(L, -1, nullptr));
+      lua_pushvalue(L, 1);
+      lua_pushinteger(L, 500);
+      lua_call(L, 1, 0);
+    }
+    return 0;
+  }
+
+  /*
+  * the body of the coroutine of the pool running the handler, a rpcall in it
+  * yields instead of running the loop on this stack, stack: reply, handler, request
+  */
+  static int run(lua_State* L) {
+    lua_pushvalue(L, 1);
+    lua_pcall_k(L, 2, 0, 0, done);
+    return done(L, LUA_OK, 0);
+  }
+
+  void receive(lua_State* L, const char* data, size_t size) {
+    corked = true;
+    parse(L, data, size);
+    corked = false;
+    flush();
+    paused = paused || full();
+  }
+
+  void parse(lua_State* L, const char* data, size_t size) {
+    while (size > 0 && !stopped) {
+      if (full()) {
+        paused = true;
+        backlog.append(data, size);
+        return;
+      }
+      parser.data = &message;
+      size_t n = http_parser_execute(&parser, http_message::settings(), data, size);
+      if (message.size() > limit) {
+        fail(413);
+        return;
+      }
+      if (message.complete) {
+        http_parser_pause(&parser, 0);
+        dispatch(L);
+        message.clear();
+      }
+      else if (n < size || HTTP_PARSER_ERRNO(&parser) != HPE_OK) {
+        fail(400);
+        return;
+      }
+      data += n;
+      size -= n;
+    }
+  }
+
+  /* io.http.serve(peer, handler [, { keepalive = true, limit = 8M, pipeline = 16, timeout = 30000 }]) */
+  static int serve(lua_State* L) {
+    auto peer = lua_checksocket(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+
+    auto self = std::make_shared<http_session>();
+    self->peer = peer;
+    if (lua_istable(L, 3)) {
+      lua_getfield(L, 3, "keepalive");
+      if (!lua_isnil(L, -1)) {
+        self->keepalive = lua_toboolean(L, -1) != 0;
+      }
+      lua_getfield(L, 3, "limit");
+      self->limit = (size_t)luaL_optinteger(L, -1, (lua_Integer)self->limit);
+      lua_getfield(L, 3, "pipeline");
+      self->pipeline = std::max((size_t)luaL_optinteger(L, -1, (lua_Integer)self->pipeline), (size_t)1);
+      lua_getfield(L, 3, "timeout");
+      self->timeout = (size_t)luaL_optinteger(L, -1, (lua_Integer)self->timeout);
+      lua_pop(L, 4);
+    }
+    http_parser_init(&self->parser, HTTP_REQUEST);
+    self->handler = lua_ref(L, 2);
+
+    auto ud = newuserdata<type_ref>(L, name(), self);
+    if (!ud) {
+      lua_unref(L, self->handler);
+      lua_pushboolean(L, 0);
+      return 1;
+    }
+    self->selfref = lua_ref(L, -1);
+    self->read();
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+
+  /* one receive at a time, the next one is started unless reading is paused */
+  void read() {
+    auto self = shared_from_this();
+    peer->async_receive(
+      [self](const error_code& ec, const char* data, size_t size) {
+        io::service::measure measure(stats_socket);
+        lua_State* L = lua_local();
+        if (ec) {
+          self->close(L);
+          return;
+        }
+        self->receive(L, data, size);
+        if (!self->peer->is_open()) {
+          self->close(L);
+          return;
+        }
+        if (!self->paused) {
+          self->read();
+        }
+      }
+    );
+  }
+
+  void close(lua_State* L) {
+    timer.cancel();
+    release(L);
+  }
+
+  static void init_metatable(lua_State* L) {
+    const luaL_Reg methods[] = {
+      { "__gc",         __gc        },
+      { NULL,           NULL        }
+    };
+    newmetatable(L, name(), methods);
+    lua_pop(L, 1);
+  }
+};
+
+/********************************************************************************/
+
+SKYNET_API int luaopen_httpd(lua_State* L) {
+  http_session::init_metatable(L);
+  lua_getglobal(L, "io");
+  lua_getfield(L, -1, "http");
+  lua_pushcfunction(L, http_session::serve);
+  lua_setfield(L, -2, "serve");
+  lua_pop(L, 2);
+  return 0;
+}
+
+/********************************************************************************/
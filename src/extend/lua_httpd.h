@@ -0,0 +1,17 @@
+
+#ifndef __LUA_HTTPD_H
+#define __LUA_HTTPD_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1200)
+# pragma once
+#endif
+
+#include "../skynet_lua.h"
+
+/********************************************************************************/
+
+SKYNET_API int luaopen_httpd(lua_State* L);
+
+/********************************************************************************/
+
+#endif //__LUA_HTTPD_H
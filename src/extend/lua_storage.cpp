@@ -107,6 +107,7 @@ static int luac_set_if(lua_State* L) {
 
 static int luac_get(lua_State* L) {
   key_type key = luaL_checkstring(L, 1);
+  int lazy = luaL_optboolean(L, 2, 0);
   std::unique_lock<std::recursive_mutex> lock(_mutex);
 
   auto iter = _storage.find(key);
@@ -114,9 +115,9 @@ static int luac_get(lua_State* L) {
     lua_pushnil(L);
     return 1;
   }
-  value_type value = iter->second;
-  lua_pushlstring(L, value.c_str(), value.size());
-  return lua_unwrap(L);
+  lua_pushlstring(L, iter->second.c_str(), iter->second.size());
+  lock.unlock();
+  return lazy ? lua_unwrap_view(L) : lua_unwrap(L);
 }
 
 static int luac_exist(lua_State* L) {
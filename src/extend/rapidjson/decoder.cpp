@@ -0,0 +1,172 @@
+#include <limits>
+#include <cstring>
+
+#include <lua.hpp>
+
+#include "userdata.hpp"
+#include "values.hpp"
+#include "decoder.hpp"
+
+
+template<>
+const char* const Userdata<Decoder>::metatable()
+{
+	return "rapidjson.Decoder";
+}
+
+template<>
+Decoder* Userdata<Decoder>::construct(lua_State * L)
+{
+	return new Decoder();
+}
+
+static inline bool isspace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool Decoder::next(size_t& begin, size_t& end)
+{
+	const char* p = data.data();
+	size_t n = data.size();
+	if (!started) {
+		while (head < n && isspace(p[head]))
+			++head;
+		if (head == n)
+			return false;
+		started = true;
+		scan = head;
+	}
+
+	char first = p[head];
+	if (first != '{' && first != '[' && first != '"') {
+		// a number or a literal at the top ends at the first delimiter
+		for (; scan < n; ++scan) {
+			if (isspace(p[scan]) || strchr(",{}[]\"", p[scan]))
+				break;
+		}
+		if (scan == n)
+			return false;
+		if (scan == head) // a stray delimiter, left to the parser to report
+			++scan;
+	}
+	else {
+		for (; scan < n; ++scan) {
+			char c = p[scan];
+			if (instring) {
+				if (escape)
+					escape = false;
+				else if (c == '\\')
+					escape = true;
+				else if (c == '"') {
+					instring = false;
+					if (depth == 0)
+						break;
+				}
+			}
+			else if (c == '"')
+				instring = true;
+			else if (c == '{' || c == '[')
+				++depth;
+			else if ((c == '}' || c == ']') && --depth <= 0)
+				break;
+		}
+		if (scan == n)
+			return false;
+		++scan;
+	}
+
+	begin = head;
+	end = head = scan;
+	reset();
+	return true;
+}
+
+void Decoder::compact()
+{
+	if (head > 4096 && head * 2 > data.size()) {
+		data.erase(0, head);
+		scan -= head;
+		head = 0;
+	}
+}
+
+static int Decoder_feed(lua_State* L)
+{
+	Decoder* decoder = Userdata<Decoder>::check(L, 1);
+	size_t len = 0;
+	const char* s = luaL_checklstring(L, 2, &len);
+	decoder->feed(s, len);
+	lua_pushinteger(L, static_cast<lua_Integer>(decoder->size()));
+	return 1;
+}
+
+/**
+ * Returns true and the next document, false when it's not complete yet,
+ * or nil and the error message when it's not a valid json.
+ */
+static int Decoder_next(lua_State* L)
+{
+	Decoder* decoder = Userdata<Decoder>::check(L, 1);
+	size_t begin, end;
+	if (!decoder->next(begin, end)) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+
+	int n = values::pushDecodedInsitu(L, decoder->data.data() + begin, end - begin);
+	decoder->compact();
+	if (n == 2) // nil, error
+		return 2;
+	lua_pushboolean(L, 1); // [value, true]
+	lua_insert(L, -2); // [true, value]
+	return 2;
+}
+
+static int Decoder_value(lua_State* L)
+{
+	lua_settop(L, 1);
+	Decoder_next(L);
+	if (lua_isnil(L, 2))
+		return luaL_error(L, "%s", lua_tostring(L, 3));
+	return lua_toboolean(L, 2) ? 1 : 0;
+}
+
+static int Decoder_values(lua_State* L)
+{
+	Userdata<Decoder>::check(L, 1);
+	lua_pushcfunction(L, Decoder_value);
+	lua_pushvalue(L, 1);
+	return 2;
+}
+
+static int Decoder_size(lua_State* L)
+{
+	Decoder* decoder = Userdata<Decoder>::check(L, 1);
+	lua_pushinteger(L, static_cast<lua_Integer>(decoder->size()));
+	return 1;
+}
+
+static int Decoder_clear(lua_State* L)
+{
+	Decoder* decoder = Userdata<Decoder>::check(L, 1);
+	decoder->clear();
+	return 0;
+}
+
+template <>
+const luaL_Reg* Userdata<Decoder>::methods() {
+	static const luaL_Reg reg[] = {
+		{ "__gc", metamethod_gc },
+		{ "__tostring", metamethod_tostring },
+
+		{ "feed", Decoder_feed },
+		{ "next", Decoder_next },
+		{ "values", Decoder_values },
+		{ "size", Decoder_size },
+		{ "clear", Decoder_clear },
+
+		{ NULL, NULL }
+	};
+	return reg;
+}
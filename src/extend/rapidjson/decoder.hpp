@@ -0,0 +1,49 @@
+#ifndef __LUA_RAPIDJSON_DECODER_HPP__
+#define __LUA_RAPIDJSON_DECODER_HPP__
+
+#include <string>
+
+/**
+ * Decoder for a stream of json documents, such as the chunks given by
+ * socket:receive. Only the bytes not yet decoded are kept, and the bounds of
+ * the document at the head are scanned from where the last feed stopped.
+ */
+struct Decoder {
+	Decoder() : head(0), scan(0), depth(0), started(false), instring(false), escape(false) {}
+
+	void feed(const char* s, size_t len) {
+		data.append(s, len);
+	}
+
+	size_t size() const {
+		return data.size() - head;
+	}
+
+	void clear() {
+		data.clear();
+		head = scan = 0;
+		reset();
+	}
+
+	// Find the end of the document at the head, false when it's not complete yet
+	bool next(size_t& begin, size_t& end);
+
+	// Drop the decoded bytes once they are most of the buffer
+	void compact();
+
+	std::string data;
+private:
+	void reset() {
+		depth = 0;
+		started = instring = escape = false;
+	}
+
+	size_t head;	// start of the document at the head
+	size_t scan;	// bytes of it already scanned
+	int depth;
+	bool started;
+	bool instring;
+	bool escape;
+};
+
+#endif // __LUA_RAPIDJSON_DECODER_HPP__
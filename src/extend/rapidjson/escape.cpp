@@ -0,0 +1,139 @@
+#include "escape.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#  define ESCAPE_X64
+#  include <immintrin.h>
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#    define ESCAPE_TARGET(x)
+#  else
+#    define ESCAPE_TARGET(x) __attribute__((target(x)))
+#  endif
+#endif
+
+namespace escape {
+	typedef size_t(*Scan)(const char* s, size_t len);
+
+	static inline bool escaped(char c)
+	{
+		return static_cast<unsigned char>(c) < 0x20 || c == '"' || c == '\\';
+	}
+
+	static size_t scan_none(const char* s, size_t len)
+	{
+		size_t i = 0;
+		while (i < len && !escaped(s[i]))
+			++i;
+		return i;
+	}
+
+#ifdef ESCAPE_X64
+	static inline unsigned first(unsigned mask)
+	{
+#ifdef _MSC_VER
+		unsigned long offset;
+		_BitScanForward(&offset, mask);
+		return offset;
+#else
+		return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+	}
+
+	// inlined into scan_avx2 too, where it's compiled to AVX code
+	static inline size_t scan_16(const char* s, size_t len)
+	{
+		const __m128i dq = _mm_set1_epi8('"');
+		const __m128i bs = _mm_set1_epi8('\\');
+		const __m128i sp = _mm_set1_epi8(0x1F);
+		size_t i = 0;
+		for (; i + 16 <= len; i += 16) {
+			const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+			const __m128i x = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, dq), _mm_cmpeq_epi8(v, bs)),
+				_mm_cmpeq_epi8(_mm_max_epu8(v, sp), sp)); // v < 0x20 <=> max(v, 0x1F) == 0x1F
+			unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(x));
+			if (mask != 0)
+				return i + first(mask);
+		}
+		return i + scan_none(s + i, len - i);
+	}
+
+	static size_t scan_sse2(const char* s, size_t len)
+	{
+		return scan_16(s, len);
+	}
+
+	ESCAPE_TARGET("avx2")
+	static size_t scan_avx2(const char* s, size_t len)
+	{
+		const __m256i dq = _mm256_set1_epi8('"');
+		const __m256i bs = _mm256_set1_epi8('\\');
+		const __m256i sp = _mm256_set1_epi8(0x1F);
+		size_t i = 0;
+		for (; i + 32 <= len; i += 32) {
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+			const __m256i x = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, dq), _mm256_cmpeq_epi8(v, bs)),
+				_mm256_cmpeq_epi8(_mm256_max_epu8(v, sp), sp));
+			unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(x));
+			if (mask != 0)
+				return i + first(mask);
+		}
+		// not a call to scan_sse2, switching to legacy SSE code after AVX code is slow
+		return i + scan_16(s + i, len - i);
+	}
+
+	static bool has_avx2()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+			return false; // no osxsave or avx, or the os doesn't save the ymm registers
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+#endif
+
+	struct Dispatch {
+		Dispatch() : fn(scan_none), name("none") {
+#ifdef ESCAPE_X64
+			if (has_avx2()) {
+				fn = scan_avx2;
+				name = "avx2";
+			}
+			else {
+				fn = scan_sse2;
+				name = "sse2";
+			}
+#endif
+		}
+		Scan fn;
+		const char* name;
+	};
+
+	static const Dispatch& dispatch()
+	{
+		static const Dispatch d;
+		return d;
+	}
+
+	size_t scan(const char* s, size_t len)
+	{
+#ifdef ESCAPE_X64
+		if (len < 64) // not worth the setup of the AVX registers
+			return scan_16(s, len);
+#endif
+		return dispatch().fn(s, len);
+	}
+
+	const char* simd()
+	{
+		return dispatch().name;
+	}
+}
@@ -0,0 +1,20 @@
+#ifndef __LUA_RAPIDJSON_ESCAPE_HPP__
+#define __LUA_RAPIDJSON_ESCAPE_HPP__
+
+#include <cstddef>
+
+namespace escape {
+	/**
+	 * Returns the offset of the first character that must be escaped in a json
+	 * string (control characters, '"' and '\\'), or len when there is none.
+	 * The SIMD version is picked on the first call by the features of the cpu.
+	 */
+	size_t scan(const char* s, size_t len);
+
+	/**
+	 * Name of the version picked by scan: "avx2", "sse2" or "none".
+	 */
+	const char* simd();
+}
+
+#endif // __LUA_RAPIDJSON_ESCAPE_HPP__
@@ -2,6 +2,7 @@
 #include <cstdio>
 #include <vector>
 #include <algorithm>
+#include <cstring>
 
 // __SSE2__ and __SSE4_2__ are recognized by gcc, clang, and the Intel compiler.
 // We use -march=native with gmake to enable -msse2 and -msse4.2, if supported.
@@ -30,6 +31,8 @@
 #include "luax.hpp"
 #include "file.hpp"
 #include "stringstream.hpp"
+#include "decoder.hpp"
+#include "escape.hpp"
 
 using namespace rapidjson;
 
@@ -102,8 +105,7 @@ static int json_decode(lua_State* L)
 		return luaL_argerror(L, 1, "required string or lightuserdata (points to a memory of a string)");
 	}
 
-	rapidjson::extend::StringStream s(contents, len);
-	return values::pushDecoded(L, s);
+	return values::pushDecodedInsitu(L, contents, len);
 }
 
 
@@ -138,14 +140,66 @@ struct Key
 
 
 
+/**
+ * Writer of json.encode, kept by each thread with its buffer. Strings without
+ * characters to escape are copied at once, the scan for them is picked at
+ * runtime by the features of the cpu.
+ */
+class StringWriter : public Writer<StringBuffer> {
+public:
+	StringWriter() : Writer<StringBuffer>(buffer) {}
+
+	bool String(const Ch* str, SizeType length, bool copy = false) {
+		if (escape::scan(str, length) < length)
+			return Writer<StringBuffer>::String(str, length, copy);
+		Prefix(kStringType);
+		PutReserve(*os_, length + 2);
+		PutUnsafe(*os_, '\"');
+		std::memcpy(os_->Push(length), str, length);
+		PutUnsafe(*os_, '\"');
+		return EndValue(true);
+	}
+
+	bool Key(const Ch* str, SizeType length, bool copy = false) {
+		return String(str, length, copy);
+	}
+
+	void Reset() {
+		buffer.Clear();
+		Writer<StringBuffer>::Reset(buffer);
+	}
+
+	// Release the buffer when a large document was written
+	void Release() {
+		if (buffer.GetSize() > RETAIN) {
+			buffer.Clear();
+			buffer.ShrinkToFit();
+		}
+	}
+
+	StringBuffer buffer;
+private:
+	static const size_t RETAIN = 1024 * 1024;
+};
+
+static thread_local StringWriter string_writer;
+
+
 class Encoder {
 	bool pretty;
 	bool sort_keys;
 	bool empty_table_as_array;
 	int max_depth;
 	static const int MAX_DEPTH_DEFAULT = 128;
+
+	// __jsontype of the metatables met while encoding, most tables share a few
+	enum JsonType { JSON_NONE, JSON_OBJECT, JSON_ARRAY };
+	static const int META_CACHE = 4;
+	const void* metas[META_CACHE];
+	JsonType types[META_CACHE];
+	int nmeta;
 public:
-	Encoder(lua_State*L, int opt) : pretty(false), sort_keys(false), empty_table_as_array(false), max_depth(MAX_DEPTH_DEFAULT)
+	Encoder(lua_State*L, int opt) : pretty(false), sort_keys(false), empty_table_as_array(false), max_depth(MAX_DEPTH_DEFAULT), nmeta(0)
 	{
 		if (lua_isnoneornil(L, opt))
 			return;
@@ -157,6 +211,11 @@ public:
 		max_depth = luax::optintfield(L, opt, "max_depth", MAX_DEPTH_DEFAULT);
 	}
 
+	bool sorted() const
+	{
+		return sort_keys;
+	}
+
 private:
 	template<typename Writer>
 	void encodeValue(lua_State* L, Writer* writer, int idx, int depth = 0)
@@ -201,6 +260,47 @@ private:
 		}
 	}
 
+	JsonType jsonType(lua_State* L, int idx)
+	{
+		if (!lua_getmetatable(L, idx)) // [metatable]
+			return JSON_NONE;
+
+		const void* meta = lua_topointer(L, -1);
+		for (int i = 0; i < nmeta; ++i)
+		{
+			if (metas[i] == meta)
+			{
+				lua_pop(L, 1); // []
+				return types[i];
+			}
+		}
+
+		bool isarray = false;
+		JsonType type = JSON_NONE;
+		lua_pop(L, 1); // []
+		if (values::hasJsonType(L, idx, isarray))
+			type = isarray ? JSON_ARRAY : JSON_OBJECT;
+
+		int slot = nmeta < META_CACHE ? nmeta++ : META_CACHE - 1;
+		metas[slot] = meta;
+		types[slot] = type;
+		return type;
+	}
+
+	bool isarray(lua_State* L, int idx)
+	{
+		JsonType type = jsonType(L, idx);
+		if (type != JSON_NONE) // any table with a meta field __jsontype set to 'array' are arrays
+			return type == JSON_ARRAY;
+
+		lua_pushnil(L);
+		if (lua_next(L, idx) != 0) {
+			lua_pop(L, 2);
+			return luax::rawlen(L, idx) > 0; // any non empty table has length > 0 are treat as array.
+		}
+		return empty_table_as_array;
+	}
+
 	template<typename Writer>
 	void encodeTable(lua_State* L, Writer* writer, int idx, int depth)
 	{
@@ -211,7 +311,7 @@ private:
 			luaL_error(L, "stack overflow");
 
 		idx = luax::absindex(L, idx);
-		if (values::isarray(L, idx, empty_table_as_array))
+		if (isarray(L, idx))
 		{
 			encodeArray(L, writer, idx, depth);
 			return;
@@ -329,6 +429,17 @@ public:
 			encodeValue(L, &writer, idx);
 		}
 	}
+
+	void encode(lua_State* L, StringWriter* writer, int idx)
+	{
+		if (pretty)
+		{
+			PrettyWriter<StringBuffer> pretty_writer(writer->buffer);
+			encodeValue(L, &pretty_writer, idx);
+		}
+		else
+			encodeValue(L, writer, idx);
+	}
 };
 
 
@@ -336,9 +447,18 @@ static int json_encode(lua_State* L)
 {
 	try{
 		Encoder encode(L, 2);
-		StringBuffer s;
-		encode.encode(L, &s, 1);
-		lua_pushlstring(L, s.GetString(), s.GetSize());
+		if (encode.sorted()) {
+			// looking up the sorted keys may run a finalizer that encodes too
+			StringBuffer s;
+			encode.encode(L, &s, 1);
+			lua_pushlstring(L, s.GetString(), s.GetSize());
+			return 1;
+		}
+		StringWriter* writer = &string_writer;
+		writer->Reset();
+		encode.encode(L, writer, 1);
+		lua_pushlstring(L, writer->buffer.GetString(), writer->buffer.GetSize());
+		writer->Release();
 		return 1;
 	}
 	catch (...) {
@@ -394,6 +514,7 @@ static const luaL_Reg methods[] = {
 	{ "Document", Userdata<Document>::create },
 	{ "SchemaDocument", Userdata<SchemaDocument>::create },
 	{ "SchemaValidator", Userdata<SchemaValidator>::create },
+	{ "decoder", Userdata<Decoder>::create },
 
 	{NULL, NULL }
 };
@@ -409,6 +530,9 @@ int luaL_rapidjson(lua_State* L)
 	lua_pushliteral(L, LUA_RAPIDJSON_VERSION); // [rapidjson, version]
 	lua_setfield(L, -2, "_VERSION"); // [rapidjson]
 
+	lua_pushstring(L, escape::simd()); // [rapidjson, simd]
+	lua_setfield(L, -2, "_SIMD"); // [rapidjson]
+
   values::push_null(L); // [rapidjson, json.null]
   lua_setfield(L, -2, "null"); // [rapidjson]
 
@@ -418,5 +542,6 @@ int luaL_rapidjson(lua_State* L)
 	Userdata<Document>::luaopen(L);
 	Userdata<SchemaDocument>::luaopen(L);
 	Userdata<SchemaValidator>::luaopen(L);
+	Userdata<Decoder>::luaopen(L);
 	return 1;
 }
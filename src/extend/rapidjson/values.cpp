@@ -5,6 +5,11 @@
 using rapidjson::Value;
 using rapidjson::SizeType;
 
+// Buffers kept by each thread for pushDecodedInsitu, released above this size.
+static const size_t INSITU_RETAIN = 1024 * 1024;
+static thread_local std::vector<char> insitu_buffer;
+static thread_local values::Allocator insitu_pool;
+
 
 namespace values {
 
@@ -14,6 +19,7 @@ namespace values {
 		static Value TableValue(lua_State* L, int idx, int depth, Allocator& allocator);
 		static Value ObjectValue(lua_State* L, int idx, int depth, Allocator& allocator);
 		static Value ArrayValue(lua_State* L, int idx, int depth, Allocator& allocator);
+		static bool pushPresized(lua_State* L, const Value& v, int meta);
 
 
 		Value toValue(lua_State* L, int idx, int depth, Allocator& allocator) {
@@ -101,6 +107,97 @@ namespace values {
 
 			return array;
 		}
+
+		// meta is the index of json.object, json.array is at meta + 1
+		bool pushPresized(lua_State* L, const Value& v, int meta)
+		{
+			switch (v.GetType()) {
+			case rapidjson::kNullType:
+				push_null(L);
+				return true;
+			case rapidjson::kFalseType:
+				lua_pushboolean(L, 0);
+				return true;
+			case rapidjson::kTrueType:
+				lua_pushboolean(L, 1);
+				return true;
+			case rapidjson::kStringType:
+				lua_pushlstring(L, v.GetString(), v.GetStringLength());
+				return true;
+			case rapidjson::kNumberType:
+				if (v.IsInt64())
+					lua_pushinteger(L, static_cast<lua_Integer>(v.GetInt64()));
+				else if (v.IsUint64())
+					lua_pushnumber(L, static_cast<lua_Number>(v.GetUint64()));
+				else
+					lua_pushnumber(L, static_cast<lua_Number>(v.GetDouble()));
+				return true;
+			case rapidjson::kObjectType:
+				if (!lua_checkstack(L, 3)) // object, key, value
+					return false;
+				lua_createtable(L, 0, static_cast<int>(v.MemberCount())); // [object]
+				lua_pushvalue(L, meta);
+				lua_setmetatable(L, -2);
+				for (Value::ConstMemberIterator i = v.MemberBegin(); i != v.MemberEnd(); ++i)
+				{
+					lua_pushlstring(L, i->name.GetString(), i->name.GetStringLength()); // [object, key]
+					if (!pushPresized(L, i->value, meta))
+						return false;
+					lua_rawset(L, -3); // [object]
+				}
+				return true;
+			case rapidjson::kArrayType:
+				if (!lua_checkstack(L, 2)) // array, element
+					return false;
+				lua_createtable(L, static_cast<int>(v.Size()), 0); // [array]
+				lua_pushvalue(L, meta + 1);
+				lua_setmetatable(L, -2);
+				for (SizeType n = 0; n < v.Size(); ++n)
+				{
+					if (!pushPresized(L, v[n], meta))
+						return false;
+					lua_rawseti(L, -2, n + 1); // [array]
+				}
+				return true;
+			}
+			return false;
+		}
 	}
 
+	int pushDecodedInsitu(lua_State* L, const char* ptr, size_t len)
+	{
+		int top = lua_gettop(L);
+		bool pushed = false;
+		insitu_pool.Clear();
+		insitu_buffer.assign(ptr, ptr + len);
+		insitu_buffer.push_back('\0');
+		{
+			rapidjson::Document doc(&insitu_pool);
+			doc.ParseInsitu(insitu_buffer.data());
+			if (doc.HasParseError()) {
+				lua_pushnil(L);
+				lua_pushfstring(L, "%s (%d)", rapidjson::GetParseError_En(doc.GetParseError()), doc.GetErrorOffset());
+			}
+			else {
+				luaL_getmetatable(L, "json.object"); // [json.object]
+				luaL_getmetatable(L, "json.array"); // [json.object, json.array]
+				pushed = details::pushPresized(L, doc, top + 1);
+			}
+		}
+		insitu_pool.Clear();
+		if (insitu_buffer.capacity() > INSITU_RETAIN)
+			std::vector<char>().swap(insitu_buffer);
+
+		if (lua_gettop(L) == top + 2) // nil, error
+			return 2;
+		if (!pushed) {
+			lua_settop(L, top);
+			lua_pushnil(L);
+			lua_pushliteral(L, "stack overflow");
+			return 2;
+		}
+		lua_replace(L, top + 1);
+		lua_settop(L, top + 1);
+		return 1;
+	}
 }
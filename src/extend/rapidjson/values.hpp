@@ -263,6 +263,12 @@ namespace values {
         rapidjson::extend::StringStream s(ptr, len);
         return pushDecoded(L, s);
 	}
+
+	/**
+	 * Decode a json string into Lua tables created with their final sizes.
+	 * The string is parsed in place from a per-thread copy, then pushed.
+	 */
+	int pushDecodedInsitu(lua_State* L, const char* ptr, size_t len);
 }
 
 #endif // __LUA_RAPIDJSON_TOLUAHANDLER_HPP__
@@ -41,6 +41,7 @@ private:
 };
 
 static thread_local lua_allotor allotor;
+static thread_local size_t allocated = 0; /* bytes, for the rate of allocation */
 
 /********************************************************************************/
 
@@ -129,7 +130,17 @@ void* skynet_allotor(void* ud, void* ptr, size_t osize, size_t nsize) {
     allotor.p_free(ptr, osize);
     return NULL;
   }
+  if (ptr == NULL) {
+    allocated += nsize; /* osize is the type of the object */
+  }
+  else if (nsize > osize) {
+    allocated += nsize - osize;
+  }
   return allotor.p_realloc(ptr, osize, nsize);
 }
 
+size_t skynet_allocated() {
+  return allocated;
+}
+
 /********************************************************************************/
@@ -11,6 +11,9 @@
 
 void* skynet_allotor(void* ud, void* ptr, size_t osize, size_t nsize);
 
+/* bytes allocated by the states of the calling thread since it started */
+size_t skynet_allocated();
+
 /********************************************************************************/
 
 #endif //SKYNET_ALLOTOR_H
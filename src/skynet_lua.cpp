@@ -11,6 +11,8 @@
 #include "extend/lua_skiplist.h"
 #include "extend/lua_deflate.h"
 #include "extend/lua_http.h"
+#include "extend/lua_httpc.h"
+#include "extend/lua_httpd.h"
 #include "extend/lua_openssl.h"
 #include "extend/lua_string.h"
 #include "extend/lua_storage.h"
@@ -25,6 +27,8 @@ static const lua_CFunction skynet_modules[] = {
   luaopen_json,         /* json.encode... */
   luaopen_list,         /* list */
   luaopen_http,         /*  */
+  luaopen_httpc,        /* io.http.request */
+  luaopen_httpd,        /* io.http.serve */
   luaopen_skiplist,     /*  */
   luaopen_deflate,      /* deflate, inflate */
   luaopen_base64,       /* base64.encode  */
@@ -32,7 +36,7 @@ static const lua_CFunction skynet_modules[] = {
   luaopen_lstring,      /* string.split    */
   luaopen_storage,      /*  */
   luaopen_directory,    /* os.mkdir, os.opendir */
-  luaopen_profiler,     /* snapshot */
+  luaopen_profiler,     /* os.profile, os.snapshot */
   NULL
 };
 
@@ -57,8 +61,7 @@ static void openlibs(lua_State* L, const lua_CFunction f[]) {
   if (lua_gettop(L) > 0) {
     lua_ftrace("%s", "WARNNING: stack exception");
   }
-  lua_gc(L, LUA_GCRESTART);
-  lua_gc(L, LUA_GCGEN, 0, 0);
+  lua_gc(L, LUA_GCRESTART); /* the mode is set by os.gcbudget */
 }
 
 static lua_State* newstate() {
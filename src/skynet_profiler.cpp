@@ -3,32 +3,37 @@
 #include "skynet_lua.h"
 #include "skynet_profiler.h"
 
-/********************************************************************************/
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#if !defined(_MSC_VER)
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 
-static void mark_object(
-  lua_State *L, lua_State *dL, const void * parent, const char * desc
-);
+/********************************************************************************/
 
-#define UNKNOWN		0
-#define TABLE			1
-#define FUNCTION	2
-#define THREAD		3
-#define USERDATA	4
-#define MARK			5
+#define SNAPSHOT_BUDGET   1       /* ms of walk per turn of the service */
+#define SNAPSHOT_CHECK    64      /* objects walked between two looks at the clock */
+#define SNAPSHOT_CHUNK    256     /* entries of a table walked at once */
+#define SNAPSHOT_OBJECT   64      /* bytes of an object, to size the set of the seen */
+#define SNAPSHOT_BUFFER   65536
+#define SNAPSHOT_END      0xff    /* type of the last record */
 
-/********************************************************************************/
+static const char snapshot_magic[8] = { 'L', 'U', 'A', 'H', 'E', 'A', 'P', '1' };
 
-static bool is_marked(lua_State* dL, const void* p) {
-  lua_rawgetp(dL, MARK, p);
-  if (lua_isnil(dL, -1)) {    /* if not marked */
-    lua_pop(dL, 1);           /* pop nil */
-    lua_pushboolean(dL, 1);   /* push true */
-    lua_rawsetp(dL, MARK, p); /* set marked: t[p] = true */
-    return false;
-  }
-  lua_pop(dL, 1); /*pop true */
-  return true;
-}
+/* a record of the file, in native byte order, followed by the name */
+struct snapshot_record {
+  uint8_t  type;          /* lua type, SNAPSHOT_END for the last record */
+  uint8_t  reserved;
+  uint16_t length;        /* of the name */
+  uint32_t size;          /* bytes, estimated */
+  uint64_t address;
+  uint64_t referrer;      /* the object it was first found in, 0 for the root */
+};
 
 static bool is_lightcfunction(lua_State *L, int i) {
   if (lua_iscfunction(L, i)) {
@@ -40,45 +45,6 @@ static bool is_lightcfunction(lua_State *L, int i) {
   return false;
 }
 
-static int check_type(lua_State *L, int i) {
-  switch (lua_type(L, i)) {
-  case LUA_TTABLE:
-    return TABLE;
-  case LUA_TFUNCTION:
-    if (is_lightcfunction(L, i)) break;
-    return FUNCTION;
-  case LUA_TTHREAD:
-    return THREAD;
-  case LUA_TUSERDATA:
-    return USERDATA;
-  }
-  lua_pop(L, 1);
-  return UNKNOWN;
-}
-
-static const void* read_object(lua_State *L, lua_State *dL, const void *parent, const char *desc) {
-  int tidx = check_type(L, -1);
-  if (tidx == UNKNOWN) {
-    return NULL;
-  }
-  const void *pv = lua_topointer(L, -1);
-  if (is_marked(dL, pv)) {
-    lua_rawgetp(dL, tidx, pv);
-    if (!lua_isnil(dL, -1)) {
-      lua_pushstring(dL, desc);
-      lua_rawsetp(dL, -2, parent);
-    }
-    lua_pop(dL, 1);
-    lua_pop(L,  1);
-    return NULL;
-  }
-  lua_newtable(dL);
-  lua_pushstring(dL, desc);
-  lua_rawsetp(dL, -2, parent);
-  lua_rawsetp(dL, tidx, pv);
-  return pv;
-}
-
 static const char* key_tostring(lua_State *L, int i, char * buffer, size_t size) {
   int type = lua_type(L, i);
   switch (type) {
@@ -100,151 +66,762 @@ static const char* key_tostring(lua_State *L, int i, char * buffer, size_t size)
   return buffer;
 }
 
-static void mark_table(lua_State *L, lua_State *dL, const void * parent, const char * desc) {
-  const void * pv = read_object(L, dL, parent, desc);
-  if (pv == NULL) {
-    return;
+/*
+* Heap snapshot of a service, walked from the registry a budget at a time on
+* the turns of the service and streamed to a file: one record per object with
+* its type, estimated size and the object it was first found in.
+* The objects found and not walked yet are kept alive by the pending table,
+* their referrers and names are kept aside. Big tables are walked a chunk at a
+* time, the next key is kept by the pending table too; a table resized in the
+* meantime loses its next key and the rest of it isn't walked.
+* The walk isn't atomic: objects created during the walk may be found or not,
+* and an address freed and reused during the walk is taken as seen.
+*/
+struct heap_snapshot final {
+  struct edge {
+    const void* referrer;
+    std::string name;
+    bool   started;  /* tables: the walk of the entries began */
+    bool   done;
+    bool   weakk;
+    bool   weakv;
+    size_t count;    /* tables: entries walked */
+  };
+
+  bool   running = false;
+  size_t budget  = SNAPSHOT_BUDGET * 1000; /* us */
+  size_t objects = 0;
+  size_t bytes   = 0;
+  size_t turns   = 0;
+  size_t begin   = 0;    /* us */
+  size_t elapsed = 0;    /* us, from the start to the end */
+  std::string filename;
+  std::string error;
+
+  inline static heap_snapshot& local() {
+    static thread_local heap_snapshot snapshot;
+    return snapshot;
+  }
+  inline static size_t now() {
+    return (size_t)std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+  }
+
+  bool start(lua_State* L, const char* name) {
+    _file = fopen(name, "wb");
+    if (!_file) {
+      error = strerror(errno);
+      return false;
+    }
+    setvbuf(_file, nullptr, _IOFBF, SNAPSHOT_BUFFER);
+    fwrite(snapshot_magic, 1, sizeof(snapshot_magic), _file);
+    filename = name;
+    error.clear();
+    objects = bytes = turns = elapsed = 0;
+    begin = now();
+    running = true;
+    _generation++; /* the turns of a stopped walk end */
+
+    /* a rehash of a big set is a long pause, objects are rarely under 64 bytes */
+    _seen.reserve((size_t)lua_gc(L, LUA_GCCOUNT) * 1024 / SNAPSHOT_OBJECT);
+    lua_newtable(L);
+    _seen.insert(lua_topointer(L, -1));
+    _pending = lua_ref(L, -1);
+    _index = lua_gettop(L);
+    lua_pushvalue(L, LUA_REGISTRYINDEX);
+    found(L, nullptr, "[registry]");
+    lua_pop(L, 1);
+    next();
+    return true;
   }
-  bool weakk = false;
-  bool weakv = false;
-  if (lua_getmetatable(L, -1)) {
-    lua_pushliteral(L, "__mode");
-    lua_rawget(L, -2);
-    if (lua_isstring(L,-1)) {
-      const char *mode = lua_tostring(L, -1);
-      if (strchr(mode, 'k')) {
-        weakk = true;
+
+  void stop(lua_State* L, const char* reason) {
+    if (reason) {
+      error = reason;
+    }
+    else {
+      snapshot_record end = { SNAPSHOT_END, 0, 0, 0, objects, bytes };
+      fwrite(&end, sizeof(end), 1, _file);
+    }
+    if (fclose(_file) != 0 && error.empty()) {
+      error = strerror(errno);
+    }
+    _file = nullptr;
+    lua_unref(L, _pending);
+    _pending = LUA_NOREF;
+    std::vector<edge>().swap(_edges);
+    std::unordered_set<const void*>().swap(_seen);
+    elapsed = now() - begin;
+    running = false;
+  }
+
+  /* walks until the budget is spent, the pending table is at the top */
+  void step(lua_State* L) {
+    _index = lua_gettop(L);
+    size_t start = now();
+    size_t n = 0;
+    while (!_edges.empty()) {
+      if (n >= SNAPSHOT_CHECK) {
+        if (now() - start > budget) {
+          break;
+        }
+        n = 0;
       }
-      if (strchr(mode, 'v')) {
-        weakv = true;
+      int i = (int)_edges.size();
+      if (_edges.back().done) {
+        pop(L, i); /* the entries of the table are walked */
+        continue;
       }
+      lua_rawgeti(L, _index, i);
+      if (lua_type(L, -1) == LUA_TTABLE) {
+        n += walk_table(L, i);
+        continue;
+      }
+      edge e(std::move(_edges.back()));
+      pop(L, i);
+      walk(L, e);
+      n++;
     }
-    lua_pop(L,1);
-    luaL_checkstack(L, LUA_MINSTACK, NULL);
-    mark_table(L, dL, pv, "[metatable]");
+    turns++;
   }
-  lua_pushnil(L);
-  while (lua_next(L, -2) != 0) {
-    if (weakv) {
+
+  void next() {
+    size_t generation = _generation;
+    lua_service()->post([this, generation]() {
+      if (running && generation == _generation) {
+        lua_State* L = lua_local();
+        lua_auto_revert revert(L);
+        lua_pushcfunction(L, snapshot_step);
+        if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+          stop(L, luaL_tolstring(L, -1, nullptr));
+        }
+        else if (_edges.empty()) {
+          stop(L, nullptr);
+        }
+        else {
+          next();
+        }
+      }
+    });
+  }
+
+private:
+  static int snapshot_step(lua_State* L) {
+    auto& snapshot = local();
+    lua_pushref(L, snapshot._pending);
+    snapshot.step(L);
+    return 0;
+  }
+
+  /* stack: pending, table, key; returns the next key, none at the end */
+  static int snapshot_chunk(lua_State* L) {
+    auto& snapshot = local();
+    snapshot._index = 1;
+    return snapshot.walk_entries(L);
+  }
+
+  void pop(lua_State* L, int i) {
+    lua_pushnil(L);
+    lua_rawseti(L, _index, i);
+    lua_pushnil(L);
+    lua_rawseti(L, _index, -i);
+    _edges.pop_back();
+  }
+
+  void write(int type, size_t size, const void* address, const void* referrer, const char* name, size_t length) {
+    snapshot_record record;
+    record.type = (uint8_t)type;
+    record.reserved = 0;
+    record.length = (uint16_t)std::min(length, (size_t)UINT16_MAX);
+    record.size = (uint32_t)std::min(size, (size_t)UINT32_MAX);
+    record.address = (uint64_t)(uintptr_t)address;
+    record.referrer = (uint64_t)(uintptr_t)referrer;
+    fwrite(&record, sizeof(record), 1, _file);
+    fwrite(name, 1, record.length, _file);
+    objects++;
+    bytes += size;
+  }
+
+  /* pops the value at the top, strings are written now, the others walked later */
+  void found(lua_State* L, const void* referrer, const char* name) {
+    int type = lua_type(L, -1);
+    switch (type) {
+    case LUA_TSTRING: case LUA_TTABLE: case LUA_TUSERDATA: case LUA_TTHREAD:
+      break;
+    case LUA_TFUNCTION:
+      if (!is_lightcfunction(L, -1)) {
+        break;
+      }
+    default:
+      lua_pop(L, 1);
+      return;
+    }
+    const void* p = lua_topointer(L, -1);
+    if (!_seen.insert(p).second) {
+      lua_pop(L, 1);
+      return;
+    }
+    if (type == LUA_TSTRING) {
+      size_t length = 0;
+      lua_tolstring(L, -1, &length);
+      write(type, length + 25, p, referrer, name, strlen(name));
       lua_pop(L, 1);
+      return;
+    }
+    _edges.push_back(edge{ referrer, name, false, false, false, false, 0 });
+    lua_rawseti(L, _index, (lua_Integer)_edges.size());
+  }
+
+  /* pops the value at the top */
+  void walk(lua_State* L, const edge& e) {
+    luaL_checkstack(L, LUA_MINSTACK, NULL);
+    int type = lua_type(L, -1);
+    const void* p = lua_topointer(L, -1);
+    size_t size = 0;
+    switch (type) {
+    case LUA_TUSERDATA:
+      size = walk_userdata(L, p);
+      break;
+    case LUA_TFUNCTION:
+      size = walk_function(L, p);
+      break;
+    case LUA_TTHREAD:
+      size = walk_thread(L, p);
+      break;
+    }
+    write(type, size, p, e.referrer, e.name.c_str(), e.name.size());
+    lua_pop(L, 1);
+  }
+
+  /* pops the table at the top, walks a chunk of it, returns the entries walked */
+  size_t walk_table(lua_State* L, int i) {
+    int t = lua_gettop(L);
+    const void* p = lua_topointer(L, t);
+    if (!_edges[i - 1].started) {
+      _edges[i - 1].started = true;
+      if (lua_getmetatable(L, t)) {
+        lua_getfield(L, -1, "__mode");
+        if (lua_isstring(L, -1)) {
+          const char* mode = lua_tostring(L, -1);
+          _edges[i - 1].weakk = strchr(mode, 'k') != nullptr;
+          _edges[i - 1].weakv = strchr(mode, 'v') != nullptr;
+        }
+        lua_pop(L, 1);
+        found(L, p, "[metatable]");
+      }
+    }
+    size_t count = _edges[i - 1].count;
+    _chunk = i;
+    lua_pushcfunction(L, snapshot_chunk);
+    lua_pushvalue(L, _index);
+    lua_pushvalue(L, t);
+    lua_rawgeti(L, _index, -i);
+    int index = _index;
+    int state = lua_pcall(L, 3, LUA_MULTRET, 0);
+    _index = index;
+    auto& e = _edges[i - 1];
+    if (state == LUA_OK && lua_gettop(L) > t) {
+      lua_rawseti(L, _index, -i); /* walked next time */
     }
     else {
-      char key[256];
-      const char *desc = key_tostring(L, -2, key, sizeof(key));
-      mark_object(L, dL, pv , desc);
+      /* the end, or the table was resized and lost the next key */
+      size_t array = (size_t)lua_rawlen(L, t);
+      size_t hash = e.count > array ? e.count - array : 0;
+      size_t nodes = 1;
+      while (nodes < hash) {
+        nodes <<= 1;
+      }
+      write(LUA_TTABLE, 56 + array * 16 + (hash ? nodes * 32 : 0), p, e.referrer, e.name.c_str(), e.name.size());
+      e.done = true;
     }
-    if (!weakk) {
-      lua_pushvalue(L, -1);
-      mark_object(L, dL, pv , "[key]");
+    lua_settop(L, t - 1);
+    return e.count - count + 1;
+  }
+
+  int walk_entries(lua_State* L) {
+    const void* p = lua_topointer(L, 2);
+    bool weakk = _edges[_chunk - 1].weakk;
+    bool weakv = _edges[_chunk - 1].weakv;
+    char buffer[256];
+    for (int n = 0; n < SNAPSHOT_CHUNK; n++) {
+      if (lua_next(L, 2) == 0) {
+        return 0;
+      }
+      _edges[_chunk - 1].count++;
+      if (!weakv) {
+        std::string name(key_tostring(L, -2, buffer, sizeof(buffer)));
+        found(L, p, name.c_str());
+      }
+      else {
+        lua_pop(L, 1);
+      }
+      if (!weakk) {
+        lua_pushvalue(L, -1);
+        found(L, p, "[key]");
+      }
     }
+    return 1;
   }
-  lua_pop(L, 1);
-}
 
-static void mark_userdata(lua_State *L, lua_State *dL, const void * parent, const char *desc) {
-  const void * pv = read_object(L, dL, parent, desc);
-  if (pv == NULL) {
-    return;
+  size_t walk_userdata(lua_State* L, const void* p) {
+    if (lua_getmetatable(L, -1)) {
+      found(L, p, "[metatable]");
+    }
+    int n = 1;
+    for (; lua_getiuservalue(L, -1, n) != LUA_TNONE; n++) {
+      found(L, p, "[uservalue]");
+    }
+    lua_pop(L, 1); /* none */
+    return 40 + (size_t)lua_rawlen(L, -1) + (n - 1) * 16;
   }
-  if (lua_getmetatable(L, -1)) {
-    mark_table(L, dL, pv, "[metatable]");
+
+  size_t walk_function(lua_State* L, const void* p) {
+    int n = 1;
+    for (; ; n++) {
+      const char* name = lua_getupvalue(L, -1, n);
+      if (name == NULL) {
+        break;
+      }
+      found(L, p, name[0] ? name : "[upvalue]");
+    }
+    n--;
+    return lua_iscfunction(L, -1) ? 32 + n * 16 : 32 + n * 48;
   }
-  lua_getuservalue(L, -1);
-  if (lua_isnil(L,-1)) {
-    lua_pop(L,2);
+
+  size_t walk_thread(lua_State* L, const void* p) {
+    lua_State* cL = lua_tothread(L, -1);
+    int top = lua_gettop(cL);
+    luaL_checkstack(cL, 1, NULL);
+    char name[128];
+    for (int i = 1; i <= top; i++) {
+      lua_pushvalue(cL, i);
+      lua_xmove(cL, L, 1);
+      snprintf(name, sizeof(name), "[%d]", i);
+      found(L, p, name);
+    }
+    lua_Debug ar;
+    for (int level = 0; lua_getstack(cL, level, &ar); level++) {
+      lua_getinfo(cL, "Sl", &ar);
+      for (int j = 1; j > -1; j -= 2) {
+        for (int i = j; ; i += j) {
+          const char* local = lua_getlocal(cL, &ar, i);
+          if (local == NULL) {
+            break;
+          }
+          lua_xmove(cL, L, 1);
+          snprintf(name, sizeof(name), "%s:%s:%d", local, ar.short_src, ar.currentline);
+          found(L, p, name);
+        }
+      }
+    }
+    return 1024 + top * 16;
   }
-  else {
-    mark_object(L, dL, pv, "[userdata]");
-    lua_pop(L,1);
+
+  FILE* _file = nullptr;
+  int   _pending = LUA_NOREF;   /* ref of the table of the objects to walk */
+  int   _index = 0;             /* of the pending table on the stack */
+  int   _chunk = 0;             /* the table walked by snapshot_chunk */
+  size_t _generation = 0;
+  std::vector<edge> _edges;     /* of the pending objects, by their index */
+  std::unordered_set<const void*> _seen;
+};
+
+/* os.snapshot([filename [, budget]] | false) */
+static int os_snapshot(lua_State* L) {
+  auto& snapshot = heap_snapshot::local();
+  if (lua_isnoneornil(L, 1)) {
+    lua_createtable(L, 0, 7);
+    lua_pushboolean(L, snapshot.running ? 1 : 0);
+    lua_setfield(L, -2, "running");
+    lua_pushlstring(L, snapshot.filename.c_str(), snapshot.filename.size());
+    lua_setfield(L, -2, "filename");
+    lua_pushinteger(L, (lua_Integer)snapshot.objects);
+    lua_setfield(L, -2, "objects");
+    lua_pushinteger(L, (lua_Integer)snapshot.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, (lua_Integer)snapshot.turns);
+    lua_setfield(L, -2, "turns");
+    lua_pushnumber(L, (snapshot.running ? heap_snapshot::now() - snapshot.begin : snapshot.elapsed) / 1000.0);
+    lua_setfield(L, -2, "elapsed");
+    if (!snapshot.error.empty()) {
+      lua_pushlstring(L, snapshot.error.c_str(), snapshot.error.size());
+      lua_setfield(L, -2, "error");
+    }
+    return 1;
   }
+  if (lua_isboolean(L, 1) && !lua_toboolean(L, 1)) {
+    if (snapshot.running) {
+      snapshot.stop(L, "stopped");
+    }
+    return 0;
+  }
+  const char* filename = luaL_checkstring(L, 1);
+  auto budget = luaL_optnumber(L, 2, SNAPSHOT_BUDGET);
+  luaL_argcheck(L, budget > 0, 2, "budget must be positive");
+  if (snapshot.running) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "already running");
+    return 2;
+  }
+  snapshot.budget = std::max((size_t)(budget * 1000), (size_t)1);
+  if (!snapshot.start(L, filename)) {
+    lua_pushboolean(L, 0);
+    lua_pushlstring(L, snapshot.error.c_str(), snapshot.error.size());
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
 }
 
-static void mark_function(lua_State *L, lua_State *dL, const void * parent, const char *desc) {
-  const void * pv = read_object(L, dL, parent, desc);
-  if (pv == NULL) {
-    return;
+/********************************************************************************/
+
+#define PROFILE_INTERVAL  1       /* ms of cpu time between two samples */
+#define PROFILE_CAPACITY  10000   /* samples kept, the oldest are overwritten */
+#define PROFILE_DEPTH     32      /* frames kept by a sample, from the top */
+
+#if defined(_MSC_VER)
+#define PROFILE_COUNT     1000    /* no timer signal, a count hook checks the clock */
+#endif
+
+/* the coroutine running on the thread, nullptr for the main state */
+static thread_local lua_State* profile_current = nullptr;
+
+/*
+* Sampling profiler of a service. A timer of the cpu time of the thread sends
+* it SIGPROF, the handler sets a one shot hook on the running coroutine, as
+* lua.c does for SIGINT, and the hook takes a sample of its stack: there is no
+* hook between samples. Ticks spent in C before the hook runs weight the sample.
+* Without timer signals (windows) a count hook checks the clock instead.
+*/
+struct lua_profiler final {
+  struct sample {
+    uint32_t weight;
+    uint32_t depth;
+    uint32_t frames[PROFILE_DEPTH]; /* the top of the stack first */
+  };
+
+  bool   running  = false;
+  size_t interval = PROFILE_INTERVAL * 1000; /* us */
+  size_t head     = 0;       /* next slot of the ring */
+  size_t count    = 0;       /* samples in the ring */
+  size_t dropped  = 0;       /* samples overwritten */
+  lua_State* mainL = nullptr;
+  std::vector<sample> ring;
+  std::vector<std::string> names;
+  std::unordered_map<std::string, uint32_t> ids;
+#if defined(PROFILE_COUNT)
+  size_t next = 0;           /* us, time of the next sample */
+#else
+  volatile sig_atomic_t pending = 0; /* ticks not sampled yet */
+  timer_t timer;
+#endif
+
+  inline static lua_profiler& local() {
+    static thread_local lua_profiler profiler;
+    return profiler;
   }
-  for (int i = 1; ; i++) {
-    const char *name = lua_getupvalue(L, -1, i);
-    if (name == NULL) {
-      break;
+  inline static size_t now() {
+    return (size_t)std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+  }
+  inline lua_State* running_state() const {
+    return profile_current ? profile_current : mainL;
+  }
+
+#if defined(PROFILE_COUNT)
+  bool start() {
+    next = now() + interval;
+    lua_sethook(mainL, lua_profile_hook, LUA_MASKCOUNT, PROFILE_COUNT);
+    if (profile_current) {
+      lua_sethook(profile_current, lua_profile_hook, LUA_MASKCOUNT, PROFILE_COUNT);
     }
-    mark_object(L, dL, pv, name[0] ? name : "[upvalue]");
+    return true;
   }
-  lua_pop(L,1); /* get upvalue only */
-}
+  void stop() {
+  }
+#else
+  static void on_signal(int sig) {
+    auto& profiler = local();
+    if (!profiler.running) {
+      return;
+    }
+    lua_State* L = profiler.running_state();
+    lua_Hook hook = lua_gethook(L);
+    if (hook && hook != lua_profile_hook) {
+      return; /* a debugger's */
+    }
+    profiler.pending = profiler.pending + 1;
+    lua_sethook(L, lua_profile_hook, LUA_MASKCOUNT, 1);
+  }
+  bool start() {
+    static std::once_flag once;
+    std::call_once(once, []() {
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = on_signal;
+      sa.sa_flags = SA_RESTART;
+      sigemptyset(&sa.sa_mask);
+      sigaction(SIGPROF, &sa, nullptr);
+    });
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev._sigev_un._tid = (pid_t)syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timer) != 0) {
+      return false;
+    }
+    struct itimerspec its;
+    its.it_interval.tv_sec = (time_t)(interval / 1000000);
+    its.it_interval.tv_nsec = (long)(interval % 1000000) * 1000;
+    its.it_value = its.it_interval;
+    if (timer_settime(timer, 0, &its, nullptr) != 0) {
+      timer_delete(timer);
+      return false;
+    }
+    pending = 0;
+    return true;
+  }
+  void stop() {
+    timer_delete(timer);
+  }
+#endif
 
-static void mark_thread(lua_State *L, lua_State *dL, const void * parent, const char *desc) {
-  const void * pv = read_object(L, dL, parent, desc);
-  if (pv == NULL) {
-    return;
+  void clear() {
+    head = count = dropped = 0;
+    std::vector<sample>().swap(ring);
+    std::vector<std::string>().swap(names);
+    ids.clear();
   }
-  int level = 0;
-  lua_State *cL = lua_tothread(L, -1);
-  if (cL == L) {
-    level = 1;
+
+  uint32_t id_of(lua_Debug* ar) {
+    char name[256];
+    if (*ar->what == 'C') {
+      snprintf(name, sizeof(name), "%s [C]", ar->name ? ar->name : "?");
+    }
+    else if (*ar->what == 'm') {
+      snprintf(name, sizeof(name), "main chunk (%s)", ar->short_src);
+    }
+    else {
+      snprintf(name, sizeof(name), "%s (%s:%d)",
+        ar->name ? ar->name : "?", ar->short_src, ar->linedefined);
+    }
+    for (char* p = name; *p; p++) {
+      if (*p == ';') {
+        *p = ','; /* the separator of the folded stacks */
+      }
+    }
+    auto iter = ids.find(name);
+    if (iter != ids.end()) {
+      return iter->second;
+    }
+    uint32_t id = (uint32_t)names.size();
+    names.emplace_back(name);
+    ids.emplace(names.back(), id);
+    return id;
   }
-  else {
-    int top = lua_gettop(cL);
-    luaL_checkstack(cL, 1, NULL);
-    char tmp[16];
-    for (int i = 0; i < top; i++) {
-      lua_pushvalue(cL, i + 1);
-      sprintf(tmp, "[%d]", i + 1);
-      mark_object(cL, dL, cL, tmp);
-    }
-  }
-  lua_Debug ar;
-  while (lua_getstack(cL, level, &ar)) {
-    lua_getinfo(cL, "Sl", &ar);
-    for (int j = 1; j > -1; j -= 2) {
-      for (int i = j; ; i += j) {
-        const char * name = lua_getlocal(cL, &ar, i);
-        if (name == NULL) {
-          break;
+
+  void take(lua_State* L, uint32_t weight) {
+    if (ring.empty()) {
+      return;
+    }
+    auto& s = ring[head];
+    s.weight = weight;
+    s.depth = 0;
+    lua_Debug ar;
+    for (int level = 0; s.depth < PROFILE_DEPTH && lua_getstack(L, level, &ar); level++) {
+      lua_getinfo(L, "Sn", &ar);
+      s.frames[s.depth++] = id_of(&ar);
+    }
+    head = (head + 1) % ring.size();
+    if (count < ring.size()) {
+      count++;
+    }
+    else {
+      dropped++;
+    }
+  }
+
+  /* "root;...;leaf weight" per distinct stack */
+  std::string folded() const {
+    std::map<std::string, size_t> stacks;
+    size_t first = (head + ring.size() - count) % std::max(ring.size(), (size_t)1);
+    for (size_t i = 0; i < count; i++) {
+      auto& s = ring[(first + i) % ring.size()];
+      std::string stack;
+      for (uint32_t j = s.depth; j > 0; j--) {
+        if (!stack.empty()) {
+          stack.push_back(';');
         }
-        char tmp[128];
-        snprintf(tmp, sizeof(tmp), "%s:%s:%d", name, ar.short_src, ar.currentline);
-        mark_object(cL, dL, pv, tmp);
+        stack.append(names[s.frames[j - 1]]);
       }
+      stacks[stack] += s.weight;
+    }
+    std::string data;
+    char weight[32];
+    for (auto& v : stacks) {
+      snprintf(weight, sizeof(weight), " %zu\n", v.second);
+      data.append(v.first).append(weight);
     }
-    ++level;
+    return data;
   }
-  lua_pop(L, 1);
+};
+
+SKYNET_API void lua_profile_hook(lua_State* L, lua_Debug* ar) {
+  auto& profiler = lua_profiler::local();
+  if (!profiler.running) {
+    lua_sethook(L, nullptr, 0, 0); /* left behind by os.profile(false) */
+    return;
+  }
+#if defined(PROFILE_COUNT)
+  size_t now = lua_profiler::now();
+  if (now < profiler.next) {
+    return;
+  }
+  uint32_t weight = 1 + (uint32_t)((now - profiler.next) / profiler.interval);
+  profiler.next = now + profiler.interval;
+#else
+  lua_sethook(L, nullptr, 0, 0); /* set again by the next tick */
+  uint32_t weight = (uint32_t)profiler.pending;
+  profiler.pending = 0;
+  if (weight == 0) {
+    return;
+  }
+#endif
+  profiler.take(L, weight);
 }
 
-static void mark_object(lua_State *L, lua_State *dL, const void * parent, const char *desc) {
-  luaL_checkstack(L, LUA_MINSTACK, NULL);
-  switch (lua_type(L, -1)) {
-  case LUA_TTABLE:
-    mark_table(L, dL, parent, desc);
-    break;
-  case LUA_TUSERDATA:
-    mark_userdata(L, dL, parent, desc);
-    break;
-  case LUA_TFUNCTION:
-    mark_function(L, dL, parent, desc);
-    break;
-  case LUA_TTHREAD:
-    mark_thread(L, dL, parent, desc);
-    break;
-  default:
+/* coL runs until it returns, yields or fails */
+static lua_State* profile_enter(lua_State* coL, lua_State* L) {
+  lua_State* previous = profile_current;
+  profile_current = coL;
+#if defined(PROFILE_COUNT)
+  if (coL && lua_gethook(L) == lua_profile_hook && lua_gethook(coL) != lua_profile_hook) {
+    lua_sethook(coL, lua_profile_hook, LUA_MASKCOUNT, PROFILE_COUNT);
+  }
+#endif
+  return previous;
+}
+
+SKYNET_API int lua_profile_resume(lua_State* coL, lua_State* L, int nargs, int* nresults) {
+  lua_State* previous = profile_enter(coL, L);
+  int state = lua_resume(coL, L, nargs, nresults);
+  profile_current = previous;
+  return state;
+}
+
+/* calls the function of upvalue 1 with coL running, rethrows its errors */
+static int profile_call(lua_State* L, lua_State* coL) {
+  int top = lua_gettop(L);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_insert(L, 1);
+  lua_State* previous = profile_enter(coL, L);
+  int state = lua_pcall(L, top, LUA_MULTRET, 0);
+  profile_current = previous;
+  if (state != LUA_OK) {
+    return lua_error(L);
+  }
+  return lua_gettop(L);
+}
+
+/* coroutine.resume(co, ...) */
+static int profile_coresume(lua_State* L) {
+  return profile_call(L, lua_tothread(L, 1));
+}
+
+/* the function of coroutine.wrap */
+static int profile_cowrapped(lua_State* L) {
+  return profile_call(L, lua_tothread(L, lua_upvalueindex(2)));
+}
+
+/* coroutine.wrap(f) */
+static int profile_cowrap(lua_State* L) {
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_insert(L, 1);
+  lua_call(L, lua_gettop(L) - 1, 1);
+  lua_getupvalue(L, -1, 1); /* the coroutine of the original */
+  lua_pushcclosure(L, profile_cowrapped, 2);
+  return 1;
+}
+
+/* replaces field name of the coroutine library with a wrapper of it, or puts the original back */
+static void profile_replace(lua_State* L, const char* name, lua_CFunction wrapper, bool install) {
+  lua_getfield(L, -1, name);
+  bool wrapped = lua_tocfunction(L, -1) == wrapper;
+  if (install && !wrapped) {
+    lua_pushcclosure(L, wrapper, 1);
+    lua_setfield(L, -2, name);
+  }
+  else if (!install && wrapped) {
+    lua_getupvalue(L, -1, 1);
+    lua_setfield(L, -3, name);
+    lua_pop(L, 1);
+  }
+  else {
     lua_pop(L, 1);
-    break;
   }
 }
 
-static int luac_snapshot(lua_State* L) {
-  lua_gc(L, LUA_GCCOLLECT);
-  lua_State *dL = luaL_newstate();
-  for (int i = 0; i < MARK; i++) {
-    lua_newtable(dL);
-  }
-  lua_pushvalue(L, LUA_REGISTRYINDEX);
-  mark_table(L, dL, NULL, "[registry]");
-  lua_pushvalue(dL, 1);
-  lua_xmove(dL, L, TABLE);
-  lua_close(dL);
+/* the coroutines of the library are sampled only while the profiler runs */
+static void profile_coroutine(lua_State* L, bool install) {
+  lua_getglobal(L, LUA_COLIBNAME);
+  if (lua_istable(L, -1)) {
+    profile_replace(L, "resume", profile_coresume, install);
+    profile_replace(L, "wrap", profile_cowrap, install);
+  }
+  lua_pop(L, 1);
+}
+
+/* returns the folded stacks and the number of samples */
+static int profile_result(lua_State* L, const lua_profiler& profiler) {
+  std::string data = profiler.folded();
+  lua_pushlstring(L, data.c_str(), data.size());
+  lua_pushinteger(L, (lua_Integer)profiler.count);
+  return 2;
+}
+
+/* os.profile([true [, interval [, capacity]] | false]) */
+static int os_profile(lua_State* L) {
+  auto& profiler = lua_profiler::local();
+  if (lua_isnoneornil(L, 1)) {
+    return profile_result(L, profiler);
+  }
+  if (!lua_toboolean(L, 1)) {
+    if (profiler.running) {
+      profiler.running = false;
+      profiler.stop();
+      lua_sethook(profiler.mainL, nullptr, 0, 0);
+      lua_sethook(L, nullptr, 0, 0);
+      profile_coroutine(L, false);
+    }
+    int n = profile_result(L, profiler);
+    profiler.clear();
+    return n;
+  }
+  auto interval = luaL_optnumber(L, 2, PROFILE_INTERVAL);
+  auto capacity = luaL_optinteger(L, 3, PROFILE_CAPACITY);
+  luaL_argcheck(L, interval > 0, 2, "interval must be positive");
+  luaL_argcheck(L, capacity > 0, 3, "capacity must be positive");
+  if (profiler.running) {
+    lua_pushboolean(L, 0);
+    lua_pushliteral(L, "already running");
+    return 2;
+  }
+  profiler.clear();
+  profiler.ring.resize((size_t)capacity);
+  profiler.interval = std::max((size_t)(interval * 1000), (size_t)1);
+  profiler.mainL = lua_local();
+  if (!profiler.start()) {
+    profiler.clear();
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, strerror(errno));
+    return 2;
+  }
+  profiler.running = true;
+  profile_coroutine(L, true);
+  lua_pushboolean(L, 1);
   return 1;
 }
 
@@ -252,10 +829,11 @@ static int luac_snapshot(lua_State* L) {
 
 SKYNET_API int luaopen_profiler(lua_State* L) {
   const luaL_Reg methods[] = {
-    //{ "snapshot",   luac_snapshot }, /* snapshot */
+    { "profile",    os_profile    },
+    { "snapshot",   os_snapshot   },
     { NULL,         NULL          }
   };
-  return new_module(L, LUA_GNAME, methods);
+  return new_module(L, "os", methods);
 }
 
 /********************************************************************************/
@@ -13,6 +13,12 @@
 
 SKYNET_API int luaopen_profiler(lua_State* L);
 
+/* the hook of os.profile */
+SKYNET_API void lua_profile_hook(lua_State* L, lua_Debug* ar);
+
+/* lua_resume, os.profile samples coL while it runs */
+SKYNET_API int lua_profile_resume(lua_State* coL, lua_State* L, int nargs, int* nresults);
+
 /********************************************************************************/
 
 #endif //SKYNET_PROFILER_H
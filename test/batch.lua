@@ -0,0 +1,84 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--rpc.batch and rpc.all, from a coroutine
+--run: skynet test/batch.lua
+
+local format = string.format;
+
+--------------------------------------------------------------------------------
+
+local function test()
+  local b = rpc.batch(500);
+  assert(b:call("test.batch.add", 1, 2) == 1);
+  assert(b:call("test.batch.mul", 3, 4) == 2);
+  assert(b:call("test.batch.none") == 3);
+  assert(b:call_to(os.id(), "test.batch.add", 5, 6) == 4);
+  assert(b:size() == 4);
+  local done, results = b:submit();
+  assert(done and b:size() == 0);
+  assert(results[1][1] and results[1][2] == 3);
+  assert(results[2][1] and results[2][2] == 12);
+  assert(not results[3][1]);
+  assert(results[4][1] and results[4][2] == 11);
+
+  --a late call fails the whole batch, unless partial results are asked for
+  b:call("test.batch.slow");
+  b:call("test.batch.add", 2, 2);
+  local ok, err = b:submit();
+  assert(not ok and err == "timeout", tostring(err));
+  b:call("test.batch.slow");
+  b:call("test.batch.add", 2, 2);
+  done, results = b:submit(true);
+  assert(not done and not results[1][1] and results[1][2] == "timeout" and results[2][2] == 4);
+
+  b:call("test.batch.add", 1, 1);
+  b:clear();
+  assert(b:size() == 0);
+
+  --every receiver answers, keyed by its id
+  done, results = rpc.all("test.batch.who");
+  local count = 0;
+  for id, r in pairs(results) do
+    assert(r[1] and r[2] == (id == os.id() and "client" or "server"));
+    count = count + 1;
+  end
+  assert(done and count == 2);
+  assert(not rpc.all("test.batch.none"));
+
+  --a provider too slow doesn't hold rpc.all beyond its timeout
+  local t = os.clock("ms");
+  done, results = rpc.all(1000, "test.batch.slow");
+  assert(not done and os.clock("ms") - t < 2500);
+  return count;
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  rpc.create("test.batch.add", function(a, b)
+    return a + b;
+  end);
+  rpc.create("test.batch.who", function()
+    return "client";
+  end);
+  local ok, job = os.pload("test.batch_server");
+  assert(ok, job);
+  os.wait(100);
+  os.go(function()
+    local count = test();
+    print(format("batch ok, %d receivers", count));
+    job:close();
+    os.exit();
+  end);
+  while not os.stopped() do
+    os.wait();
+  end
+end
+
+--------------------------------------------------------------------------------
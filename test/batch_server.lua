@@ -0,0 +1,27 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--rpc functions for test/batch.lua, test.batch.slow never answers in time
+
+function main()
+  rpc.create("test.batch.mul", function(a, b)
+    return a * b;
+  end);
+  rpc.create("test.batch.who", function()
+    return "server";
+  end);
+  rpc.create("test.batch.slow", function()
+    os.wait(3000);
+    return 1;
+  end);
+  while not os.stopped() do
+    os.wait();
+  end
+end
+
+--------------------------------------------------------------------------------
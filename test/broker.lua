@@ -0,0 +1,145 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--the response cache of lua/http/broker.lua: hits, 304, gzip, ttl, eviction
+--run: skynet test/broker.lua
+
+local format = string.format;
+local port <const> = 19853;
+local limit <const> = 4096; --cache_limit of the broker
+
+--------------------------------------------------------------------------------
+
+local function request(path, headers)
+  local lines = { format("GET %s HTTP/1.1", path), "Host: test" };
+  for k, v in pairs(headers or {}) do
+    table.insert(lines, format("%s: %s", k, v));
+  end
+  table.insert(lines, "\r\n");
+  return table.concat(lines, "\r\n");
+end
+
+--reads count responses, with their status, headers and body
+local function responses(socket, count)
+  local result, buffer = {}, "";
+  while #result < count do
+    local head, rest = buffer:match("^(.-\r\n)\r\n()");
+    local length = head and tonumber(head:match("[Cc]ontent%-[Ll]ength: (%d+)"));
+    if length and #buffer >= rest + length - 1 then
+      local r = { status = tonumber(head:match("^HTTP/1%.1 (%d+)")), headers = {} };
+      for k, v in head:gmatch("\r\n([^:]+): ([^\r]*)") do
+        r.headers[k] = v;
+      end
+      r.body = buffer:sub(rest, rest + length - 1);
+      buffer = buffer:sub(rest + length);
+      table.insert(result, r);
+    else
+      local data = socket:read();
+      if not data then
+        break;
+      end
+      buffer = buffer .. data;
+    end
+  end
+  return result;
+end
+
+local function get(socket, path, headers)
+  socket:write(request(path, headers));
+  return responses(socket, 1)[1];
+end
+
+local function calls(name)
+  local _, count = rpc.new()("test.broker.calls", name);
+  return count;
+end
+
+--------------------------------------------------------------------------------
+
+local function test(socket)
+  --a hit doesn't call the rpc again, the version is the ETag
+  local r = get(socket, "/test/version?id=1");
+  assert(r.status == 200 and r.body == "version 1" and r.headers.ETag == '"v1"');
+  assert(get(socket, "/test/version?id=1").body == "version 1");
+  assert(calls("test:version") == 1);
+
+  --If-None-Match answers 304 without a body
+  r = get(socket, "/test/version?id=1", { ["If-None-Match"] = '"v1"' });
+  assert(r.status == 304 and r.body == "");
+  r = get(socket, "/test/version?id=1", { ["If-None-Match"] = '"v0"' });
+  assert(r.status == 200 and r.body == "version 1");
+
+  --gzip is compressed once and kept next to the raw body
+  r = get(socket, "/test/big", { ["Accept-Encoding"] = "gzip, deflate" });
+  assert(r.status == 200 and r.headers["Content-Encoding"] == "gzip");
+  assert(#r.body < 1000 and uncompress(r.body, "gzip") == string.rep("compressible ", 1000));
+  r = get(socket, "/test/big");
+  assert(r.headers["Content-Encoding"] == nil and #r.body == 13000);
+  assert(calls("test:big") == 1);
+
+  --no policy, no cache
+  get(socket, "/test/plain");
+  get(socket, "/test/plain");
+  assert(calls("test:plain") == 2);
+
+  --an entry with a ttl is called again once it expired
+  get(socket, "/test/ttl");
+  get(socket, "/test/ttl");
+  assert(calls("test:ttl") == 1);
+  os.wait(1100);
+  get(socket, "/test/ttl");
+  assert(calls("test:ttl") == 2);
+
+  --a full cache drops the least recently used entry and still takes new ones
+  for i = 2, limit + 10, 256 do
+    local batch = {};
+    for id = i, math.min(i + 255, limit + 10) do
+      table.insert(batch, request("/test/version?id=" .. id));
+      if id % 512 == 0 then
+        table.insert(batch, request("/test/version?id=1")); --keeps id=1 recent
+      end
+    end
+    socket:write(table.concat(batch));
+    assert(#responses(socket, #batch) == #batch);
+  end
+  local before = calls("test:version");
+  get(socket, "/test/version?id=new");
+  get(socket, "/test/version?id=new");
+  assert(calls("test:version") == before + 1, "a new entry isn't cached");
+  get(socket, "/test/version?id=1");
+  assert(calls("test:version") == before + 1, "a recent entry was evicted");
+  get(socket, "/test/version?id=2");
+  assert(calls("test:version") == before + 2, "the oldest entry wasn't evicted");
+
+  --http:expire drops the entries of a method
+  local _, count = rpc.new()("http:expire", "test:version");
+  assert(count == limit, count);
+  get(socket, "/test/version?id=1");
+  assert(calls("test:version") == before + 3);
+  return count;
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  local oks, server = os.pload("test.broker_server");
+  assert(oks, server);
+  local okb, broker = os.pload("http.broker", port, "127.0.0.1");
+  assert(okb, broker);
+  os.wait(200);
+  local socket = io.socket("tcp");
+  assert(socket:connect("127.0.0.1", port));
+  local count = test(socket);
+  socket:close();
+  print(format("broker ok, %d entries cached at most", count));
+  broker:close();
+  server:close();
+  os.exit();
+end
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,48 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--rpc functions behind lua/http/broker.lua for test/broker.lua, they count calls
+
+local calls = {};
+
+--------------------------------------------------------------------------------
+
+local function counted(name, func)
+  calls[name] = 0;
+  rpc.create(name, function(...)
+    calls[name] = calls[name] + 1;
+    return func(...);
+  end);
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  --kept until expired or evicted
+  counted("test:version", function(query)
+    return "version " .. query.id, { version = "v" .. query.id };
+  end);
+  --kept for one second
+  counted("test:ttl", function()
+    return "ttl", 1;
+  end);
+  counted("test:big", function()
+    return string.rep("compressible ", 1000), 60;
+  end);
+  counted("test:plain", function()
+    return "plain";
+  end);
+  rpc.create("test.broker.calls", function(name)
+    return calls[name];
+  end);
+  while not os.stopped() do
+    os.wait();
+  end
+end
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,63 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--rpc.deadline, nested calls bounded by the deadline, expired requests skipped
+--timeouts are at least 1000ms and checked every second
+--run: skynet test/deadline.lua
+
+local format = string.format;
+
+--------------------------------------------------------------------------------
+
+local function test()
+  assert(rpc.deadline() == nil);
+  local r = rpc.new();
+
+  --the nested call gives up with the caller, not after its own 5000ms
+  local ok, err = rpc.new(0, 0, 1000)("test.deadline.nested");
+  assert(not ok and err == "timeout", tostring(err));
+  os.wait(1200);
+  local _, stats = r("test.deadline.stats");
+  assert(stats.remaining > 800 and stats.remaining <= 1000, stats.remaining);
+  assert(not stats.ok and stats.elapsed < 2500, stats.elapsed);
+
+  --a request still queued when its deadline passes isn't run
+  r:dispatch("test.deadline.busy", 1500);
+  ok, err = rpc.new(0, 0, 1000)("test.deadline.count");
+  assert(not ok, tostring(err));
+  local _, after = r("test.deadline.stats");
+  assert(after.count == 0, after.count);
+  assert(r("test.deadline.count"));
+  _, after = r("test.deadline.stats");
+  assert(after.count == 1);
+  return stats.remaining, stats.elapsed;
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  --never answered, the responser is kept
+  local never = {};
+  rpc.create("test.deadline.never", function()
+    table.insert(never, rpc.responser());
+  end);
+  local ok, job = os.pload("test.deadline_server");
+  assert(ok, job);
+  os.wait(100);
+  os.go(function()
+    local remaining, elapsed = test();
+    print(format("deadline ok, %dms left to the nested call, which gave up after %dms", remaining, elapsed));
+    job:close();
+    os.exit();
+  end);
+  while not os.stopped() do
+    os.wait();
+  end
+end
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,38 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--rpc functions for test/deadline.lua
+
+local stats = { count = 0 };
+
+--------------------------------------------------------------------------------
+
+function main()
+  --a call of 5000ms made here gets what is left of the caller's deadline
+  rpc.create("test.deadline.nested", function()
+    stats.remaining = rpc.deadline();
+    local t = os.clock("ms");
+    stats.ok, stats.err = rpc.new(0, 0, 5000)("test.deadline.never");
+    stats.elapsed = os.clock("ms") - t;
+  end);
+  rpc.create("test.deadline.busy", function(ms)
+    local t = os.clock("ms");
+    while os.clock("ms") - t < ms do end
+  end);
+  rpc.create("test.deadline.count", function()
+    stats.count = stats.count + 1;
+  end);
+  rpc.create("test.deadline.stats", function()
+    return stats;
+  end);
+  while not os.stopped() do
+    os.wait();
+  end
+end
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,79 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--the binary frames of the cluster: round trips, topic ids and bad frames
+--run: skynet test/frame.lua
+
+local encode = rpc.r_encode;
+local decode = rpc.r_decode;
+
+--------------------------------------------------------------------------------
+
+local function same(frame, ...)
+  local expected = table.pack(...);
+  local result = table.pack(decode(frame));
+  assert(result.n == expected.n, result.n);
+  for i = 1, expected.n do
+    assert(result[i] == expected[i], string.format("#%d: %s ~= %s", i, result[i], expected[i]));
+  end
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  local argv = wrap(1001, "hello", { x = 1, y = 2 });
+
+  --a deliver by name, the ttl is optional
+  same(encode("deliver", "test.frame", argv, 0, 1, 2, -3, 4),
+    "deliver", "test.frame", argv, 0, 1, 2, -3, 4, nil);
+  same(encode("deliver", "test.frame", "", 1804289384, 0, 7, 2, 12345, 500),
+    "deliver", "test.frame", "", 1804289384, 0, 7, 2, 12345, 500);
+
+  --bind gives the topic an id, a deliver by id is shorter and decodes the name
+  local bind = encode("bind", "test.frame.topic", "module", -1, 7);
+  local _, name, id, module, rcb, caller = decode(bind);
+  assert(name == "test.frame.topic" and id > 0 and module == "module" and rcb == -1 and caller == 7);
+  local short = encode("deliver", id, argv, 0, 1, 2, 3, 4);
+  assert(#short < #encode("deliver", "test.frame.topic", argv, 0, 1, 2, 3, 4));
+  same(short, "deliver", "test.frame.topic", argv, 0, 1, 2, 3, 4, nil);
+
+  same(encode("response", argv, 9, -3, 77), "response", argv, 9, -3, 77);
+  same(encode("unbind", "test.frame.topic", 7), "unbind", "test.frame.topic", 7);
+  same(encode("forword", 5, "10.0.0.1", 8080), "forword", 5, "10.0.0.1", 8080);
+  same(encode("ready"), "ready");
+
+  --a batch carries whole frames
+  local a = encode("deliver", "test.frame", argv, 0, 1, 2, 3, 4);
+  local b = encode("response", argv, 9, -3, 77);
+  same(encode("batch", a, b), "batch", a, b);
+
+  --large values and negative rcf survive the varints
+  same(encode("response", "", math.maxinteger, math.mininteger + 1, 0),
+    "response", "", math.maxinteger, math.mininteger + 1, 0);
+
+  --bad frames are refused, never partly decoded
+  same("\1", nil, "version mismatch");
+  same("\2\1", nil, "version mismatch");
+  same("\1\99", nil, "malformed frame");
+  local frame = encode("response", argv, 9, -3, 77);
+  for i = 3, #frame - 1 do
+    same(frame:sub(1, i), nil, "malformed frame");
+  end
+  same(encode("batch", a):sub(1, -2), nil, "malformed frame");
+
+  --a batch of more frames than the stack takes is refused, not raised
+  local count = 1500000;
+  local varint = string.char(count % 128 | 128, (count >> 7) % 128 | 128, count >> 14);
+  same(encode("ready"):sub(1, 1) .. encode("batch"):sub(2, 2) .. varint .. string.rep("\0", count), nil, "malformed frame");
+  assert(not pcall(encode, "none"));
+
+  print(string.format("frame ok, deliver of %d bytes, %d by topic id", #a, #short));
+  os.exit();
+end
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,55 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--the idle collector: ticks while the service allocates, slows down in its pause
+--run: skynet test/gc.lua
+
+local format = string.format;
+
+--------------------------------------------------------------------------------
+
+--ticks run so far, and the cycles they finished
+local function ticks()
+  local s = os.gcstats();
+  local n = s.skipped;
+  for _, v in ipairs(s.pauses) do
+    n = n + v;
+  end
+  return n, s.cycles;
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  assert(os.gcstats().mode == "incremental");
+  local keep = {};
+  local t0 = ticks();
+  local t_end = os.clock("ms") + 1000;
+  while os.clock("ms") < t_end do
+    for k = 1, 1000 do
+      keep[k % 5000 + 1] = { k };
+    end
+    os.wait(5);
+  end
+  local busy = ticks() - t0;
+  assert(busy > 50, busy);
+  assert(os.gcstats().stepsize <= 8192, "a step is bigger than lua's");
+
+  --nothing allocated but the waits: the ticks stop until the next allocation
+  keep = nil;
+  os.wait(500);
+  local t1, c1 = ticks();
+  os.wait(2000);
+  local t2, c2 = ticks();
+  assert(t2 - t1 <= 10, t2 - t1);
+
+  print(format("gc ok, %d ticks/s busy, %d ticks and %d cycles in 2s idle", busy, t2 - t1, c2 - c1));
+  os.exit();
+end
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,89 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--os.go and os.gopool: arguments, errors, yields and reuse of the coroutines
+--run: skynet test/go.lua
+
+local format = string.format;
+
+--------------------------------------------------------------------------------
+
+function main()
+  local ok, job = os.pload("test.go_server");
+  assert(ok, job);
+  os.wait(100);
+  local r = rpc.new();
+
+  --arguments are passed, an error is logged and the pool goes on
+  local got = {};
+  os.go(function(a, b, c)
+    got.sum = a + b;
+    got.nothing = c;
+    got.yieldable = coroutine.isyieldable();
+  end, 1, 2, nil);
+  os.go(function()
+    error("test.go: this error is expected");
+  end);
+  os.go(function(v)
+    got.ok, got.echo = r("test.go.echo", v);
+  end, "hi");
+  assert(got.sum == 3 and got.nothing == nil and got.yieldable);
+  assert(got.echo == nil); --still waiting
+  os.wait(300);
+  assert(got.ok and got.echo == "hi");
+
+  --short functions reuse one coroutine
+  local before = os.gopool();
+  assert(before.running == 0 and before.idle >= 1);
+  local n = 0;
+  for i = 1, 10000 do
+    os.go(function(v)
+      n = n + v;
+    end, 1);
+  end
+  local after = os.gopool();
+  assert(n == 10000 and after.misses == before.misses and after.hits == before.hits + 10000);
+
+  --concurrent calls take as many coroutines, which go back to the pool
+  local done, bad = 0, 0;
+  for i = 1, 500 do
+    os.go(function(v)
+      local ok, echo = r("test.go.echo", v);
+      if not ok or echo ~= v then
+        bad = bad + 1;
+      end
+      done = done + 1;
+    end, i);
+  end
+  assert(os.gopool().running == 500);
+  while done < 500 do
+    os.wait(10);
+  end
+  local stats = os.gopool();
+  assert(bad == 0 and stats.running == 0 and stats.peak >= 500 and stats.idle >= 500);
+
+  --the limit trims the idle coroutines
+  assert(os.gopool(10).limit == 10);
+  done = 0;
+  for i = 1, 100 do
+    os.go(function(v)
+      r("test.go.echo", v);
+      done = done + 1;
+    end, i);
+  end
+  while done < 100 do
+    os.wait(10);
+  end
+  assert(os.gopool().idle <= 10);
+
+  print(format("go ok, %d coroutines at most, %d hits, %d misses", stats.peak, stats.hits, stats.misses));
+  job:close();
+  os.exit();
+end
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,92 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--the message mode of io.http.request_parser and response_parser
+--run: skynet test/http_parser.lua
+
+local format = string.format;
+
+--------------------------------------------------------------------------------
+
+local function request_parser(options)
+  local messages = {};
+  options = options or {};
+  options.on_message = function(message)
+    table.insert(messages, message);
+  end;
+  return io.http.request_parser(options), messages;
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  --pipelined requests, the first ones fed byte by byte
+  local parser, messages = request_parser();
+  local input = "GET /a/b?x=1&y=2 HTTP/1.1\r\nHost: h\r\nX-A: 1\r\n\r\n"
+    .. "POST /p HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+    .. "GET / HTTP/1.0\r\n\r\n";
+  local split = 60;
+  for i = 1, split do
+    assert(parser:execute(input:sub(i, i)) == 1);
+  end
+  assert(parser:execute(input:sub(split + 1)) == #input - split);
+  assert(#messages == 3);
+  local get, post, last = messages[1], messages[2], messages[3];
+  assert(get.method == "GET" and get.url == "/a/b?x=1&y=2" and get.path == "/a/b" and get.query == "x=1&y=2");
+  assert(get.headers.Host == "h" and get.headers["X-A"] == "1" and get.keepalive and get.body == nil);
+  assert(post.method == "POST" and post.path == "/p" and post.body == "hello" and post.keepalive);
+  assert(last.path == "/" and last.keepalive == false);
+
+  --a chunked body
+  parser, messages = request_parser();
+  parser:execute("POST /c HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n5\r\ndefgh\r\n0\r\n\r\n");
+  assert(#messages == 1 and messages[1].body == "abcdefgh");
+
+  --with on_body, bodies over stream bytes come in chunks ended by nil
+  local events = {};
+  parser = io.http.request_parser({
+    stream = 4,
+    on_message = function(message)
+      table.insert(events, format("message %s %s", message.path, tostring(message.body)));
+    end,
+    on_body = function(chunk)
+      table.insert(events, "body " .. tostring(chunk));
+    end,
+  });
+  parser:execute("POST /big HTTP/1.1\r\nContent-Length: 10\r\n\r\n0123");
+  parser:execute("456789");
+  parser:execute("POST /small HTTP/1.1\r\nContent-Length: 2\r\n\r\nok");
+  local result = table.concat(events, ", ");
+  assert(result == "body 0123, body 456789, body nil, message /big nil, message /small ok", result);
+
+  --an error stops the parser until it's reset
+  parser, messages = request_parser();
+  parser:execute("GARBAGE\r\n\r\n");
+  assert(parser:execute("GET / HTTP/1.1\r\n\r\n") == 0 and #messages == 0);
+  parser:reset();
+  parser:execute("GET /again HTTP/1.1\r\n\r\n");
+  assert(#messages == 1 and messages[1].path == "/again");
+
+  --responses
+  local responses = {};
+  parser = io.http.response_parser({
+    on_message = function(message)
+      table.insert(responses, message);
+    end,
+  });
+  parser:execute("HTTP/1.1 404 Not Found\r\nContent-Length: 3\r\nServer: x\r\n\r\nnop");
+  parser:execute("HTTP/1.1 200 OK\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+  assert(#responses == 2);
+  assert(responses[1].status == 404 and responses[1].body == "nop" and responses[1].headers.Server == "x");
+  assert(responses[2].status == 200 and responses[2].keepalive == false);
+
+  print(format("http_parser ok, %d bytes pipelined", #input));
+  os.exit();
+end
+
+--------------------------------------------------------------------------------
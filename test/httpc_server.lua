@@ -0,0 +1,84 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--a raw http server for test/httpc.lua, the path tells what it does:
+--/slow never answers, /drop closes a connection that already answered,
+--/post echoes the body, others answer the path; X-Conn and X-Count tell
+--the connection and the number of the request on it
+
+local format = string.format;
+local conns = 0;
+
+--------------------------------------------------------------------------------
+
+local function respond(peer, id, count, method, path, body)
+  if path == "/slow" then
+    return true;
+  end
+  if path == "/drop" and count > 1 then
+    peer:close();
+    return false;
+  end
+  local data = path == "/post" and body or path;
+  local head = format("HTTP/1.1 200 OK\r\nX-Conn: %d\r\nX-Count: %d\r\nContent-Length: %d\r\n\r\n",
+    id, count, #data);
+  peer:write(method == "HEAD" and head or head .. data);
+  return true;
+end
+
+local function serve(peer)
+  conns = conns + 1;
+  local id, count, buffer = conns, 0, "";
+  peer:receive(function(data)
+    if not data then
+      return;
+    end
+    buffer = buffer .. data;
+    while true do
+      local head, rest = buffer:match("^(.-\r\n)\r\n()");
+      if not head then
+        return;
+      end
+      local length = tonumber(head:match("[Cc]ontent%-[Ll]ength: (%d+)")) or 0;
+      if #buffer < rest + length - 1 then
+        return;
+      end
+      local body = buffer:sub(rest, rest + length - 1);
+      buffer = buffer:sub(rest + length);
+      count = count + 1;
+      local method, path = head:match("^(%u+) (%S+)");
+      if not respond(peer, id, count, method, path, body) then
+        return;
+      end
+    end
+  end);
+end
+
+--------------------------------------------------------------------------------
+
+function main(port, certificate, key)
+  local server = io.server("tcp");
+  assert(server:listen("127.0.0.1", port, function(peer, ec)
+    if not ec then
+      serve(peer);
+    end
+  end));
+  local ctx = io.context();
+  assert(ctx:load(certificate, key));
+  local secure = io.server("ssl", ctx);
+  assert(secure:listen("127.0.0.1", port + 1, function(peer, ec)
+    if not ec then
+      serve(peer);
+    end
+  end));
+  while not os.stopped() do
+    os.wait();
+  end
+end
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,92 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--keep-alive, pipelining, the pipeline limit and the deadline of io.http.serve
+--run: skynet test/httpd.lua
+
+local format = string.format;
+local port <const> = 19851;
+
+--------------------------------------------------------------------------------
+
+local function request(path, close)
+  return format("GET %s HTTP/1.1\r\nHost: test\r\n%s\r\n", path, close and "Connection: close\r\n" or "");
+end
+
+--reads until count responses are complete, returns their status and bodies
+local function responses(socket, count)
+  local result, buffer = {}, "";
+  while #result < count do
+    local data = socket:read();
+    if not data then
+      break;
+    end
+    buffer = buffer .. data;
+    while true do
+      local status, length, rest = buffer:match("^HTTP/1%.1 (%d+) [^\r]*\r\nContent%-Length: (%d+)\r\n.-\r\n\r\n()");
+      if not status or #buffer < rest + length - 1 then
+        break;
+      end
+      table.insert(result, { status = tonumber(status), body = buffer:sub(rest, rest + length - 1) });
+      buffer = buffer:sub(rest + length);
+    end
+  end
+  return result;
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  local ok, job = os.pload("test.httpd_server", port, { pipeline = 4, timeout = 300 });
+  assert(ok, job);
+  os.wait(100);
+
+  --keep-alive: requests one after another on one connection
+  local socket = io.socket("tcp");
+  assert(socket:connect("127.0.0.1", port));
+  for i = 1, 3 do
+    socket:write(request("/a" .. i));
+    local r = responses(socket, 1)[1];
+    assert(r.status == 200 and r.body == "/a" .. i);
+  end
+
+  --pipelining: the late answers hold back the later ones, which stay in order
+  local paths = {};
+  local batch = {};
+  for i = 1, 12 do
+    paths[i] = (i % 3 == 0) and "/late" or ("/p" .. i);
+    table.insert(batch, request(paths[i]));
+  end
+  socket:write(table.concat(batch));
+  local list = responses(socket, 12);
+  assert(#list == 12);
+  for i, r in ipairs(list) do
+    assert(r.status == 200 and r.body == (paths[i] == "/late" and "late" or paths[i]), r.body);
+  end
+
+  --the handler sees at most 4 requests at a time (pipeline = 4)
+  socket:write(string.rep(request("/late"), 8));
+  assert(#responses(socket, 8) == 8);
+  local _, peak = rpc.new()("test.httpd.stats");
+  assert(peak == 4, "pipeline limit " .. tostring(peak));
+
+  --a request never answered gets 504, the ones behind it follow
+  local t = os.clock("ms");
+  socket:write(request("/never") .. request("/b") .. request("/c", true));
+  list = responses(socket, 3);
+  assert(#list == 3 and list[1].status == 504 and list[2].body == "/b" and list[3].body == "/c");
+  assert(os.clock("ms") - t >= 250);
+  assert(socket:read() == nil); --closed by the server
+  socket:close();
+
+  print(format("httpd ok, %d requests in flight at most", peak));
+  job:close();
+  os.exit();
+end
+
+--------------------------------------------------------------------------------
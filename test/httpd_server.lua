@@ -0,0 +1,62 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--io.http.serve for test/httpd.lua, /late is answered by the timer, /never isn't
+
+local format = string.format;
+local late   = {};
+local stats  = { inflight = 0, peak = 0 };
+
+--------------------------------------------------------------------------------
+
+local function on_request(request, reply)
+  stats.inflight = stats.inflight + 1;
+  stats.peak = math.max(stats.peak, stats.inflight);
+  local answer = function(status, body)
+    stats.inflight = stats.inflight - 1;
+    reply(status, body);
+  end
+  if request.path == "/never" then
+    return;
+  end
+  if request.path == "/late" then
+    table.insert(late, answer);
+    return;
+  end
+  answer(200, request.path);
+end
+
+--------------------------------------------------------------------------------
+
+function main(port, options)
+  local server = io.server("tcp");
+  assert(server:listen("127.0.0.1", port, function(peer, ec)
+    if not ec then
+      io.http.serve(peer, on_request, options);
+    end
+  end));
+  rpc.create("test.httpd.stats", function()
+    return stats.peak;
+  end);
+  local timer = os.timer();
+  timer:expires(20, function()
+    --the oldest first, the responses are still sent in order
+    local answer = table.remove(late, 1);
+    if answer then
+      answer(200, "late");
+    end
+    return 20;
+  end);
+  while not os.stopped() do
+    os.wait();
+  end
+  timer:cancel();
+  server:close();
+end
+
+--------------------------------------------------------------------------------
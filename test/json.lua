@@ -0,0 +1,112 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--json.decoder: documents split across feed calls, scalars, errors, compaction
+--run: skynet test/json.lua
+
+local format = string.format;
+
+--------------------------------------------------------------------------------
+
+--feeds the chunks one by one, returns what next gave, errors as "error"
+local function decode(chunks)
+  local decoder = json.decoder();
+  local out = {};
+  for _, chunk in ipairs(chunks) do
+    decoder:feed(chunk);
+    while true do
+      local ok, v = decoder:next();
+      if ok == false then
+        break;
+      end
+      if ok == nil then
+        assert(type(v) == "string");
+        table.insert(out, "error");
+      elseif v == json.null then
+        table.insert(out, "null");
+      else
+        table.insert(out, type(v) == "table" and json.encode(v) or tostring(v));
+      end
+    end
+  end
+  return table.concat(out, " | "), decoder;
+end
+
+local function bytes(s)
+  local chunks = {};
+  for i = 1, #s do
+    chunks[i] = s:sub(i, i);
+  end
+  return chunks;
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  --an escape or a quote split from what follows it
+  assert(decode({ '{"a":"x\\', '"y"}' }) == '{"a":"x\\"y"}');
+  assert(decode({ '{"a":"}', ']"}' }) == '{"a":"}]"}');
+  assert(decode({ '["a\\\\', '"]' }) == '["a\\\\"]');
+  assert(decode({ '"top', '"' }) == "top");
+
+  --a scalar at the top waits for a delimiter
+  local result, decoder = decode({ "42" });
+  assert(result == "" and decoder:size() == 2);
+  assert(decode({ "42", " " }) == "42");
+  assert(decode({ "tr", "ue", "\n", "-1.5", "[", "]" }) == "true | -1.5 | []");
+  assert(decode({ "null", "," }) == "null | error");
+
+  --a bad document is reported and skipped
+  assert(decode({ '{"bad":}{"ok":1}' }) == 'error | {"ok":1}');
+  assert(decode({ "[1] x [2]" }) == "[1] | error | [2]");
+
+  --byte by byte gives the same as one chunk
+  local input = '{"s":"a}b\\"]"}\n[1,[2,[3]]] "top" 42 true\n{"bad":}{"ok":1}  ';
+  local whole = decode({ input });
+  assert(whole == decode(bytes(input)), whole);
+  assert(whole == '{"s":"a}b\\"]"} | [1,[2,[3]]] | top | 42 | true | error | {"ok":1}', whole);
+
+  --values stops at the incomplete one, errors raise
+  decoder = json.decoder();
+  decoder:feed("[1] [2] [3");
+  local count = 0;
+  for v in decoder:values() do
+    count = count + 1;
+    assert(v[1] == count);
+  end
+  assert(count == 2 and decoder:size() == 2);
+  decoder:feed("] }");
+  assert(select(2, decoder:next())[1] == 3);
+  assert(not pcall(function()
+    for _ in decoder:values() do end
+  end));
+  decoder:feed("[1");
+  decoder:clear();
+  assert(decoder:size() == 0 and decoder:next() == false);
+
+  --the consumed data is dropped once it's large, a split document survives it
+  decoder = json.decoder();
+  local docs = {};
+  for i = 1, 2000 do
+    docs[i] = format('{"i":%d}', i);
+  end
+  decoder:feed(table.concat(docs, "\n") .. '\n{"i":"sp');
+  for i = 1, 2000 do
+    local ok, v = decoder:next();
+    assert(ok and v.i == i);
+  end
+  assert(decoder:next() == false and decoder:size() == #'{"i":"sp');
+  decoder:feed('lit"}');
+  local ok, v = decoder:next();
+  assert(ok and v.i == "split" and decoder:size() == 0);
+
+  print(format("json ok, %d bytes byte by byte", #input));
+  os.exit();
+end
+
+--------------------------------------------------------------------------------
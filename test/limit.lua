@@ -0,0 +1,86 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--rpc.limit with the reject, shed and block policies, and rpc.stats
+--run: skynet test/limit.lua
+
+--------------------------------------------------------------------------------
+
+--8 calls at once to a queue of 2, returns the served ones sorted
+local function flood(r, policy)
+  local served, pending = {}, 8;
+  for i = 1, 8 do
+    r("test.limit." .. policy, function(ok, v)
+      if ok then
+        table.insert(served, v);
+      else
+        assert(v == "busy", tostring(v));
+      end
+      pending = pending - 1;
+    end, i);
+  end
+  while pending > 0 do
+    os.wait(10);
+  end
+  table.sort(served);
+  return served, table.concat(served, " ");
+end
+
+local function test(policy)
+  local ok, job = os.pload("test.limit_server", policy);
+  assert(ok, job);
+  os.wait(100);
+  local r = rpc.new();
+  local served, answers = flood(r, policy);
+  local stats = rpc.stats(job:id());
+  assert(stats.limit == 2 and stats.depth == 0 and stats.max_depth == 2);
+  assert(stats.executed == #served);
+  if policy == "reject" then
+    --the first ones are served (one may be taken before the queue is full)
+    assert(#served <= 3 and served[1] == 1 and served[2] == 2, answers);
+    assert(stats.rejected == 8 - #served);
+  elseif policy == "shed" then
+    --the newest two are served, the older ones shed
+    assert(#served <= 3 and served[#served - 1] == 7 and served[#served] == 8, answers);
+    assert(stats.shed == 8 - #served);
+  else
+    --the callers wait for room and all are served
+    assert(answers == "1 2 3 4 5 6 7 8", answers);
+    assert(stats.rejected == 0);
+
+    --callers in coroutines are parked, a blocking caller gets busy
+    local done = 0;
+    for i = 1, 5 do
+      os.go(function()
+        local ok, v = r("test.limit.block", i);
+        assert(ok and v == i);
+        done = done + 1;
+      end);
+    end
+    local ok, err = r("test.limit.block", 99);
+    assert(not ok and err == "busy", tostring(err));
+    while done < 5 do
+      os.wait(10);
+    end
+    assert(rpc.stats(job:id()).blocked >= stats.blocked + 3);
+  end
+  job:close();
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  assert(rpc.stats() == nil);
+  for _, policy in ipairs({ "reject", "shed", "block" }) do
+    test(policy);
+  end
+  print("limit ok");
+  os.exit();
+end
+
+--------------------------------------------------------------------------------
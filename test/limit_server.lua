@@ -0,0 +1,23 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--a service with a queue of 2 requests for test/limit.lua, each takes 50ms
+
+function main(policy)
+  rpc.limit(2, policy);
+  rpc.create("test.limit." .. policy, function(i)
+    local t = os.clock("ms");
+    while os.clock("ms") - t < 50 do end
+    return i;
+  end);
+  while not os.stopped() do
+    os.wait();
+  end
+end
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,84 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--the caches of require: compiled chunks follow the mtime and the size of their
+--file, a module missing from a listed directory is found once it's written
+--run: skynet test/require.lua
+
+local format = string.format;
+local name <const> = "test.require_module";
+local file <const> = "test/require_module.lua";
+
+--------------------------------------------------------------------------------
+
+local function write(source)
+  local f = assert(io.open(file, "w"));
+  f:write(source);
+  f:close();
+end
+
+local function load()
+  package.loaded[name] = nil;
+  local ok, value = pcall(require, name);
+  package.loaded[name] = nil;
+  return ok and value or nil;
+end
+
+--a new file is found once the listing of its directory is read again
+local function await(value)
+  local begin = os.clock("ms");
+  while load() ~= value do
+    assert(os.clock("ms") - begin < 2000, "a new module isn't found");
+    os.wait(100);
+  end
+  return os.clock("ms") - begin;
+end
+
+--------------------------------------------------------------------------------
+
+local function test()
+  --the second require loads the chunk from the cache
+  write("return 1");
+  await(1);
+  local hits = os.bytecode().hits;
+  assert(load() == 1);
+  assert(os.bytecode().hits == hits + 1, "not a hit");
+
+  --same size in the same second, only the nanoseconds of the mtime differ
+  os.wait(20);
+  write("return 2");
+  assert(load() == 2, "a chunk of the same size is kept");
+
+  --another size
+  write("return 300");
+  assert(load() == 300, "a chunk of another size is kept");
+  hits = os.bytecode().hits;
+  assert(load() == 300 and os.bytecode().hits == hits + 1);
+
+  --a missing module is remembered, until the directory changes
+  os.remove(file);
+  os.wait(1100);
+  assert(load() == nil, "a removed module is found");
+  assert(load() == nil);
+  write("return 'new'");
+  local elapsed = await("new");
+  os.remove(file);
+  return elapsed;
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  local ok, elapsed = pcall(test);
+  os.remove(file);
+  assert(ok, elapsed);
+  print(format("require ok, a new module found after %dms", elapsed));
+  os.exit();
+end
+
+--------------------------------------------------------------------------------
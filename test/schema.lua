@@ -0,0 +1,77 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--wrap_schema: definitions, round trips and the range of the typed fields
+--run: skynet test/schema.lua
+
+local format = string.format;
+
+--------------------------------------------------------------------------------
+
+--the first line of the error, the rest is the traceback
+local function failed(data, err)
+  assert(data == nil, "no error");
+  return err:match("^[^\n]*");
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  local Move = assert(wrap_schema({ id = 41, "uid:u32", "x:f32", "hp:i16", "name:string", "alive:boolean", "items" }));
+  assert(wrap_schema({ id = 41, "uid:u32", "x:f32", "hp:i16", "name:string", "alive:boolean", "items" }) == Move);
+  assert(failed(wrap_schema({ id = 41, "uid:u32" })) == "schema 41: schema is defined with other fields");
+  assert(failed(wrap_schema({ id = 42, "uid:u33" })):find("name[:type]", 1, true));
+  assert(failed(wrap_schema({ id = 256, "uid" })) == "schema id must be an integer from 0 to 255");
+
+  --the keys aren't written, the metatable comes back
+  local m = setmetatable({ uid = 123456, x = 10.5, hp = -20, name = "hero", alive = true, items = { 1, 2, 3 } }, Move);
+  local data = wrap(m, 5);
+  assert(#data < #wrap({ uid = 123456, x = 10.5, hp = -20, name = "hero", alive = true, items = { 1, 2, 3 } }, 5));
+  local v, n = unwrap(data);
+  assert(getmetatable(v) == Move and n == 5);
+  assert(v.uid == 123456 and v.x == 10.5 and v.hp == -20 and v.name == "hero" and v.alive and v.items[3] == 3);
+  v = unwrap(wrap(setmetatable({ uid = 1 }, Move)));
+  assert(v.uid == 1 and v.name == nil and v.items == nil);
+
+  --each integer type takes its bounds and refuses one past them
+  local Range = assert(wrap_schema({ id = 43, "u8:u8", "i8:i8", "u16:u16", "i16:i16", "u32:u32", "i32:i32", "i64:i64", "f32:f32" }));
+  local bounds = {
+    u8  = { 0, 255 },
+    i8  = { -128, 127 },
+    u16 = { 0, 65535 },
+    i16 = { -32768, 32767 },
+    u32 = { 0, 4294967295 },
+    i32 = { -2147483648, 2147483647 },
+  };
+  local count = 0;
+  for name, range in pairs(bounds) do
+    for i, value in ipairs(range) do
+      local t = unwrap(wrap(setmetatable({ [name] = value }, Range)));
+      assert(t[name] == value, name);
+      local out = value + (i == 1 and -1 or 1);
+      local err = failed(wrap(setmetatable({ [name] = out }, Range)));
+      assert(err == format("field '%s' of schema 43 expects %s, got number", name, name), err);
+      count = count + 2;
+    end
+    assert(failed(wrap(setmetatable({ [name] = 1.5 }, Range))));
+    assert(failed(wrap(setmetatable({ [name] = "1" }, Range))));
+    assert(unwrap(wrap(setmetatable({ [name] = 2.0 }, Range)))[name] == 2);
+  end
+  local t = unwrap(wrap(setmetatable({ i64 = math.mininteger, f32 = -3.25 }, Range)));
+  assert(t.i64 == math.mininteger and t.f32 == -3.25);
+  assert(failed(wrap(setmetatable({ f32 = "x" }, Range))) == "field 'f32' of schema 43 expects f32, got string");
+
+  --an unknown schema and truncated data are refused
+  assert(failed(unwrap("\xc7\x02\x01\x09\x00")) == "Unknown schema in input.");
+  assert(failed(unwrap(data:sub(1, 10))) == "Missing bytes in input.");
+
+  print(format("schema ok, %d bounds checked", count));
+  os.exit();
+end
+
+--------------------------------------------------------------------------------
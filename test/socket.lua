@@ -0,0 +1,86 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--the callbacks of a socket run one after another, even when they yield,
+--while the accepts of a server don't wait for each other
+--run: skynet test/socket.lua
+
+local port <const> = 19852;
+
+--------------------------------------------------------------------------------
+
+function main()
+  local ok, job = os.pload("test.socket_server");
+  assert(ok, job);
+  os.wait(100);
+
+  local log = {};
+  local server = io.server("tcp");
+  assert(server:listen("127.0.0.1", port, function(peer, ec)
+    if ec then
+      return;
+    end
+    table.insert(log, "accept");
+    peer:receive(function(data, ec)
+      if not data then
+        table.insert(log, "closed");
+        return;
+      end
+      table.insert(log, "in " .. data);
+      local _, v = rpc.new()("test.socket.slow", data);
+      table.insert(log, "out " .. tostring(v));
+      if v == "b" then
+        error("test.socket: this error is expected");
+      end
+    end);
+  end));
+
+  --each chunk arrives while the callback of the previous one waits
+  local socket = io.socket("tcp");
+  assert(socket:connect("127.0.0.1", port));
+  for _, data in ipairs({ "a", "b", "c" }) do
+    socket:write(data);
+    os.wait(5);
+  end
+  socket:close();
+  os.wait(300);
+  local result = table.concat(log, ", ");
+  assert(result == "accept, in a, out a, in b, out b, in c, out c, closed", result);
+
+  server:close();
+
+  --the second accept runs while the first one waits
+  log = {};
+  server = io.server("tcp");
+  assert(server:listen("127.0.0.1", port + 1, function(peer, ec)
+    if ec then
+      return;
+    end
+    local id = #log + 1;
+    table.insert(log, "accept " .. id);
+    local _, v = rpc.new()("test.socket.slow", id);
+    table.insert(log, "done " .. tostring(v));
+    peer:close();
+  end));
+  local first, second = io.socket("tcp"), io.socket("tcp");
+  assert(first:connect("127.0.0.1", port + 1));
+  os.wait(5);
+  assert(second:connect("127.0.0.1", port + 1));
+  os.wait(300);
+  first:close();
+  second:close();
+  local accepts = table.concat(log, ", ");
+  assert(accepts == "accept 1, accept 2, done 1, done 2", accepts);
+
+  print("socket ok, " .. result .. "; " .. accepts);
+  server:close();
+  job:close();
+  os.exit();
+end
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,22 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--a slow echo for test/socket.lua, 30ms each
+
+function main()
+  rpc.create("test.socket.slow", function(v)
+    local t = os.clock("ms");
+    while os.clock("ms") - t < 30 do end
+    return v;
+  end);
+  while not os.stopped() do
+    os.wait();
+  end
+end
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,83 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--streamed answers: order, the credit of the writer, errors and early close
+--run: skynet test/stream.lua
+
+local format = string.format;
+
+--------------------------------------------------------------------------------
+
+local function stats(r)
+  local _, written, stopped = r("test.stream.stats");
+  return written, stopped;
+end
+
+local function test()
+  local r = rpc.new();
+  local count, sum = 0, 0;
+  for i, square in r:stream("test.stream.squares", 100) do
+    assert(square == i * i);
+    count, sum = count + 1, sum + i;
+  end
+  assert(count == 100 and sum == 5050);
+
+  --the writer stops when the reader doesn't read
+  local stream = r:stream("test.stream.squares", 100);
+  assert(select(2, stream:read()) == 1);
+  os.wait(200);
+  local written = stats(r);
+  assert(written >= 16 and written <= 17, "written " .. written);
+  local credit = written;
+
+  --closing the reader cancels the writer
+  stream:close();
+  os.wait(200);
+  local _, stopped = stats(r);
+  assert(stopped == "cancel", tostring(stopped));
+
+  --an answer without a stream is one chunk
+  count = 0;
+  for v in r:stream("test.stream.plain") do
+    assert(v == "one");
+    count = count + 1;
+  end
+  assert(count == 1);
+
+  --the error of the writer ends the stream
+  stream = r:stream("test.stream.failed");
+  local ok, v = stream:read();
+  assert(ok and v == "first");
+  ok, v = stream:read();
+  assert(ok == false and v == "failed", tostring(v));
+  assert(not pcall(function()
+    for _ in r:stream("test.stream.failed") do end
+  end));
+  ok, v = r:stream("test.stream.none"):read();
+  assert(ok == false, tostring(v));
+  return credit;
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  local ok, job = os.pload("test.stream_server");
+  assert(ok, job);
+  os.wait(100);
+  os.go(function()
+    local credit = test();
+    print(format("stream ok, %d chunks written ahead of the reader", credit));
+    job:close();
+    os.exit();
+  end);
+  while not os.stopped() do
+    os.wait();
+  end
+end
+
+--------------------------------------------------------------------------------
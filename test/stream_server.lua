@@ -0,0 +1,48 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--streamed answers for test/stream.lua
+
+local stats = { written = 0, stopped = false };
+
+--------------------------------------------------------------------------------
+
+function main()
+  --n chunks of i, i * i, the writer waits while 16 are not acknowledged
+  rpc.create("test.stream.squares", function(n)
+    local writer = rpc.stream();
+    stats.written, stats.stopped = 0, false;
+    os.go(function()
+      for i = 1, n do
+        local ok, err = writer:write(i, i * i);
+        if not ok then
+          stats.stopped = err;
+          break;
+        end
+        stats.written = i;
+      end
+      writer:close();
+    end);
+  end);
+  rpc.create("test.stream.failed", function()
+    local writer = rpc.stream();
+    writer:write("first");
+    writer:close("failed");
+  end);
+  rpc.create("test.stream.plain", function()
+    return "one";
+  end);
+  rpc.create("test.stream.stats", function()
+    return stats.written, stats.stopped;
+  end);
+  while not os.stopped() do
+    os.wait();
+  end
+end
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,129 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--os.timer and the timer wheel: re-arm, cancel, collect, callbacks that yield
+--run: skynet test/timer.lua
+
+local format = string.format;
+
+--------------------------------------------------------------------------------
+
+--errors of the callbacks are only logged, what they saw is checked at the end
+local function test(options)
+  local name = options and "wheel" or "timer";
+  local t0 = os.clock("ms");
+  local wrong = {};
+
+  --the value returned arms it again, nil stops it
+  local fired = {};
+  local repeated = os.timer(options);
+  repeated:expires(50, function()
+    table.insert(fired, os.clock("ms") - t0);
+    if #fired < 3 then
+      return 30;
+    end
+  end);
+
+  --cancelled before it fires, or by its own callback
+  local cancelled = os.timer(options);
+  cancelled:expires(20, function()
+    table.insert(wrong, "cancelled");
+  end);
+  cancelled:cancel();
+  local stopped = 0;
+  local self = os.timer(options);
+  self:expires(10, function()
+    stopped = stopped + 1;
+    self:cancel();
+    return 10;
+  end);
+
+  --expires called again by the callback replaces what it returns
+  local rearmed = 0;
+  local again = os.timer(options);
+  again:expires(10, function()
+    rearmed = rearmed + 1;
+    again:expires(10, function()
+      rearmed = rearmed + 1;
+    end);
+    return 1000;
+  end);
+
+  --beyond the near wheel (2560ms)
+  local far;
+  local later = os.timer(options);
+  later:expires(2700, function()
+    far = os.clock("ms") - t0;
+  end);
+
+  --a collected timer never fires
+  do
+    local lost = os.timer(options);
+    lost:expires(50, function()
+      table.insert(wrong, "collected");
+    end);
+  end
+  collectgarbage();
+  collectgarbage();
+
+  --the callback yields in a rpcall, then it's armed with what it returned
+  local calls = 0;
+  local yielding = os.timer(options);
+  yielding:expires(10, function()
+    local ok, v = rpc.new()("test.timer.echo", calls);
+    if not ok or v ~= calls then
+      table.insert(wrong, "echo");
+    end
+    calls = calls + 1;
+    if calls < 3 then
+      return 10;
+    end
+  end);
+
+  --many timers fire once each
+  local count = 0;
+  local many = {};
+  for i = 1, 1000 do
+    many[i] = os.timer(options);
+    many[i]:expires(i % 500, function()
+      count = count + 1;
+    end);
+  end
+
+  while os.clock("ms") - t0 < 3000 do
+    os.wait(10);
+  end
+  assert(#wrong == 0, name .. ": " .. table.concat(wrong, ","));
+  assert(#fired == 3, name .. ": repeated " .. #fired);
+  assert(fired[1] >= 40 and fired[3] - fired[1] >= 50, name .. ": repeated too early");
+  assert(stopped == 1, name .. ": stopped " .. stopped);
+  assert(rearmed == 2, name .. ": rearmed " .. rearmed);
+  assert(far and far >= 2690, name .. ": far " .. tostring(far));
+  assert(calls == 3, name .. ": yielding " .. calls);
+  assert(count == 1000, name .. ": many " .. count);
+  for _, timer in ipairs({ repeated, self, again, later, yielding }) do
+    timer:cancel();
+  end
+  return format("%s far at %dms", name, far);
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  rpc.create("test.timer.echo", function(v)
+    return v;
+  end);
+  local results = {
+    test(nil),
+    test({ wheel = true }),
+  };
+  print(format("timer ok, %s", table.concat(results, ", ")));
+  os.exit();
+end
+
+--------------------------------------------------------------------------------
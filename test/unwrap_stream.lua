@@ -0,0 +1,71 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--unwrap_stream: values split across chunks, iteration, bad data
+--run: skynet test/unwrap_stream.lua
+
+local format = string.format;
+
+--------------------------------------------------------------------------------
+
+function main()
+  local User = assert(wrap_schema({ id = 45, "uid:u32", "name" }));
+  local big = {};
+  for i = 1, 20000 do
+    big[i] = { i, "s" .. i };
+  end
+  local parts = {
+    wrap(1), wrap("hello"), wrap(big), wrap(setmetatable({ uid = 7, name = "x" }, User)),
+    wrap({ a = { b = { c = 3 } } }), wrap(nil), wrap(42)
+  };
+  local all = table.concat(parts);
+
+  --byte by byte at both ends, large chunks in the middle
+  local stream = unwrap_stream();
+  local out, pos = {}, 1;
+  while pos <= #all do
+    local step = (pos > 20 and pos < #all - 100) and 997 or 1;
+    stream:feed(all:sub(pos, pos + step - 1));
+    pos = pos + step;
+    while true do
+      local ok, v = stream:next();
+      if not ok then
+        break;
+      end
+      out[#out + 1] = v == nil and "nil" or v;
+    end
+  end
+  assert(#out == 7 and stream:size() == 0);
+  assert(out[1] == 1 and out[2] == "hello" and #out[3] == 20000 and out[3][20000][2] == "s20000");
+  assert(out[4].uid == 7 and out[4].name == "x" and getmetatable(out[4]) == User);
+  assert(out[5].a.b.c == 3 and out[6] == "nil" and out[7] == 42);
+
+  --values stops at the incomplete one, which is kept
+  local values = {};
+  assert(stream:feed(parts[1] .. parts[2] .. parts[2]:sub(1, 3)) == #parts[1] + #parts[2] + 3);
+  for v in stream:values() do
+    table.insert(values, v);
+  end
+  assert(#values == 2 and values[1] == 1 and values[2] == "hello" and stream:size() == 3);
+  stream:feed(parts[2]:sub(4));
+  assert(select(2, stream:next()) == "hello");
+  assert(stream:next() == false);
+
+  --bad data raises and empties the stream
+  stream:feed("\xc1");
+  assert(not pcall(stream.next, stream));
+  assert(stream:size() == 0 and stream:next() == false);
+  stream:feed("\xc1");
+  stream:clear();
+  assert(stream:size() == 0);
+
+  print(format("unwrap_stream ok, %d bytes in %d values", #all, #out));
+  os.exit();
+end
+
+--------------------------------------------------------------------------------
@@ -0,0 +1,82 @@
+--[[
+*********************************************************************************
+** Copyright(C) 2020-2024 https://www.iccgame.com/
+** Author: zhaozp@iccgame.com
+*********************************************************************************
+]]--
+
+--------------------------------------------------------------------------------
+--unwrap_view: lazy fields, pairs and #, read only, wrap without decoding
+--run: skynet test/unwrap_view.lua
+
+local format = string.format;
+
+--------------------------------------------------------------------------------
+
+local function state(n)
+  local players = {};
+  for i = 1, n do
+    players[i] = { id = i, name = "p" .. i, pos = { x = i * 1.5, y = -i }, items = { 1, 2, 3 } };
+  end
+  return { tick = 42, map = "arena", players = players, [5] = "five", [true] = "yes" };
+end
+
+local function test()
+  local Tag = assert(wrap_schema({ id = 44, "uid:u32", "x:f32", "tags" }));
+  local data = wrap(state(1000), 7, setmetatable({ uid = 9, tags = { "a", "b" } }, Tag));
+  local v, n, tv = unwrap_view(data);
+  assert(type(v) == "userdata" and n == 7 and type(tv) == "userdata");
+  assert(tostring(v):match("^wrap view"));
+
+  --fields of any key type, nested tables are views too
+  assert(v.tick == 42 and v.map == "arena" and v[5] == "five" and v[true] == "yes" and v.none == nil);
+  assert(#v.players == 1000 and v.players[1001] == nil);
+  assert(v.players[3].name == "p3" and v.players[3].pos.y == -3);
+  assert(type(v.players[3].pos) == "userdata");
+  assert(tv.uid == 9 and tv.x == nil and tv.tags[2] == "b" and #tv.tags == 2);
+
+  local keys = {};
+  for k, x in pairs(v) do
+    table.insert(keys, format("%s=%s", k, type(x)));
+  end
+  table.sort(keys);
+  assert(table.concat(keys, ",") == "5=string,map=string,players=userdata,tick=number,true=string");
+  local count = 0;
+  for i, p in pairs(v.players) do
+    assert(p.id == i);
+    count = count + 1;
+  end
+  assert(count == 1000);
+
+  assert(not pcall(function() v.tick = 1; end));
+
+  --wrap copies the bytes of a view, unwrap turns it into a table
+  local player = unwrap(wrap(v.players[2]));
+  assert(type(player) == "table" and player.name == "p2" and player.pos.x == 3 and #player.items == 3);
+  local t = unwrap(v);
+  assert(type(t) == "table" and t.players[1000].name == "p1000");
+  assert(getmetatable(unwrap(tv)) == Tag and unwrap(tv).uid == 9);
+
+  --a lazy rpc function gets views
+  rpc.create("test.unwrap_view.sum", function(t)
+    return type(t), t.players[1].id + t.players[2].id;
+  end, false, true);
+  local ok, kind, sum = rpc.new()("test.unwrap_view.sum", state(5));
+  assert(ok and kind == "userdata" and sum == 3);
+  return #data;
+end
+
+--------------------------------------------------------------------------------
+
+function main()
+  os.go(function()
+    local size = test();
+    print(format("unwrap_view ok, %d bytes", size));
+    os.exit();
+  end);
+  while not os.stopped() do
+    os.wait();
+  end
+end
+
+--------------------------------------------------------------------------------